@@ -411,6 +411,10 @@
 
 #define TELEPARAMSIZE 400
 
+#define	TELEPOOL_THREADS 4	/* telemetry workers per node, see rpt_tele_worker() */
+
+#define	TELEPOOL_WAITERS 8	/* most workers per node for items that wait, see rpt_tele_waits() */
+
 #define REM_SCANTIME 100
 
 #define	DTMF_LOCAL_TIME 250
@@ -570,6 +574,7 @@ ASTERISK_FILE_VERSION(__FILE__,"$Revision$")
 #include "asterisk/file.h"
 #include "asterisk/logger.h"
 #include "asterisk/channel.h"
+#include "asterisk/causes.h"
 #include "asterisk/callerid.h"
 #include "asterisk/pbx.h"
 #include "asterisk/module.h"
@@ -586,6 +591,8 @@ ASTERISK_FILE_VERSION(__FILE__,"$Revision$")
 #include "asterisk/astdb.h"
 #include "asterisk/app.h"
 #include "asterisk/indications.h"
+#include "asterisk/astobj2.h"
+#include "asterisk/ulaw.h"
 #include <termios.h>
 
 #ifdef	NEW_ASTERISK
@@ -831,10 +838,97 @@ int	endindex;
 time_t	lastone;
 } ;
 
+/*
+ * Resident node database.  A nodes stanza (from rpt.conf or from an extnodes
+ * file) is parsed once into a hashed snapshot.  Snapshots are ao2 objects and
+ * are never modified once built: a lookup takes a reference to the current
+ * one and searches it without holding any lock, and a reload swaps a new
+ * snapshot in, the old one going away when its last reader lets go of it.
+ */
+
+#define	NODEDB_RECHECK 1		/* seconds between stat()s of an extnodes file */
+
+struct rpt_nodedb_entry
+{
+	struct rpt_nodedb_entry *next;
+	char	*name;
+	char	*value;
+} ;
+
+struct rpt_nodedb
+{
+	unsigned int nbuckets;		/* always a power of 2 */
+	struct rpt_nodedb_entry **buckets;
+	struct rpt_nodedb_entry **wilds;	/* '_' patterns, in file order */
+	int	nwilds;
+	int	nentries;
+	int	longestnode;
+	char	*pool;			/* entries, bucket array and strings */
+} ;
+
+/* an extnodes file/stanza pair and its current snapshot */
+struct rpt_nodedb_source
+{
+	AST_LIST_ENTRY(rpt_nodedb_source) list;
+	ast_mutex_t lock;		/* serializes rebuilds */
+	struct rpt_nodedb *db;
+	dev_t	dev;
+	ino_t	ino;
+	off_t	size;
+	time_t	mtime;
+	time_t	lastcheck;
+	char	*file;
+	char	*section;
+} ;
+
 static time_t	starttime = 0;
 
 static  pthread_t rpt_master_thread;
 
+/*
+ * Hierarchical timer wheel.  Every node has one, and the rpt() loop
+ * only handles the timers whose slot has come due, rather than aging
+ * every countdown on every wakeup.  A timer is idle, queued on a wheel
+ * slot, or (if it has an id) parked on the expired list until the
+ * loop picks it up with rpt_twheel_expired().
+*/
+
+#define	RPT_TW_TICK	10		/* ms per wheel tick */
+#define	RPT_TW_BITS	6
+#define	RPT_TW_SLOTS	(1 << RPT_TW_BITS)
+#define	RPT_TW_MASK	(RPT_TW_SLOTS - 1)
+#define	RPT_TW_LEVELS	3
+
+enum {RPT_TM_NONE, RPT_TM_NEWKEY, RPT_TM_LINKMODE, RPT_TM_RETX, RPT_TM_RERX,
+	RPT_TM_CONNECT, RPT_TM_TAIL};
+
+struct rpt_twheel;
+
+struct rpt_timer
+{
+	struct rpt_timer *next;
+	struct rpt_timer *prev;
+	struct rpt_twheel *wheel;	/* wheel we are queued on, NULL if idle */
+	long long expires;		/* deadline in wheel ticks */
+	char	fired;			/* on the expired list */
+	int	id;			/* RPT_TM_xxx, NONE if nobody cares */
+	void	*data;			/* owner (link or node) */
+} ;
+
+struct rpt_twheel
+{
+	ast_mutex_t lock;
+	struct rpt_timer slot[RPT_TW_LEVELS][RPT_TW_SLOTS];	/* list heads */
+	struct rpt_timer expired;	/* list head */
+	long long ticks;		/* next tick to be processed */
+	long long base;			/* monotonic ms at tick 0 */
+	int	narmed;
+	unsigned long long narms;
+	unsigned long long nfired;
+	unsigned long long nwakeups;
+	time_t	started;
+} ;
+
 /*
  * Structure that holds information regarding app_rpt operation
 */ 
@@ -866,12 +960,13 @@ struct rpt_link
 	char	outbound;
 	char	disced;
 	char	killme;
-	long	elaptime;
-	long	disctime;
-	long 	retrytimer;
-	long	retxtimer;
-	long	rerxtimer;
-	long	rxlingertimer;
+	long	elaptime;		/* -1 if not timing the connect */
+	struct rpt_timer conntimer;
+	struct rpt_timer disctime;
+	struct rpt_timer retrytimer;
+	struct rpt_timer retxtimer;
+	struct rpt_timer rerxtimer;
+	struct rpt_timer rxlingertimer;
 	int     rssi;
 	int	retries;
 	int	max_retries;
@@ -881,7 +976,8 @@ struct rpt_link
 	struct ast_channel *pchan;	
 	char	linklist[MAXLINKLIST];
 	time_t	linklistreceived;
-	long	linklisttimer;
+	unsigned int linklistseq;	/* bumped whenever linklist changes */
+	struct rpt_timer linklisttimer;
 	int	dtmfed;
 	int linkunkeytocttimer;
 	struct timeval lastlinktv;
@@ -889,12 +985,13 @@ struct rpt_link
 	struct	rpt_chan_stat chan_stat[NRPTSTAT];
 	struct vox vox;
 	char wasvox;
-	int voxtotimer;
+	struct rpt_timer voxtotimer;
 	char voxtostate;
 	char newkey;
 	char iaxkey;
 	int linkmode;
-	int newkeytimer;
+	struct rpt_timer linkmodetimer;
+	struct rpt_timer newkeytimer;
 	char gott;
 	int		voterlink;      /*!< \brief set if node is defined as a voter rx */
 	int		votewinner;		/*!< \brief set if node won the rssi competition */
@@ -910,23 +1007,37 @@ struct rpt_link
 #else
 	AST_LIST_HEAD_NOLOCK(, ast_frame) textq;
 #endif
+	ast_mutex_t lock;	/* protects textq, see rpt_qwrite() */
 } ;
 
 /*
- * Structure used to manage link status
+ * Read-only copy of a node's link list, published by rpt() so that
+ * status readers (CLI, manager) never have to take myrpt->lock.
+ * Readers hold a reference (rpt_linksnap_get()/rpt_linksnap_put()),
+ * a newer snapshot may be published meanwhile and the old one is
+ * freed when its last reader lets go of it.
 */
-struct rpt_lstat
+struct rpt_linksnap_ent
 {
-	struct	rpt_lstat *next;
-	struct	rpt_lstat *prev;
-	char	peer[MAXPEERSTR];
+	struct	rpt_link *link;		/* identity only, never dereferenced */
+	struct	ast_channel *chan;	/* identity only, never dereferenced */
 	char	name[MAXNODESTR];
+	char	peer[MAXPEERSTR];
 	char	mode;
 	char	outbound;
-	int	reconnects;
 	char	thisconnected;
+	char	lastrx1;
+	int	reconnects;
 	long long	connecttime;
-	struct	rpt_chan_stat chan_stat[NRPTSTAT];
+	char	*linklist;
+} ;
+
+struct rpt_linksnap
+{
+	int	refs;
+	int	n;
+	long long	when;		/* rpt_mono_ms() at publish time */
+	struct	rpt_linksnap_ent *ent;
 } ;
 
 struct rpt_tele
@@ -945,9 +1056,25 @@ struct rpt_tele
 	} submode;
 	unsigned int parrot;
 	char killed;
+	char running;		/* a telemetry worker has it */
 	pthread_t threadid;
 } ;
 
+/* per node telemetry workers, each with its own pseudo channel */
+struct rpt_telepool
+{
+	ast_mutex_t lock;
+	ast_cond_t cond;
+	unsigned int seq;	/* bumped whenever there may be work */
+	int nthreads;
+	int stop;
+	pthread_t threads[TELEPOOL_THREADS];
+	int nwaiters;
+	int idle_waiters;	/* waiters with nothing to do */
+	int pending_waits;	/* waiting items no waiter has taken yet */
+	pthread_t waiters[TELEPOOL_WAITERS];
+} ;
+
 struct function_table_tag
 {
 	char action[ACTIONSIZE];
@@ -955,6 +1082,30 @@ struct function_table_tag
 		int command_source, struct rpt_link *mylink);
 } ;
 
+/*
+ * A function stanza (functions, link_functions, phone_functions, ...)
+ * compiled into a digit trie by load_rpt_vars(), so collect_function_digits()
+ * does not browse the stanza and search function_table[] on every digit.
+ * Each node where a stanza entry ends holds the action and parameter string
+ * already split out of its value.  A trie lives and dies with myrpt->cfg.
+ */
+struct rpt_functrie_node
+{
+	struct rpt_functrie_node *child;	/* first child */
+	struct rpt_functrie_node *sibling;
+	char	c;			/* digit, lower case */
+	int	order;			/* position in the stanza of the entry ending here, -1 if none */
+	int	len;			/* length of that entry's name */
+	struct function_table_tag *action;	/* NULL if not in function_table[] */
+	char	*param;			/* NULL if the value had no comma */
+} ;
+
+struct rpt_functrie
+{
+	struct rpt_functrie_node *nodes;	/* nodes[0] is the root */
+	int	nnodes;
+} ;
+
 /*
  * Structs used in the DAQ code
  */
@@ -1088,6 +1239,11 @@ static struct rpt
 	ast_mutex_t lock;
 	ast_mutex_t remlock;
 	ast_mutex_t statpost_lock;
+	/* ahead of p, so the initial load_rpt_vars() leaves it alone */
+	struct rpt_twheel twheel;	/* node and link timers, see rpt_twheel_run() */
+	ast_mutex_t linksnaplock;	/* guards the linksnap pointer only */
+	ast_mutex_t telemcachelock;	/* guards telemcache */
+	struct rpt_telepool telepool;	/* see rpt_telepool_kick() */
 	struct ast_config *cfg;
 	char reload;
 	char reload1;
@@ -1101,7 +1257,6 @@ static struct rpt
 	char remote;
 	char *remoterig;
 	struct	rpt_chan_stat chan_stat[NRPTSTAT];
-	unsigned int scram;
 #ifdef	_MDC_DECODE_H_
 	mdc_decoder_t *mdc;
 #endif
@@ -1157,6 +1312,7 @@ static struct rpt
 		char propagate_dtmf;
 		char propagate_phonedtmf;
 		char linktolink;
+		char usermixer;
 		unsigned char civaddr;
 		struct rpt_xlat inxlat;
 		struct rpt_xlat outxlat;
@@ -1282,7 +1438,8 @@ static struct rpt
 	pthread_t rpt_call_thread,rpt_thread;
 	time_t dtmf_time,rem_dtmf_time,dtmf_time_rem;
 	int calldigittimer;
-	int tailtimer,totimer,idtimer,txconf,conf,callmode,cidx,scantimer,tmsgtimer,skedtimer,linkactivitytimer,elketimer;
+	int totimer,txconf,conf,callmode,cidx,scantimer,linkactivitytimer,elketimer;
+	struct rpt_timer tailtimer,idtimer,tmsgtimer,skedtimer;
 	int mustid,tailid;
 	int rptinacttimer;
 	int tailevent;
@@ -1324,7 +1481,24 @@ static struct rpt
 	int dphone_longestfunc;
 	int link_longestfunc;
 	int longestfunc;
+	struct rpt_functrie *functrie;	/* compiled function stanzas, see rpt_functrie_build() */
+	struct rpt_functrie *link_functrie;
+	struct rpt_functrie *phone_functrie;
+	struct rpt_functrie *dphone_functrie;
+	struct rpt_functrie *alt_functrie;
 	int longestnode;
+	struct rpt_nodedb *localnodes;	/* index of the nodes stanza, see rpt_nodedb_build() */
+	struct rpt_mixer *mixer;	/* in-process conference mixer, see rpt_mix_request() */
+	struct ast_waitset *waitset;	/* channels rpt() waits on, see rpt_waitset_sync() */
+	char waitsetdirty;
+	struct rpt_linksnap *linksnap;	/* see rpt_linksnap_publish() */
+	unsigned int linksnapsig;
+	struct rpt_telem_render *telemcache;	/* see rpt_telem_get() */
+	int telemcachebytes;
+	int telemcacheentries;
+	unsigned int telemcachehits;
+	unsigned int telemcachemisses;
+	char usermixer;			/* pseudo channels come from mixer, not DAHDI */
 	int threadrestarts;		
 	int tailmessagen;
 	time_t disgorgetime;
@@ -1350,8 +1524,8 @@ static struct rpt
 	char wasvox;
 	int voxtotimer;
 	char voxtostate;
-	int linkposttimer;			
-	int keyposttimer;			
+	struct rpt_timer linkposttimer;
+	struct rpt_timer keyposttimer;
 	int lastkeytimer;			
 	char newkey;
 	char iaxkey;
@@ -1447,6 +1621,11 @@ AST_MUTEX_DEFINE_STATIC(nodeloglock);
 
 AST_MUTEX_DEFINE_STATIC(nodelookuplock);
 
+/* protects nodedb_sources and the snapshot pointers hanging off it and rpt_vars */
+AST_MUTEX_DEFINE_STATIC(nodedblock);
+
+static AST_LIST_HEAD_NOLOCK_STATIC(nodedb_sources, rpt_nodedb_source);
+
 #ifdef	APP_RPT_LOCK_DEBUG
 
 #warning COMPILING WITH LOCK-DEBUGGING ENABLED!!
@@ -1475,6 +1654,23 @@ struct by_lightning
 
 int lock_ring_index = 0;
 
+/*
+ * Lock contention histogram: how long rpt_mutex_lock() callers had to
+ * wait for a lock somebody else held, bucket n counts waits of
+ * 2^n .. 2^(n+1)-1 us (the last bucket takes everything longer)
+*/
+#define	LOCKHIST_BUCKETS 20
+
+struct lock_contention
+{
+	unsigned long long locks;	/* all lock requests */
+	unsigned long long contended;	/* requests that had to wait */
+	unsigned long long waitus;	/* total wait */
+	long long maxwaitus;
+	int maxwaitline;
+	unsigned long long hist[LOCKHIST_BUCKETS];
+} lock_contention;
+
 AST_MUTEX_DEFINE_STATIC(locklock);
 
 static struct lockthread *get_lockthread(pthread_t id)
@@ -1518,6 +1714,7 @@ int	i;
 static void rpt_mutex_spew(void)
 {
 	struct by_lightning lock_ring_copy[32];
+	struct lock_contention lc;
 	int lock_ring_index_copy;
 	int i,j;
 	long long diff;
@@ -1527,6 +1724,7 @@ static void rpt_mutex_spew(void)
 	ast_mutex_lock(&locklock);
 	memcpy(&lock_ring_copy, &lock_ring, sizeof(lock_ring_copy));
 	lock_ring_index_copy = lock_ring_index;
+	lc = lock_contention;
 	ast_mutex_unlock(&locklock);
 
 	lasttv.tv_sec = lasttv.tv_usec = 0;
@@ -1556,6 +1754,38 @@ static void rpt_mutex_spew(void)
 				i - 31,lock_ring_copy[j].line,lock_ring_copy[j].rpt->name,(int) lock_ring_copy[j].lockthread.id,diff,a,(int)lock_ring_copy[j].tv.tv_usec);
 		}
 	}
+	if (!lc.locks) return;
+	ast_log(LOG_NOTICE,"LOCKDEBUG contention: %llu of %llu locks waited, avg %llu us, max %lld us at app_rpt.c:%d\n",
+		lc.contended,lc.locks,(lc.contended) ? lc.waitus / lc.contended : 0,
+		lc.maxwaitus,lc.maxwaitline);
+	for(i = 0; i < LOCKHIST_BUCKETS; i++)
+	{
+		if (!lc.hist[i]) continue;
+		if (i == LOCKHIST_BUCKETS - 1)
+			ast_log(LOG_NOTICE,"LOCKDEBUG wait >= %8ld us: %llu\n",
+				1L << i,lc.hist[i]);
+		else
+			ast_log(LOG_NOTICE,"LOCKDEBUG wait %8ld - %8ld us: %llu\n",
+				(i) ? 1L << i : 0L,(1L << (i + 1)) - 1,lc.hist[i]);
+	}
+}
+
+/* account for a lock request, call with locklock held */
+static void lock_contention_add(int line,long long waitus)
+{
+int	i;
+
+	lock_contention.locks++;
+	if (waitus < 0) return;
+	lock_contention.contended++;
+	lock_contention.waitus += waitus;
+	if (waitus > lock_contention.maxwaitus)
+	{
+		lock_contention.maxwaitus = waitus;
+		lock_contention.maxwaitline = line;
+	}
+	for(i = 0; (i < LOCKHIST_BUCKETS - 1) && (waitus >= (2LL << i)); i++);
+	lock_contention.hist[i]++;
 }
 
 
@@ -1563,6 +1793,8 @@ static void _rpt_mutex_lock(ast_mutex_t *lockp, struct rpt *myrpt, int line)
 {
 struct lockthread *t;
 pthread_t id;
+struct timeval tv,now;
+long long waitus;
 
 	id = pthread_self();
 	ast_mutex_lock(&locklock);
@@ -1589,7 +1821,18 @@ pthread_t id;
 	if(lock_ring_index == 32)
 		lock_ring_index = 0;
 	ast_mutex_unlock(&locklock);
-	ast_mutex_lock(lockp);
+	waitus = -1;
+	if (ast_mutex_trylock(lockp))
+	{
+		gettimeofday(&tv, NULL);
+		ast_mutex_lock(lockp);
+		gettimeofday(&now, NULL);
+		waitus = ((long long)(now.tv_sec - tv.tv_sec) * 1000000) +
+			(now.tv_usec - tv.tv_usec);
+	}
+	ast_mutex_lock(&locklock);
+	lock_contention_add(line,waitus);
+	ast_mutex_unlock(&locklock);
 }
 
 
@@ -1706,6 +1949,269 @@ char	rv = 0;
 }
 
 
+static long long rpt_mono_ms(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return(((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+static void rpt_timer_init(struct rpt_timer *t,int id,void *data)
+{
+	memset(t,0,sizeof(struct rpt_timer));
+	t->id = id;
+	t->data = data;
+}
+
+static void rpt_twheel_init(struct rpt_twheel *w)
+{
+int	i,j;
+
+	memset(w,0,sizeof(struct rpt_twheel));
+	ast_mutex_init(&w->lock);
+	for(i = 0; i < RPT_TW_LEVELS; i++)
+	{
+		for(j = 0; j < RPT_TW_SLOTS; j++)
+			w->slot[i][j].next = w->slot[i][j].prev = &w->slot[i][j];
+	}
+	w->expired.next = w->expired.prev = &w->expired;
+	w->base = rpt_mono_ms();
+	time(&w->started);
+}
+
+/* must be called with the wheel locked */
+static void __rpt_timer_unlink(struct rpt_timer *t)
+{
+	t->next->prev = t->prev;
+	t->prev->next = t->next;
+	t->next = t->prev = NULL;
+	if (!t->fired) t->wheel->narmed--;
+	t->wheel = NULL;
+	t->fired = 0;
+}
+
+/* must be called with the wheel locked */
+static void __rpt_timer_add(struct rpt_twheel *w,struct rpt_timer *t)
+{
+long long idx = t->expires - w->ticks;
+struct rpt_timer *head;
+
+	if (idx < 0)
+		head = &w->slot[0][w->ticks & RPT_TW_MASK];
+	else if (idx < RPT_TW_SLOTS)
+		head = &w->slot[0][t->expires & RPT_TW_MASK];
+	else if (idx < (RPT_TW_SLOTS << RPT_TW_BITS))
+		head = &w->slot[1][(t->expires >> RPT_TW_BITS) & RPT_TW_MASK];
+	else if (idx < (1LL << (RPT_TW_BITS * RPT_TW_LEVELS)))
+		head = &w->slot[2][(t->expires >> (RPT_TW_BITS * 2)) & RPT_TW_MASK];
+	else	/* beyond the wheel, park in the furthest slot and re-file on cascade */
+		head = &w->slot[2][((w->ticks >> (RPT_TW_BITS * 2)) - 1) & RPT_TW_MASK];
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+	t->wheel = w;
+}
+
+/* (re)start a timer to go off in ms milliseconds, ms <= 0 stops it */
+static void rpt_timer_arm(struct rpt_twheel *w,struct rpt_timer *t,int ms)
+{
+	ast_mutex_lock(&w->lock);
+	if (t->wheel) __rpt_timer_unlink(t);
+	if (ms > 0)
+	{
+		t->expires = (rpt_mono_ms() - w->base + ms + RPT_TW_TICK - 1) / RPT_TW_TICK;
+		__rpt_timer_add(w,t);
+		w->narmed++;
+		w->narms++;
+	}
+	ast_mutex_unlock(&w->lock);
+}
+
+static void rpt_timer_cancel(struct rpt_timer *t)
+{
+struct rpt_twheel *w = t->wheel;
+
+	if (!w) return;
+	ast_mutex_lock(&w->lock);
+	if (t->wheel) __rpt_timer_unlink(t);
+	ast_mutex_unlock(&w->lock);
+}
+
+/* non-zero while the timer is running (has not gone off yet) */
+static int rpt_timer_pending(struct rpt_timer *t)
+{
+	return(t->wheel && (!t->fired));
+}
+
+/* milliseconds left on a running timer, 0 if it is not running */
+static int rpt_timer_left(struct rpt_timer *t)
+{
+struct rpt_twheel *w = t->wheel;
+long long left;
+
+	if ((!w) || t->fired) return(0);
+	left = (t->expires * RPT_TW_TICK) - (rpt_mono_ms() - w->base);
+	if (left < 0) left = 0;
+	return((int)left);
+}
+
+/* must be called with the wheel locked */
+static void __rpt_twheel_cascade(struct rpt_twheel *w,int level,int idx)
+{
+struct rpt_timer list,*t;
+
+	if (w->slot[level][idx].next == &w->slot[level][idx]) return;
+	list.next = w->slot[level][idx].next;
+	list.prev = w->slot[level][idx].prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	w->slot[level][idx].next = w->slot[level][idx].prev = &w->slot[level][idx];
+	while((t = list.next) != &list)
+	{
+		list.next = t->next;
+		t->next->prev = &list;
+		__rpt_timer_add(w,t);
+	}
+}
+
+/*
+ * Bring the wheel up to date.  Timers that went off without an id go
+ * back to idle, the others are queued for rpt_twheel_expired().
+*/
+static void rpt_twheel_run(struct rpt_twheel *w)
+{
+long long now;
+struct rpt_timer *head,*t;
+int	idx;
+
+	ast_mutex_lock(&w->lock);
+	w->nwakeups++;
+	now = (rpt_mono_ms() - w->base) / RPT_TW_TICK;
+	while(w->ticks <= now)
+	{
+		idx = w->ticks & RPT_TW_MASK;
+		if (!idx)
+		{
+			idx = (w->ticks >> RPT_TW_BITS) & RPT_TW_MASK;
+			if (!idx) __rpt_twheel_cascade(w,2,
+				(w->ticks >> (RPT_TW_BITS * 2)) & RPT_TW_MASK);
+			__rpt_twheel_cascade(w,1,idx);
+			idx = 0;
+		}
+		head = &w->slot[0][idx];
+		while((t = head->next) != head)
+		{
+			w->nfired++;
+			if (t->id == RPT_TM_NONE)
+			{
+				__rpt_timer_unlink(t);
+				continue;
+			}
+			t->next->prev = t->prev;
+			t->prev->next = t->next;
+			t->prev = w->expired.prev;
+			t->next = &w->expired;
+			w->expired.prev->next = t;
+			w->expired.prev = t;
+			t->fired = 1;
+			w->narmed--;
+		}
+		w->ticks++;
+	}
+	ast_mutex_unlock(&w->lock);
+}
+
+/* next timer from the expired list, now idle, or NULL */
+static struct rpt_timer *rpt_twheel_expired(struct rpt_twheel *w)
+{
+struct rpt_timer *t = NULL;
+
+	ast_mutex_lock(&w->lock);
+	if (w->expired.next != &w->expired)
+	{
+		t = w->expired.next;
+		__rpt_timer_unlink(t);
+	}
+	ast_mutex_unlock(&w->lock);
+	return(t);
+}
+
+/* how long we can sleep (up to maxms) before the wheel needs running */
+static int rpt_twheel_next(struct rpt_twheel *w,int maxms)
+{
+long long now,tick;
+int	ms = maxms;
+
+	ast_mutex_lock(&w->lock);
+	now = rpt_mono_ms() - w->base;
+	if (w->expired.next != &w->expired) ms = 0;
+	else for(tick = w->ticks; (tick * RPT_TW_TICK) <= (now + maxms); tick++)
+	{
+		/* stop at a cascade point or at the first busy slot */
+		if ((!(tick & RPT_TW_MASK)) ||
+		    (w->slot[0][tick & RPT_TW_MASK].next != &w->slot[0][tick & RPT_TW_MASK]))
+		{
+			ms = (int)((tick * RPT_TW_TICK) - now);
+			if (ms < 0) ms = 0;
+			break;
+		}
+	}
+	ast_mutex_unlock(&w->lock);
+	return(ms);
+}
+
+static void rpt_link_init(struct rpt_link *l)
+{
+	rpt_timer_init(&l->conntimer,RPT_TM_CONNECT,l);
+	rpt_timer_init(&l->disctime,RPT_TM_NONE,l);
+	rpt_timer_init(&l->retrytimer,RPT_TM_NONE,l);
+	rpt_timer_init(&l->retxtimer,RPT_TM_RETX,l);
+	rpt_timer_init(&l->rerxtimer,RPT_TM_RERX,l);
+	rpt_timer_init(&l->rxlingertimer,RPT_TM_NONE,l);
+	rpt_timer_init(&l->linklisttimer,RPT_TM_NONE,l);
+	rpt_timer_init(&l->voxtotimer,RPT_TM_NONE,l);
+	rpt_timer_init(&l->linkmodetimer,RPT_TM_LINKMODE,l);
+	rpt_timer_init(&l->newkeytimer,RPT_TM_NEWKEY,l);
+	ast_mutex_init(&l->lock);
+}
+
+static void rpt_node_timers_init(struct rpt *myrpt)
+{
+	rpt_timer_cancel(&myrpt->tailtimer);
+	rpt_timer_cancel(&myrpt->idtimer);
+	rpt_timer_cancel(&myrpt->tmsgtimer);
+	rpt_timer_cancel(&myrpt->skedtimer);
+	rpt_timer_cancel(&myrpt->linkposttimer);
+	rpt_timer_cancel(&myrpt->keyposttimer);
+	rpt_timer_init(&myrpt->tailtimer,RPT_TM_TAIL,myrpt);
+	rpt_timer_init(&myrpt->idtimer,RPT_TM_NONE,myrpt);
+	rpt_timer_init(&myrpt->tmsgtimer,RPT_TM_NONE,myrpt);
+	rpt_timer_init(&myrpt->skedtimer,RPT_TM_NONE,myrpt);
+	rpt_timer_init(&myrpt->linkposttimer,RPT_TM_NONE,myrpt);
+	rpt_timer_init(&myrpt->keyposttimer,RPT_TM_NONE,myrpt);
+}
+
+/* stop everything a link has on the wheel, drop its queued text and its lock, before it is freed */
+static void rpt_link_destroy(struct rpt_link *l)
+{
+struct ast_frame *f;
+
+	rpt_timer_cancel(&l->conntimer);
+	rpt_timer_cancel(&l->disctime);
+	rpt_timer_cancel(&l->retrytimer);
+	rpt_timer_cancel(&l->retxtimer);
+	rpt_timer_cancel(&l->rerxtimer);
+	rpt_timer_cancel(&l->rxlingertimer);
+	rpt_timer_cancel(&l->linklisttimer);
+	rpt_timer_cancel(&l->voxtotimer);
+	rpt_timer_cancel(&l->linkmodetimer);
+	rpt_timer_cancel(&l->newkeytimer);
+	while((f = AST_LIST_REMOVE_HEAD(&l->textq,frame_list))) ast_frfree(f);
+	ast_mutex_destroy(&l->lock);
+}
+
 static void voxinit_rpt(struct rpt *myrpt,char enable)
 {
 
@@ -1734,7 +2240,7 @@ static void voxinit_link(struct rpt_link *mylink,char enable)
 	mylink->vox.ondebcnt = VOX_ON_DEBOUNCE_COUNT;
 	mylink->vox.offdebcnt = VOX_OFF_DEBOUNCE_COUNT;
 	mylink->wasvox = 0;
-	mylink->voxtotimer = 0;
+	rpt_timer_cancel(&mylink->voxtotimer);
 	mylink->voxtostate = 0;
 }
 
@@ -3476,6 +3982,7 @@ static void *uchameleon_monitor_thread(void *this)
 
 static int saynum(struct ast_channel *mychannel, int num);
 static int sayfile(struct ast_channel *mychannel,char *fname);
+static void rpt_telem_flush(struct rpt *myrpt);
 static int wait_interval(struct rpt *myrpt, int type, struct ast_channel *chan);
 static void rpt_telem_select(struct rpt *myrpt, int command_source, struct rpt_link *mylink);
 static void rpt_telem_select(struct rpt *myrpt, int command_source, struct rpt_link *mylink);
@@ -4161,6 +4668,14 @@ struct	statfs statfsbuf;
 	return(statfsbuf.f_bavail);
 }
 
+/* stop a telemetry item whether a worker has it yet or not, must be
+   called locked */
+static void rpt_tele_kill(struct rpt_tele *telem)
+{
+	if (telem->chan) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+	telem->killed = 1;
+}
+
 static void flush_telem(struct rpt *myrpt)
 {
 	struct rpt_tele *telem;
@@ -4170,7 +4685,7 @@ static void flush_telem(struct rpt *myrpt)
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		if (telem->mode != SETREMOTE) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		if (telem->mode != SETREMOTE) rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
@@ -4250,7 +4765,10 @@ int	src;
 		else if (!strncasecmp(mylink->chan->name,"tlb",8)) src = LINKMODE_TLB;
 		if (myrpt->p.linkmodedynamic[src] && (mylink->linkmode >= 1) && 
 		    (mylink->linkmode < 0x7ffffffe))
-				mylink->linkmode = LINK_HANG_TIME;
+		{
+			mylink->linkmode = LINK_HANG_TIME;
+			rpt_timer_arm(&myrpt->twheel,&mylink->linkmodetimer,LINK_HANG_TIME);
+		}
 	}
 	if (!myrpt->p.telemdynamic) return;
 	if (myrpt->telemmode == 0) return;
@@ -4312,14 +4830,31 @@ int	nonlocals;
 	return(0);
 }
 
+/* a silent copy of f for padding a delay queue; the first one made is
+   kept in *zp and all the others share its data with it (they are all
+   silence, so muting one of them in place later does no harm) */
+static struct ast_frame *rpt_frsilence(struct ast_frame *f,struct ast_frame **zp)
+{
+struct	ast_frame *z;
+
+	if (*zp) return(ast_frshare(*zp));
+	if (!(z = ast_frshare(f))) return(NULL);
+	memset(AST_FRAME_DATAP(z),0,z->datalen);
+	*zp = z;
+	return(z);
+}
+
 static void rpt_qwrite(struct rpt_link *l,struct ast_frame *f)
 {
 struct	ast_frame *f1;
 
 	if (!l->chan) return;
 	f1 = ast_frdup(f);
+	if (!f1) return;
 	memset(&f1->frame_list,0,sizeof(f1->frame_list));
+	ast_mutex_lock(&l->lock);
 	AST_LIST_INSERT_TAIL(&l->textq,f1,frame_list);
+	ast_mutex_unlock(&l->lock);
 	return;
 }
 
@@ -4533,7 +5068,7 @@ static void birdbath(struct rpt *myrpt)
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		if (telem->mode == PARROT) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		if (telem->mode == PARROT) rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
@@ -4548,7 +5083,7 @@ static void cancel_pfxtone(struct rpt *myrpt)
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		if (telem->mode == PFXTONE) ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		if (telem->mode == PFXTONE) rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 }
@@ -5277,12 +5812,54 @@ static int send_link_pl(struct rpt *myrpt, char *txt)
 	return 0;
 }
 
+/*
+ * Append one link (and what it reports behind it) to a link list string,
+ * downgrading the nodes behind it to its own mode where appropriate
+*/
+static void mklinklist_add(char *buf,char *name,char mode,char lastrx1,char *linklist,int flag)
+{
+int	i,spos;
+
+	spos = strlen(buf); /* current buf size (b4 we add our stuff) */
+	if (spos)
+	{
+		strcat(buf,",");
+		spos++;
+	}
+	if (flag)
+	{
+		snprintf(buf + spos,MAXLINKLIST - spos,
+			"%s%c%c",name,mode,(lastrx1) ? 'K' : 'U');
+	}
+	else
+	{
+		/* add nodes into buffer */
+		if (linklist[0])
+		{
+			snprintf(buf + spos,MAXLINKLIST - spos,
+				"%c%s,%s",mode,name,linklist);
+		}
+		else /* if no nodes, add this node into buffer */
+		{
+			snprintf(buf + spos,MAXLINKLIST - spos,
+				"%c%s",mode,name);
+		}	
+	}
+	/* if we are in tranceive mode, let all modes stand */
+	if (mode == 'T') return;
+	/* downgrade everyone on this node if appropriate */
+	for(i = spos; buf[i]; i++)
+	{
+		if (buf[i] == 'T') buf[i] = mode;
+		if ((buf[i] == 'R') && (mode == 'C')) buf[i] = mode;
+	}
+}
+
 /* must be called locked */
 static void __mklinklist(struct rpt *myrpt, struct rpt_link *mylink, char *buf,int flag)
 {
 struct rpt_link *l;
 char mode;
-int	i,spos;
 
 	buf[0] = 0; /* clear output buffer */
 	if (myrpt->remote) return;
@@ -5299,39 +5876,156 @@ int	i,spos;
 		mode = 'T'; /* use Tranceive by default */
 		if (!l->mode) mode = 'R'; /* indicate RX for our mode */
 		if (!l->thisconnected) 	mode = 'C'; /* indicate connecting */
-		spos = strlen(buf); /* current buf size (b4 we add our stuff) */
-		if (spos)
-		{
-			strcat(buf,",");
-			spos++;
-		}
-		if (flag)
-		{
-			snprintf(buf + spos,MAXLINKLIST - spos,
-				"%s%c%c",l->name,mode,(l->lastrx1) ? 'K' : 'U');
-		}
+		mklinklist_add(buf,l->name,mode,l->lastrx1,l->linklist,flag);
+	}
+	return;
+}
+
+/*
+ * Cheap fingerprint of everything a link snapshot shows (bar the
+ * connect time, which readers extrapolate), must be called locked
+*/
+static unsigned int rpt_linksnap_sig(struct rpt *myrpt)
+{
+struct rpt_link *l;
+unsigned int sig = 2166136261U;
+
+	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
+	{
+		sig = (sig ^ (unsigned int)(unsigned long)l) * 16777619U;
+		sig = (sig ^ (unsigned int)(unsigned long)l->chan) * 16777619U;
+		sig = (sig ^ (unsigned int)l->reconnects) * 16777619U;
+		sig = (sig ^ l->linklistseq) * 16777619U;
+		sig = (sig ^ (unsigned int)((l->mode << 24) | (l->outbound << 16) |
+			(l->thisconnected << 8) | l->lastrx1)) * 16777619U;
+	}
+	return(sig);
+}
+
+static void rpt_linksnap_put(struct rpt_linksnap *snap)
+{
+	if (!snap) return;
+	if (ast_atomic_dec_and_test(&snap->refs)) ast_free(snap);
+}
+
+/*
+ * Take a reference to the current link snapshot (NULL if rpt() has not
+ * published one), release it with rpt_linksnap_put()
+*/
+static struct rpt_linksnap *rpt_linksnap_get(struct rpt *myrpt)
+{
+struct rpt_linksnap *snap;
+
+	ast_mutex_lock(&myrpt->linksnaplock);
+	snap = myrpt->linksnap;
+	if (snap) ast_atomic_fetchadd_int(&snap->refs,1);
+	ast_mutex_unlock(&myrpt->linksnaplock);
+	return(snap);
+}
+
+/* replace the published snapshot (NULL to withdraw it) */
+static void rpt_linksnap_swap(struct rpt *myrpt,struct rpt_linksnap *snap)
+{
+struct rpt_linksnap *old;
+
+	ast_mutex_lock(&myrpt->linksnaplock);
+	old = myrpt->linksnap;
+	myrpt->linksnap = snap;
+	ast_mutex_unlock(&myrpt->linksnaplock);
+	rpt_linksnap_put(old);
+}
+
+/*
+ * Copy the link list into a new snapshot and publish it, must be called
+ * locked.  The whole snapshot is one allocation: header, entries, then
+ * the reported link list strings.  Peer names are carried over from the
+ * previous snapshot for links whose channel has not changed, so the
+ * channel is only asked once per connection.
+*/
+static void rpt_linksnap_publish(struct rpt *myrpt,unsigned int sig)
+{
+struct rpt_link *l;
+struct rpt_linksnap *snap,*old;
+struct rpt_linksnap_ent *e;
+size_t	len;
+char	*cp;
+int	i,j,n;
+
+	n = 0;
+	len = sizeof(struct rpt_linksnap);
+	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
+	{
+		n++;
+		len += sizeof(struct rpt_linksnap_ent) + strlen(l->linklist) + 1;
+	}
+	snap = ast_calloc(1,len);
+	if (!snap) return;
+	snap->refs = 1;
+	snap->n = n;
+	snap->when = rpt_mono_ms();
+	snap->ent = (struct rpt_linksnap_ent *)(snap + 1);
+	cp = (char *)(snap->ent + n);
+	old = myrpt->linksnap;	/* only rpt() publishes, so no need to take a ref */
+	i = 0;
+	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
+	{
+		e = &snap->ent[i];
+		e->link = l;
+		e->chan = l->chan;
+		strlcpy(e->name,l->name,sizeof(e->name));
+		e->mode = l->mode;
+		e->outbound = l->outbound;
+		e->thisconnected = l->thisconnected;
+		e->lastrx1 = l->lastrx1;
+		e->reconnects = l->reconnects;
+		e->connecttime = l->connecttime;
+		e->linklist = cp;
+		strcpy(cp,l->linklist);
+		cp += strlen(cp) + 1;
+		if (!l->chan) strcpy(e->peer,"(none)");
 		else
 		{
-			/* add nodes into buffer */
-			if (l->linklist[0])
+			for(j = 0; old && (j < old->n); j++)
 			{
-				snprintf(buf + spos,MAXLINKLIST - spos,
-					"%c%s,%s",mode,l->name,l->linklist);
+				if ((old->ent[j].link == l) && (old->ent[j].chan == l->chan)) break;
 			}
-			else /* if no nodes, add this node into buffer */
-			{
-				snprintf(buf + spos,MAXLINKLIST - spos,
-					"%c%s",mode,l->name);
-			}	
-		}
-		/* if we are in tranceive mode, let all modes stand */
-		if (mode == 'T') continue;
-		/* downgrade everyone on this node if appropriate */
-		for(i = spos; buf[i]; i++)
-		{
-			if (buf[i] == 'T') buf[i] = mode;
-			if ((buf[i] == 'R') && (mode == 'C')) buf[i] = mode;
+			if (old && (j < old->n))
+				strcpy(e->peer,old->ent[j].peer);
+			else
+				pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", e->peer, MAXPEERSTR - 1);
 		}
+		i++;
+	}
+	myrpt->linksnapsig = sig;
+	rpt_linksnap_swap(myrpt,snap);
+}
+
+/* connect time of a snapshot entry, as of now */
+static long long rpt_linksnap_conntime(struct rpt_linksnap *snap,struct rpt_linksnap_ent *e)
+{
+	return(e->connecttime + (rpt_mono_ms() - snap->when));
+}
+
+/* same as __mklinklist(myrpt,NULL,buf,flag), but from a snapshot and without any lock */
+static void rpt_linksnap_mklinklist(struct rpt_linksnap *snap,char *buf,int flag)
+{
+struct rpt_linksnap_ent *e;
+char mode;
+int	i;
+
+	buf[0] = 0; /* clear output buffer */
+	if (!snap) return;
+	for(i = 0; i < snap->n; i++)
+	{
+		e = &snap->ent[i];
+		/* if is not a real link, ignore it */
+		if (e->name[0] == '0') continue;
+		if (e->mode > 1) continue; /* dont report local modes */
+		/* figure out mode to report */
+		mode = 'T'; /* use Tranceive by default */
+		if (!e->mode) mode = 'R'; /* indicate RX for our mode */
+		if (!e->thisconnected) 	mode = 'C'; /* indicate connecting */
+		mklinklist_add(buf,e->name,mode,e->lastrx1,e->linklist,flag);
 	}
 	return;
 }
@@ -5345,9 +6039,9 @@ struct rpt_link *l;
 	{
 		/* if is not a real link, ignore it */
 		if (l->name[0] == '0') continue;
-		l->linklisttimer = LINKLISTSHORTTIME;
+		rpt_timer_arm(&myrpt->twheel,&l->linklisttimer,LINKLISTSHORTTIME);
 	}
-	myrpt->linkposttimer = LINKPOSTSHORTTIME;
+	rpt_timer_arm(&myrpt->twheel,&myrpt->linkposttimer,LINKPOSTSHORTTIME);
 	myrpt->lastgpstime = 0;
 	return;
 }
@@ -5832,84 +6526,380 @@ int	n;
 	return;
 }
 
-/* 
- * AllStar Network node lookup function.  This function will take the nodelist that has been read into memory
- * and try to match the node number that was passed to it.  If it is found, the function requested will succeed.
- * If not, it will fail.  Called when a connection to a remote node is requested.
- */
+static void rpt_nodedb_destructor(void *obj)
+{
+struct rpt_nodedb *db = obj;
 
-static int node_lookup(struct rpt *myrpt,char *digitbuf,char *str, int strmax, int wilds)
+	if (db->pool) ast_free(db->pool);
+}
+
+static unsigned int rpt_nodedb_hash(const char *str)
 {
+unsigned int hash = 5381;
 
-char *val;
-int longestnode,i,j,found;
-struct stat mystat;
-struct ast_config *ourcfg;
+	while(*str) hash = (hash * 33) ^ tolower(*str++);
+	return(hash);
+}
+
+/*
+ * Build a node database snapshot from a list of config variables.  The
+ * entries, hash buckets and strings all live in a single allocation, so
+ * re-indexing a large extnodes file costs one malloc.
+ */
+
+static struct rpt_nodedb *rpt_nodedb_build(struct ast_variable *varlist)
+{
+struct rpt_nodedb *db;
+struct rpt_nodedb_entry *e,**bp;
 struct ast_variable *vp;
+size_t len;
+char *cp;
+int j,n,nw;
 
-	/* try to look it up locally first */
-	val = (char *) ast_variable_retrieve(myrpt->cfg, myrpt->p.nodes, digitbuf);
-	if (val)
+	db = ao2_alloc(sizeof(*db),rpt_nodedb_destructor);
+	if (!db) return(NULL);
+	n = nw = 0;
+	len = 0;
+	for(vp = varlist; vp; vp = vp->next)
 	{
-		if (str && strmax)
-			snprintf(str,strmax,val,digitbuf);
-		return(1);
+		n++;
+		if (*vp->name == '_') nw++;
+		len += strlen(vp->name) + strlen(vp->value) + 2;
+	}
+	db->nbuckets = 16;
+	while(db->nbuckets < (n * 2)) db->nbuckets <<= 1;
+	db->pool = ast_calloc(1,(n * sizeof(struct rpt_nodedb_entry)) +
+		((db->nbuckets + nw) * sizeof(struct rpt_nodedb_entry *)) + len);
+	if (!db->pool)
+	{
+		ao2_ref(db,-1);
+		return(NULL);
+	}
+	e = (struct rpt_nodedb_entry *) db->pool;
+	db->buckets = (struct rpt_nodedb_entry **) (e + n);
+	db->wilds = db->buckets + db->nbuckets;
+	cp = (char *) (db->wilds + nw);
+	for(vp = varlist; vp; vp = vp->next, e++)
+	{
+		e->name = strcpy(cp,vp->name);
+		cp += strlen(cp) + 1;
+		e->value = strcpy(cp,vp->value);
+		cp += strlen(cp) + 1;
+		j = strlen(e->name);
+		if (*e->name == '_')
+		{
+			db->wilds[db->nwilds++] = e;
+			j--;
+		}
+		if (j > db->longestnode)
+			db->longestnode = j;
+		/* keep the first of any duplicates, like ast_variable_retrieve() */
+		bp = &db->buckets[rpt_nodedb_hash(e->name) & (db->nbuckets - 1)];
+		while(*bp)
+		{
+			if (!strcasecmp((*bp)->name,e->name)) break;
+			bp = &(*bp)->next;
+		}
+		if (*bp) continue;
+		*bp = e;
+		db->nentries++;
+	}
+	return(db);
+}
+
+static char *rpt_nodedb_find(struct rpt_nodedb *db, char *node, int wilds)
+{
+struct rpt_nodedb_entry *e;
+int i;
+
+	e = db->buckets[rpt_nodedb_hash(node) & (db->nbuckets - 1)];
+	for(; e; e = e->next)
+	{
+		if (!strcasecmp(e->name,node)) return(e->value);
 	}
 	if (wilds)
 	{
-		vp = ast_variable_browse(myrpt->cfg, myrpt->p.nodes);
-		while(vp)
+		for(i = 0; i < db->nwilds; i++)
 		{
-			if (ast_extension_match(vp->name, digitbuf))
-			{
-				if (str && strmax)
-					snprintf(str,strmax,vp->value,digitbuf);
-				return(1);
-			}
-			vp = vp->next;
+			if (ast_extension_match(db->wilds[i]->name,node))
+				return(db->wilds[i]->value);
 		}
 	}
-	ast_mutex_lock(&nodelookuplock);
-	if (!myrpt->p.extnodefilesn) 
+	return(NULL);
+}
+
+/*
+ * Compile a function stanza into a digit trie.  Nodes, parameter strings and
+ * the trie itself are a single allocation, freed with ast_free().
+ */
+
+static struct rpt_functrie *rpt_functrie_build(struct ast_variable *varlist)
+{
+struct rpt_functrie *t;
+struct rpt_functrie_node *n,*c;
+struct ast_variable *vp;
+char workstring[200],*stringp,*action,*cp,*s;
+size_t len;
+int i,nnodes,order;
+
+	nnodes = 1;
+	len = 0;
+	for(vp = varlist; vp; vp = vp->next)
+	{
+		nnodes += strlen(vp->name);
+		len += strlen(vp->value) + 1;
+	}
+	t = ast_calloc(1,sizeof(*t) + (nnodes * sizeof(struct rpt_functrie_node)) + len);
+	if (!t) return(NULL);
+	t->nodes = (struct rpt_functrie_node *) (t + 1);
+	cp = (char *) (t->nodes + nnodes);
+	t->nodes[0].order = -1;
+	t->nnodes = 1;
+	for(order = 0, vp = varlist; vp; vp = vp->next, order++)
+	{
+		n = t->nodes;
+		for(s = vp->name; *s; s++)
+		{
+			for(c = n->child; c; c = c->sibling)
+				if (c->c == tolower(*s)) break;
+			if (!c)
+			{
+				c = &t->nodes[t->nnodes++];
+				c->c = tolower(*s);
+				c->order = -1;
+				c->sibling = n->child;
+				n->child = c;
+			}
+			n = c;
+		}
+		/* of duplicates, the first one is the one that ever matched */
+		if (n->order >= 0) continue;
+		n->order = order;
+		n->len = strlen(vp->name);
+		ast_copy_string(workstring,vp->value,sizeof(workstring));
+		stringp = workstring;
+		action = strsep(&stringp, ",");
+		for(i = 0 ; i < (sizeof(function_table)/sizeof(struct function_table_tag)); i++){
+			if(!strncasecmp(action, function_table[i].action, strlen(action)))
+				break;
+		}
+		if (i < (sizeof(function_table)/sizeof(struct function_table_tag)))
+			n->action = &function_table[i];
+		if (stringp)
+		{
+			n->param = strcpy(cp,stringp);
+			cp += strlen(cp) + 1;
+		}
+	}
+	return(t);
+}
+
+/*
+ * Find the stanza entry collect_function_digits() used to: of the entries
+ * whose name is a prefix of digits, the one that comes first in the stanza.
+ */
+
+static struct rpt_functrie_node *rpt_functrie_find(struct rpt_functrie *t, char *digits)
+{
+struct rpt_functrie_node *n,*best;
+char	c;
+
+	n = t->nodes;
+	best = (n->order >= 0) ? n : NULL;
+	for(; *digits; digits++)
 	{
-		ast_mutex_unlock(&nodelookuplock);
-		return(0);
+		c = tolower(*digits);
+		for(n = n->child; n; n = n->sibling)
+			if (n->c == c) break;
+		if (!n) break;
+		if ((n->order >= 0) && ((!best) || (n->order < best->order))) best = n;
 	}
-	/* determine longest node length again */		
-	longestnode = 0;
-	vp = ast_variable_browse(myrpt->cfg, myrpt->p.nodes);
-	while(vp)
+	return(best);
+}
+
+/*
+ * Free all of a node's compiled function stanzas
+ */
+
+static void rpt_functrie_free(struct rpt *myrpt)
+{
+	if (myrpt->functrie) ast_free(myrpt->functrie);
+	myrpt->functrie = NULL;
+	if (myrpt->link_functrie) ast_free(myrpt->link_functrie);
+	myrpt->link_functrie = NULL;
+	if (myrpt->phone_functrie) ast_free(myrpt->phone_functrie);
+	myrpt->phone_functrie = NULL;
+	if (myrpt->dphone_functrie) ast_free(myrpt->dphone_functrie);
+	myrpt->dphone_functrie = NULL;
+	if (myrpt->alt_functrie) ast_free(myrpt->alt_functrie);
+	myrpt->alt_functrie = NULL;
+}
+
+/*
+ * Return a reference to the current snapshot of the given stanza of an
+ * extnodes file, or NULL if the file is not there.  The file is stat()ed at
+ * most once every NODEDB_RECHECK seconds and re-parsed only when its inode,
+ * size or mtime has changed.  While one thread re-parses, everyone else keeps
+ * using the previous snapshot.  The caller must ao2_ref(db,-1) it when done.
+ */
+
+static struct rpt_nodedb *rpt_nodedb_get(char *file, char *section)
+{
+struct rpt_nodedb_source *src;
+struct rpt_nodedb *db,*newdb,*olddb;
+struct ast_config *ourcfg;
+struct stat mystat;
+time_t now;
+
+	time(&now);
+	ast_mutex_lock(&nodedblock);
+	AST_LIST_TRAVERSE(&nodedb_sources, src, list)
 	{
-		j = strlen(vp->name);
-		if (*vp->name == '_') j--;
-		if (j > longestnode)
-			longestnode = j;
-		vp = vp->next;
+		if ((!strcmp(src->file,file)) && (!strcasecmp(src->section,section)))
+			break;
 	}
-	found = 0;
-	for(i = 0; i < myrpt->p.extnodefilesn; i++)
+	if (!src)
+	{
+		src = ast_calloc(1,sizeof(*src) + strlen(file) + strlen(section) + 2);
+		if (!src)
+		{
+			ast_mutex_unlock(&nodedblock);
+			return(NULL);
+		}
+		src->file = strcpy((char *)(src + 1),file);
+		src->section = strcpy(src->file + strlen(file) + 1,section);
+		ast_mutex_init(&src->lock);
+		AST_LIST_INSERT_TAIL(&nodedb_sources, src, list);
+	}
+	db = src->db;
+	if (db) ao2_ref(db,1);
+	if (src->lastcheck && ((now - src->lastcheck) < NODEDB_RECHECK))
+	{
+		ast_mutex_unlock(&nodedblock);
+		return(db);
+	}
+	ast_mutex_unlock(&nodedblock);
+	/* if someone else is re-reading it, use what we have meanwhile */
+	if (db && ast_mutex_trylock(&src->lock)) return(db);
+	if (!db) ast_mutex_lock(&src->lock);
+	/* it may have been refreshed while we waited for the lock */
+	ast_mutex_lock(&nodedblock);
+	if (db) ao2_ref(db,-1);
+	db = src->db;
+	if (db) ao2_ref(db,1);
+	if (src->lastcheck && ((now - src->lastcheck) < NODEDB_RECHECK))
+	{
+		ast_mutex_unlock(&nodedblock);
+		ast_mutex_unlock(&src->lock);
+		return(db);
+	}
+	ast_mutex_unlock(&nodedblock);
+	newdb = NULL;
+	/* if file does not exist, drop whatever we had */
+	if (stat(file,&mystat) == -1)
+		memset(&mystat,0,sizeof(mystat));
+	else if (db && (mystat.st_dev == src->dev) && (mystat.st_ino == src->ino) &&
+	    (mystat.st_size == src->size) && (mystat.st_mtime == src->mtime))
+	{
+		ast_mutex_lock(&nodedblock);
+		src->lastcheck = now;
+		ast_mutex_unlock(&nodedblock);
+		ast_mutex_unlock(&src->lock);
+		return(db);
+	}
+	else
 	{
 #ifdef	NEW_ASTERISK
-		ourcfg = ast_config_load(myrpt->p.extnodefiles[i],config_flags);
+		ourcfg = ast_config_load(file,config_flags);
 #else
-		ourcfg = ast_config_load(myrpt->p.extnodefiles[i]);
+		ourcfg = ast_config_load(file);
 #endif
-		/* if file does not exist */
-		if (stat(myrpt->p.extnodefiles[i],&mystat) == -1) continue;
-		/* if file not there, try next */
-		if (!ourcfg) continue;
-		vp = ast_variable_browse(ourcfg, myrpt->p.extnodes);
-		while(vp)
+		if (ourcfg)
 		{
-			j = strlen(vp->name);
-			if (*vp->name == '_') j--;
-			if (j > longestnode)
-				longestnode = j;
-			vp = vp->next;
+			newdb = rpt_nodedb_build(ast_variable_browse(ourcfg,section));
+			ast_config_destroy(ourcfg);
+		}
+		if (newdb) ao2_ref(newdb,1);
+	}
+	ast_mutex_lock(&nodedblock);
+	olddb = src->db;
+	src->db = newdb;
+	src->dev = mystat.st_dev;
+	src->ino = mystat.st_ino;
+	src->size = mystat.st_size;
+	src->mtime = mystat.st_mtime;
+	src->lastcheck = now;
+	ast_mutex_unlock(&nodedblock);
+	ast_mutex_unlock(&src->lock);
+	if (olddb) ao2_ref(olddb,-1);
+	if (db) ao2_ref(db,-1);
+	return(newdb);
+}
+
+static void rpt_nodedb_cleanup(void)
+{
+struct rpt_nodedb_source *src;
+int i;
+
+	ast_mutex_lock(&nodedblock);
+	while((src = AST_LIST_REMOVE_HEAD(&nodedb_sources, list)))
+	{
+		if (src->db) ao2_ref(src->db,-1);
+		ast_mutex_destroy(&src->lock);
+		ast_free(src);
+	}
+	for(i = 0; i < nrpts; i++)
+	{
+		if (rpt_vars[i].localnodes) ao2_ref(rpt_vars[i].localnodes,-1);
+		rpt_vars[i].localnodes = NULL;
+	}
+	ast_mutex_unlock(&nodedblock);
+}
+
+/* 
+ * AllStar Network node lookup function.  This function will take the nodelist that has been read into memory
+ * and try to match the node number that was passed to it.  If it is found, the function requested will succeed.
+ * If not, it will fail.  Called when a connection to a remote node is requested.
+ */
+
+static int node_lookup(struct rpt *myrpt,char *digitbuf,char *str, int strmax, int wilds)
+{
+
+char *val;
+int longestnode,i,found;
+struct rpt_nodedb *db;
+
+	longestnode = 0;
+	/* try to look it up locally first */
+	ast_mutex_lock(&nodedblock);
+	db = myrpt->localnodes;
+	if (db) ao2_ref(db,1);
+	ast_mutex_unlock(&nodedblock);
+	if (db)
+	{
+		val = rpt_nodedb_find(db,digitbuf,wilds);
+		if (val)
+		{
+			if (str && strmax)
+				snprintf(str,strmax,val,digitbuf);
+			ao2_ref(db,-1);
+			return(1);
 		}
+		longestnode = db->longestnode;
+		ao2_ref(db,-1);
+	}
+	if (!myrpt->p.extnodefilesn) return(0);
+	found = 0;
+	for(i = 0; i < myrpt->p.extnodefilesn; i++)
+	{
+		db = rpt_nodedb_get(myrpt->p.extnodefiles[i],myrpt->p.extnodes);
+		/* if file not there, try next */
+		if (!db) continue;
+		if (db->longestnode > longestnode)
+			longestnode = db->longestnode;
 		if (!found)
 		{
-			val = (char *) ast_variable_retrieve(ourcfg, myrpt->p.extnodes, digitbuf);
+			val = rpt_nodedb_find(db,digitbuf,0);
 			if (val)
 			{
 				found = 1;
@@ -5917,10 +6907,9 @@ struct ast_variable *vp;
 					snprintf(str,strmax,val,digitbuf);
 			}
 		}
-		ast_config_destroy(ourcfg);
+		ao2_ref(db,-1);
 	}
 	myrpt->longestnode = longestnode;
-	ast_mutex_unlock(&nodelookuplock);
 	return(found);
 }
 
@@ -5929,58 +6918,734 @@ static char *forward_node_lookup(struct rpt *myrpt,char *digitbuf, struct ast_co
 
 char *val,*efil,*enod,*strs[100];
 int i,n;
-struct stat mystat;
-static struct ast_config *ourcfg;
+struct rpt_nodedb *db;
+/* holds the snapshot the last returned string lives in */
+static struct rpt_nodedb *lastdb;
 
 	val = (char *) ast_variable_retrieve(cfg, "proxy", "extnodefile");
 	if (!val) val = EXTNODEFILE;
 	enod = (char *) ast_variable_retrieve(cfg, "proxy", "extnodes");
 	if (!enod) enod = EXTNODES;
-	ast_mutex_lock(&nodelookuplock);
 	efil = ast_strdup(val);
-	if (!efil) 
-	{
-		ast_config_destroy(ourcfg);
-		if (ourcfg) ast_config_destroy(ourcfg);
-		ourcfg = NULL;
-		ast_mutex_unlock(&nodelookuplock);
-		return NULL;
-	}
+	if (!efil) return NULL;
 	n = finddelim(efil,strs,100);
-	if (n < 1)
-	{
-		ast_free(efil);
-		ast_config_destroy(ourcfg);
-		if (ourcfg) ast_config_destroy(ourcfg);
-		ourcfg = NULL;
-		ast_mutex_unlock(&nodelookuplock);
-		return NULL;
-	}
-	if (ourcfg) ast_config_destroy(ourcfg);
+	ast_mutex_lock(&nodelookuplock);
+	if (lastdb) ao2_ref(lastdb,-1);
+	lastdb = NULL;
 	val = NULL;
-	for(i = 0; i < n; i++)
+	for(i = 0; (i < n) && (!val); i++)
 	{
-		/* if file does not exist */
-		if (stat(strs[i],&mystat) == -1) continue;
-#ifdef	NEW_ASTERISK
-		ourcfg = ast_config_load(strs[i],config_flags);
-#else
-		ourcfg = ast_config_load(strs[i]);
-#endif
+		db = rpt_nodedb_get(strs[i],enod);
 		/* if file not there, try next */
-		if (!ourcfg) continue;
-		if (!val) val = (char *) ast_variable_retrieve(ourcfg, enod, digitbuf);
+		if (!db) continue;
+		val = rpt_nodedb_find(db,digitbuf,0);
+		if (val) lastdb = db;
+		else ao2_ref(db,-1);
 	}
-        if (!val)
-        {
-                if (ourcfg) ast_config_destroy(ourcfg);
-                ourcfg = NULL;
-        }
 	ast_mutex_unlock(&nodelookuplock);
 	ast_free(efil);
 	return(val);
 }
 
+/*
+ * In-process conference mixer.
+ *
+ * A node with usermixer=yes in rpt.conf, or one running on a host without
+ * DAHDI, gets its pseudo channels from here instead of from DAHDI.  Each
+ * node has one mixer thread that, every 20 ms, takes a block of audio from
+ * every member, sums each conference and hands every member what it should
+ * hear.  Audio moves between a channel and the mixer through a pair of
+ * single-producer/single-consumer rings, so moving a frame takes no lock.
+ * Conference numbers and modes are those of DAHDI_SETCONF, which lets the
+ * rest of app_rpt treat both kinds of pseudo channel the same way through
+ * rpt_setconf() and friends.
+ */
+
+#define	RPT_MIX_TICK 20			/* ms per mixer pass */
+#define	RPT_MIX_BLOCK 160		/* samples per mixer pass */
+#define	RPT_MIX_RINGSIZE 2048		/* samples per ring, must be a power of 2 */
+#define	RPT_MIX_TONEAMP 2000
+
+#define	RPT_CONF_MODE(x) ((x) & 0xff)
+
+struct rpt_mix_ring
+{
+	volatile unsigned int head;	/* only advanced by the producer */
+	volatile unsigned int tail;	/* only advanced by the consumer */
+	short	buf[RPT_MIX_RINGSIZE];
+} ;
+
+struct rpt_mix_conf
+{
+	struct rpt_mix_conf *next;
+	int	confno;
+	int	nmembers;
+	int	mix[RPT_MIX_BLOCK];
+} ;
+
+struct rpt_mix_member
+{
+	struct rpt_mix_member *next;
+	struct rpt_mixer *mixer;
+	struct ast_channel *chan;
+	struct rpt_mix_conf *conf;	/* conference modes */
+	struct rpt_mix_member *target;	/* monitor modes */
+	int	channo;
+	int	confmode;
+	int	pfd[2];			/* pfd[0] is the channel's fds[0] */
+	volatile int signalled;		/* a wakeup byte is in the pipe */
+	int	tone;			/* DAHDI_TONE_xxx being played, or -1 */
+	unsigned int tonepos;
+	struct rpt_mix_ring txring;	/* audio written to the channel */
+	struct rpt_mix_ring rxring;	/* audio to be read from the channel */
+	short	talk[RPT_MIX_BLOCK];	/* mixer thread only */
+	short	heard[RPT_MIX_BLOCK];	/* mixer thread only */
+	struct ast_frame fr;		/* reader only */
+	char	frdata[AST_FRIENDLY_OFFSET + (RPT_MIX_BLOCK * 2)];
+} ;
+
+struct rpt_mixer
+{
+	ast_mutex_t lock;		/* members, conferences and modes */
+	struct rpt_mix_member *members;
+	struct rpt_mix_conf *confs;
+	int	nextconf;
+	int	running;
+	char	*name;
+	unsigned long ticks;
+	unsigned long overruns;
+} ;
+
+AST_MUTEX_DEFINE_STATIC(rptmixlock);
+
+static int rpt_mix_nextchan;
+
+static struct ast_channel *rpt_mix_requester(const char *type, int format, void *data, int *cause);
+static int rpt_mix_call(struct ast_channel *chan, char *addr, int timeout);
+static int rpt_mix_hangup(struct ast_channel *chan);
+static struct ast_frame *rpt_mix_read(struct ast_channel *chan);
+static int rpt_mix_write(struct ast_channel *chan, struct ast_frame *f);
+static int rpt_mix_indicate(struct ast_channel *chan, int condition, const void *data, size_t datalen);
+
+static const struct ast_channel_tech rpt_mix_tech = {
+	.type = "RptMix",
+	.description = "app_rpt conference mixer pseudo channel",
+	.capabilities = AST_FORMAT_SLINEAR,
+	.requester = rpt_mix_requester,
+	.call = rpt_mix_call,
+	.hangup = rpt_mix_hangup,
+	.read = rpt_mix_read,
+	.write = rpt_mix_write,
+	.indicate = rpt_mix_indicate,
+};
+
+#define	IS_RPT_MIX(c) ((c)->tech == &rpt_mix_tech)
+
+static unsigned int rpt_mix_ring_avail(struct rpt_mix_ring *r)
+{
+	return(r->head - r->tail);
+}
+
+static int rpt_mix_ring_put(struct rpt_mix_ring *r, short *samples, unsigned int n)
+{
+unsigned int i,head;
+
+	head = r->head;
+	if (n > (RPT_MIX_RINGSIZE - (head - r->tail))) return(-1);
+	for(i = 0; i < n; i++)
+		r->buf[(head + i) & (RPT_MIX_RINGSIZE - 1)] = samples[i];
+	__sync_synchronize();
+	r->head = head + n;
+	return(0);
+}
+
+static unsigned int rpt_mix_ring_get(struct rpt_mix_ring *r, short *samples, unsigned int n)
+{
+unsigned int i,tail;
+
+	tail = r->tail;
+	if (n > (r->head - tail)) n = r->head - tail;
+	__sync_synchronize();
+	for(i = 0; i < n; i++)
+		samples[i] = r->buf[(tail + i) & (RPT_MIX_RINGSIZE - 1)];
+	__sync_synchronize();
+	r->tail = tail + n;
+	return(n);
+}
+
+static int rpt_mix_talks(int confmode)
+{
+	switch(RPT_CONF_MODE(confmode))
+	{
+	    case DAHDI_CONF_CONF:
+		return((confmode & DAHDI_CONF_TALKER) != 0);
+	    case DAHDI_CONF_CONFANN:
+	    case DAHDI_CONF_CONFANNMON:
+		return(1);
+	}
+	return(0);
+}
+
+static int rpt_mix_listens(int confmode)
+{
+	switch(RPT_CONF_MODE(confmode))
+	{
+	    case DAHDI_CONF_CONF:
+		return((confmode & DAHDI_CONF_LISTENER) != 0);
+	    case DAHDI_CONF_CONFMON:
+	    case DAHDI_CONF_CONFANNMON:
+		return(1);
+	}
+	return(0);
+}
+
+static int rpt_mix_monitors(int confmode)
+{
+	switch(RPT_CONF_MODE(confmode))
+	{
+	    case DAHDI_CONF_MONITOR:
+	    case DAHDI_CONF_MONITORTX:
+	    case DAHDI_CONF_MONITORBOTH:
+		return(1);
+	}
+	return(0);
+}
+
+static short rpt_mix_clip(int s)
+{
+	if (s > 32767) return(32767);
+	if (s < -32768) return(-32768);
+	return(s);
+}
+
+/* replace a member's talk with the call progress tone it is playing */
+static void rpt_mix_tone(struct rpt_mix_member *m)
+{
+int	i,f1,f2;
+float	t;
+
+	switch(m->tone)
+	{
+	    case DAHDI_TONE_DIALTONE:
+		f1 = 350;
+		f2 = 440;
+		break;
+	    case DAHDI_TONE_CONGESTION:
+		f1 = 480;
+		f2 = 620;
+		/* 250 ms on, 250 ms off */
+		if ((m->tonepos % 4000) >= 2000)
+		{
+			memset(m->talk,0,sizeof(m->talk));
+			m->tonepos += RPT_MIX_BLOCK;
+			return;
+		}
+		break;
+	    default:
+		return;
+	}
+	for(i = 0; i < RPT_MIX_BLOCK; i++)
+	{
+		t = (float) (m->tonepos++ % 8000) / 8000.0;
+		m->talk[i] = RPT_MIX_TONEAMP * (sin(2.0 * M_PI * f1 * t) +
+			sin(2.0 * M_PI * f2 * t));
+	}
+}
+
+/* one mixer pass, called with mixer->lock held */
+static void rpt_mix_tick(struct rpt_mixer *mixer)
+{
+struct rpt_mix_member *m;
+struct rpt_mix_conf *c;
+unsigned int n;
+int	i;
+
+	for(c = mixer->confs; c; c = c->next)
+		memset(c->mix,0,sizeof(c->mix));
+	for(m = mixer->members; m; m = m->next)
+	{
+		n = rpt_mix_ring_get(&m->txring,m->talk,RPT_MIX_BLOCK);
+		if (n < RPT_MIX_BLOCK)
+			memset(m->talk + n,0,(RPT_MIX_BLOCK - n) * sizeof(short));
+		if (m->tone != -1) rpt_mix_tone(m);
+		if ((!m->conf) || (!rpt_mix_talks(m->confmode))) continue;
+		for(i = 0; i < RPT_MIX_BLOCK; i++)
+			m->conf->mix[i] += m->talk[i];
+	}
+	for(m = mixer->members; m; m = m->next)
+	{
+		if (rpt_mix_monitors(m->confmode)) continue;
+		if ((!m->conf) || (!rpt_mix_listens(m->confmode)))
+		{
+			memset(m->heard,0,sizeof(m->heard));
+			continue;
+		}
+		/* nobody hears himself */
+		if (rpt_mix_talks(m->confmode))
+		{
+			for(i = 0; i < RPT_MIX_BLOCK; i++)
+				m->heard[i] = rpt_mix_clip(m->conf->mix[i] - m->talk[i]);
+		}
+		else
+		{
+			for(i = 0; i < RPT_MIX_BLOCK; i++)
+				m->heard[i] = rpt_mix_clip(m->conf->mix[i]);
+		}
+	}
+	for(m = mixer->members; m; m = m->next)
+	{
+		if (!rpt_mix_monitors(m->confmode)) continue;
+		for(i = 0; i < RPT_MIX_BLOCK; i++)
+		{
+			switch(RPT_CONF_MODE(m->confmode))
+			{
+			    case DAHDI_CONF_MONITOR:
+				m->heard[i] = m->target->talk[i];
+				break;
+			    case DAHDI_CONF_MONITORTX:
+				m->heard[i] = m->target->heard[i];
+				break;
+			    default:
+				m->heard[i] = rpt_mix_clip(m->target->talk[i] +
+					m->target->heard[i]);
+				break;
+			}
+		}
+	}
+	for(m = mixer->members; m; m = m->next)
+	{
+		if (rpt_mix_ring_put(&m->rxring,m->heard,RPT_MIX_BLOCK))
+		{
+			mixer->overruns++;
+			continue;
+		}
+		if (!__sync_lock_test_and_set(&m->signalled,1))
+		{
+			if (write(m->pfd[1],"",1) != 1)
+				m->signalled = 0;
+		}
+	}
+	mixer->ticks++;
+}
+
+static void *rpt_mix_thread(void *data)
+{
+struct rpt_mixer *mixer = (struct rpt_mixer *) data;
+struct timespec next,now;
+
+	clock_gettime(CLOCK_MONOTONIC,&next);
+	for(;;)
+	{
+		next.tv_nsec += RPT_MIX_TICK * 1000000;
+		if (next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL) == EINTR);
+		ast_mutex_lock(&mixer->lock);
+		if (!mixer->members)
+		{
+			mixer->running = 0;
+			ast_mutex_unlock(&mixer->lock);
+			break;
+		}
+		rpt_mix_tick(mixer);
+		ast_mutex_unlock(&mixer->lock);
+		/* if we fell way behind, dont try to catch up */
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		if ((now.tv_sec - next.tv_sec) > 1) next = now;
+	}
+	return(NULL);
+}
+
+/* take a member out of whatever it is in, called with mixer->lock held */
+static void rpt_mix_leave(struct rpt_mix_member *m)
+{
+struct rpt_mix_conf **cp;
+
+	if (m->conf && (!--m->conf->nmembers))
+	{
+		for(cp = &m->mixer->confs; *cp; cp = &(*cp)->next)
+		{
+			if (*cp != m->conf) continue;
+			*cp = m->conf->next;
+			ast_free(m->conf);
+			break;
+		}
+	}
+	m->conf = NULL;
+	m->target = NULL;
+	m->confmode = 0;
+}
+
+static int rpt_mix_setconf(struct rpt_mix_member *m, struct dahdi_confinfo *ci)
+{
+struct rpt_mixer *mixer = m->mixer;
+struct rpt_mix_member *t;
+struct rpt_mix_conf *c;
+
+	ast_mutex_lock(&mixer->lock);
+	if (rpt_mix_monitors(ci->confmode))
+	{
+		for(t = mixer->members; t; t = t->next)
+		{
+			if (t->channo == ci->confno) break;
+		}
+		if ((!t) || (t == m))
+		{
+			ast_mutex_unlock(&mixer->lock);
+			errno = EINVAL;
+			return(-1);
+		}
+		rpt_mix_leave(m);
+		m->target = t;
+		m->confmode = ci->confmode;
+		ast_mutex_unlock(&mixer->lock);
+		return(0);
+	}
+	if ((!rpt_mix_talks(ci->confmode)) && (!rpt_mix_listens(ci->confmode)) &&
+	    (RPT_CONF_MODE(ci->confmode) != DAHDI_CONF_CONF))
+	{
+		rpt_mix_leave(m);
+		ast_mutex_unlock(&mixer->lock);
+		return(0);
+	}
+	if (ci->confno == -1) ci->confno = ++mixer->nextconf;
+	for(c = mixer->confs; c; c = c->next)
+	{
+		if (c->confno == ci->confno) break;
+	}
+	if ((!c) || (c != m->conf))
+	{
+		if (!c)
+		{
+			c = ast_calloc(1,sizeof(*c));
+			if (!c)
+			{
+				ast_mutex_unlock(&mixer->lock);
+				errno = ENOMEM;
+				return(-1);
+			}
+			c->confno = ci->confno;
+			c->next = mixer->confs;
+			mixer->confs = c;
+			if (c->confno > mixer->nextconf) mixer->nextconf = c->confno;
+		}
+		c->nmembers++;
+		rpt_mix_leave(m);
+		m->conf = c;
+	}
+	m->confmode = ci->confmode;
+	ast_mutex_unlock(&mixer->lock);
+	return(0);
+}
+
+static struct rpt_mixer *rpt_mix_get(struct rpt *myrpt)
+{
+struct rpt_mixer *mixer;
+
+	ast_mutex_lock(&rptmixlock);
+	if (!myrpt->mixer)
+	{
+		mixer = ast_calloc(1,sizeof(*mixer));
+		if (mixer)
+		{
+			ast_mutex_init(&mixer->lock);
+			mixer->name = myrpt->name;
+			myrpt->mixer = mixer;
+		}
+	}
+	mixer = myrpt->mixer;
+	ast_mutex_unlock(&rptmixlock);
+	return(mixer);
+}
+
+/* make a pseudo channel on the node's mixer */
+static struct ast_channel *rpt_mix_request(struct rpt *myrpt)
+{
+struct rpt_mixer *mixer;
+struct rpt_mix_member *m;
+struct ast_channel *chan;
+pthread_attr_t attr;
+pthread_t id;
+
+	mixer = rpt_mix_get(myrpt);
+	if (!mixer) return(NULL);
+	m = ast_calloc(1,sizeof(*m));
+	if (!m) return(NULL);
+	if (pipe(m->pfd) == -1)
+	{
+		ast_log(LOG_ERROR,"pipe() failed: %s\n",strerror(errno));
+		ast_free(m);
+		return(NULL);
+	}
+	fcntl(m->pfd[0],F_SETFL,O_NONBLOCK);
+	fcntl(m->pfd[1],F_SETFL,O_NONBLOCK);
+	m->mixer = mixer;
+	m->tone = -1;
+	m->channo = ast_atomic_fetchadd_int(&rpt_mix_nextchan,1) + 1;
+	chan = ast_channel_alloc(0,AST_STATE_DOWN,0,0,"","s",myrpt->p.ourcontext,0,
+		"RptMix/pseudo-%s-%d",myrpt->name,m->channo);
+	if (!chan)
+	{
+		close(m->pfd[0]);
+		close(m->pfd[1]);
+		ast_free(m);
+		return(NULL);
+	}
+	chan->tech = &rpt_mix_tech;
+	chan->tech_pvt = m;
+	chan->fds[0] = m->pfd[0];
+	chan->nativeformats = AST_FORMAT_SLINEAR;
+	chan->readformat = chan->rawreadformat = AST_FORMAT_SLINEAR;
+	chan->writeformat = chan->rawwriteformat = AST_FORMAT_SLINEAR;
+	m->chan = chan;
+	ast_mutex_lock(&mixer->lock);
+	m->next = mixer->members;
+	mixer->members = m;
+	if (!mixer->running)
+	{
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+		if (ast_pthread_create(&id,&attr,rpt_mix_thread,(void *) mixer))
+			ast_log(LOG_WARNING,"Could not start mixer thread for node %s\n",myrpt->name);
+		else
+			mixer->running = 1;
+		pthread_attr_destroy(&attr);
+	}
+	ast_mutex_unlock(&mixer->lock);
+	return(chan);
+}
+
+/* mixer channels are made with rpt_request_pseudo(), never through the core */
+static struct ast_channel *rpt_mix_requester(const char *type, int format, void *data, int *cause)
+{
+	*cause = AST_CAUSE_FAILURE;
+	return(NULL);
+}
+
+static int rpt_mix_call(struct ast_channel *chan, char *addr, int timeout)
+{
+	ast_setstate(chan,AST_STATE_UP);
+	return(0);
+}
+
+static int rpt_mix_hangup(struct ast_channel *chan)
+{
+struct rpt_mix_member *m = chan->tech_pvt,**mp,*t;
+struct rpt_mixer *mixer;
+
+	if (!m) return(0);
+	mixer = m->mixer;
+	ast_mutex_lock(&mixer->lock);
+	for(mp = &mixer->members; *mp; mp = &(*mp)->next)
+	{
+		if (*mp != m) continue;
+		*mp = m->next;
+		break;
+	}
+	rpt_mix_leave(m);
+	/* anyone monitoring us is left listening to silence */
+	for(t = mixer->members; t; t = t->next)
+	{
+		if (t->target == m) rpt_mix_leave(t);
+	}
+	ast_mutex_unlock(&mixer->lock);
+	close(m->pfd[0]);
+	close(m->pfd[1]);
+	ast_free(m);
+	chan->tech_pvt = NULL;
+	chan->fds[0] = -1;
+	return(0);
+}
+
+static struct ast_frame *rpt_mix_read(struct ast_channel *chan)
+{
+struct rpt_mix_member *m = chan->tech_pvt;
+char	buf[16];
+short	*data;
+
+	if (rpt_mix_ring_avail(&m->rxring) < RPT_MIX_BLOCK)
+		return(&ast_null_frame);
+	data = (short *) (m->frdata + AST_FRIENDLY_OFFSET);
+	rpt_mix_ring_get(&m->rxring,data,RPT_MIX_BLOCK);
+	/* once drained, re-arm the wakeup and look again in case we raced the mixer */
+	if (rpt_mix_ring_avail(&m->rxring) < RPT_MIX_BLOCK)
+	{
+		while(read(m->pfd[0],buf,sizeof(buf)) == sizeof(buf));
+		m->signalled = 0;
+		__sync_synchronize();
+		if ((rpt_mix_ring_avail(&m->rxring) >= RPT_MIX_BLOCK) &&
+		    (!__sync_lock_test_and_set(&m->signalled,1)))
+		{
+			if (write(m->pfd[1],"",1) != 1)
+				m->signalled = 0;
+		}
+	}
+	memset(&m->fr,0,sizeof(m->fr));
+	m->fr.frametype = AST_FRAME_VOICE;
+	m->fr.subclass = AST_FORMAT_SLINEAR;
+	m->fr.samples = RPT_MIX_BLOCK;
+	m->fr.datalen = RPT_MIX_BLOCK * 2;
+	AST_FRAME_DATA(m->fr) = data;
+	m->fr.offset = AST_FRIENDLY_OFFSET;
+	m->fr.src = "rpt_mix";
+	return(&m->fr);
+}
+
+static int rpt_mix_write(struct ast_channel *chan, struct ast_frame *f)
+{
+struct rpt_mix_member *m = chan->tech_pvt;
+
+	if ((f->frametype != AST_FRAME_VOICE) || (f->subclass != AST_FORMAT_SLINEAR))
+		return(0);
+	/* too far ahead of the mixer, drop it like a full DAHDI buffer would */
+	if (rpt_mix_ring_put(&m->txring,AST_FRAME_DATAP(f),f->samples))
+		m->mixer->overruns++;
+	return(0);
+}
+
+static int rpt_mix_indicate(struct ast_channel *chan, int condition, const void *data, size_t datalen)
+{
+	return(0);
+}
+
+/*
+ * Wrappers for the DAHDI pseudo channel ioctls that app_rpt uses, so that
+ * the same code drives either kind of pseudo channel.
+ */
+
+static struct ast_channel *rpt_request_pseudo(struct rpt *myrpt)
+{
+	if (myrpt->usermixer) return(rpt_mix_request(myrpt));
+	return(ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL));
+}
+
+/* request a channel given in rpt.conf, mapping DAHDI pseudos onto the mixer */
+static struct ast_channel *rpt_request_chan(struct rpt *myrpt, char *tech, char *data)
+{
+	if (myrpt->usermixer && (!strcasecmp(data,"pseudo")) &&
+	    ((!strcasecmp(tech,DAHDI_CHANNEL_NAME)) || (!strcasecmp(tech,"dahdi")) ||
+	    (!strcasecmp(tech,"zap"))))
+		return(rpt_mix_request(myrpt));
+	return(ast_request(tech,AST_FORMAT_SLINEAR,data,NULL));
+}
+
+/* is name (tech/data, from rpt.conf) a DAHDI channel, one that the mixer
+   does not stand in for and that can only be conferenced in DAHDI */
+static int rpt_mix_dahdi_chan(struct rpt *myrpt, char *name)
+{
+char	*tech,*data;
+
+	if (!name) return(0);
+	tech = ast_strdupa(name);
+	data = strchr(tech,'/');
+	if (!data) return(0);
+	*data++ = 0;
+	if (strcasecmp(tech,DAHDI_CHANNEL_NAME) && strcasecmp(tech,"dahdi") &&
+	    strcasecmp(tech,"zap")) return(0);
+	/* remotes request their channels as given, pseudo or not */
+	return(myrpt->remote || strcasecmp(data,"pseudo"));
+}
+
+/* decide, once per node start, whether this node mixes its own audio */
+static void rpt_mix_select(struct rpt *myrpt)
+{
+	myrpt->usermixer = myrpt->p.usermixer;
+	if (myrpt->usermixer && ast_get_channel_tech(DAHDI_CHANNEL_NAME) &&
+	    (rpt_mix_dahdi_chan(myrpt,myrpt->rxchanname) ||
+	    rpt_mix_dahdi_chan(myrpt,myrpt->txchanname)))
+	{
+		ast_log(LOG_WARNING,"Node %s has a DAHDI radio channel, it will use DAHDI conferences rather than usermixer\n",
+			myrpt->name);
+		myrpt->usermixer = 0;
+	}
+	if ((!myrpt->usermixer) && (!ast_get_channel_tech(DAHDI_CHANNEL_NAME)))
+	{
+		ast_log(LOG_NOTICE,"No %s channel driver, node %s will use its own conference mixer\n",
+			DAHDI_CHANNEL_NAME,myrpt->name);
+		myrpt->usermixer = 1;
+	}
+}
+
+static int rpt_setconf(struct ast_channel *chan, struct dahdi_confinfo *ci)
+{
+	if (IS_RPT_MIX(chan)) return(rpt_mix_setconf(chan->tech_pvt,ci));
+	return(ioctl(chan->fds[0],DAHDI_SETCONF,ci));
+}
+
+static int rpt_channo(struct ast_channel *chan, int *channo)
+{
+	if (IS_RPT_MIX(chan))
+	{
+		*channo = ((struct rpt_mix_member *) chan->tech_pvt)->channo;
+		return(0);
+	}
+	return(ioctl(chan->fds[0],DAHDI_CHANNO,channo));
+}
+
+static int rpt_set_tonezone(struct ast_channel *chan, char *zone)
+{
+	/* the mixer only knows the standard dial and congestion tones */
+	if (IS_RPT_MIX(chan)) return(0);
+	return(tone_zone_set_zone(chan->fds[0],zone));
+}
+
+static int rpt_play_tone(struct ast_channel *chan, int tone)
+{
+struct rpt_mix_member *m;
+
+	if (!IS_RPT_MIX(chan)) return(tone_zone_play_tone(chan->fds[0],tone));
+	m = chan->tech_pvt;
+	ast_mutex_lock(&m->mixer->lock);
+	m->tone = tone;
+	m->tonepos = 0;
+	ast_mutex_unlock(&m->mixer->lock);
+	return(0);
+}
+
+/* returns 1 once everything written to the channel has been sent */
+static int rpt_writeempty(struct ast_channel *chan)
+{
+int	flags;
+
+	if (IS_RPT_MIX(chan))
+		return(!rpt_mix_ring_avail(&((struct rpt_mix_member *) chan->tech_pvt)->txring));
+	flags = DAHDI_IOMUX_WRITEEMPTY | DAHDI_IOMUX_NOWAIT;
+	if (ioctl(chan->fds[0],DAHDI_IOMUX,&flags) == -1) return(1);
+	return((flags & DAHDI_IOMUX_WRITEEMPTY) != 0);
+}
+
+/* free a node's mixer, once all of its channels have been hung up */
+static void rpt_mix_free(struct rpt *myrpt)
+{
+struct rpt_mix_conf *c;
+int	j;
+
+	if (!myrpt->mixer) return;
+	/* all the channels are gone by now, so the thread is on its way out */
+	for(j = 0; myrpt->mixer->running && (j < 50); j++)
+		usleep(RPT_MIX_TICK * 1000);
+	if (myrpt->mixer->running) return;
+	while((c = myrpt->mixer->confs))
+	{
+		myrpt->mixer->confs = c->next;
+		ast_free(c);
+	}
+	ast_mutex_destroy(&myrpt->mixer->lock);
+	ast_free(myrpt->mixer);
+	myrpt->mixer = NULL;
+}
+
+static void rpt_mix_cleanup(void)
+{
+int	i;
+
+	for(i = 0; i < nrpts; i++)
+		rpt_mix_free(&rpt_vars[i]);
+}
+
 /*
 * Match a keyword in a list, and return index of string plus 1 if there was a match,* else return 0.
 * If param is passed in non-null, then it will be set to the first character past the match
@@ -6186,6 +7851,7 @@ char *this,*val;
 int	i,j,longestnode;
 struct ast_variable *vp;
 struct ast_config *cfg;
+struct rpt_nodedb *db,*olddb;
 char *strs[100];
 char s1[256];
 static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis","totena","totdis","skena","skdis",
@@ -6340,6 +8006,8 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 	if (val) rpt_vars[n].p.propagate_phonedtmf = ast_true(val);
 	val = (char *) ast_variable_retrieve(cfg,this,"linktolink");
 	if (val) rpt_vars[n].p.linktolink = ast_true(val);
+	val = (char *) ast_variable_retrieve(cfg,this,"usermixer");
+	if (val) rpt_vars[n].p.usermixer = ast_true(val);
 	val = (char *) ast_variable_retrieve(cfg,this,"nodes");
 	if (!val) val = NODES;
 	rpt_vars[n].p.nodes = val;
@@ -6652,6 +8320,13 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 	}
 
 	rpt_vars[n].longestnode = longestnode;
+
+	db = rpt_nodedb_build(ast_variable_browse(cfg, rpt_vars[n].p.nodes));
+	ast_mutex_lock(&nodedblock);
+	olddb = rpt_vars[n].localnodes;
+	rpt_vars[n].localnodes = db;
+	ast_mutex_unlock(&nodedblock);
+	if (olddb) ao2_ref(olddb,-1);
 		
 	/*
 	* For this repeater, Determine the length of the longest function 
@@ -6708,6 +8383,16 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 			vp = vp->next;
 		}
 	}
+	/* and compile them, the old ones went with the old cfg */
+	rpt_functrie_free(&rpt_vars[n]);
+	rpt_vars[n].functrie = rpt_functrie_build(ast_variable_browse(cfg, rpt_vars[n].p.functions));
+	rpt_vars[n].link_functrie = rpt_functrie_build(ast_variable_browse(cfg, rpt_vars[n].p.link_functions));
+	if (rpt_vars[n].p.phone_functions)
+		rpt_vars[n].phone_functrie = rpt_functrie_build(ast_variable_browse(cfg, rpt_vars[n].p.phone_functions));
+	if (rpt_vars[n].p.dphone_functions)
+		rpt_vars[n].dphone_functrie = rpt_functrie_build(ast_variable_browse(cfg, rpt_vars[n].p.dphone_functions));
+	if (rpt_vars[n].p.alt_functions)
+		rpt_vars[n].alt_functrie = rpt_functrie_build(ast_variable_browse(cfg, rpt_vars[n].p.alt_functions));
 	rpt_vars[n].macro_longest = 1;
 	vp = ast_variable_browse(cfg, rpt_vars[n].p.macro);
 	while(vp){
@@ -6815,6 +8500,8 @@ static char *cs_keywords[] = {"rptena","rptdis","apena","apdis","lnkena","lnkdis
 		vp = vp->next;
 	}
 	ast_mutex_unlock(&rpt_vars[n].lock);
+	/* telemetry may have changed, render it again */
+	rpt_telem_flush(&rpt_vars[n]);
 }
 
 /*
@@ -6875,7 +8562,7 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
 	int totalexecdcommands, dailyexecdcommands, hours, minutes, seconds;
 	int uptime;
 	long long totaltxtime;
-	struct	rpt_link *l;
+	struct	rpt_linksnap *snap;
 	char *listoflinks[MAX_STAT_LINKS];	
 	char *lastdtmfcommand,*parrot_ena;
 	char *tot_state, *ider_state, *patch_state;
@@ -6883,6 +8570,10 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
 	char *sch_ena, *input_signal, *called_number, *user_funs, *tail_type;
 	char *iconns;
 	struct rpt *myrpt;
+	int tmarmed,tmsecs;
+	unsigned long long tmfired,tmwakeups;
+	unsigned int tchits,tcmisses;
+	int tcentries,tcbytes;
 
 	static char *not_applicable = "N/A";
 
@@ -6900,42 +8591,55 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
 		if (!strcmp(argv[2],rpt_vars[i].name)){
 			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			uptime = (int)(now - starttime);
-			dailytxtime = myrpt->dailytxtime;
-			totaltxtime = myrpt->totaltxtime;
-			dailykeyups = myrpt->dailykeyups;
-			totalkeyups = myrpt->totalkeyups;
-			dailykerchunks = myrpt->dailykerchunks;
-			totalkerchunks = myrpt->totalkerchunks;
-			dailyexecdcommands = myrpt->dailyexecdcommands;
-			totalexecdcommands = myrpt->totalexecdcommands;
-			timeouts = myrpt->timeouts;
-
-			/* Traverse the list of connected nodes */
+			/* Traverse the list of connected nodes (no need to lock for that) */
 			reverse_patch_state = "DOWN";
 			numoflinks = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
+			snap = rpt_linksnap_get(myrpt);
+			for(j = 0; snap && (j < snap->n); j++){
 				if(numoflinks >= MAX_STAT_LINKS){
 					ast_log(LOG_NOTICE,
 					"maximum number of links exceeds %d in rpt_do_stats()!",MAX_STAT_LINKS);
 					break;
 				}
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
+				if (snap->ent[j].name[0] == '0'){ /* Skip '0' nodes */
 					reverse_patch_state = "UP";
-					l = l->next;
 					continue;
 				}
-				listoflinks[numoflinks] = ast_strdup(l->name);
+				listoflinks[numoflinks] = ast_strdup(snap->ent[j].name);
 				if(listoflinks[numoflinks] == NULL){
 					break;
 				}
 				else{
 					numoflinks++;
 				}
-				l = l->next;
 			}
+			rpt_linksnap_put(snap);
+
+			rpt_mutex_lock(&myrpt->lock); /* LOCK */
+			uptime = (int)(now - starttime);
+			dailytxtime = myrpt->dailytxtime;
+			totaltxtime = myrpt->totaltxtime;
+			dailykeyups = myrpt->dailykeyups;
+			totalkeyups = myrpt->totalkeyups;
+			dailykerchunks = myrpt->dailykerchunks;
+			totalkerchunks = myrpt->totalkerchunks;
+			dailyexecdcommands = myrpt->dailyexecdcommands;
+			totalexecdcommands = myrpt->totalexecdcommands;
+			timeouts = myrpt->timeouts;
+			ast_mutex_lock(&myrpt->twheel.lock);
+			tmarmed = myrpt->twheel.narmed;
+			tmfired = myrpt->twheel.nfired;
+			tmwakeups = myrpt->twheel.nwakeups;
+			tmsecs = (int)(now - myrpt->twheel.started);
+			ast_mutex_unlock(&myrpt->twheel.lock);
+			if (tmsecs < 1) tmsecs = 1;
+			ast_mutex_lock(&myrpt->telemcachelock);
+			tchits = myrpt->telemcachehits;
+			tcmisses = myrpt->telemcachemisses;
+			tcbytes = myrpt->telemcachebytes;
+			tcentries = myrpt->telemcacheentries;
+			ast_mutex_unlock(&myrpt->telemcachelock);
+
 
 			if(myrpt->keyed)
 				input_signal = "YES";
@@ -7077,6 +8781,14 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
                         ast_cli(fd, "Uptime...........................................: %02d:%02d:%02d\n",
                                 hours, minutes, uptime);
 
+			ast_cli(fd, "Timers running...................................: %d\n", tmarmed);
+			ast_cli(fd, "Timers fired.....................................: %llu (%.1f/sec)\n", tmfired,
+				(double) tmfired / tmsecs);
+			ast_cli(fd, "Timer wheel wakeups..............................: %llu (%.1f/sec)\n", tmwakeups,
+				(double) tmwakeups / tmsecs);
+			ast_cli(fd, "Telemetry cache hits/misses......................: %u/%u\n", tchits, tcmisses);
+			ast_cli(fd, "Telemetry cache entries..........................: %d (%d bytes)\n", tcentries, tcbytes);
+
 			ast_cli(fd, "Nodes currently connected to us..................: ");
                         if(!numoflinks){
   	                      ast_cli(fd,"<NONE>");
@@ -7125,59 +8837,31 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
 
 static int rpt_do_lstats(int fd, int argc, char *argv[])
 {
-	int i;
+	int i,j;
 	char *connstate;
 	struct rpt *myrpt;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	struct rpt_linksnap *snap;
+	struct rpt_linksnap_ent *e;
 	if(argc != 3)
 		return RESULT_SHOWUSAGE;
 
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
 	for(i = 0; i < nrpts; i++)
 	{
 		if (!strcmp(argv[2],rpt_vars[i].name)){
-			/* Make a copy of all stat variables while locked */
+			/* Work from the published link snapshot, no lock needed */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			/* Traverse the list of connected nodes */
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\n");
-					rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
-					return RESULT_FAILURE;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strlcpy(s->name, l->name, MAXNODESTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
-			rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
+			snap = rpt_linksnap_get(myrpt);
 			ast_cli(fd, "NODE      PEER                RECONNECTS  DIRECTION  CONNECT TIME        CONNECT STATE\n");
 			ast_cli(fd, "----      ----                ----------  ---------  ------------        -------------\n");
 
-			for(s = s_head.next; s != &s_head; s = s->next){
+			for(j = 0; snap && (j < snap->n); j++){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				long long connecttime;
 				char conntime[21];
+				e = &snap->ent[j];
+				if (e->name[0] == '0') /* Skip '0' nodes */
+					continue;
+				connecttime = rpt_linksnap_conntime(snap,e);
 				hours = connecttime/3600000L;
 				connecttime %= 3600000L;
 				minutes =  connecttime/60000L;
@@ -7187,21 +8871,14 @@ static int rpt_do_lstats(int fd, int argc, char *argv[])
 				snprintf(conntime, 20, "%02d:%02d:%02d:%02d",
 					hours, minutes, seconds, (int) connecttime);
 				conntime[20] = 0;
-				if(s->thisconnected)
+				if(e->thisconnected)
 					connstate  = "ESTABLISHED";
 				else
 					connstate = "CONNECTING";
 				ast_cli(fd, "%-10s%-20s%-12d%-11s%-20s%-20s\n",
-					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
+					e->name, e->peer, e->reconnects, (e->outbound)? "OUT":"IN", conntime, connstate);
 			}	
-			/* destroy our local link queue */
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
-			}			
+			rpt_linksnap_put(snap);
 			return RESULT_SUCCESS;
 		}
 	}
@@ -7215,16 +8892,11 @@ static int rpt_do_xnode(int fd, int argc, char *argv[])
 	struct rpt *myrpt;
 	struct ast_var_t *newvariable;
 	char *connstate;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	struct rpt_linksnap *snap;
+	struct rpt_linksnap_ent *e;
 	if(argc != 3)
 		return RESULT_SHOWUSAGE;
 
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
 
 	char *parrot_ena, *sys_ena, *tot_ena, *link_ena, *patch_ena, *patch_state;
 	char *sch_ena, *user_funs, *tail_type, *iconns, *tot_state, *ider_state, *tel_mode; 
@@ -7331,67 +9003,39 @@ static int rpt_do_xnode(int fd, int argc, char *argv[])
 			}
 
 
-//### GET CONNECTED NODE INFO ####################
-			// Traverse the list of connected nodes 
-
-			__mklinklist(myrpt,NULL,lbuf,0);
-
-			j = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\n");
-					rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-					return RESULT_FAILURE;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strlcpy(s->name, l->name, MAXNODESTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
 			rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-			for(s = s_head.next; s != &s_head; s = s->next){
+
+//### GET CONNECTED NODE INFO ####################
+			// Traverse the list of connected nodes, from the published
+			// snapshot so no lock is needed
+			snap = rpt_linksnap_get(myrpt);
+			rpt_linksnap_mklinklist(snap,lbuf,0);
+			for(j = 0; snap && (j < snap->n); j++){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				long long connecttime;
 				char conntime[21];
+				e = &snap->ent[j];
+				if (e->name[0] == '0') // Skip '0' nodes 
+					continue;
+				connecttime = rpt_linksnap_conntime(snap,e);
 				hours = connecttime/3600000L;
 				connecttime %= 3600000L;
 				minutes = connecttime/60000L;
 				connecttime %= 60000L;
 				seconds = (int)  connecttime/1000L;
-				connecttime %= 1000;
+				connecttime %= 1000L;
 				snprintf(conntime, 20, "%02d:%02d:%02d",
 					hours, minutes, seconds);
 				conntime[20] = 0;
-				if(s->thisconnected)
+				if(e->thisconnected)
 					connstate  = "ESTABLISHED";
 				else
 					connstate = "CONNECTING";
 				ast_cli(fd, "%-10s%-20s%-12d%-11s%-20s%-20s~",
-					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
+					e->name, e->peer, e->reconnects, (e->outbound)? "OUT":"IN", conntime, connstate);
 			}	
+			rpt_linksnap_put(snap);
 			ast_cli(fd,"\n\n");
-			// destroy our local link queue 
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
-			}	
 
 //### GET ALL LINKED NODES INFO ####################
 			/* parse em */
@@ -7452,6 +9096,7 @@ static int rpt_do_nodes(int fd, int argc, char *argv[])
 	int i,j,ns;
 	char lbuf[MAXLINKLIST],*strs[MAXLINKLIST];
 	struct rpt *myrpt;
+	struct rpt_linksnap *snap;
 	if(argc != 3)
 		return RESULT_SHOWUSAGE;
 
@@ -7460,9 +9105,9 @@ static int rpt_do_nodes(int fd, int argc, char *argv[])
 		if (!strcmp(argv[2],rpt_vars[i].name)){
 			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			__mklinklist(myrpt,NULL,lbuf,0);
-			rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
+			snap = rpt_linksnap_get(myrpt);
+			rpt_linksnap_mklinklist(snap,lbuf,0);
+			rpt_linksnap_put(snap);
 			/* parse em */
 			ns = finddelim(lbuf,strs,MAXLINKLIST);
 			/* sort em */
@@ -8309,9 +9954,9 @@ static int morse_cat(char *str, int freq, int duration)
 }
 
 
-//## Convert string into morse code
+//## Convert string into a playtones string of morse code, caller frees it
 
-static int send_morse(struct ast_channel *chan, char *string, int speed, int freq, int amplitude)
+static char *morse_str(char *string, int speed, int freq)
 {
 
 static struct morse_bits mbits[] = {
@@ -8390,9 +10035,9 @@ static struct morse_bits mbits[] = {
 	res = 0;
 
 
-	str = ast_malloc(12*8*strlen(string)); /* 12 chrs/element max, 8 elements/letter max */
+	str = ast_malloc(12*8*strlen(string) + 1); /* 12 chrs/element max, 8 elements/letter max */
 	if(!str)
-		return -1;
+		return NULL;
 	str[0] = '\0';
 	
 	/* Approximate the dot time from the speed arg. */
@@ -8456,26 +10101,58 @@ static struct morse_bits mbits[] = {
 
 	}
 	
+	if(res){
+		ast_free(str);
+		return NULL;
+	}
+	if(debug > 4)
+		ast_log(LOG_NOTICE,"Morse string: %s\n", str);
+	return str;
+}
+
+//## Send string as morse code
+
+static int send_morse(struct ast_channel *chan, char *string, int speed, int freq, int amplitude)
+{
+	int res;
+	char *str;
+
+	res = 0;
+	str = morse_str(string, speed, freq);
+	if(!str)
+		return -1;
+
 	/* Wait for all the characters to be sent */
 
-	if(!res){
-		if(debug > 4)
-			ast_log(LOG_NOTICE,"Morse string: %s\n", str);
-		ast_safe_sleep(chan,100);
-		ast_playtones_start(chan, amplitude, str, 0);
-		while(chan->generatordata){
-			if(ast_safe_sleep(chan, 20)){
-				res = -1;
-				break;
-			}
-		}		
-				 
+	ast_safe_sleep(chan,100);
+	ast_playtones_start(chan, amplitude, str, 0);
+	while(chan->generatordata){
+		if(ast_safe_sleep(chan, 20)){
+			res = -1;
+			break;
+		}
 	}
-	if(str)
-		ast_free(str);
+	ast_free(str);
 	return res;
 }
 
+/*
+* Wait for the zaptel driver to physically write the tone blocks to the hardware
+*/
+
+static int wait_tone_written(struct ast_channel *chan)
+{
+	int i;
+
+	for(i = 0; i < 20 ; i++){
+		if(rpt_writeempty(chan))
+			break;
+		if( ast_safe_sleep(chan, 50))
+			return -1;
+	}
+	return 0;
+}
+
 //# Send telemetry tones
 
 static int send_tone_telemetry(struct ast_channel *chan, char *tonestring)
@@ -8486,8 +10163,6 @@ static int send_tone_telemetry(struct ast_channel *chan, char *tonestring)
 	int duration;
 	int amplitude;
 	int res;
-	int i;
-	int flags;
 	
 	res = 0;
 
@@ -8516,20 +10191,8 @@ static int send_tone_telemetry(struct ast_channel *chan, char *tonestring)
 
 	ast_stopstream(chan);
 
-	/*
-	* Wait for the zaptel driver to physically write the tone blocks to the hardware
-	*/
-
-	for(i = 0; i < 20 ; i++){
-		flags =  DAHDI_IOMUX_WRITEEMPTY | DAHDI_IOMUX_NOWAIT; 
-		res = ioctl(chan->fds[0], DAHDI_IOMUX, &flags);
-		if(flags & DAHDI_IOMUX_WRITEEMPTY)
-			break;
-		if( ast_safe_sleep(chan, 50)){
-			res = -1;
-			break;
-		}
-	}
+	if(wait_tone_written(chan))
+		res = -1;
 		
 	return res;
 		
@@ -8627,10 +10290,385 @@ char	*val,fname[300],str[100];
 	return res;
 }
 
+/*
+ * Telemetry render cache.  Telemetry entries (IDs, tail messages,
+ * courtesy tones) get played many times an hour, so the first time one
+ * is played it is rendered into the channel's audio format and kept, and
+ * after that it is played straight out of memory by the rpt_telem_pump
+ * generator, with no file I/O or tone math.  Each node has its own cache,
+ * keyed by entry, format and language, which load_rpt_vars() flushes.
+ */
+
+#define	TELEM_CACHE_MAX (2 * 1024 * 1024)	/* bytes of audio cached per node */
+#define	TELEM_PUMP_MAX 1024			/* max samples per generator call */
+
+struct rpt_telem_render {
+	struct rpt_telem_render *next;
+	int format;			/* AST_FORMAT_SLINEAR or AST_FORMAT_ULAW */
+	int samples;
+	int bytes;
+	void *data;
+	char *language;
+	char entry[0];			/* followed by language */
+};
+
+struct rpt_telem_buf {
+	short *s;
+	int n;
+	int alloc;
+};
+
+struct rpt_telem_pump {
+	struct rpt_telem_render *r;
+	int pos;
+	int origwfmt;
+	struct ast_frame f;
+	char buf[AST_FRIENDLY_OFFSET + (TELEM_PUMP_MAX * 2)];
+};
+
+static void rpt_telem_destructor(void *obj)
+{
+struct rpt_telem_render *r = obj;
+
+	if (r->data) ast_free(r->data);
+}
+
+static int rpt_telem_grow(struct rpt_telem_buf *b, int n)
+{
+short	*s;
+int	alloc;
+
+	if (((b->n + n) * sizeof(short)) > TELEM_CACHE_MAX) return(-1);
+	if ((b->n + n) <= b->alloc) return(0);
+	alloc = (b->alloc) ? b->alloc : 8000;
+	while(alloc < (b->n + n)) alloc <<= 1;
+	s = ast_realloc(b->s,alloc * sizeof(short));
+	if (!s) return(-1);
+	b->s = s;
+	b->alloc = alloc;
+	return(0);
+}
+
+/* same waveform as the core tone generators (ast_tonepair_start() and
+   ast_playtones_start()), rounded up to whole 20ms frames like theirs */
+static int rpt_telem_tone(struct rpt_telem_buf *b, int f1, int f2, int duration, int amplitude)
+{
+int	i,n,fac1,fac2,v1_1,v2_1,v3_1,v1_2,v2_2,v3_2;
+short	*sp;
+
+	if (duration <= 0) return(-1);
+	n = (((duration * 8) + 159) / 160) * 160;
+	if (rpt_telem_grow(b,n)) return(-1);
+	fac1 = 2.0 * cos(2.0 * M_PI * (f1 / 8000.0)) * 32768.0;
+	v1_1 = 0;
+	v2_1 = sin(-4.0 * M_PI * (f1 / 8000.0)) * amplitude;
+	v3_1 = sin(-2.0 * M_PI * (f1 / 8000.0)) * amplitude;
+	fac2 = 2.0 * cos(2.0 * M_PI * (f2 / 8000.0)) * 32768.0;
+	v1_2 = 0;
+	v2_2 = sin(-4.0 * M_PI * (f2 / 8000.0)) * amplitude;
+	v3_2 = sin(-2.0 * M_PI * (f2 / 8000.0)) * amplitude;
+	sp = b->s + b->n;
+	for(i = 0; i < n; i++)
+	{
+		v1_1 = v2_1;
+		v2_1 = v3_1;
+		v3_1 = (fac1 * v2_1 >> 15) - v1_1;
+		v1_2 = v2_2;
+		v2_2 = v3_2;
+		v3_2 = (fac2 * v2_2 >> 15) - v1_2;
+		*sp++ = v3_1 + v3_2;
+	}
+	b->n += n;
+	return(0);
+}
+
+/* what send_morse() plays */
+static int rpt_telem_render_morse(struct rpt_telem_buf *b, char *string, int speed, int freq, int amplitude)
+{
+char	*str,*cp;
+int	f,duration,res;
+
+	str = morse_str(string,speed,freq);
+	if (!str) return(-1);
+	res = (*str) ? 0 : -1;
+	for(cp = str; cp && (!res); cp = strchr(cp,','))
+	{
+		if (*cp == ',') cp++;
+		if (sscanf(cp,"!%d/%d",&f,&duration) != 2)
+		{
+			res = -1;
+			break;
+		}
+		res = rpt_telem_tone(b,f,0,duration,amplitude);
+	}
+	ast_free(str);
+	return(res);
+}
+
+/* what send_tone_telemetry() plays */
+static int rpt_telem_render_tones(struct rpt_telem_buf *b, char *tonestring)
+{
+char	*cp;
+int	f1,f2,duration,amplitude;
+
+	for(cp = tonestring; (cp = strchr(cp,'(')); cp++)
+	{
+		if (sscanf(cp,"(%d,%d,%d,%d",&f1,&f2,&duration,&amplitude) != 4)
+			break;
+		if (amplitude < 1) amplitude = 8192;  /* same as ast_tonepair_start() */
+		if (rpt_telem_tone(b,f1,f2,duration,amplitude)) return(-1);
+	}
+	if (!b->n) return(-1);
+	/* the 100ms of silence send_tone_telemetry() puts at the end */
+	return(rpt_telem_tone(b,0,0,100,0));
+}
+
+/* what sayfile() plays, decoded to slinear */
+static int rpt_telem_render_file(struct ast_channel *chan, char *fname, struct rpt_telem_buf *b)
+{
+struct ast_filestream *fs;
+struct ast_trans_pvt *trans;
+struct ast_frame *f,*f1;
+int	res,fmt;
+
+	fs = ast_openstream(chan,fname,chan->language);
+	if (!fs) return(-1);
+	trans = NULL;
+	res = fmt = 0;
+	while((f = ast_readframe(fs)))
+	{
+		if (f->frametype != AST_FRAME_VOICE)
+		{
+			ast_frfree(f);
+			continue;
+		}
+		if (f->subclass != AST_FORMAT_SLINEAR)
+		{
+			if (f->subclass != fmt)
+			{
+				if (trans) ast_translator_free_path(trans);
+				fmt = f->subclass;
+				trans = ast_translator_build_path(AST_FORMAT_SLINEAR,fmt);
+				if (!trans)
+				{
+					ast_frfree(f);
+					res = -1;
+					break;
+				}
+			}
+			f1 = ast_translate(trans,f,1);
+			if (!f1) continue;
+		}
+		else f1 = f;
+		if (rpt_telem_grow(b,f1->datalen / 2)) res = -1;
+		else
+		{
+			memcpy(b->s + b->n,AST_FRAME_DATAP(f1),(f1->datalen / 2) * sizeof(short));
+			b->n += f1->datalen / 2;
+		}
+		ast_frfree(f1);
+		if (res) break;
+	}
+	if (trans) ast_translator_free_path(trans);
+	ast_stopstream(chan);
+	if (!b->n) res = -1;
+	return(res);
+}
+
+static struct rpt_telem_render *rpt_telem_render(struct rpt *myrpt, struct ast_channel *chan,
+	char *entry, int format, int morsespeed, int morsefreq, int morseampl, int morseidfreq, int morseidampl)
+{
+struct rpt_telem_render *r;
+struct rpt_telem_buf b;
+unsigned char *up;
+int	i,res;
+char	c;
+
+	memset(&b,0,sizeof(b));
+	if (entry[0] == '|')
+	{
+		c = toupper(entry[1]);
+		if (c == 'I')
+			res = rpt_telem_render_morse(&b,entry + 2,morsespeed,morseidfreq,morseidampl);
+		else if (c == 'M')
+			res = rpt_telem_render_morse(&b,entry + 2,morsespeed,morsefreq,morseampl);
+		else if (c == 'T')
+			res = rpt_telem_render_tones(&b,entry + 2);
+		else
+			res = -1;
+	}
+	else res = rpt_telem_render_file(chan,entry,&b);
+	if (res)
+	{
+		if (b.s) ast_free(b.s);
+		return(NULL);
+	}
+	r = ao2_alloc(sizeof(*r) + strlen(entry) + strlen(chan->language) + 2,rpt_telem_destructor);
+	if (!r)
+	{
+		ast_free(b.s);
+		return(NULL);
+	}
+	r->format = format;
+	r->samples = b.n;
+	if (format == AST_FORMAT_ULAW)
+	{
+		r->bytes = b.n;
+		r->data = up = ast_malloc(b.n);
+		if (up)
+		{
+			for(i = 0; i < b.n; i++) *up++ = AST_LIN2MU(b.s[i]);
+		}
+		ast_free(b.s);
+	}
+	else
+	{
+		r->bytes = b.n * sizeof(short);
+		r->data = b.s;
+	}
+	if (!r->data)
+	{
+		ao2_ref(r,-1);
+		return(NULL);
+	}
+	strcpy(r->entry,entry);
+	r->language = r->entry + strlen(entry) + 1;
+	strcpy(r->language,chan->language);
+	return(r);
+}
+
+/* find entry in the node's cache (or render and add it), returns a reference */
+static struct rpt_telem_render *rpt_telem_get(struct rpt *myrpt, struct ast_channel *chan,
+	char *entry, int morsespeed, int morsefreq, int morseampl, int morseidfreq, int morseidampl)
+{
+struct rpt_telem_render *r,*r1;
+int	format;
+
+	format = (chan->writeformat == AST_FORMAT_ULAW) ? AST_FORMAT_ULAW : AST_FORMAT_SLINEAR;
+	ast_mutex_lock(&myrpt->telemcachelock);
+	for(r = myrpt->telemcache; r; r = r->next)
+	{
+		if ((r->format == format) && (!strcmp(r->entry,entry)) &&
+			(!strcmp(r->language,chan->language))) break;
+	}
+	if (r)
+	{
+		myrpt->telemcachehits++;
+		ao2_ref(r,1);
+		ast_mutex_unlock(&myrpt->telemcachelock);
+		return(r);
+	}
+	myrpt->telemcachemisses++;
+	ast_mutex_unlock(&myrpt->telemcachelock);
+	r = rpt_telem_render(myrpt,chan,entry,format,morsespeed,morsefreq,morseampl,morseidfreq,morseidampl);
+	if (!r) return(NULL);
+	ast_mutex_lock(&myrpt->telemcachelock);
+	/* someone else may have rendered it while we were */
+	for(r1 = myrpt->telemcache; r1; r1 = r1->next)
+	{
+		if ((r1->format == format) && (!strcmp(r1->entry,entry)) &&
+			(!strcmp(r1->language,chan->language))) break;
+	}
+	/* if it doesn't fit, it gets played this once and thrown away */
+	if ((!r1) && ((myrpt->telemcachebytes + r->bytes) <= TELEM_CACHE_MAX))
+	{
+		ao2_ref(r,1);
+		r->next = myrpt->telemcache;
+		myrpt->telemcache = r;
+		myrpt->telemcachebytes += r->bytes;
+		myrpt->telemcacheentries++;
+	}
+	ast_mutex_unlock(&myrpt->telemcachelock);
+	return(r);
+}
+
+static void rpt_telem_flush(struct rpt *myrpt)
+{
+struct rpt_telem_render *r;
+
+	ast_mutex_lock(&myrpt->telemcachelock);
+	while((r = myrpt->telemcache))
+	{
+		myrpt->telemcache = r->next;
+		ao2_ref(r,-1);
+	}
+	myrpt->telemcachebytes = 0;
+	myrpt->telemcacheentries = 0;
+	ast_mutex_unlock(&myrpt->telemcachelock);
+}
+
+static void rpt_telem_pump_release(struct ast_channel *chan, void *data)
+{
+struct rpt_telem_pump *p = data;
+
+	if (chan) ast_set_write_format(chan,p->origwfmt);
+	ao2_ref(p->r,-1);
+	ast_free(p);
+}
+
+static void *rpt_telem_pump_alloc(struct ast_channel *chan, void *params)
+{
+struct rpt_telem_pump *p;
+
+	if (!(p = ast_calloc(1,sizeof(*p))))
+		return NULL;
+	p->r = params;
+	ao2_ref(p->r,1);
+	p->origwfmt = chan->writeformat;
+	if (ast_set_write_format(chan,p->r->format))
+	{
+		ast_log(LOG_WARNING,"Unable to set write format on %s for telemetry\n",chan->name);
+		rpt_telem_pump_release(NULL,p);
+		return NULL;
+	}
+	return p;
+}
+
+static int rpt_telem_pump_generate(struct ast_channel *chan, void *data, int len, int samples)
+{
+struct rpt_telem_pump *p = data;
+int	n,bps;
+
+	n = p->r->samples - p->pos;
+	if (n <= 0) return -1;
+	if (samples > n) samples = n;
+	if (samples > TELEM_PUMP_MAX) samples = TELEM_PUMP_MAX;
+	bps = (p->r->format == AST_FORMAT_ULAW) ? 1 : 2;
+	memcpy(p->buf + AST_FRIENDLY_OFFSET,(char *)p->r->data + (p->pos * bps),samples * bps);
+	memset(&p->f,0,sizeof(p->f));
+	p->f.frametype = AST_FRAME_VOICE;
+	p->f.subclass = p->r->format;
+	p->f.datalen = samples * bps;
+	p->f.samples = samples;
+	p->f.offset = AST_FRIENDLY_OFFSET;
+	AST_FRAME_DATA(p->f) = p->buf + AST_FRIENDLY_OFFSET;
+	ast_write(chan,&p->f);
+	p->pos += samples;
+	if (p->pos >= p->r->samples) return -1;
+	return 0;
+}
+
+static struct ast_generator rpt_telem_pump = {
+	alloc: rpt_telem_pump_alloc,
+	release: rpt_telem_pump_release,
+	generate: rpt_telem_pump_generate,
+};
+
+static int rpt_telem_play(struct ast_channel *chan, struct rpt_telem_render *r)
+{
+	if (ast_activate_generator(chan,&rpt_telem_pump,r)) return(-1);
+	while(chan->generatordata)
+	{
+		if (ast_safe_sleep(chan,20)) return(-1);
+	}
+	return(0);
+}
+
 static int telem_any(struct rpt *myrpt,struct ast_channel *chan, char *entry)
 {
 	int res;
 	char c;
+	struct rpt_telem_render *r;
 	
 	int morsespeed;
 	int morsefreq;
@@ -8646,6 +10684,20 @@ static int telem_any(struct rpt *myrpt,struct ast_channel *chan, char *entry)
 	morseidampl = retrieve_astcfgint(myrpt, myrpt->p.morse, "idamplitude", 200, 8192, 2048);
 	morseidfreq = retrieve_astcfgint(myrpt, myrpt->p.morse, "idfrequency", 300, 3000, 330);	
 	
+	/* Play it from the render cache if we can */
+
+	r = rpt_telem_get(myrpt, chan, entry, morsespeed, morsefreq, morseampl, morseidfreq, morseidampl);
+	if(r){
+		c = (entry[0] == '|') ? toupper(entry[1]) : 0;
+		if((c == 'I') || (c == 'M'))
+			ast_safe_sleep(chan,100);
+		res = rpt_telem_play(chan, r);
+		ao2_ref(r, -1);
+		if((!res) && (c == 'T'))
+			res = wait_tone_written(chan);
+		return res;
+	}
+
 	/* Is it a file, or a tone sequence? */
 			
 	if(entry[0] == '|'){
@@ -9160,15 +11212,18 @@ struct	tm localtm;
  *  Many of the items here seem to have been bolted onto this routine as it app_rpt has evolved.
  */
  
-static void *rpt_tele_thread(void *this)
+/*
+ * Play one telemetry item on mychannel, which belongs to the telemetry
+ * worker running it (see rpt_tele_worker()).  Removes mytele from the
+ * queue and frees it when done.
+ */
+static void rpt_tele_run(struct rpt_tele *mytele, struct ast_channel *mychannel)
 {
 struct dahdi_confinfo ci;  /* conference info */
 int	res = 0,haslink,hastx,hasremote,imdone = 0, unkeys_queued, x;
-struct	rpt_tele *mytele = (struct rpt_tele *)this;
 struct  rpt_tele *tlist;
 struct	rpt *myrpt;
 struct	rpt_link *l,*l1,linkbase;
-struct	ast_channel *mychannel;
 int id_malloc, vmajor, vminor, m;
 char *p,*ct,*ct_copy,*ident, *nodename;
 time_t t,t1,was;
@@ -9204,7 +11259,7 @@ struct	mdcparams *mdcp;
 	    ast_log(LOG_NOTICE,"Telemetry thread aborted at line %d, mode: %d\n",__LINE__, mytele->mode); /*@@@@@@@@@@@*/
 	    rpt_mutex_unlock(&myrpt->lock);
 	    ast_free(mytele);
-	    pthread_exit(NULL);
+	    return;
 	}
 
 	if (myrpt->p.ident){
@@ -9219,7 +11274,7 @@ struct	mdcparams *mdcp;
                 	rpt_mutex_unlock(&myrpt->lock);
 			ast_free(nodename);
                 	ast_free(mytele);
-                	pthread_exit(NULL);
+                	return;
         	}
 		else{
 			id_malloc = 1;
@@ -9234,28 +11289,7 @@ struct	mdcparams *mdcp;
 		
 
 
-	/* allocate a pseudo-channel thru asterisk */
-	mychannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
-	if (!mychannel)
-	{
-		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
-		rpt_mutex_lock(&myrpt->lock);
-		remque((struct qelem *)mytele);
-		ast_log(LOG_NOTICE,"Telemetry thread aborted at line %d, mode: %d\n",__LINE__, mytele->mode); /*@@@@@@@@@@@*/
-		rpt_mutex_unlock(&myrpt->lock);
-		ast_free(nodename);
-		if(id_malloc)
-			ast_free(ident);
-		ast_free(mytele);		
-		pthread_exit(NULL);
-	}
-#ifdef	AST_CDR_FLAG_POST_DISABLED
-	if (mychannel->cdr) 
-		ast_set_flag(mychannel->cdr,AST_CDR_FLAG_POST_DISABLED);
-#endif
-	ast_answer(mychannel);
 	rpt_mutex_lock(&myrpt->lock);
-	mytele->chan = mychannel;
 	while (myrpt->active_telem && 
 	    ((myrpt->active_telem->mode == PAGE) || (
 		myrpt->active_telem->mode == MDC1200)))
@@ -9292,7 +11326,7 @@ struct	mdcparams *mdcp;
 		myrpt->conf : myrpt->teleconf);
 	ci.confmode = DAHDI_CONF_CONFANN;
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(mychannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_lock(&myrpt->lock);
@@ -9304,8 +11338,7 @@ struct	mdcparams *mdcp;
 		if(id_malloc)
 			ast_free(ident);
 		ast_free(mytele);		
-		ast_hangup(mychannel);
-		pthread_exit(NULL);
+		return;
 	}
 	ast_stopstream(mychannel);
 	res = 0;
@@ -9344,7 +11377,7 @@ struct	mdcparams *mdcp;
 
 	    case IDTALKOVER:
 		if(debug >= 6)
-			ast_log(LOG_NOTICE,"Tracepoint IDTALKOVER: in rpt_tele_thread()\n");
+			ast_log(LOG_NOTICE,"Tracepoint IDTALKOVER: in rpt_tele_run()\n");
 	    	p = (char *) ast_variable_retrieve(myrpt->cfg, nodename, "idtalkover");
 	    	if(p)
 			res = telem_any(myrpt,mychannel, p); 
@@ -9638,7 +11671,7 @@ treataslocal:
 			ci.confno = myrpt->conf;
 			ci.confmode = DAHDI_CONF_CONFANN;
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(mychannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 				rpt_mutex_lock(&myrpt->lock);
@@ -9650,8 +11683,7 @@ treataslocal:
 				if(id_malloc)
 					ast_free(ident);
 				ast_free(mytele);		
-				ast_hangup(mychannel);
-				pthread_exit(NULL);
+				return;
 			}
 			if((ct = (char *) ast_variable_retrieve(myrpt->cfg, nodename, "remotect"))){ /* Unlinked Courtesy Tone */
 				ast_safe_sleep(mychannel,200);
@@ -9680,7 +11712,7 @@ treataslocal:
 			ci.confno = myrpt->txconf;
 			ci.confmode = DAHDI_CONF_CONFANN;
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(mychannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 				rpt_mutex_lock(&myrpt->lock);
@@ -9692,8 +11724,7 @@ treataslocal:
 				if(id_malloc)
 					ast_free(ident);
 				ast_free(mytele);		
-				ast_hangup(mychannel);
-				pthread_exit(NULL);
+				return;
 			}
 			sprintf(mystr,"%04x",myrpt->lastunit);
 			myrpt->lastunit = 0;
@@ -10026,8 +12057,10 @@ treataslocal:
 			}
 			if (myrpt->iofd < 0)
 			{
+				/* a mixer channel has no events to flush, and no hook */
 				i = DAHDI_FLUSH_EVENT;
-				if (ioctl(myrpt->zaptxchannel->fds[0],DAHDI_FLUSH,&i) == -1)
+				if ((!IS_RPT_MIX(myrpt->zaptxchannel)) &&
+				    (ioctl(myrpt->zaptxchannel->fds[0],DAHDI_FLUSH,&i) == -1))
 				{
 					myrpt->remsetting = 0;
 					ast_mutex_unlock(&myrpt->remlock);
@@ -10035,7 +12068,9 @@ treataslocal:
 					res = -1;
 					break;
 				}
-				if (ioctl(myrpt->zaprxchannel->fds[0],DAHDI_GET_PARAMS,&par) == -1)
+				memset(&par,0,sizeof(par));
+				if ((!IS_RPT_MIX(myrpt->zaprxchannel)) &&
+				    (ioctl(myrpt->zaprxchannel->fds[0],DAHDI_GET_PARAMS,&par) == -1))
 				{
 					myrpt->remsetting = 0;
 					ast_mutex_unlock(&myrpt->remlock);
@@ -10382,8 +12417,7 @@ treataslocal:
 				if(id_malloc)
 					ast_free(ident);
 				ast_free(mytele);		
-				ast_hangup(mychannel);
-				pthread_exit(NULL);
+				return;
 			}
 			memcpy(l1,l,sizeof(struct rpt_link));
 			l1->next = l1->prev = NULL;
@@ -10841,24 +12875,174 @@ treataslocal:
 	rpt_mutex_lock(&myrpt->lock);
 	if (mytele->mode == TAILMSG)
 	{
-		if (!res)
+		if (!res)
+		{
+			myrpt->tailmessagen++;
+			if(myrpt->tailmessagen >= myrpt->p.tailmessagemax) myrpt->tailmessagen = 0;
+		}
+		else
+		{
+			rpt_timer_arm(&myrpt->twheel,&myrpt->tmsgtimer,myrpt->p.tailsquashedtime);
+		}
+	}
+	remque((struct qelem *)mytele);
+	myrpt->active_telem = NULL;
+	rpt_mutex_unlock(&myrpt->lock);
+	ast_free(nodename);
+	if(id_malloc)
+		ast_free(ident);
+	ast_free(mytele);		
+	myrpt->noduck=0;
+}
+
+static void send_tele_link(struct rpt *myrpt,char *cmd);
+
+/* 
+ *  More repeater telemetry routines.
+ */
+ 
+/*
+ * Telemetry workers.  Instead of a thread and a pseudo channel for every
+ * telemetry item, each node has up to TELEPOOL_THREADS workers that keep
+ * their pseudo channel open and take items off myrpt->tele.  The queue
+ * itself (and so flush_telem() and friends) works as before: items are
+ * added by rpt_telemetry() and stay on it until they are done.
+ *
+ * Courtesy tones sit on their worker until the unkey timer runs out, so
+ * they have workers of their own (waiters), started as needed so that
+ * each one waiting has one, and never hold up the rest of the telemetry.
+ */
+
+/* items that wait for the unkey timer in rpt_tele_run() */
+static int rpt_tele_waits(int mode)
+{
+	return((mode == UNKEY) || (mode == LINKUNKEY) || (mode == LOCUNKEY));
+}
+
+/* items that don't wait for their turn in rpt_tele_run() */
+static int rpt_tele_unordered(int mode)
+{
+	return((mode == SETREMOTE) || (mode == UNKEY) || (mode == LINKUNKEY) ||
+		(mode == LOCUNKEY) || (mode == COMPLETE) || (mode == REMGO) ||
+		(mode == REMCOMPLETE));
+}
+
+/* pick the next item for a worker, or for a waiter if waiter is set, must
+   be called locked.  Items that don't wait for their turn (courtesy tones
+   and such) go first, oldest first, then the oldest item when it is its
+   turn, same as rpt_tele_run() decides it */
+static struct rpt_tele *rpt_tele_next(struct rpt *myrpt, int waiter)
+{
+struct rpt_tele *t;
+
+	for(t = myrpt->tele.prev; t != &myrpt->tele; t = t->prev)
+	{
+		if ((!t->running) && rpt_tele_unordered(t->mode) &&
+		    ((rpt_tele_waits(t->mode) != 0) == (waiter != 0))) return(t);
+	}
+	if (waiter) return(NULL);
+	t = myrpt->tele.prev;
+	if ((t != &myrpt->tele) && (!t->running) && (!myrpt->active_telem)) return(t);
+	return(NULL);
+}
+
+static struct ast_channel *rpt_tele_chan(struct rpt *myrpt)
+{
+struct ast_channel *chan;
+
+	chan = rpt_request_pseudo(myrpt);
+	if (!chan) return(NULL);
+#ifdef	AST_CDR_FLAG_POST_DISABLED
+	if (chan->cdr)
+		ast_set_flag(chan->cdr,AST_CDR_FLAG_POST_DISABLED);
+#endif
+	ast_answer(chan);
+	return(chan);
+}
+
+/* get the channel ready for the next item, returns -1 if it can't be */
+static int rpt_tele_chan_reset(struct rpt *myrpt, struct ast_channel *chan)
+{
+struct dahdi_confinfo ci;
+
+	if (ast_check_hangup(chan)) return(-1);
+	/* the node may have switched mixers on restart */
+	if ((IS_RPT_MIX(chan) != 0) != (myrpt->usermixer != 0)) return(-1);
+	ast_deactivate_generator(chan);
+	ast_stopstream(chan);
+	ci.chan = 0;
+	ci.confno = 0;
+	ci.confmode = DAHDI_CONF_NORMAL;
+	if (rpt_setconf(chan,&ci) == -1) return(-1);
+	return(0);
+}
+
+static void rpt_tele_work(struct rpt *myrpt, int waiter)
+{
+struct rpt_telepool *pool = &myrpt->telepool;
+struct rpt_tele *mytele;
+struct ast_channel *mychannel = NULL;
+unsigned int seq;
+
+	/* the pool lock is never held while taking myrpt->lock, since
+	   rpt_telemetry() may be called with myrpt->lock held */
+	ast_mutex_lock(&pool->lock);
+	while(!pool->stop)
+	{
+		seq = pool->seq;
+		ast_mutex_unlock(&pool->lock);
+		if (!mychannel) mychannel = rpt_tele_chan(myrpt);
+		rpt_mutex_lock(&myrpt->lock);
+		mytele = rpt_tele_next(myrpt,waiter);
+		if (mytele)
 		{
-			myrpt->tailmessagen++;
-			if(myrpt->tailmessagen >= myrpt->p.tailmessagemax) myrpt->tailmessagen = 0;
+			mytele->running = 1;
+			mytele->chan = mychannel;
+			mytele->threadid = pthread_self();
+		}
+		rpt_mutex_unlock(&myrpt->lock);
+		if (!mytele)
+		{
+			ast_mutex_lock(&pool->lock);
+			if (waiter) pool->idle_waiters++;
+			while((pool->seq == seq) && (!pool->stop))
+				ast_cond_wait(&pool->cond,&pool->lock);
+			if (waiter) pool->idle_waiters--;
+			continue;
+		}
+		if (waiter)
+		{
+			ast_mutex_lock(&pool->lock);
+			if (pool->pending_waits) pool->pending_waits--;
+			ast_mutex_unlock(&pool->lock);
+		}
+		if (!mychannel)
+		{
+			fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
+			rpt_mutex_lock(&myrpt->lock);
+			remque((struct qelem *)mytele);
+			ast_log(LOG_NOTICE,"Telemetry thread aborted at line %d, mode: %d\n",__LINE__, mytele->mode); /*@@@@@@@@@@@*/
+			rpt_mutex_unlock(&myrpt->lock);
+			ast_free(mytele);
 		}
 		else
 		{
-			myrpt->tmsgtimer = myrpt->p.tailsquashedtime;
+			/* it was killed before it got a channel */
+			if (mytele->killed) ast_softhangup(mychannel,AST_SOFTHANGUP_DEV);
+			rpt_tele_run(mytele,mychannel);
+			if (rpt_tele_chan_reset(myrpt,mychannel))
+			{
+				ast_hangup(mychannel);
+				mychannel = NULL;
+			}
 		}
+		ast_mutex_lock(&pool->lock);
+		/* whatever was waiting for that one can go now */
+		pool->seq++;
+		ast_cond_broadcast(&pool->cond);
 	}
-	remque((struct qelem *)mytele);
-	myrpt->active_telem = NULL;
-	rpt_mutex_unlock(&myrpt->lock);
-	ast_free(nodename);
-	if(id_malloc)
-		ast_free(ident);
-	ast_free(mytele);		
-	ast_hangup(mychannel);
+	ast_mutex_unlock(&pool->lock);
+	if (mychannel) ast_hangup(mychannel);
 #ifdef  APP_RPT_LOCK_DEBUG
 	{
 		struct lockthread *t;
@@ -10870,22 +13054,85 @@ treataslocal:
 		ast_mutex_unlock(&locklock);
 	}			
 #endif
-	myrpt->noduck=0;
-	pthread_exit(NULL);
 }
 
-static void send_tele_link(struct rpt *myrpt,char *cmd);
+static void *rpt_tele_worker(void *data)
+{
+	rpt_tele_work((struct rpt *) data,0);
+	return(NULL);
+}
+
+static void *rpt_tele_waiter(void *data)
+{
+	rpt_tele_work((struct rpt *) data,1);
+	return(NULL);
+}
+
+/* tell the workers there is an item of the given mode on the queue,
+   starting them the first time, and starting a waiter if it is an item
+   that waits and no waiter is free for it.  Returns -1 if there are no
+   workers to do it */
+static int rpt_telepool_kick(struct rpt *myrpt, int mode)
+{
+struct rpt_telepool *pool = &myrpt->telepool;
+int	res;
+
+	ast_mutex_lock(&pool->lock);
+	while((!pool->stop) && (pool->nthreads < TELEPOOL_THREADS))
+	{
+		res = ast_pthread_create(&pool->threads[pool->nthreads],NULL,rpt_tele_worker,(void *) myrpt);
+		if (res)
+		{
+			ast_log(LOG_WARNING, "Could not create telemetry thread: %s\n",strerror(res));
+			break;
+		}
+		pool->nthreads++;
+	}
+	res = (pool->nthreads) ? 0 : -1;
+	if (rpt_tele_waits(mode))
+	{
+		if ((!pool->stop) && (pool->pending_waits >= pool->idle_waiters) &&
+		    (pool->nwaiters < TELEPOOL_WAITERS))
+		{
+			res = ast_pthread_create(&pool->waiters[pool->nwaiters],NULL,rpt_tele_waiter,(void *) myrpt);
+			if (res)
+				ast_log(LOG_WARNING, "Could not create telemetry thread: %s\n",strerror(res));
+			else
+				pool->nwaiters++;
+		}
+		res = (pool->nwaiters) ? 0 : -1;
+		if (!res) pool->pending_waits++;
+	}
+	pool->seq++;
+	ast_cond_broadcast(&pool->cond);
+	ast_mutex_unlock(&pool->lock);
+	return(res);
+}
+
+static void rpt_telepool_stop(struct rpt *myrpt)
+{
+struct rpt_telepool *pool = &myrpt->telepool;
+int	i;
+
+	ast_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	ast_cond_broadcast(&pool->cond);
+	ast_mutex_unlock(&pool->lock);
+	for(i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i],NULL);
+	pool->nthreads = 0;
+	for(i = 0; i < pool->nwaiters; i++)
+		pthread_join(pool->waiters[i],NULL);
+	pool->nwaiters = 0;
+	pool->idle_waiters = 0;
+	pool->pending_waits = 0;
+}
 
-/* 
- *  More repeater telemetry routines.
- */
- 
 static void rpt_telemetry(struct rpt *myrpt,int mode, void *data)
 {
 struct rpt_tele *tele;
 struct rpt_link *mylink = NULL;
-int res,vmajor,vminor,i,ns;
-pthread_attr_t attr;
+int vmajor,vminor,i,ns;
 char *v1, *v2,mystr[1024],*p,haslink,lat[100],lon[100],elev[100];
 char lbuf[MAXLINKLIST],*strs[MAXLINKLIST];
 time_t	t,was;
@@ -11181,14 +13428,14 @@ struct rpt_link *l;
 	if ((mode == REMXXX) || (mode == PAGE) || (mode == MDC1200)) tele->submode.p= data;
 	insque((struct qelem *)tele, (struct qelem *)myrpt->tele.next);
 	rpt_mutex_unlock(&myrpt->lock);
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	res = ast_pthread_create(&tele->threadid,&attr,rpt_tele_thread,(void *) tele);
-	if(res < 0){
+	if(rpt_telepool_kick(myrpt,mode) < 0){
 		rpt_mutex_lock(&myrpt->lock);
-		remque((struct qlem *) tele); /* We don't like stuck transmitters, remove it from the queue */
+		/* We don't like stuck transmitters, remove it from the queue */
+		if (!tele->running){
+			remque((struct qelem *) tele);
+			ast_free(tele);
+		}
 		rpt_mutex_unlock(&myrpt->lock);	
-		ast_log(LOG_WARNING, "Could not create telemetry thread: %s",strerror(res));
 	}
 	if(debug >= 6)
 			ast_log(LOG_NOTICE,"Tracepoint rpt_telemetry() exit\n");
@@ -11218,7 +13465,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 
 	myrpt->mydtmf = 0;
 	/* allocate a pseudo-channel thru asterisk */
-	mychannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	mychannel = rpt_request_pseudo(myrpt);
 	if (!mychannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -11233,7 +13480,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	ci.confno = myrpt->conf; /* use the pseudo conference */
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER | DAHDI_CONF_LISTENER;
 	/* first put the channel on the conference */
-	if (ioctl(mychannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(mychannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		ast_hangup(mychannel);
@@ -11241,7 +13488,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		pthread_exit(NULL);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	genchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	genchannel = rpt_request_pseudo(myrpt);
 	if (!genchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -11257,7 +13504,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	ci.confno = myrpt->conf;
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER | DAHDI_CONF_LISTENER;
 	/* first put the channel on the conference */
-	if (ioctl(genchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(genchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		ast_hangup(mychannel);
@@ -11265,7 +13512,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		myrpt->callmode = 0;
 		pthread_exit(NULL);
 	}
-	if (myrpt->p.tonezone && (tone_zone_set_zone(mychannel->fds[0],myrpt->p.tonezone) == -1))
+	if (myrpt->p.tonezone && (rpt_set_tonezone(mychannel,myrpt->p.tonezone) == -1))
 	{
 		ast_log(LOG_WARNING, "Unable to set tone zone %s\n",myrpt->p.tonezone);
 		ast_hangup(mychannel);
@@ -11273,7 +13520,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		myrpt->callmode = 0;
 		pthread_exit(NULL);
 	}
-	if (myrpt->p.tonezone && (tone_zone_set_zone(genchannel->fds[0],myrpt->p.tonezone) == -1))
+	if (myrpt->p.tonezone && (rpt_set_tonezone(genchannel,myrpt->p.tonezone) == -1))
 	{
 		ast_log(LOG_WARNING, "Unable to set tone zone %s\n",myrpt->p.tonezone);
 		ast_hangup(mychannel);
@@ -11283,7 +13530,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	}
 	/* start dialtone if patchquiet is 0. Special patch modes don't send dial tone */
 	if ((!myrpt->patchquiet) && (!myrpt->patchexten[0]) 
-		&& (tone_zone_play_tone(genchannel->fds[0],DAHDI_TONE_DIALTONE) < 0))
+		&& (rpt_play_tone(genchannel,DAHDI_TONE_DIALTONE) < 0))
 	{
 		ast_log(LOG_WARNING, "Cannot start dialtone\n");
 		ast_hangup(mychannel);
@@ -11324,7 +13571,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		{
 			stopped = 1;
 			/* stop dial tone */
-			tone_zone_play_tone(genchannel->fds[0],-1);
+			rpt_play_tone(genchannel,-1);
 		}
 		if (myrpt->callmode == 1)
 		{
@@ -11342,7 +13589,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 			if(!congstarted){
 				congstarted = 1;
 				/* start congestion tone */
-				tone_zone_play_tone(genchannel->fds[0],DAHDI_TONE_CONGESTION);
+				rpt_play_tone(genchannel,DAHDI_TONE_CONGESTION);
 			}
 		}
 		res = ast_safe_sleep(mychannel, MSWAIT);
@@ -11360,7 +13607,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		dialtimer += MSWAIT;
 	}
 	/* stop any tone generation */
-	tone_zone_play_tone(genchannel->fds[0],-1);
+	rpt_play_tone(genchannel,-1);
 	/* end if done */
 	if (!myrpt->callmode)
 	{
@@ -11425,7 +13672,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	if (mychannel->pbx)
 	{
 		/* first put the channel on the conference in announce mode */
-		if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+		if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 			ast_hangup(mychannel);
@@ -11436,7 +13683,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		}
 		/* get its channel number */
 		res = 0;
-		if (ioctl(mychannel->fds[0],DAHDI_CHANNO,&res) == -1)
+		if (rpt_channo(mychannel,&res) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to get autopatch channel number\n");
 			ast_hangup(mychannel);
@@ -11448,7 +13695,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 		ci.confno = res;
 		ci.confmode = DAHDI_CONF_MONITOR;
 		/* put vox channel monitoring on the channel  */
-		if (ioctl(myrpt->voxchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+		if (rpt_setconf(myrpt->voxchannel,&ci) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 			ast_hangup(mychannel);
@@ -11477,7 +13724,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 				myrpt->callmode = 4;
 				rpt_mutex_unlock(&myrpt->lock);
 				/* start congestion tone */
-				tone_zone_play_tone(genchannel->fds[0],DAHDI_TONE_CONGESTION);
+				rpt_play_tone(genchannel,DAHDI_TONE_CONGESTION);
 				rpt_mutex_lock(&myrpt->lock);
 			}
 		}
@@ -11515,7 +13762,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	if(debug)
 		ast_log(LOG_NOTICE, "exit channel loop\n");
 	rpt_mutex_unlock(&myrpt->lock);
-	tone_zone_play_tone(genchannel->fds[0],-1);
+	rpt_play_tone(genchannel,-1);
 	if (mychannel->pbx) ast_softhangup(mychannel,AST_SOFTHANGUP_DEV);
 	ast_hangup(genchannel);
 	rpt_mutex_lock(&myrpt->lock);
@@ -11529,7 +13776,7 @@ struct ast_channel *mychannel,*genchannel,*c;
 	ci.confmode = ((myrpt->p.duplex == 2) || (myrpt->p.duplex == 4)) ? DAHDI_CONF_CONFANNMON :
 		(DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER);
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 	}
@@ -11797,6 +14044,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	}
 	/* zero the silly thing */
 	memset((char *)l,0,sizeof(struct rpt_link));
+	rpt_link_init(l);
 	l->mode = mode;
 	l->outbound = 1;
 	l->thisconnected = 0;
@@ -11805,7 +14053,6 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	l->isremote = (s && ast_true(s));
 	if (modechange) l->connected = 1;
 	l->hasconnected = l->perma = perma;
-	l->newkeytimer = NEWKEYTIME;
 	l->iaxkey = 0;
 	l->newkey = 2;
 	l->voterlink=voterlink;
@@ -11823,6 +14070,7 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	tele = strchr(deststr, '/');
 	if (!tele){
 		ast_log(LOG_WARNING,"link3:Dial number (%s) must be in format tech/number\n",deststr);
+		rpt_link_destroy(l);
 		ast_free(l);
 		return -1;
 	}
@@ -11877,14 +14125,16 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 			sprintf(str,"LINKFAIL,%s/%s",deststr,tele);
 			donodelog(myrpt,str);
 		}
+		rpt_link_destroy(l);
 		ast_free(l);
 		return -1;
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	l->pchan = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	l->pchan = rpt_request_pseudo(myrpt);
 	if (!l->pchan){
 		ast_log(LOG_WARNING,"rpt connect: Sorry unable to obtain pseudo channel\n");
 		ast_hangup(l->chan);
+		rpt_link_destroy(l);
 		ast_free(l);
 		return -1;
 	}
@@ -11900,11 +14150,12 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	ci.confno = myrpt->conf;
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER;
 	/* first put the channel on the conference in proper mode */
-	if (ioctl(l->pchan->fds[0], DAHDI_SETCONF, &ci) == -1)
+	if (rpt_setconf(l->pchan,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		ast_hangup(l->chan);
 		ast_hangup(l->pchan);
+		rpt_link_destroy(l);
 		ast_free(l);
 		return -1;
 	}
@@ -11919,8 +14170,11 @@ static int connect_link(struct rpt *myrpt, char* node, int mode, int perma)
 	if (perma)
 		l->max_retries = MAX_RETRIES_PERM;
 	if (l->isremote) l->retries = l->max_retries + 1;
-	l->rxlingertimer = ((l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
+	rpt_timer_arm(&myrpt->twheel,&l->rxlingertimer,(l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
+	rpt_timer_arm(&myrpt->twheel,&l->newkeytimer,NEWKEYTIME);
+	rpt_timer_arm(&myrpt->twheel,&l->conntimer,MAXCONNECTTIME);
 	insque((struct qelem *)l,(struct qelem *)myrpt->links.next);
+	myrpt->waitsetdirty = 1;
 	__kickshort(myrpt);
 	rpt_mutex_unlock(&myrpt->lock);
 	return 0;
@@ -12464,7 +14718,7 @@ static int function_status(struct rpt *myrpt, char *param, char *digitbuf, int c
 		        if(myrpt->p.idtime)  /* ID time must be non-zero */
 			{
 		                myrpt->mustid = myrpt->tailid = 0;
-		                myrpt->idtimer = myrpt->p.idtime;
+		                rpt_timer_arm(&myrpt->twheel,&myrpt->idtimer,myrpt->p.idtime);
 			}
  			telem = myrpt->tele.next;
 			while(telem != &myrpt->tele)
@@ -12498,7 +14752,7 @@ static int function_status(struct rpt *myrpt, char *param, char *digitbuf, int c
 		        if(myrpt->p.idtime)  /* ID time must be non-zero */
 			{
 		                myrpt->mustid = myrpt->tailid = 0;
-		                myrpt->idtimer = myrpt->p.idtime;
+		                rpt_timer_arm(&myrpt->twheel,&myrpt->idtimer,myrpt->p.idtime);
 			}
  			telem = myrpt->tele.next;
 			while(telem != &myrpt->tele)
@@ -13251,12 +15505,11 @@ static int function_cop(struct rpt *myrpt, char *param, char *digitbuf, int comm
 static int collect_function_digits(struct rpt *myrpt, char *digits, 
 	int command_source, struct rpt_link *mylink)
 {
-	int i,rv;
-	char *stringp,*action,*param,*functiondigits;
-	char function_table_name[30] = "";
+	int rv;
+	char *param = NULL;
 	char workstring[200];
-	
-	struct ast_variable *vp;
+	struct rpt_functrie *trie;
+	struct rpt_functrie_node *fn = NULL;
 	
 	if (debug > 6) ast_log(LOG_NOTICE,"digits=%s  source=%d\n",digits, command_source);
 
@@ -13265,29 +15518,24 @@ static int collect_function_digits(struct rpt *myrpt, char *digits,
 	
 	if (command_source == SOURCE_DPHONE) {
 		if (!myrpt->p.dphone_functions) return DC_INDETERMINATE;
-		strncpy(function_table_name, myrpt->p.dphone_functions, sizeof(function_table_name) - 1);
+		trie = myrpt->dphone_functrie;
 		}
 	else if (command_source == SOURCE_ALT) {
 		if (!myrpt->p.alt_functions) return DC_INDETERMINATE;
-		strncpy(function_table_name, myrpt->p.alt_functions, sizeof(function_table_name) - 1);
+		trie = myrpt->alt_functrie;
 		}
 	else if (command_source == SOURCE_PHONE) {
 		if (!myrpt->p.phone_functions) return DC_INDETERMINATE;
-		strncpy(function_table_name, myrpt->p.phone_functions, sizeof(function_table_name) - 1);
+		trie = myrpt->phone_functrie;
 		}
 	else if (command_source == SOURCE_LNK)
-		strncpy(function_table_name, myrpt->p.link_functions, sizeof(function_table_name) - 1);
+		trie = myrpt->link_functrie;
 	else
-		strncpy(function_table_name, myrpt->p.functions, sizeof(function_table_name) - 1);
-    /* find context for function table in rpt.conf file */
-	vp = ast_variable_browse(myrpt->cfg, function_table_name);
-	while(vp) {
-		if(!strncasecmp(vp->name, digits, strlen(vp->name)))
-			break;
-		vp = vp->next;
-	}	
+		trie = myrpt->functrie;
+    /* find the function in the compiled function table */
+	if (trie) fn = rpt_functrie_find(trie, digits);
 	/* if function context not found */
-	if(!vp) {
+	if(!fn) {
 		int n;
 
 		n = myrpt->longestfunc;
@@ -13304,32 +15552,25 @@ static int collect_function_digits(struct rpt *myrpt, char *digits,
 		else
 			return DC_INDETERMINATE;
 	}	
-	/* Found a match, retrieve value part and parse */
-	strncpy(workstring, vp->value, sizeof(workstring) - 1 );
-	stringp = workstring;
-	action = strsep(&stringp, ",");
-	param = stringp;
-	if(debug)
-		printf("@@@@ action: %s, param = %s\n",action, (param) ? param : "(null)");
-	/* Look up the action */
-	for(i = 0 ; i < (sizeof(function_table)/sizeof(struct function_table_tag)); i++){
-		if(!strncasecmp(action, function_table[i].action, strlen(action)))
-			break;
+	/* Found a match, the functions may write into their parameter */
+	if (fn->param)
+	{
+		ast_copy_string(workstring, fn->param, sizeof(workstring));
+		param = workstring;
 	}
 	if(debug)
-		printf("@@@@ table index i = %d\n",i);
-	if(i == (sizeof(function_table)/sizeof(struct function_table_tag))){
+		printf("@@@@ action: %s, param = %s\n",(fn->action) ? fn->action->action : "(unknown)", (param) ? param : "(null)");
+	if(!fn->action){
 		/* Error, action not in table */
 		return DC_ERROR;
 	}
-	if(function_table[i].function == NULL){
+	if(fn->action->function == NULL){
 		/* Error, function undefined */
 		if(debug)
-			printf("@@@@ NULL for action: %s\n",action);
+			printf("@@@@ NULL for action: %s\n",fn->action->action);
 		return DC_ERROR;
 	}
-	functiondigits = digits + strlen(vp->name);
-	rv=(*function_table[i].function)(myrpt, param, functiondigits, command_source, mylink);
+	rv=(*fn->action->function)(myrpt, param, digits + fn->len, command_source, mylink);
 	if (debug > 6) ast_log(LOG_NOTICE,"rv=%i\n",rv);
 	return(rv);
 }
@@ -13362,9 +15603,9 @@ struct	ast_frame wf;
         }
         if (!strcmp(tmp,newkeystr))
         {
-		if ((!mylink->newkey) || mylink->newkeytimer)
+		if ((!mylink->newkey) || rpt_timer_pending(&mylink->newkeytimer))
 		{
-			mylink->newkeytimer = 0;
+			rpt_timer_cancel(&mylink->newkeytimer);
 			mylink->newkey = 1;
 			send_old_newkey(mylink->chan);
 		}
@@ -13372,7 +15613,7 @@ struct	ast_frame wf;
         }
         if (!strcmp(tmp,newkey1str))
         {
-		mylink->newkeytimer = 0;
+		rpt_timer_cancel(&mylink->newkeytimer);
 		mylink->newkey = 2;
                 return;
         }
@@ -13408,6 +15649,7 @@ struct	ast_frame wf;
 		rpt_mutex_lock(&myrpt->lock);
 		strcpy(mylink->linklist,tmp + 2);
 		time(&mylink->linklistreceived);
+		mylink->linklistseq++;
 		rpt_mutex_unlock(&myrpt->lock);
 		if (debug > 6) ast_log(LOG_NOTICE,"@@@@ node %s recieved node list %s from node %s\n",
 			myrpt->name,tmp,mylink->name);
@@ -18758,6 +21000,7 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	rpt_mutex_lock(&myrpt->lock);
 	/* remove from queue */
 	remque((struct qelem *) l);
+	myrpt->waitsetdirty = 1;
 	rpt_mutex_unlock(&myrpt->lock);
 	s = tmp;
 	s1 = strsep(&s,",");
@@ -18777,6 +21020,7 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	}
 	*tele++ = 0;
 	l->elaptime = 0;
+	rpt_timer_arm(&myrpt->twheel,&l->conntimer,MAXCONNECTTIME);
 	l->connecttime = 0;
 	l->thisconnected = 0;
 	l->iaxkey = 0;
@@ -18790,10 +21034,12 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	l->linkmode = 0;
 	l->lastrx1 = 0;
 	l->lastrealrx = 0;
-	l->rxlingertimer = ((l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
-	l->newkeytimer = NEWKEYTIME;
+	rpt_timer_arm(&myrpt->twheel,&l->rxlingertimer,(l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
+	rpt_timer_arm(&myrpt->twheel,&l->newkeytimer,NEWKEYTIME);
 	l->newkey = 2;
+	ast_mutex_lock(&l->lock);
 	while((f1 = AST_LIST_REMOVE_HEAD(&l->textq,frame_list))) ast_frfree(f1);
+	ast_mutex_unlock(&l->lock);
 	if (l->chan){
 		ast_set_read_format(l->chan, AST_FORMAT_SLINEAR);
 		ast_set_write_format(l->chan, AST_FORMAT_SLINEAR);
@@ -18821,6 +21067,7 @@ static int attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	rpt_mutex_lock(&myrpt->lock);
 	/* put back in queue */
 	insque((struct qelem *)l,(struct qelem *)myrpt->links.next);
+	myrpt->waitsetdirty = 1;
 	rpt_mutex_unlock(&myrpt->lock);
 	ast_log(LOG_WARNING,"Reconnect Attempt to %s in process\n",l->name);
 	return 0;
@@ -19063,7 +21310,7 @@ static void queue_id(struct rpt *myrpt)
 {
 	if(myrpt->p.idtime){ /* ID time must be non-zero */
 		myrpt->mustid = myrpt->tailid = 0;
-		myrpt->idtimer = myrpt->p.idtime; /* Reset our ID timer */
+		rpt_timer_arm(&myrpt->twheel,&myrpt->idtimer,myrpt->p.idtime); /* Reset our ID timer */
 		rpt_mutex_unlock(&myrpt->lock);
 		rpt_telemetry(myrpt,ID,NULL);
 		rpt_mutex_lock(&myrpt->lock);
@@ -19252,6 +21499,114 @@ static void do_scheduler(struct rpt *myrpt)
 }
 
 /* single thread with one file (request) to dial */
+/*
+ * Reload the wait set after links (or their channels) came or went,
+ * must be called locked
+*/
+static void rpt_waitset_sync(struct rpt *myrpt)
+{
+struct ast_waitset *ws = myrpt->waitset;
+struct rpt_link *l;
+
+	ast_waitset_clear(ws);
+	ast_waitset_add(ws,myrpt->rxchannel);
+	ast_waitset_add(ws,myrpt->pchannel);
+	ast_waitset_add(ws,myrpt->monchannel);
+	ast_waitset_add(ws,myrpt->telechannel);
+	ast_waitset_add(ws,myrpt->btelechannel);
+	if (myrpt->parrotchannel) ast_waitset_add(ws,myrpt->parrotchannel);
+	if (myrpt->voxchannel) ast_waitset_add(ws,myrpt->voxchannel);
+	ast_waitset_add(ws,myrpt->txpchannel);
+	if (myrpt->txchannel != myrpt->rxchannel) ast_waitset_add(ws,myrpt->txchannel);
+	if (myrpt->zaptxchannel != myrpt->txchannel)
+		ast_waitset_add(ws,myrpt->zaptxchannel);
+	for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
+	{
+		if ((!l->killme) && (!rpt_timer_pending(&l->disctime)) && l->chan)
+		{
+			ast_waitset_add(ws,l->chan);
+			ast_waitset_add(ws,l->pchan);
+		}
+	}
+	myrpt->waitsetdirty = 0;
+}
+
+/*
+ * Act on the link and node timers the wheel says went off,
+ * must be called locked
+*/
+static void rpt_do_timers(struct rpt *myrpt)
+{
+struct rpt_timer *t;
+struct rpt_link *l;
+
+	while((t = rpt_twheel_expired(&myrpt->twheel)))
+	{
+		l = (struct rpt_link *) t->data;
+		switch(t->id)
+		{
+		    case RPT_TM_NEWKEY:
+			if (l->thisconnected)
+			{
+				if (l->newkey == 2) l->newkey = 0;
+			}
+			else
+			{
+				rpt_timer_arm(&myrpt->twheel,&l->newkeytimer,NEWKEYTIME);
+			}
+			break;
+		    case RPT_TM_LINKMODE:
+			if ((l->linkmode > 1) && (l->linkmode < 0x7ffffffe))
+				l->linkmode = 1;
+			break;
+		    case RPT_TM_RETX:
+			if (l->newkey != 1) break;
+			if (l->chan && l->phonemode == 0) 
+			{
+				if (l->lasttx)
+					ast_indicate(l->chan,AST_CONTROL_RADIO_KEY);
+				else
+					ast_indicate(l->chan,AST_CONTROL_RADIO_UNKEY);
+			}
+			break;
+		    case RPT_TM_RERX:
+			if (l->newkey != 1) break;
+			if (debug == 7) printf("@@@@ rx un-key\n");
+			l->lastrealrx = 0;
+			if (l->lastrx1)
+			{
+				if (myrpt->p.archivedir)
+				{
+					char str[512];
+
+					sprintf(str,"RXUNKEY(T),%s",l->name);
+					donodelog(myrpt,str);
+				}
+				if(myrpt->p.duplex) 
+					rpt_telemetry(myrpt,LINKUNKEY,l);
+				l->lastrx1 = 0;
+				rpt_update_links(myrpt);
+			}
+			break;
+		    case RPT_TM_CONNECT:
+			/* ignore non-timing channels */
+			if (l->elaptime < 0) break;
+			rpt_timer_arm(&myrpt->twheel,&l->conntimer,MAXCONNECTTIME);
+			/* if connection has taken too long */
+			if ((!l->chan) || (l->chan->_state != AST_STATE_UP))
+			{
+				rpt_mutex_unlock(&myrpt->lock);
+				if (l->chan) ast_softhangup(l->chan,AST_SOFTHANGUP_DEV);
+				rpt_mutex_lock(&myrpt->lock);
+			}
+			break;
+		    case RPT_TM_TAIL:
+			myrpt->tailevent = 1;
+			break;
+		}
+	}
+}
+
 static void *rpt(void *this)
 {
 struct	rpt *myrpt = (struct rpt *)this;
@@ -19280,7 +21635,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	telem = myrpt->tele.next;
 	while(telem != &myrpt->tele)
 	{
-		ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+		rpt_tele_kill(telem);
 		telem = telem->next;
 	}
 	rpt_mutex_unlock(&myrpt->lock);
@@ -19322,9 +21677,11 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		pthread_exit(NULL);
 	}
 	*tele++ = 0;
-	myrpt->rxchannel = ast_request(tmpstr,AST_FORMAT_SLINEAR,tele,NULL);
+	rpt_mix_select(myrpt);
+	myrpt->rxchannel = rpt_request_chan(myrpt,tmpstr,tele);
 	myrpt->zaprxchannel = NULL;
-	if (!strcasecmp(tmpstr,DAHDI_CHANNEL_NAME))
+	if ((!strcasecmp(tmpstr,DAHDI_CHANNEL_NAME)) && myrpt->rxchannel &&
+	    (!IS_RPT_MIX(myrpt->rxchannel)))
 		myrpt->zaprxchannel = myrpt->rxchannel;
 	if (myrpt->rxchannel)
 	{
@@ -19380,7 +21737,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			pthread_exit(NULL);
 		}
 		*tele++ = 0;
-		myrpt->txchannel = ast_request(tmpstr,AST_FORMAT_SLINEAR,tele,NULL);
+		myrpt->txchannel = rpt_request_chan(myrpt,tmpstr,tele);
 		if ((!strcasecmp(tmpstr,DAHDI_CHANNEL_NAME)) && strcasecmp(tele,"pseudo"))
 			myrpt->zaptxchannel = myrpt->txchannel;
 		if (myrpt->txchannel)
@@ -19440,7 +21797,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		ast_indicate(myrpt->txchannel,AST_CONTROL_RADIO_UNKEY);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->pchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->pchannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->pchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19462,7 +21819,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	if (!myrpt->zaptxchannel)
 	{
 		/* allocate a pseudo-channel thru asterisk */
-		myrpt->zaptxchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+		myrpt->zaptxchannel = rpt_request_pseudo(myrpt);
 		if (!myrpt->zaptxchannel)
 		{
 			fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19482,7 +21839,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		ast_answer(myrpt->zaptxchannel);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->monchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->monchannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->monchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19505,7 +21862,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confno = -1; /* make a new conf */
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER;
 	/* first put the channel on the conference in proper mode */
-	if (ioctl(myrpt->zaptxchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->zaptxchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19525,7 +21882,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confmode = ((myrpt->p.duplex == 2) || (myrpt->p.duplex == 4)) ? DAHDI_CONF_CONFANNMON :
 		(DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER);
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19541,7 +21898,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	myrpt->conf = ci.confno;
 	/* make a conference for the pseudo */
 	ci.chan = 0;
-	if ((strstr(myrpt->txchannel->name,"pseudo") == NULL) &&
+	if ((!myrpt->usermixer) && (strstr(myrpt->txchannel->name,"pseudo") == NULL) &&
 		(myrpt->zaptxchannel == myrpt->txchannel))
 	{
 		/* get tx channel's port number */
@@ -19566,7 +21923,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		ci.confmode = DAHDI_CONF_CONFANNMON;
 	}
 	/* first put the channel on the conference in announce mode */
-	if (ioctl(myrpt->monchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->monchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode for monitor\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19579,7 +21936,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		pthread_exit(NULL);
 	}
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->parrotchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->parrotchannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->parrotchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19601,7 +21958,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 
 	/* Telemetry Channel Resources */
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->telechannel = ast_request("dahdi",AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->telechannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->telechannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19623,7 +21980,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confno = -1; // make a new conference
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER | DAHDI_CONF_LISTENER;
  	/* put the channel on the conference in proper mode */
-	if (ioctl(myrpt->telechannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->telechannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19639,7 +21996,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 
 	/* make a channel to connect between the telemetry conference process
 	   and the main tx audio conference. */
-	myrpt->btelechannel = ast_request("dahdi",AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->btelechannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->btelechannel)
 	{
 		fprintf(stderr,"rtp:Failed to obtain pseudo channel for btelechannel\n");
@@ -19661,7 +22018,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confno = myrpt->txconf;
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER;
 	/* first put the channel on the conference in proper mode */
-	if (ioctl(myrpt->btelechannel->fds[0], DAHDI_SETCONF, &ci) == -1)
+	if (rpt_setconf(myrpt->btelechannel,&ci) == -1)
 	{
 		ast_log(LOG_ERROR, "Failed to create btelechannel.\n");
 		ast_hangup(myrpt->btelechannel);
@@ -19676,7 +22033,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 
 
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->voxchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->voxchannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->voxchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19695,7 +22052,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 #endif
 	ast_answer(myrpt->voxchannel);
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->txpchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->txpchannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->txpchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -19718,7 +22075,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	ci.confno = myrpt->txconf;
 	ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_TALKER ;
  	/* first put the channel on the conference in proper mode */
-	if (ioctl(myrpt->txpchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->txpchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -19747,10 +22104,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	   tx channel buffer */
 	myrpt->links.next = &myrpt->links;
 	myrpt->links.prev = &myrpt->links;
-	myrpt->tailtimer = 0;
+	rpt_node_timers_init(myrpt);
 	myrpt->totimer = myrpt->p.totime;
-	myrpt->tmsgtimer = myrpt->p.tailmessagetime;
-	myrpt->idtimer = myrpt->p.politeid;
+	rpt_timer_arm(&myrpt->twheel,&myrpt->tmsgtimer,myrpt->p.tailmessagetime);
+	rpt_timer_arm(&myrpt->twheel,&myrpt->idtimer,myrpt->p.politeid);
 	myrpt->elketimer = myrpt->p.elke;
 	myrpt->mustid = myrpt->tailid = 0;
 	myrpt->callmode = 0;
@@ -19758,7 +22115,6 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	myrpt->tonotify = 0;
 	myrpt->retxtimer = 0;
 	myrpt->rerxtimer = 0;
-	myrpt->skedtimer = 0;
 	myrpt->tailevent = 0;
 	lasttx = 0;
 	lastexttx = 0;
@@ -19829,12 +22185,18 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 	rpt_update_boolean(myrpt,"RPT_ALINKS",-1);
 	rpt_update_boolean(myrpt,"RPT_NUMALINKS",-1);
 
+	myrpt->waitset = ast_waitset_alloc();
+	if (!myrpt->waitset)
+	{
+		ast_log(LOG_ERROR,"Unable to allocate wait set for node %s\n",myrpt->name);
+		ms = -1;
+	}
+	myrpt->waitsetdirty = 1;
 	myrpt->ready = 1;	
 	while (ms >= 0)
 	{
-		struct ast_frame *f,*f1,*f2;
-		struct ast_channel *cs[300],*cs1[300];
-		int totx=0,elap=0,n,x,toexit=0;
+		struct ast_frame *f,*f1,*f2,*fz;
+		int totx=0,elap=0,n,x,toexit=0,mswait;
 
 		/* DEBUG Dump */
 		if((myrpt->disgorgetime) && (time(NULL) >= myrpt->disgorgetime)){
@@ -19858,7 +22220,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			ast_log(LOG_NOTICE,"myrpt->tonotify = %d\n",myrpt->tonotify);
 			ast_log(LOG_NOTICE,"myrpt->retxtimer = %ld\n",myrpt->retxtimer);
 			ast_log(LOG_NOTICE,"myrpt->totimer = %d\n",myrpt->totimer);
-			ast_log(LOG_NOTICE,"myrpt->tailtimer = %d\n",myrpt->tailtimer);
+			ast_log(LOG_NOTICE,"myrpt->tailtimer = %d\n",rpt_timer_left(&myrpt->tailtimer));
 			ast_log(LOG_NOTICE,"myrpt->tailevent = %d\n",myrpt->tailevent);
 			ast_log(LOG_NOTICE,"myrpt->linkactivitytimer = %d\n",myrpt->linkactivitytimer);
 			ast_log(LOG_NOTICE,"myrpt->linkactivityflag = %d\n",(int) myrpt->linkactivityflag);
@@ -19882,8 +22244,8 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				ast_log(LOG_NOTICE,"        link->outbound %d\n",zl->outbound);
 				ast_log(LOG_NOTICE,"        link->disced %d\n",zl->disced);
 				ast_log(LOG_NOTICE,"        link->killme %d\n",zl->killme);
-				ast_log(LOG_NOTICE,"        link->disctime %ld\n",zl->disctime);
-				ast_log(LOG_NOTICE,"        link->retrytimer %ld\n",zl->retrytimer);
+				ast_log(LOG_NOTICE,"        link->disctime %d\n",rpt_timer_left(&zl->disctime));
+				ast_log(LOG_NOTICE,"        link->retrytimer %d\n",rpt_timer_left(&zl->retrytimer));
 				ast_log(LOG_NOTICE,"        link->retries = %d\n",zl->retries);
 				ast_log(LOG_NOTICE,"        link->reconnects = %d\n",zl->reconnects);
 				ast_log(LOG_NOTICE,"        link->newkey = %d\n",zl->newkey);
@@ -19910,7 +22272,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			telem = myrpt->tele.next;
 			while(telem != &myrpt->tele)
 			{
-				ast_softhangup(telem->chan,AST_SOFTHANGUP_DEV);
+				rpt_tele_kill(telem);
 				telem = telem->next;
 			}
 			myrpt->reload = 0;
@@ -20002,7 +22364,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		}
 		/* Create a "must_id" flag for the cleanup ID */		
 		if(myrpt->p.idtime) /* ID time must be non-zero */
-			myrpt->mustid |= (myrpt->idtimer) && (myrpt->keyed || myrpt->remrx) ;
+			myrpt->mustid |= rpt_timer_pending(&myrpt->idtimer) && (myrpt->keyed || myrpt->remrx) ;
 		if(myrpt->keyed || myrpt->remrx){
 			/* Set the inactivity was keyed flag and reset its timer */
 			myrpt->rptinactwaskeyedflag = 1;
@@ -20116,9 +22478,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			myrpt->tonotify = 0;
 		}
 		else{
-			myrpt->tailtimer = myrpt->p.s[myrpt->p.sysstate_cur].alternatetail ?
+			rpt_timer_arm(&myrpt->twheel,&myrpt->tailtimer,
+				myrpt->p.s[myrpt->p.sysstate_cur].alternatetail ?
 				myrpt->p.althangtime : /* Initialize tail timer */
-				myrpt->p.hangtime;
+				myrpt->p.hangtime);
 
 		}
 		/* if in 1/2 or 3/4 duplex, give rx priority */
@@ -20158,9 +22521,9 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			channel_revert(myrpt);
 		}
 		/* get rid of tail if timed out or repeater is beaconing */
-		if (!myrpt->totimer || (!myrpt->mustid && myrpt->p.beaconing)) myrpt->tailtimer = 0;
+		if (!myrpt->totimer || (!myrpt->mustid && myrpt->p.beaconing)) rpt_timer_cancel(&myrpt->tailtimer);
 		/* if not timed-out, add in tail */
-		if (myrpt->totimer) totx = totx || myrpt->tailtimer;
+		if (myrpt->totimer) totx = totx || rpt_timer_pending(&myrpt->tailtimer);
 		/* If user or links key up or are keyed up over standard ID, switch to talkover ID, if one is defined */
 		/* If tail message, kill the message if someone keys up over it */ 
 		if ((myrpt->keyed || myrpt->remrx || myrpt->localoverride) && ((identqueued && idtalkover) || (tailmessagequeued))) {
@@ -20194,11 +22557,12 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		/* else if at ID time limit, do it right over the top of them */
 		/* If beaconing is enabled, always id when the timer expires */
 		/* Lastly, if the repeater has been keyed, and the ID timer is expired, do a clean up ID */
-		if(((myrpt->mustid)||(myrpt->p.beaconing)) && (!myrpt->idtimer))
+		if(((myrpt->mustid)||(myrpt->p.beaconing)) && (!rpt_timer_pending(&myrpt->idtimer)))
 			queue_id(myrpt);
 
 		if ((myrpt->p.idtime && totx && (!myrpt->exttx) &&
-			 (myrpt->idtimer <= myrpt->p.politeid) && myrpt->tailtimer)) /* ID time must be non-zero */ 
+			 (rpt_timer_left(&myrpt->idtimer) <= myrpt->p.politeid) &&
+			 rpt_timer_pending(&myrpt->tailtimer))) /* ID time must be non-zero */ 
 			{
 				myrpt->tailid = 1;
 			}
@@ -20212,9 +22576,9 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				queue_id(myrpt);
 			}
 			else if ((myrpt->p.tailmessages[0]) &&
-				(myrpt->p.tailmessagetime) && (myrpt->tmsgtimer == 0)){
+				(myrpt->p.tailmessagetime) && (!rpt_timer_pending(&myrpt->tmsgtimer))){
 					totx = 1;
-					myrpt->tmsgtimer = myrpt->p.tailmessagetime;	
+					rpt_timer_arm(&myrpt->twheel,&myrpt->tmsgtimer,myrpt->p.tailmessagetime);
 					rpt_mutex_unlock(&myrpt->lock);
 					rpt_telemetry(myrpt, TAILMSG, NULL);
 					rpt_mutex_lock(&myrpt->lock);
@@ -20324,7 +22688,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			ci.chan = 0;
 
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(myrpt->parrotchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(myrpt->parrotchannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode for parrot\n");
 				ast_mutex_unlock(&myrpt->lock);
@@ -20365,12 +22729,14 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			{
 				/* remove from queue */
 				remque((struct qelem *) l);
+				myrpt->waitsetdirty = 1;
 				if (!strcmp(myrpt->cmdnode,l->name))
 					myrpt->cmdnode[0] = 0;
 				rpt_mutex_unlock(&myrpt->lock);
 				/* hang-up on call to device */
 				if (l->chan) ast_hangup(l->chan);
 				ast_hangup(l->pchan);
+				rpt_link_destroy(l);
 				ast_free(l);
 				rpt_mutex_lock(&myrpt->lock);
 				/* re-start link traversal */
@@ -20405,29 +22771,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				}
 			}
 		}
-		n = 0;
-		cs[n++] = myrpt->rxchannel;
-		cs[n++] = myrpt->pchannel;
-		cs[n++] = myrpt->monchannel;
-		cs[n++] = myrpt->telechannel;
-		cs[n++] = myrpt->btelechannel;
-
-		if (myrpt->parrotchannel) cs[n++] = myrpt->parrotchannel;
-		if (myrpt->voxchannel) cs[n++] = myrpt->voxchannel;
-		cs[n++] = myrpt->txpchannel;
-		if (myrpt->txchannel != myrpt->rxchannel) cs[n++] = myrpt->txchannel;
-		if (myrpt->zaptxchannel != myrpt->txchannel)
-			cs[n++] = myrpt->zaptxchannel;
-		l = myrpt->links.next;
-		while(l != &myrpt->links)
-		{
-			if ((!l->killme) && (!l->disctime) && l->chan)
-			{
-				cs[n++] = l->chan;
-				cs[n++] = l->pchan;
-			}
-			l = l->next;
-		}
+		if (myrpt->waitsetdirty) rpt_waitset_sync(myrpt);
+		u = rpt_linksnap_sig(myrpt);
+		if ((!myrpt->linksnap) || (u != myrpt->linksnapsig))
+			rpt_linksnap_publish(myrpt,u);
 		if ((myrpt->topkeystate == 1) && 
 		    ((t - myrpt->topkeytime) > TOPKEYWAIT))
 		{
@@ -20443,58 +22790,37 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			rpt_telemetry(myrpt,TOPKEY,NULL);
 			myrpt->topkeystate = 3;
 		}
-		ms = MSWAIT;
-		for(x = 0; x < n; x++)
-		{
-			int s = -(-x - myrpt->scram - 1) % n;
-			cs1[x] = cs[s];
-		}
-		myrpt->scram++;
-		who = ast_waitfor_n(cs1,n,&ms);
+		/* sleep no longer than the next link or node timer allows */
+		mswait = ms = rpt_twheel_next(&myrpt->twheel,MSWAIT);
+		who = ast_waitset_wait(myrpt->waitset,&ms);
 		if (who == NULL) ms = 0;
-		elap = MSWAIT - ms;
+		elap = mswait - ms;
+		rpt_twheel_run(&myrpt->twheel);
 		/* @@@@@@ LOCK @@@@@@@ */
 		rpt_mutex_lock(&myrpt->lock);
+		rpt_do_timers(myrpt);
 		l = myrpt->links.next;
 		while(l != &myrpt->links)
 		{
-			int myrx,mymaxct;
+			int myrx;
 			
 			
 			if (l->chan && l->thisconnected && (!AST_LIST_EMPTY(&l->textq)))
 			{
+				ast_mutex_lock(&l->lock);
 				f = AST_LIST_REMOVE_HEAD(&l->textq,frame_list);
-				ast_write(l->chan,f);
-				ast_frfree(f);
-			}
-
-			if (l->rxlingertimer) l->rxlingertimer -= elap;
-			if (l->rxlingertimer < 0) l->rxlingertimer = 0;
-
-			x = l->newkeytimer;
-			if (l->newkeytimer) l->newkeytimer -= elap;
-			if (l->newkeytimer < 0) l->newkeytimer = 0;
-
-			if ((x > 0) && (!l->newkeytimer))
-			{
-				if (l->thisconnected)
-				{
-					if (l->newkey == 2) l->newkey = 0;
-				}
-				else
+				ast_mutex_unlock(&l->lock);
+				if (f)
 				{
-					l->newkeytimer = NEWKEYTIME;
+					ast_write(l->chan,f);
+					ast_frfree(f);
 				}
 			}
-			if ((l->linkmode > 1) && (l->linkmode < 0x7ffffffe)) 
-			{
-				l->linkmode -= elap;
-				if (l->linkmode < 1) l->linkmode = 1;
-			}
-			if ((l->newkey == 2) && l->lastrealrx && (!l->rxlingertimer))
+
+			if ((l->newkey == 2) && l->lastrealrx && (!rpt_timer_pending(&l->rxlingertimer)))
 			{
 				l->lastrealrx = 0;
-				l->rerxtimer = 0;
+				rpt_timer_cancel(&l->rerxtimer);
 				if (l->lastrx1)
 				{
 					if (myrpt->p.archivedir)
@@ -20511,9 +22837,6 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				}
 			}				
 
-			if (l->voxtotimer) l->voxtotimer -= elap;
-			if (l->voxtotimer < 0) l->voxtotimer = 0;
-
 			if (l->lasttx != l->lasttx1)
 			{
 				if ((!l->phonemode) || (!l->phonevox)) voxinit_link(l,!l->lasttx);
@@ -20523,16 +22846,16 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			if ((l->phonemode) && (l->phonevox))
 			{
 				myrx = myrx || (!AST_LIST_EMPTY(&l->rxq));
-				if (l->voxtotimer <= 0)
+				if (!rpt_timer_pending(&l->voxtotimer))
 				{
 					if (l->voxtostate)
 					{
-						l->voxtotimer = myrpt->p.voxtimeout_ms;
+						rpt_timer_arm(&myrpt->twheel,&l->voxtotimer,myrpt->p.voxtimeout_ms);
 						l->voxtostate = 0;
 					}				
 					else
 					{
-						l->voxtotimer = myrpt->p.voxrecover_ms;
+						rpt_timer_arm(&myrpt->twheel,&l->voxtotimer,myrpt->p.voxrecover_ms);
 						l->voxtostate = 1;
 					}
 				}
@@ -20540,12 +22863,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					myrx = myrx || l->wasvox ;
 			}
 			l->lastrx = myrx;
-			if (l->linklisttimer)
-			{
-				l->linklisttimer -= elap;
-				if (l->linklisttimer < 0) l->linklisttimer = 0;
-			}
-			if ((!l->linklisttimer) && (l->name[0] != '0') && (!l->isremote))
+			if ((!rpt_timer_pending(&l->linklisttimer)) && (l->name[0] != '0') && (!l->isremote))
 			{
 				struct	ast_frame lf;
 
@@ -20555,7 +22873,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				lf.offset = 0;
 				lf.mallocd = 0;
 				lf.samples = 0;
-				l->linklisttimer = LINKLISTTIME;
+				rpt_timer_arm(&myrpt->twheel,&l->linklisttimer,LINKLISTTIME);
 				strcpy(lstr,"L ");
 				__mklinklist(myrpt,l,lstr + 2,0);
 				if (l->chan)
@@ -20570,49 +22888,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			}
 			if (l->newkey == 1)
 			{
-				if ((l->retxtimer += elap) >= REDUNDANT_TX_TIME)
-				{
-					l->retxtimer = 0;
-					if (l->chan && l->phonemode == 0) 
-					{
-						if (l->lasttx)
-							ast_indicate(l->chan,AST_CONTROL_RADIO_KEY);
-						else
-							ast_indicate(l->chan,AST_CONTROL_RADIO_UNKEY);
-					}
-				}
-				if ((l->rerxtimer += elap) >= (REDUNDANT_TX_TIME * 5))
-				{
-					if (debug == 7) printf("@@@@ rx un-key\n");
-					l->lastrealrx = 0;
-					l->rerxtimer = 0;
-					if (l->lastrx1)
-					{
-						if (myrpt->p.archivedir)
-						{
-							char str[512];
-	
-							sprintf(str,"RXUNKEY(T),%s",l->name);
-							donodelog(myrpt,str);
-						}
-						if(myrpt->p.duplex) 
-							rpt_telemetry(myrpt,LINKUNKEY,l);
-						l->lastrx1 = 0;
-						rpt_update_links(myrpt);
-					}
-				}
-			}
-			if (l->disctime) /* Disconnect timer active on a channel ? */
-			{
-				l->disctime -= elap;
-				if (l->disctime <= 0) /* Disconnect timer expired on inbound channel ? */
-					l->disctime = 0; /* Yep */
-			}
-
-			if (l->retrytimer)
-			{
-				l->retrytimer -= elap;
-				if (l->retrytimer < 0) l->retrytimer = 0;
+				if (!rpt_timer_pending(&l->retxtimer))
+					rpt_timer_arm(&myrpt->twheel,&l->retxtimer,REDUNDANT_TX_TIME);
+				if (!rpt_timer_pending(&l->rerxtimer))
+					rpt_timer_arm(&myrpt->twheel,&l->rerxtimer,REDUNDANT_TX_TIME * 5);
 			}
 
 			/* Tally connect time */
@@ -20624,29 +22903,18 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				l = l->next;
 				continue;
 			}
-			l->elaptime += elap;
-			mymaxct = MAXCONNECTTIME;
-			/* if connection has taken too long */
-			if ((l->elaptime > mymaxct) && 
-			   ((!l->chan) || (l->chan->_state != AST_STATE_UP)))
-			{
-				l->elaptime = 0;
-				rpt_mutex_unlock(&myrpt->lock);
-				if (l->chan) ast_softhangup(l->chan,AST_SOFTHANGUP_DEV);
-				rpt_mutex_lock(&myrpt->lock);
-				break;
-			}
-			if ((!l->chan) && (!l->retrytimer) && l->outbound && 
+			if ((!l->chan) && (!rpt_timer_pending(&l->retrytimer)) && l->outbound && 
 				(l->retries++ < l->max_retries) && (l->hasconnected))
 			{
 				if (l->chan) ast_hangup(l->chan);
 				l->chan = 0;
+				myrpt->waitsetdirty = 1;
 				rpt_mutex_unlock(&myrpt->lock);
 				if ((l->name[0] > '0') && (l->name[0] <= '9') && (!l->isremote))
 				{
 					if (attempt_reconnect(myrpt,l) == -1)
 					{
-						l->retrytimer = RETRY_TIMER_MS;
+						rpt_timer_arm(&myrpt->twheel,&l->retrytimer,RETRY_TIMER_MS);
 					} 
 				}
 				else 
@@ -20657,11 +22925,12 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				rpt_mutex_lock(&myrpt->lock);
 				break;
 			}
-			if ((!l->chan) && (!l->retrytimer) && l->outbound &&
+			if ((!l->chan) && (!rpt_timer_pending(&l->retrytimer)) && l->outbound &&
 				(l->retries >= l->max_retries))
 			{
 				/* remove from queue */
 				remque((struct qelem *) l);
+				myrpt->waitsetdirty = 1;
 				if (!strcmp(myrpt->cmdnode,l->name))
 					myrpt->cmdnode[0] = 0;
 				rpt_mutex_unlock(&myrpt->lock);
@@ -20686,15 +22955,17 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				}
 				/* hang-up on call to device */
 				ast_hangup(l->pchan);
+				rpt_link_destroy(l);
 				ast_free(l);
                                 rpt_mutex_lock(&myrpt->lock);
 				break;
 			}
-            if ((!l->chan) && (!l->disctime) && (!l->outbound))
+            if ((!l->chan) && (!rpt_timer_pending(&l->disctime)) && (!l->outbound))
             {
 		if(debug) ast_log(LOG_NOTICE, "LINKDISC AA\n");
                 /* remove from queue */
                 remque((struct qelem *) l);
+                myrpt->waitsetdirty = 1;
 		if (myrpt->links.next==&myrpt->links) channel_revert(myrpt);
                 if (!strcmp(myrpt->cmdnode,l->name))myrpt->cmdnode[0] = 0;
                 rpt_mutex_unlock(&myrpt->lock);
@@ -20712,24 +22983,20 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		dodispgm(myrpt,l->name);
                 /* hang-up on call to device */
                 ast_hangup(l->pchan);
+		rpt_link_destroy(l);
                 ast_free(l);
                 rpt_mutex_lock(&myrpt->lock);
                 break;
             }
 			l = l->next;
 		}
-		if (myrpt->linkposttimer)
-		{
-			myrpt->linkposttimer -= elap;
-			if (myrpt->linkposttimer < 0) myrpt->linkposttimer = 0;
-		}
-		if (myrpt->linkposttimer <= 0)
+		if (!rpt_timer_pending(&myrpt->linkposttimer))
 		{
 			int nstr;
 			char lst,*str;
 			time_t now;
 
-			myrpt->linkposttimer = LINKPOSTTIME;
+			rpt_timer_arm(&myrpt->twheel,&myrpt->linkposttimer,LINKPOSTTIME);
 			nstr = 0;
 			for(l = myrpt->links.next; l != &myrpt->links; l = l->next)
 			{
@@ -20780,18 +23047,13 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			myrpt->deferid = 0;
 			queue_id(myrpt);
 		}
-		if (myrpt->keyposttimer)
-		{
-			myrpt->keyposttimer -= elap;
-			if (myrpt->keyposttimer < 0) myrpt->keyposttimer = 0;
-		}
-		if (myrpt->keyposttimer <= 0)
+		if (!rpt_timer_pending(&myrpt->keyposttimer))
 		{
 			char str[100];
 			int n = 0;
 			time_t now;
 
-			myrpt->keyposttimer = KEYPOSTTIME;
+			rpt_timer_arm(&myrpt->twheel,&myrpt->keyposttimer,KEYPOSTTIME);
 			time(&now);
 			if (myrpt->lastkeyedtime)
 			{
@@ -20806,17 +23068,8 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			myrpt->dailytxtime += elap;
 			myrpt->totaltxtime += elap;
 		}
-		i = myrpt->tailtimer;
-		if (myrpt->tailtimer) myrpt->tailtimer -= elap;
-		if (myrpt->tailtimer < 0) myrpt->tailtimer = 0;
-		if((i) && (myrpt->tailtimer == 0))
-			myrpt->tailevent = 1;
 		if ((!myrpt->p.s[myrpt->p.sysstate_cur].totdisable) && myrpt->totimer) myrpt->totimer -= elap;
 		if (myrpt->totimer < 0) myrpt->totimer = 0;
-		if (myrpt->idtimer) myrpt->idtimer -= elap;
-		if (myrpt->idtimer < 0) myrpt->idtimer = 0;
-		if (myrpt->tmsgtimer) myrpt->tmsgtimer -= elap;
-		if (myrpt->tmsgtimer < 0) myrpt->tmsgtimer = 0;
 		if (myrpt->voxtotimer) myrpt->voxtotimer -= elap;
 		if (myrpt->voxtotimer < 0) myrpt->voxtotimer = 0;
 		if (myrpt->keyed) myrpt->lastkeytimer = KEYTIMERTIME;
@@ -20851,12 +23104,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		}
 		do_dtmf_local(myrpt,0);
 		/* Execute scheduler appx. every 2 tenths of a second */
-		if (myrpt->skedtimer <= 0){
-			myrpt->skedtimer = 200;
+		if (!rpt_timer_pending(&myrpt->skedtimer)){
+			rpt_timer_arm(&myrpt->twheel,&myrpt->skedtimer,200);
 			do_scheduler(myrpt);
 		}
-		else
-			myrpt->skedtimer -=elap;
 		if (!ms) 
 		{
 			rpt_mutex_unlock(&myrpt->lock);
@@ -20877,7 +23128,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			ci.chan = 0;
 
 			/* first put the channel on the conference in announce mode */
-			if (ioctl(myrpt->parrotchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+			if (rpt_setconf(myrpt->parrotchannel,&ci) == -1)
 			{
 				ast_log(LOG_WARNING, "Unable to set conference mode for parrot\n");
 				break;
@@ -20990,7 +23241,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							myrpt->linkactivitytimer = 0;
 							myrpt->keyed = 1;
 							time(&myrpt->lastkeyedtime);
-							myrpt->keyposttimer = KEYPOSTSHORTTIME;
+							rpt_timer_arm(&myrpt->twheel,&myrpt->keyposttimer,KEYPOSTSHORTTIME);
 						}
 						myrpt->lastrxburst = i;
 					}
@@ -21009,7 +23260,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						myrpt->linkactivitytimer = 0;
 						myrpt->keyed = 1;
 						time(&myrpt->lastkeyedtime);
-						myrpt->keyposttimer = KEYPOSTSHORTTIME;
+						rpt_timer_arm(&myrpt->twheel,&myrpt->keyposttimer,KEYPOSTSHORTTIME);
 					}
 				}
 #ifdef	_MDC_DECODE_H_
@@ -21266,7 +23517,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							myrpt->linkactivitytimer = 0;
 							myrpt->keyed = 1;
 							time(&myrpt->lastkeyedtime);
-							myrpt->keyposttimer = KEYPOSTSHORTTIME;
+							rpt_timer_arm(&myrpt->twheel,&myrpt->keyposttimer,KEYPOSTSHORTTIME);
 						}
 					}
 					if (myrpt->p.archivedir)
@@ -21385,7 +23636,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					}
 					myrpt->localoverride = 0;
 					time(&myrpt->lastkeyedtime);
-					myrpt->keyposttimer = KEYPOSTSHORTTIME;
+					rpt_timer_arm(&myrpt->twheel,&myrpt->keyposttimer,KEYPOSTSHORTTIME);
 					myrpt->lastdtmfuser[0] = 0;
 					strcpy(myrpt->lastdtmfuser,myrpt->curdtmfuser);
 					myrpt->curdtmfuser[0] = 0;
@@ -21548,7 +23799,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			}
 			if (f->frametype == AST_FRAME_VOICE)
 			{
-				struct ast_frame *f1;
+				struct ast_frame *f1,*fz;
 
 				if (myrpt->p.duplex < 2)
 				{
@@ -21559,10 +23810,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						    x = 0;
 						    AST_LIST_TRAVERSE(&myrpt->txq, f1,
 							frame_list) x++;
+						    fz = NULL;
 						    for(;x < myrpt->p.simplexpatchdelay; x++)
 						    {
-								f1 = ast_frdup(f);
-								memset(AST_FRAME_DATAP(f1),0,f1->datalen);
+								if (!(f1 = rpt_frsilence(f,&fz))) break;
 								memset(&f1->frame_list,0,sizeof(f1->frame_list));
 								AST_LIST_INSERT_TAIL(&myrpt->txq,f1,frame_list);
 						    }
@@ -21615,7 +23866,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			int remnomute,remrx;
 			struct timeval now;
 
-			if (l->disctime)
+			if (rpt_timer_pending(&l->disctime))
 			{
 				l = l->next;
 				continue;
@@ -21694,19 +23945,21 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						if ((!l->disced) && (!l->outbound))
 						{
 							if ((l->name[0] <= '0') || (l->name[0] > '9') || l->isremote)
-								l->disctime = 1;
+								rpt_timer_arm(&myrpt->twheel,&l->disctime,1);
 							else
-								l->disctime = DISC_TIME;
+								rpt_timer_arm(&myrpt->twheel,&l->disctime,DISC_TIME);
 							rpt_mutex_lock(&myrpt->lock);
 							ast_hangup(l->chan);
 							l->chan = 0;
+							myrpt->waitsetdirty = 1;
 							break;
 						}
 	
-						if (l->retrytimer) 
+						if (rpt_timer_pending(&l->retrytimer)) 
 						{
 							ast_hangup(l->chan);
 							l->chan = 0;
+							myrpt->waitsetdirty = 1;
 							rpt_mutex_lock(&myrpt->lock);
 							break; 
 						}
@@ -21715,9 +23968,11 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							rpt_mutex_lock(&myrpt->lock);
 							if (l->chan) ast_hangup(l->chan);
 							l->chan = 0;
+							myrpt->waitsetdirty = 1;
 							l->hasconnected = 1;
-							l->retrytimer = RETRY_TIMER_MS;
+							rpt_timer_arm(&myrpt->twheel,&l->retrytimer,RETRY_TIMER_MS);
 							l->elaptime = 0;
+							rpt_timer_arm(&myrpt->twheel,&l->conntimer,MAXCONNECTTIME);
 							l->connecttime = 0;
 							l->thisconnected = 0;
 							break;
@@ -21726,6 +23981,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					rpt_mutex_lock(&myrpt->lock);
 					/* remove from queue */
 					remque((struct qelem *) l);
+					myrpt->waitsetdirty = 1;
 					if (!strcmp(myrpt->cmdnode,l->name))
 						myrpt->cmdnode[0] = 0;
 					__kickshort(myrpt);
@@ -21752,6 +24008,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					/* hang-up on call to device */
 					ast_hangup(l->chan);
 					ast_hangup(l->pchan);
+					rpt_link_destroy(l);
 					ast_free(l);
 					rpt_mutex_lock(&myrpt->lock);
 					break;
@@ -21800,12 +24057,12 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						}
 					}
 
-					l->rxlingertimer = ((l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
+					rpt_timer_arm(&myrpt->twheel,&l->rxlingertimer,(l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
 
 					if ((l->newkey == 2) && (!l->lastrealrx))
 					{
 						l->lastrealrx = 1;
-						l->rerxtimer = 0;
+						rpt_timer_cancel(&l->rerxtimer);
 						if (!l->lastrx1)
 						{
 							if (myrpt->p.archivedir)
@@ -21833,8 +24090,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 								if (debug)ast_log(LOG_DEBUG,"Link Node %s, vox %d\n",l->name,n1);
 								l->wasvox = n1;
 								l->voxtostate = 0;
-								if (n1) l->voxtotimer = myrpt->p.voxtimeout_ms;
-								else l->voxtotimer = 0;
+								rpt_timer_arm(&myrpt->twheel,&l->voxtotimer,(n1) ? myrpt->p.voxtimeout_ms : 0);
 							}
 							if (l->lastrealrx || n1)
 							{
@@ -21843,10 +24099,10 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 								    x = 0;
 								    AST_LIST_TRAVERSE(&l->rxq, f1,
 									frame_list) x++;
+								    fz = NULL;
 								    for(;x < myrpt->p.simplexphonedelay; x++)
 									{
-										f1 = ast_frdup(f);
-										memset(AST_FRAME_DATAP(f1),0,f1->datalen);
+										if (!(f1 = rpt_frsilence(f,&fz))) break;
 										memset(&f1->frame_list,0,sizeof(f1->frame_list));
 										AST_LIST_INSERT_TAIL(&l->rxq,
 											f1,frame_list);
@@ -21968,6 +24224,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						l->hasconnected = 1;
 						l->thisconnected = 1;
 						l->elaptime = -1;
+						rpt_timer_cancel(&l->conntimer);
 						if (!l->phonemode) send_newkey(l->chan);
 						if (!l->isremote) l->retries = 0;
 						if (!lconnected) 
@@ -21996,7 +24253,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					{
 						if (debug == 7 ) printf("@@@@ rx key\n");
 						l->lastrealrx = 1;
-						l->rerxtimer = 0;
+						rpt_timer_cancel(&l->rerxtimer);
 						if (!l->lastrx1)
 						{
 							if (myrpt->p.archivedir)
@@ -22017,7 +24274,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 
 						if (debug == 7) printf("@@@@ rx un-key\n");
 						l->lastrealrx = 0;
-						l->rerxtimer = 0;
+						rpt_timer_cancel(&l->rerxtimer);
 						if (l->lastrx1)
 						{
 							if (myrpt->p.archivedir)
@@ -22046,18 +24303,20 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 							if ((!l->outbound) && (!l->disced))
 							{
 								if ((l->name[0] <= '0') || (l->name[0] > '9') || l->isremote)
-									l->disctime = 1;
+									rpt_timer_arm(&myrpt->twheel,&l->disctime,1);
 								else
-									l->disctime = DISC_TIME;
+									rpt_timer_arm(&myrpt->twheel,&l->disctime,DISC_TIME);
 								rpt_mutex_lock(&myrpt->lock);
 								ast_hangup(l->chan);
 								l->chan = 0;
+								myrpt->waitsetdirty = 1;
 								break;
 							}
-							if (l->retrytimer) 
+							if (rpt_timer_pending(&l->retrytimer)) 
 							{
 								if (l->chan) ast_hangup(l->chan);
 								l->chan = 0;
+								myrpt->waitsetdirty = 1;
 								rpt_mutex_lock(&myrpt->lock);
 								break;
 							}
@@ -22066,9 +24325,11 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 								rpt_mutex_lock(&myrpt->lock);
 								if (l->chan) ast_hangup(l->chan);
 								l->chan = 0;
+								myrpt->waitsetdirty = 1;
 								l->hasconnected = 1;
 								l->elaptime = 0;
-								l->retrytimer = RETRY_TIMER_MS;
+								rpt_timer_arm(&myrpt->twheel,&l->conntimer,MAXCONNECTTIME);
+								rpt_timer_arm(&myrpt->twheel,&l->retrytimer,RETRY_TIMER_MS);
 								l->connecttime = 0;
 								l->thisconnected = 0;
 								break;
@@ -22077,6 +24338,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						rpt_mutex_lock(&myrpt->lock);
 						/* remove from queue */
 						remque((struct qelem *) l);
+						myrpt->waitsetdirty = 1;
 						if (!strcmp(myrpt->cmdnode,l->name))
 							myrpt->cmdnode[0] = 0;
 						__kickshort(myrpt);
@@ -22103,6 +24365,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						/* hang-up on call to device */
 						ast_hangup(l->chan);
 						ast_hangup(l->pchan);
+						rpt_link_destroy(l);
 						ast_free(l);
 						rpt_mutex_lock(&myrpt->lock);
 						break;
@@ -22198,11 +24461,12 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				{
 					write(myrpt->outstreampipe[1],AST_FRAME_DATAP(f),f->datalen);
 				}
-				fs = ast_frdup(f);
+				fs = f;
 				fac = 1.0;
 				if (l->chan && (!strncasecmp(l->chan->name,"echolink",8)))
 					fac = myrpt->p.etxgain;
-				if (fac != 1.0)
+				/* only the gain adjusted audio needs a copy of its own */
+				if ((fac != 1.0) && (fs = ast_frdup(f)))
 				{
 					sp = (short *)AST_FRAME_DATAP(fs);
 					for(x1 = 0; x1 < fs->datalen / 2; x1++)
@@ -22224,7 +24488,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						if (l->chan && 
 						    (!strncasecmp(l->chan->name,"irlp",4)))
 						{
-							ast_write(l->chan,fs);
+							ast_write(l->chan,(fs) ? fs : f);
 						} 
 						else
 						{
@@ -22233,7 +24497,7 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					    }
 					l = l->next;
 				}
-				ast_frfree(fs);
+				if (fs && (fs != f)) ast_frfree(fs);
 			}
 			if (f->frametype == AST_FRAME_CONTROL)
 			{
@@ -22437,18 +24701,30 @@ char tmpstr[512],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 		struct rpt_link *ll = l;
 		/* remove from queue */
 		remque((struct qelem *) l);
+		myrpt->waitsetdirty = 1;
 		/* hang-up on call to device */
 		if (l->chan) ast_hangup(l->chan);
 		ast_hangup(l->pchan);
+		rpt_link_destroy(ll);
 		l = l->next;
 		ast_free(ll);
 	}
 	if (myrpt->xlink  == 1) myrpt->xlink = 2;
+	ast_waitset_free(myrpt->waitset);
+	myrpt->waitset = NULL;
+	rpt_linksnap_swap(myrpt,NULL);
 	rpt_mutex_unlock(&myrpt->lock);
 	if (debug) printf("@@@@ rpt:Hung up channel\n");
-	myrpt->rpt_thread = AST_PTHREADT_STOP;
 	if (myrpt->outstreampid) kill(myrpt->outstreampid,SIGTERM);
 	myrpt->outstreampid = 0;
+	/* a deleted node's slot may be reused once we are gone, so its
+	   telemetry workers (and their channels) and its mixer go with us */
+	if (myrpt->deleted)
+	{
+		rpt_telepool_stop(myrpt);
+		rpt_mix_free(myrpt);
+	}
+	myrpt->rpt_thread = AST_PTHREADT_STOP;
 	pthread_exit(NULL); 
 	return NULL;
 }
@@ -22521,6 +24797,11 @@ char *this,*val;
 		ast_mutex_init(&rpt_vars[n].lock);
 		ast_mutex_init(&rpt_vars[n].remlock);
 		ast_mutex_init(&rpt_vars[n].statpost_lock);
+		rpt_twheel_init(&rpt_vars[n].twheel);
+		ast_mutex_init(&rpt_vars[n].linksnaplock);
+		ast_mutex_init(&rpt_vars[n].telemcachelock);
+		ast_mutex_init(&rpt_vars[n].telepool.lock);
+		ast_cond_init(&rpt_vars[n].telepool.cond,NULL);
 		rpt_vars[n].tele.next = &rpt_vars[n].tele;
 		rpt_vars[n].tele.prev = &rpt_vars[n].tele;
 		rpt_vars[n].rpt_thread = AST_PTHREADT_NULL;
@@ -22708,7 +24989,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	char *options,*stringp,*callstr,*tele,c,*altp,*memp;
 	char sx[320],*sy,myfirst,*b,*b1;
 	struct	rpt *myrpt;
-	struct ast_frame *f,*f1,*f2;
+	struct ast_frame *f,*f1,*f2,*fz;
 	struct ast_channel *who;
 	struct ast_channel *cs[20];
 	struct	rpt_link *l;
@@ -23421,6 +25702,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		}
 		/* zero the silly thing */
 		memset((char *)l,0,sizeof(struct rpt_link));
+		rpt_link_init(l);
 		l->mode = 1;
 		strncpy(l->name,b1,MAXNODESTR - 1);
 		l->isremote = 0;
@@ -23436,14 +25718,11 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		l->lastf2 = NULL;
 		l->dtmfed = 0;
 		l->gott = 0;
-		l->rxlingertimer = ((l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
-		l->newkeytimer = NEWKEYTIME;
 		l->newkey = 0;
 		l->iaxkey = 0;
 		if ((!phone_mode) && (l->name[0] != '0') &&
 		    strncasecmp(chan->name,"echolink",8) && 
 			strncasecmp(chan->name,"tlb",3)) l->newkey = 2;
-		if (l->name[0] > '9') l->newkeytimer = 0;
 		voxinit_link(l,1);
 		if (!strncasecmp(chan->name,"echolink",8)) 
 			init_linkmode(myrpt,l,LINKMODE_ECHOLINK);
@@ -23455,7 +25734,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		ast_set_write_format(l->chan,AST_FORMAT_SLINEAR);
 		gettimeofday(&myrpt->lastlinktime,NULL);
 		/* allocate a pseudo-channel thru asterisk */
-		l->pchan = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+		l->pchan = rpt_request_pseudo(myrpt);
 		if (!l->pchan)
 		{
 			fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -23473,7 +25752,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		ci.confno = myrpt->conf;
 		ci.confmode = DAHDI_CONF_CONF | DAHDI_CONF_LISTENER | DAHDI_CONF_TALKER;
 		/* first put the channel on the conference in proper mode */
-		if (ioctl(l->pchan->fds[0],DAHDI_SETCONF,&ci) == -1)
+		if (rpt_setconf(l->pchan,&ci) == -1)
 		{
 			ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 			pthread_exit(NULL);
@@ -23481,8 +25760,12 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		rpt_mutex_lock(&myrpt->lock);
 		if ((phone_mode == 2) && (!phone_vox)) l->lastrealrx = 1;
 		l->max_retries = MAX_RETRIES;
+		rpt_timer_arm(&myrpt->twheel,&l->rxlingertimer,(l->iaxkey) ? RX_LINGER_TIME_IAXKEY : RX_LINGER_TIME);
+		if (l->name[0] <= '9') rpt_timer_arm(&myrpt->twheel,&l->newkeytimer,NEWKEYTIME);
+		rpt_timer_arm(&myrpt->twheel,&l->conntimer,MAXCONNECTTIME);
 		/* insert at end of queue */
 		insque((struct qelem *)l,(struct qelem *)myrpt->links.next);
+		myrpt->waitsetdirty = 1;
 		__kickshort(myrpt);
 		gettimeofday(&myrpt->lastlinktime,NULL);
 		rpt_mutex_unlock(&myrpt->lock);
@@ -23641,6 +25924,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 		}
 	}
 	rpt_mutex_lock(&myrpt->lock);
+	rpt_mix_select(myrpt);
 	tele = strchr(myrpt->rxchanname,'/');
 	if (!tele)
 	{
@@ -23733,7 +26017,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	i = 3;
 	ast_channel_setoption(myrpt->rxchannel,AST_OPTION_TONE_VERIFY,&i,sizeof(char),0);
 	/* allocate a pseudo-channel thru asterisk */
-	myrpt->pchannel = ast_request(DAHDI_CHANNEL_NAME,AST_FORMAT_SLINEAR,"pseudo",NULL);
+	myrpt->pchannel = rpt_request_pseudo(myrpt);
 	if (!myrpt->pchannel)
 	{
 		fprintf(stderr,"rpt:Sorry unable to obtain pseudo channel\n");
@@ -23757,7 +26041,7 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 	ci.confno = -1; /* make a new conf */
 	ci.confmode = DAHDI_CONF_CONFANNMON ;
 	/* first put the channel on the conference in announce/monitor mode */
-	if (ioctl(myrpt->pchannel->fds[0],DAHDI_SETCONF,&ci) == -1)
+	if (rpt_setconf(myrpt->pchannel,&ci) == -1)
 	{
 		ast_log(LOG_WARNING, "Unable to set conference mode to Announce\n");
 		rpt_mutex_unlock(&myrpt->lock);
@@ -24341,10 +26625,10 @@ static int rpt_exec(struct ast_channel *chan, void *data)
 						    x = 0;
 						    AST_LIST_TRAVERSE(&myrpt->rxq, f1,
 							frame_list) x++;
+						    fz = NULL;
 						    for(;x < myrpt->p.simplexphonedelay; x++)
 						    {
-							f1 = ast_frdup(f);
-							memset(AST_FRAME_DATAP(f1),0,f1->datalen);
+							if (!(f1 = rpt_frsilence(f,&fz))) break;
 							memset(&f1->frame_list,0,sizeof(f1->frame_list));
 							AST_LIST_INSERT_TAIL(&myrpt->rxq,
 								f1,frame_list);
@@ -24839,15 +27123,10 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 	struct rpt *myrpt;
 	struct ast_var_t *newvariable;
 	char *connstate;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	struct rpt_linksnap *snap;
+	struct rpt_linksnap_ent *e;
 	const char *node = astman_get_header(m, "Node");
 
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
 
 	char *parrot_ena, *sys_ena, *tot_ena, *link_ena, *patch_ena, *patch_state;
 	char *sch_ena, *user_funs, *tail_type, *iconns, *tot_state, *ider_state, *tel_mode; 
@@ -24957,42 +27236,21 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 			}
 
 
-//### GET CONNECTED NODE INFO ####################
-			// Traverse the list of connected nodes 
-
-			__mklinklist(myrpt,NULL,lbuf,0);
-
-			j = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\r\n");
-					rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-					return -1;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strlcpy(s->name, l->name, MAXNODESTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
 			rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-			for(s = s_head.next; s != &s_head; s = s->next){
+
+//### GET CONNECTED NODE INFO ####################
+			// Traverse the list of connected nodes, from the published
+			// snapshot so no lock is needed
+			snap = rpt_linksnap_get(myrpt);
+			rpt_linksnap_mklinklist(snap,lbuf,0);
+			for(j = 0; snap && (j < snap->n); j++){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				long long connecttime;
 				char conntime[21];
+				e = &snap->ent[j];
+				if (e->name[0] == '0') // Skip '0' nodes 
+					continue;
+				connecttime = rpt_linksnap_conntime(snap,e);
 				hours = connecttime/3600000L;
 				connecttime %= 3600000L;
 				minutes = connecttime/60000L;
@@ -25002,21 +27260,14 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 				snprintf(conntime, 20, "%02d:%02d:%02d",
 					hours, minutes, seconds);
 				conntime[20] = 0;
-				if(s->thisconnected)
+				if(e->thisconnected)
 					connstate  = "ESTABLISHED";
 				else
 					connstate = "CONNECTING";
 				astman_append(ses, "Conn: %-10s%-20s%-12d%-11s%-20s%-20s\r\n",
-					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
-			}	
-			// destroy our local link queue 
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
+					e->name, e->peer, e->reconnects, (e->outbound)? "OUT":"IN", conntime, connstate);
 			}	
+			rpt_linksnap_put(snap);
 
 			astman_append(ses,"LinkedNodes: ");
 //### GET ALL LINKED NODES INFO ####################
@@ -25082,7 +27333,7 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 	int totalkerchunks, dailykeyups, totalkeyups, timeouts;
 	int totalexecdcommands, dailyexecdcommands, hours, minutes, seconds;
 	long long totaltxtime;
-	struct	rpt_link *l;
+	struct	rpt_linksnap *snap;
 	char *listoflinks[MAX_STAT_LINKS];	
 	char *lastdtmfcommand,*parrot_ena;
 	char *tot_state, *ider_state, *patch_state;
@@ -25206,42 +27457,42 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 
 			/* ELSE Process as a repeater node */
 			/* Make a copy of all stat variables while locked */
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			dailytxtime = myrpt->dailytxtime;
-			totaltxtime = myrpt->totaltxtime;
-			dailykeyups = myrpt->dailykeyups;
-			totalkeyups = myrpt->totalkeyups;
-			dailykerchunks = myrpt->dailykerchunks;
-			totalkerchunks = myrpt->totalkerchunks;
-			dailyexecdcommands = myrpt->dailyexecdcommands;
-			totalexecdcommands = myrpt->totalexecdcommands;
-			timeouts = myrpt->timeouts;
-
-
-			/* Traverse the list of connected nodes */
+			/* Traverse the list of connected nodes (no need to lock for that) */
 			reverse_patch_state = "DOWN";
 			numoflinks = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
+			snap = rpt_linksnap_get(myrpt);
+			for(j = 0; snap && (j < snap->n); j++){
 				if(numoflinks >= MAX_STAT_LINKS){
 					ast_log(LOG_NOTICE,
 					"maximum number of links exceeds %d in rpt_do_stats()!",MAX_STAT_LINKS);
 					break;
 				}
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
+				if (snap->ent[j].name[0] == '0'){ /* Skip '0' nodes */
 					reverse_patch_state = "UP";
-					l = l->next;
 					continue;
 				}
-				listoflinks[numoflinks] = ast_strdup(l->name);
+				listoflinks[numoflinks] = ast_strdup(snap->ent[j].name);
 				if(listoflinks[numoflinks] == NULL){
 					break;
 				}
 				else{
 					numoflinks++;
 				}
-				l = l->next;
 			}
+			rpt_linksnap_put(snap);
+
+			rpt_mutex_lock(&myrpt->lock); /* LOCK */
+			dailytxtime = myrpt->dailytxtime;
+			totaltxtime = myrpt->totaltxtime;
+			dailykeyups = myrpt->dailykeyups;
+			totalkeyups = myrpt->totalkeyups;
+			dailykerchunks = myrpt->dailykerchunks;
+			totalkerchunks = myrpt->totalkerchunks;
+			dailyexecdcommands = myrpt->dailyexecdcommands;
+			totalexecdcommands = myrpt->totalexecdcommands;
+			timeouts = myrpt->timeouts;
+
+
 
 			if(myrpt->keyed)
 				input_signal = "YES";
@@ -25761,11 +28012,24 @@ static int unload_module(void)
 
 	daq_uninit();
 
+	rpt_nodedb_cleanup();
+	for(i = 0; i < nrpts; i++)
+		rpt_telepool_stop(&rpt_vars[i]);
+	rpt_mix_cleanup();
+
 	for(i = 0; i < nrpts; i++) {
 		if (!strcmp(rpt_vars[i].name,rpt_vars[i].p.nodes)) continue;
                 ast_mutex_destroy(&rpt_vars[i].lock);
                 ast_mutex_destroy(&rpt_vars[i].remlock);
+		ast_mutex_destroy(&rpt_vars[i].twheel.lock);
+		rpt_telem_flush(&rpt_vars[i]);
+		ast_mutex_destroy(&rpt_vars[i].linksnaplock);
+		ast_mutex_destroy(&rpt_vars[i].telemcachelock);
+		ast_mutex_destroy(&rpt_vars[i].telepool.lock);
+		ast_cond_destroy(&rpt_vars[i].telepool.cond);
 	}
+	for(i = 0; i < nrpts; i++)
+		rpt_functrie_free(&rpt_vars[i]);
 	res = ast_unregister_application(app);
 #ifdef	_MDC_ENCODE_H_
 	res |= ast_unregister_application(app);
@@ -25943,13 +28207,25 @@ char	*val,*this;
 		}
 		if (n >= nrpts) /* no such node, yet */
 		{
-			/* find an empty hole or the next one */
-			for(n = 0; n < nrpts; n++) if (rpt_vars[n].deleted) break;
+			/* find an empty hole or the next one.  A deleted node's
+			   hole is only empty once its rpt thread is gone */
+			for(n = 0; n < nrpts; n++)
+			{
+				if (!rpt_vars[n].deleted) continue;
+				if ((rpt_vars[n].rpt_thread == AST_PTHREADT_STOP) ||
+				    (rpt_vars[n].rpt_thread == AST_PTHREADT_NULL)) break;
+			}
 			if (n >= MAXRPTS)
 			{
 				ast_log(LOG_ERROR,"Attempting to add repeater node %s would exceed max. number of repeaters (%d)\n",this,MAXRPTS);
 				continue;
 			}
+			/* remotes have no rpt thread to have done this */
+			if (n < nrpts)
+			{
+				rpt_telepool_stop(&rpt_vars[n]);
+				rpt_mix_free(&rpt_vars[n]);
+			}
 			memset(&rpt_vars[n],0,sizeof(rpt_vars[n]));
 			rpt_vars[n].name = ast_strdup(this);
 			val = (char *) ast_variable_retrieve(cfg,this,"rxchannel");
@@ -25971,6 +28247,11 @@ char	*val,*this;
 			ast_mutex_init(&rpt_vars[n].lock);
 			ast_mutex_init(&rpt_vars[n].remlock);
 			ast_mutex_init(&rpt_vars[n].statpost_lock);
+			rpt_twheel_init(&rpt_vars[n].twheel);
+			ast_mutex_init(&rpt_vars[n].linksnaplock);
+			ast_mutex_init(&rpt_vars[n].telemcachelock);
+			ast_mutex_init(&rpt_vars[n].telepool.lock);
+			ast_cond_init(&rpt_vars[n].telepool.cond,NULL);
 			rpt_vars[n].tele.next = &rpt_vars[n].tele;
 			rpt_vars[n].tele.prev = &rpt_vars[n].tele;
 			rpt_vars[n].rpt_thread = AST_PTHREADT_NULL;
@@ -25985,8 +28266,9 @@ char	*val,*this;
 	for(n = 0; n < nrpts; n++)
 	{
 		if (rpt_vars[n].reload1) continue;
-		if (rpt_vars[n].rxchannel) ast_softhangup(rpt_vars[n].rxchannel,AST_SOFTHANGUP_DEV);
+		/* set first, rpt() looks at it on the way out */
 		rpt_vars[n].deleted = 1;
+		if (rpt_vars[n].rxchannel) ast_softhangup(rpt_vars[n].rxchannel,AST_SOFTHANGUP_DEV);
 	}
 	for(n = 0; n < nrpts; n++) if (!rpt_vars[n].deleted) rpt_vars[n].reload = 1;
 	ast_mutex_unlock(&rpt_master_lock);
@@ -164,6 +164,10 @@ ASTERISK_FILE_VERSION(__FILE__,"$Revision$")
 #define	EL_APRS_SERVER "aprs.echolink.org"
 #define	EL_APRS_INTERVAL 600
 #define	EL_APRS_START_DELAY 10
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define	EL_HAVE_SENDMMSG
+#endif
 #define	GPSFILE "/tmp/gps.dat"
 #define	GPS_VALID_SECS 60
 
@@ -232,6 +236,20 @@ struct el_node {
    struct el_pvt *p;
    struct ast_channel *chan;
    char outbound;
+   struct sockaddr_in sin; /* audio address, resolved when added */
+};
+
+#define	EL_FANOUT_ALL 0
+#define	EL_FANOUT_ALL_BUT_ONE 1
+#define	EL_FANOUT_ONLY_ONE 2
+
+#define	EL_RTP_HDR_SIZE offsetof(struct gsmVoice_t,data)
+
+/* one destination of an audio fan-out */
+struct el_fanout {
+	struct el_node *node;
+	unsigned char hdr[EL_RTP_HDR_SIZE];	/* RTP header, with their seqnum */
+	struct iovec iov[2];
 };
 
 struct el_pending {
@@ -289,21 +307,41 @@ struct el_instance
 	char login_display[EL_NAME_SIZE + EL_CALL_SIZE + 1];
 	char aprs_display[EL_APRS_SIZE + 1];
 	pthread_t el_reader_thread;
+	/* audio fan-out destinations, must be used with lock locked */
+	struct el_fanout *fanout;
+#ifdef	EL_HAVE_SENDMMSG
+	struct mmsghdr *fanmsgs;
+#endif
+	int nfanout;
+	int maxfanout;
+	int fanout_mode;
+	/* receive queue totals, for echolink show stats */
+	unsigned long rxqast_frames;
+	unsigned long rxqast_overflows;
+	unsigned long rxqel_frames;
+	unsigned long rxqel_overflows;
 } ;
 
 struct el_rxqast {
-	struct el_rxqast *qe_forw;
-	struct el_rxqast *qe_back;
 	char buf[GSM_FRAME_SIZE];
 };
 
 struct el_rxqel {
-        struct el_rxqel *qe_forw;
-        struct el_rxqel *qe_back;
         char buf[BLOCKING_FACTOR * GSM_FRAME_SIZE];
         char fromip[EL_IP_SIZE + 1];
 };
 
+/* fixed size receive queue (ring) bookkeeping, the entries themselves
+   live in an array next to it. When full, the oldest entry is dropped.
+   must be used with instp->lock locked */
+struct el_rxq {
+	int head;	/* oldest entry */
+	int depth;
+	int size;
+	int maxdepth;
+	unsigned long overflows;
+};
+
 struct el_pvt {
 	struct ast_channel *owner;
 	struct el_instance *instp;
@@ -315,8 +353,10 @@ struct el_pvt {
 	int keepalive;
 	struct ast_frame fr;	
 	int txindex;
-	struct el_rxqast rxqast;
-        struct el_rxqel rxqel;
+	struct el_rxqast rxqast[QUEUE_OVERLOAD_THRESHOLD_AST];
+	struct el_rxq rxqastq;
+        struct el_rxqel rxqel[QUEUE_OVERLOAD_THRESHOLD_EL];
+	struct el_rxq rxqelq;
 	char firstsent;
 	char firstheard;
 	struct ast_dsp *dsp;
@@ -379,6 +419,7 @@ struct eldb {
 
 AST_MUTEX_DEFINE_STATIC(el_db_lock);
 AST_MUTEX_DEFINE_STATIC(el_count_lock);
+AST_MUTEX_DEFINE_STATIC(el_fanout_lock);
 
 #ifdef	OLD_ASTERISK
 static int usecnt;
@@ -393,6 +434,8 @@ int count_n = 0;
 int count_outbound_n = 0;
 int dummy_outbound = 0;
 struct el_instance *count_instp;
+int count_fd = -1;
+struct el_instance *fanout_instp;
 
 /* binary search tree in memory, root node */
 static void *el_node_list = NULL;
@@ -440,8 +483,7 @@ static int is_rtcp_bye(unsigned char *p, int len);
 static int is_rtcp_sdes(unsigned char *p, int len);
  /* remove binary tree functions if Asterisk has similar functionality */
 static int compare_ip(const void *pa, const void *pb);
-static void send_audio_all_but_one(const void *nodep, const VISIT which, const int depth);
-static void send_audio_all(const void *nodep, const VISIT which, const int depth);
+static void collect_fanout(const void *nodep, const VISIT which, const int depth);
 static void send_heartbeat(const void *nodep, const VISIT which, const int depth);
 static void send_info(const void *nodep, const VISIT which, const int depth);
 static void print_users(const void *nodep, const VISIT which, const int depth);
@@ -482,6 +524,7 @@ static const struct ast_channel_tech el_tech = {
 static int el_do_debug(int fd, int argc, char *argv[]);
 static int el_do_dbdump(int fd, int argc, char *argv[]);
 static int el_do_dbget(int fd, int argc, char *argv[]);
+static int el_do_stats(int fd, int argc, char *argv[]);
 
 static char debug_usage[] =
 "Usage: echolink debug level {0-7}\n"
@@ -495,6 +538,10 @@ static char dbget_usage[] =
 "Usage: echolink dbget <nodename|callsign|ipaddr> <lookup-data>\n"
 "       Looks up echolink db entry\n";
 
+static char stats_usage[] =
+"Usage: echolink show stats\n"
+"       Shows receive queue depths and overflows\n";
+
 #ifndef	NEW_ASTERISK
 
 static struct ast_cli_entry  cli_debug =
@@ -508,6 +555,10 @@ static struct ast_cli_entry  cli_dbget =
         { { "echolink", "dbget" }, el_do_dbget,
 		"Look up echolink db entry", dbget_usage };
 
+static struct ast_cli_entry  cli_stats =
+        { { "echolink", "show", "stats" }, el_do_stats,
+		"Show echolink receive queue stats", stats_usage };
+
 #endif
 
 static void mythread_exit(void *nothing)
@@ -1018,6 +1069,37 @@ static int el_call(struct ast_channel *ast, char *dest, int timeout)
 	return 0;
 }
 
+/* returns the slot to put a new entry in, dropping the oldest one if full.
+   must be called with instp->lock locked */
+static int el_rxq_put(struct el_rxq *q)
+{
+	int i;
+
+	if (q->depth >= q->size)
+	{
+		if (++q->head >= q->size) q->head = 0;
+		q->depth--;
+		q->overflows++;
+	}
+	i = q->head + q->depth++;
+	if (i >= q->size) i -= q->size;
+	if (q->depth > q->maxdepth) q->maxdepth = q->depth;
+	return(i);
+}
+
+/* returns the slot of the oldest entry and takes it off the queue, or -1 if empty.
+   must be called with instp->lock locked (and the entry used before unlocking) */
+static int el_rxq_get(struct el_rxq *q)
+{
+	int i;
+
+	if (!q->depth) return(-1);
+	i = q->head;
+	if (++q->head >= q->size) q->head = 0;
+	q->depth--;
+	return(i);
+}
+
 static void el_destroy(struct el_pvt *p)
 {
 	if (p->dsp) ast_dsp_free(p->dsp);
@@ -1060,12 +1142,9 @@ static struct el_pvt *el_alloc(void *data)
 		
 		sprintf(stream,"%s-%lu",(char *)data,instances[n]->seqno++);
 		strcpy(p->stream,stream);
-		p->rxqast.qe_forw = &p->rxqast;
-		p->rxqast.qe_back = &p->rxqast;
+		p->rxqastq.size = QUEUE_OVERLOAD_THRESHOLD_AST;
+		p->rxqelq.size = QUEUE_OVERLOAD_THRESHOLD_EL;
 
-                p->rxqel.qe_forw = &p->rxqel;
-                p->rxqel.qe_back = &p->rxqel;
-                
 		p->keepalive = KEEPALIVE_TIME;
 		p->instp = instances[n];
 		p->instp->confp = p;  /* save for conference mode */
@@ -1314,85 +1393,102 @@ static int compare_ip(const void *pa, const void *pb)
    return strncmp(((struct el_node *)pa)->ip,((struct el_node *)pb)->ip,EL_IP_SIZE); 
 }
 
-/* Echolink ---> Echolink */
-void send_audio_all_but_one(const void *nodep, const VISIT which, const int depth) 
+/* add a node to its instance's fan-out if it should get this audio */
+static void collect_fanout(const void *nodep, const VISIT which, const int depth)
 {
-   struct sockaddr_in sin;
-   struct el_instance *instp = (*(struct el_node **)nodep)->instp;
-
-   if ((which == leaf) || (which == postorder)) {
-      if (strncmp((*(struct el_node **)nodep)->ip, instp->el_node_test.ip,EL_IP_SIZE) != 0) {
-         sin.sin_family = AF_INET;
-         sin.sin_port = htons(instp->audio_port);
-         sin.sin_addr.s_addr = inet_addr((*(struct el_node **)nodep)->ip);
-
-         instp->audio_all_but_one.version = 3;
-         instp->audio_all_but_one.pad = 0;
-         instp->audio_all_but_one.ext = 0;
-         instp->audio_all_but_one.csrc = 0;
-         instp->audio_all_but_one.marker = 0;
-         instp->audio_all_but_one.payt = 3;
-         instp->audio_all_but_one.seqnum = htons((*(struct el_node **)nodep)->seqnum++); 
-         instp->audio_all_but_one.time = htonl(0);
-         instp->audio_all_but_one.ssrc = htonl(instp->mynode);
-
-         sendto(instp->audio_sock, (char *)&instp->audio_all_but_one, sizeof(instp->audio_all_but_one),
-                0,(struct sockaddr *)&sin,sizeof(sin));
-      }
-   }
-}
+	struct el_node *node = *(struct el_node **)nodep;
+	struct el_instance *instp = fanout_instp;
+	struct el_fanout *fp;
+	int n;
 
-static void send_audio_only_one(const void *nodep, const VISIT which, const int depth) 
-{
-   struct sockaddr_in sin;
-   struct el_instance *instp = (*(struct el_node **)nodep)->instp;
+	if ((which != leaf) && (which != postorder)) return;
+	if (node->instp != instp) return;
+	n = strncmp(node->ip,instp->el_node_test.ip,EL_IP_SIZE);
+	if ((instp->fanout_mode == EL_FANOUT_ALL_BUT_ONE) && (!n)) return;
+	if ((instp->fanout_mode == EL_FANOUT_ONLY_ONE) && n) return;
+	if (instp->nfanout >= instp->maxfanout)
+	{
+		n = (instp->maxfanout) ? instp->maxfanout * 2 : 16;
+		fp = ast_realloc(instp->fanout,n * sizeof(struct el_fanout));
+		if (!fp) return;
+		instp->fanout = fp;
+#ifdef	EL_HAVE_SENDMMSG
+		{
+			struct mmsghdr *mp;
 
-   if ((which == leaf) || (which == postorder)) {
-      if (strncmp((*(struct el_node **)nodep)->ip, instp->el_node_test.ip,EL_IP_SIZE) == 0) {
-         sin.sin_family = AF_INET;
-         sin.sin_port = htons(instp->audio_port);
-         sin.sin_addr.s_addr = inet_addr((*(struct el_node **)nodep)->ip);
-
-      instp->audio_all.version = 3;
-      instp->audio_all.pad = 0;
-      instp->audio_all.ext = 0;
-      instp->audio_all.csrc = 0;
-      instp->audio_all.marker = 0;
-      instp->audio_all.payt = 3;
-      instp->audio_all.seqnum = htons((*(struct el_node **)nodep)->seqnum++);
-      instp->audio_all.time = htonl(0);
-      instp->audio_all.ssrc = htonl(instp->mynode);
-
-      sendto(instp->audio_sock, (char *)&instp->audio_all, sizeof(instp->audio_all), 
-             0,(struct sockaddr *)&sin,sizeof(sin));
-      }
-   }
+			mp = ast_realloc(instp->fanmsgs,n * sizeof(struct mmsghdr));
+			if (!mp) return;
+			instp->fanmsgs = mp;
+		}
+#endif
+		instp->maxfanout = n;
+	}
+	instp->fanout[instp->nfanout++].node = node;
 }
 
-/* Asterisk ---> Echolink */
-void send_audio_all(const void *nodep, const VISIT which, const int depth)
+/* send an audio packet to the instance's nodes (all of them, all but
+   or only the one in el_node_test), with a single sendmmsg() where
+   available. must be called with instp->lock locked */
+static void send_audio_fanout(struct el_instance *instp, struct gsmVoice_t *pkt, int mode)
 {
-   struct sockaddr_in sin;
-   struct el_instance *instp = (*(struct el_node **)nodep)->instp;
+	struct el_fanout *fp;
+	int i,n;
 
-   if ((which == leaf) || (which == postorder)) {
-      sin.sin_family = AF_INET;
-      sin.sin_port = htons(instp->audio_port);
-      sin.sin_addr.s_addr = inet_addr((*(struct el_node **)nodep)->ip);
+	pkt->version = 3;
+	pkt->pad = 0;
+	pkt->ext = 0;
+	pkt->csrc = 0;
+	pkt->marker = 0;
+	pkt->payt = 3;
+	pkt->seqnum = 0;
+	pkt->time = htonl(0);
+	pkt->ssrc = htonl(instp->mynode);
+
+	ast_mutex_lock(&el_fanout_lock);
+	fanout_instp = instp;
+	instp->fanout_mode = mode;
+	instp->nfanout = 0;
+	twalk(el_node_list, collect_fanout);
+	ast_mutex_unlock(&el_fanout_lock);
+
+	/* everyone shares the payload, only the header (seqnum) differs */
+	for(i = 0; i < instp->nfanout; i++)
+	{
+		fp = &instp->fanout[i];
+		memcpy(fp->hdr,pkt,EL_RTP_HDR_SIZE);
+		((struct gsmVoice_t *)fp->hdr)->seqnum = htons(fp->node->seqnum++);
+		fp->iov[0].iov_base = fp->hdr;
+		fp->iov[0].iov_len = EL_RTP_HDR_SIZE;
+		fp->iov[1].iov_base = pkt->data;
+		fp->iov[1].iov_len = sizeof(pkt->data);
+#ifdef	EL_HAVE_SENDMMSG
+		memset(&instp->fanmsgs[i],0,sizeof(struct mmsghdr));
+		instp->fanmsgs[i].msg_hdr.msg_name = &fp->node->sin;
+		instp->fanmsgs[i].msg_hdr.msg_namelen = sizeof(fp->node->sin);
+		instp->fanmsgs[i].msg_hdr.msg_iov = fp->iov;
+		instp->fanmsgs[i].msg_hdr.msg_iovlen = 2;
+#endif
+	}
+#ifdef	EL_HAVE_SENDMMSG
+	for(i = 0; i < instp->nfanout; i += n)
+	{
+		n = sendmmsg(instp->audio_sock,instp->fanmsgs + i,instp->nfanout - i,0);
+		/* skip past one that cant be sent, like sendto() would */
+		if (n <= 0) n = 1;
+	}
+#else
+	for(i = 0; i < instp->nfanout; i++)
+	{
+		struct msghdr msg;
 
-      instp->audio_all.version = 3;
-      instp->audio_all.pad = 0;
-      instp->audio_all.ext = 0;
-      instp->audio_all.csrc = 0;
-      instp->audio_all.marker = 0;
-      instp->audio_all.payt = 3;
-      instp->audio_all.seqnum = htons((*(struct el_node **)nodep)->seqnum++);
-      instp->audio_all.time = htonl(0);
-      instp->audio_all.ssrc = htonl(instp->mynode);
-
-      sendto(instp->audio_sock, (char *)&instp->audio_all, sizeof(instp->audio_all), 
-             0,(struct sockaddr *)&sin,sizeof(sin));
-   }
+		memset(&msg,0,sizeof(msg));
+		msg.msg_name = &instp->fanout[i].node->sin;
+		msg.msg_namelen = sizeof(struct sockaddr_in);
+		msg.msg_iov = instp->fanout[i].iov;
+		msg.msg_iovlen = 2;
+		sendmsg(instp->audio_sock,&msg,0);
+	}
+#endif
 }
 
 static void print_users(const void *nodep, const VISIT which, const int depth)
@@ -1415,6 +1511,22 @@ static void count_users(const void *nodep, const VISIT which, const int depth)
    }
 }
 
+static void print_rxq_stats(const void *nodep, const VISIT which, const int depth)
+{
+	struct el_node *node = *(struct el_node **)nodep;
+
+	if ((which != leaf) && (which != postorder)) return;
+	if ((node->instp != count_instp) || (!node->p)) return;
+	/* in conference mode they all share the one pvt, so only show it once */
+	if (count_instp->useless_flag_1 && count_n++) return;
+	ast_cli(count_fd,"  %-16s ast %2d/%2d (max %2d, %lu dropped)  el %2d/%2d (max %2d, %lu dropped)\n",
+		(count_instp->useless_flag_1) ? "(conference)" : node->call,
+		node->p->rxqastq.depth,node->p->rxqastq.size,node->p->rxqastq.maxdepth,
+		node->p->rxqastq.overflows,
+		node->p->rxqelq.depth,node->p->rxqelq.size,node->p->rxqelq.maxdepth,
+		node->p->rxqelq.overflows);
+}
+
 static void send_info(const void *nodep, const VISIT which, const int depth)
 {
 	struct sockaddr_in sin;
@@ -1627,9 +1739,7 @@ static int el_xwrite(struct ast_channel *ast, struct ast_frame *frame)
 	struct el_pvt *p = ast->tech_pvt;
 	struct el_instance *instp = p->instp;
 	struct ast_frame fr,*f1, *f2;
-	struct el_rxqast *qpast;
-	int n,m,x;
-        struct el_rxqel *qpel;
+	int n,x;
 	char buf[GSM_FRAME_SIZE + AST_FRIENDLY_OFFSET];
 
 	if (frame->frametype != AST_FRAME_VOICE) return 0;
@@ -1653,76 +1763,64 @@ static int el_xwrite(struct ast_channel *ast, struct ast_frame *frame)
 	}
 
         /* Echolink to Asterisk */
-	if (p->rxqast.qe_forw != &p->rxqast) {
-		for(n = 0,qpast = p->rxqast.qe_forw; qpast != &p->rxqast; qpast = qpast->qe_forw) {
-			n++;
-		}
-		if (n > QUEUE_OVERLOAD_THRESHOLD_AST) {
-			while(p->rxqast.qe_forw != &p->rxqast) {
-				qpast = p->rxqast.qe_forw;
-				remque((struct qelem *)qpast);
-				ast_free(qpast);
-			}
-			if (p->rxkey) p->rxkey = 1;
-		} else {		
-			if (!p->rxkey) {
-				memset(&fr,0,sizeof(fr));
-				fr.datalen = 0;
-				fr.samples = 0;
-				fr.frametype = AST_FRAME_CONTROL;
-				fr.subclass = AST_CONTROL_RADIO_KEY;
-				fr.data =  0;
-				fr.src = type;
-				fr.offset = 0;
-				fr.mallocd=0;
-				fr.delivery.tv_sec = 0;
-				fr.delivery.tv_usec = 0;
-				ast_queue_frame(ast,&fr);
-			} 
-			p->rxkey = MAX_RXKEY_TIME;
-			qpast = p->rxqast.qe_forw;
-			remque((struct qelem *)qpast);
-			memcpy(buf + AST_FRIENDLY_OFFSET,qpast->buf,GSM_FRAME_SIZE);
-			ast_free(qpast);
-
+	ast_mutex_lock(&instp->lock);
+	n = el_rxq_get(&p->rxqastq);
+	if (n >= 0) memcpy(buf + AST_FRIENDLY_OFFSET,p->rxqast[n].buf,GSM_FRAME_SIZE);
+	ast_mutex_unlock(&instp->lock);
+	if (n >= 0) {
+		if (!p->rxkey) {
 			memset(&fr,0,sizeof(fr));
-			fr.datalen = GSM_FRAME_SIZE;
-			fr.samples = 160;
-			fr.frametype = AST_FRAME_VOICE;
-			fr.subclass = AST_FORMAT_GSM;
-			fr.data =  buf + AST_FRIENDLY_OFFSET;
+			fr.datalen = 0;
+			fr.samples = 0;
+			fr.frametype = AST_FRAME_CONTROL;
+			fr.subclass = AST_CONTROL_RADIO_KEY;
+			fr.data =  0;
 			fr.src = type;
-			fr.offset = AST_FRIENDLY_OFFSET;
+			fr.offset = 0;
 			fr.mallocd=0;
 			fr.delivery.tv_sec = 0;
 			fr.delivery.tv_usec = 0;
+			ast_queue_frame(ast,&fr);
+		} 
+		p->rxkey = MAX_RXKEY_TIME;
 
-			x = 0;
-			if (p->dsp && (!instp->useless_flag_1))
-			{
-				f2 = ast_translate(p->xpath,&fr,0);
-				f1 = ast_dsp_process(NULL,p->dsp,f2);
-				ast_frfree(f2);
+		memset(&fr,0,sizeof(fr));
+		fr.datalen = GSM_FRAME_SIZE;
+		fr.samples = 160;
+		fr.frametype = AST_FRAME_VOICE;
+		fr.subclass = AST_FORMAT_GSM;
+		fr.data =  buf + AST_FRIENDLY_OFFSET;
+		fr.src = type;
+		fr.offset = AST_FRIENDLY_OFFSET;
+		fr.mallocd=0;
+		fr.delivery.tv_sec = 0;
+		fr.delivery.tv_usec = 0;
+
+		x = 0;
+		if (p->dsp && (!instp->useless_flag_1))
+		{
+			f2 = ast_translate(p->xpath,&fr,0);
+			f1 = ast_dsp_process(NULL,p->dsp,f2);
+			ast_frfree(f2);
 #ifdef	OLD_ASTERISK
-				if (f1->frametype == AST_FRAME_DTMF)
+			if (f1->frametype == AST_FRAME_DTMF)
 #else
-				if ((f1->frametype == AST_FRAME_DTMF_END) ||
-					(f1->frametype == AST_FRAME_DTMF_BEGIN))
+			if ((f1->frametype == AST_FRAME_DTMF_END) ||
+				(f1->frametype == AST_FRAME_DTMF_BEGIN))
 #endif
+			{
+				if ((f1->subclass != 'm') && (f1->subclass != 'u'))
 				{
-					if ((f1->subclass != 'm') && (f1->subclass != 'u'))
-					{
 #ifndef	OLD_ASTERISK
-						if (f1->frametype == AST_FRAME_DTMF_END)
+					if (f1->frametype == AST_FRAME_DTMF_END)
 #endif
-							if (option_verbose > 3) ast_verbose(VERBOSE_PREFIX_3 "Echolink %s Got DTMF char %c from IP %s\n",p->stream,f1->subclass,p->ip);
-						ast_queue_frame(ast,f1);
-						x = 1;
-					}
+						if (option_verbose > 3) ast_verbose(VERBOSE_PREFIX_3 "Echolink %s Got DTMF char %c from IP %s\n",p->stream,f1->subclass,p->ip);
+					ast_queue_frame(ast,f1);
+					x = 1;
 				}
-			} 
-			if (!x) ast_queue_frame(ast,&fr);
-		}
+			}
+		} 
+		if (!x) ast_queue_frame(ast,&fr);
 	}
 	if (p->rxkey == 1) {
 		memset(&fr,0,sizeof(fr));
@@ -1740,36 +1838,23 @@ static int el_xwrite(struct ast_channel *ast, struct ast_frame *frame)
 	} 
 	if (p->rxkey) p->rxkey--;
 
-        if (instp->useless_flag_1 && (p->rxqel.qe_forw != &p->rxqel))
+	n = -1;
+	if (instp->useless_flag_1)
+	{
+		ast_mutex_lock(&instp->lock);
+		n = el_rxq_get(&p->rxqelq);
+		if (n >= 0)
+		{
+			memcpy(instp->audio_all_but_one.data,p->rxqel[n].buf,BLOCKING_FACTOR * GSM_FRAME_SIZE);
+			ast_copy_string(instp->el_node_test.ip, p->rxqel[n].fromip, sizeof(instp->el_node_test.ip));
+			send_audio_fanout(instp,&instp->audio_all_but_one,EL_FANOUT_ALL_BUT_ONE);
+		}
+		ast_mutex_unlock(&instp->lock);
+	}
+        if (n >= 0)
         {
-           for(m = 0,qpel = p->rxqel.qe_forw; qpel != &p->rxqel; qpel = qpel->qe_forw) 
-              m++;
-
-           if (m > QUEUE_OVERLOAD_THRESHOLD_EL)
-           {
-              while(p->rxqel.qe_forw != &p->rxqel) 
-              {
-                 qpel = p->rxqel.qe_forw;
-                 remque((struct qelem *)qpel);
-                 ast_free(qpel);
-              }
-           } 
-           else 
-           {
-              qpel = p->rxqel.qe_forw;
-              remque((struct qelem *)qpel);
-
-              memcpy(instp->audio_all_but_one.data,qpel->buf,BLOCKING_FACTOR * GSM_FRAME_SIZE);
-              strncpy(instp->el_node_test.ip, qpel->fromip, EL_IP_SIZE+1);
-
-              ast_free(qpel);
-	      ast_mutex_lock(&instp->lock);
-              twalk(el_node_list, send_audio_all_but_one);
-	      ast_mutex_unlock(&instp->lock);
-
               if (instp->fdr >= 0)
                  write(instp->fdr, instp->audio_all_but_one.data, BLOCKING_FACTOR * GSM_FRAME_SIZE);
-           }
         }
         else
         {
@@ -1786,12 +1871,12 @@ static int el_xwrite(struct ast_channel *ast, struct ast_frame *frame)
 		ast_mutex_lock(&instp->lock);
                 if (instp->useless_flag_1)
 		{
-			twalk(el_node_list, send_audio_all);
+			send_audio_fanout(instp,&instp->audio_all,EL_FANOUT_ALL);
 		}
 		else
 		{
 			strcpy(instp->el_node_test.ip,p->ip);
-			twalk(el_node_list, send_audio_only_one);
+			send_audio_fanout(instp,&instp->audio_all,EL_FANOUT_ONLY_ONE);
 		}
 		ast_mutex_unlock(&instp->lock);
                 p->txindex = 0;
@@ -1989,6 +2074,40 @@ static int el_do_dbget(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+/*
+* Show receive queue stats
+*/
+
+static int el_do_stats(int fd, int argc, char *argv[])
+{
+	struct el_instance *instp;
+	int n;
+
+        if (argc != 3)
+                return RESULT_SHOWUSAGE;
+
+	for(n = 0; n < ninstances; n++)
+	{
+		instp = instances[n];
+		ast_mutex_lock(&instp->lock);
+		ast_cli(fd,"Instance %s:\n",instp->name);
+		ast_cli(fd,"  Echolink to Asterisk: %lu frames queued, %lu dropped (queue full)\n",
+			instp->rxqast_frames,instp->rxqast_overflows);
+		if (instp->useless_flag_1)
+			ast_cli(fd,"  Echolink to Echolink: %lu blocks queued, %lu dropped (queue full)\n",
+				instp->rxqel_frames,instp->rxqel_overflows);
+		ast_mutex_lock(&el_count_lock);
+		count_instp = instp;
+		count_fd = fd;
+		count_n = 0;
+		twalk(el_node_list, print_rxq_stats);
+		count_fd = -1;
+		ast_mutex_unlock(&el_count_lock);
+		ast_mutex_unlock(&instp->lock);
+	}
+	return RESULT_SUCCESS;
+}
+
 #ifdef	NEW_ASTERISK
 
 static char *res2cli(int r)
@@ -2048,10 +2167,25 @@ static char *handle_cli_dbget(struct ast_cli_entry *e,
 	return res2cli(rpt_do_dbget(a->fd,a->argc,a->argv));
 }
 
+static char *handle_cli_stats(struct ast_cli_entry *e,
+	int cmd, struct ast_cli_args *a)
+{
+        switch (cmd) {
+        case CLI_INIT:
+                e->command = "echolink show stats";
+                e->usage = stats_usage;
+                return NULL;
+        case CLI_GENERATE:
+                return NULL;
+	}
+	return res2cli(el_do_stats(a->fd,a->argc,a->argv));
+}
+
 static struct ast_cli_entry rpt_cli[] = {
 	AST_CLI_DEFINE(handle_cli_debug,"Enable app_rpt debugging"),
 	AST_CLI_DEFINE(handle_cli_dbdump,"Dump entire echolink db"),
-	AST_CLI_DEFINE(handle_cli_dbget,"Look up echolink db entry")
+	AST_CLI_DEFINE(handle_cli_dbget,"Look up echolink db entry"),
+	AST_CLI_DEFINE(handle_cli_stats,"Show echolink receive queue stats")
 } ;
 
 #endif
@@ -2086,10 +2220,18 @@ int	n;
 	ast_cli_unregister(&cli_debug);
 	ast_cli_unregister(&cli_dbdump);
 	ast_cli_unregister(&cli_dbget);
+	ast_cli_unregister(&cli_stats);
 #endif
 	/* First, take us out of the channel loop */
 	ast_channel_unregister(&el_tech);
-	for(n = 0; n < ninstances; n++) ast_free(instances[n]);
+	for(n = 0; n < ninstances; n++)
+	{
+		if (instances[n]->fanout) ast_free(instances[n]->fanout);
+#ifdef	EL_HAVE_SENDMMSG
+		if (instances[n]->fanmsgs) ast_free(instances[n]->fanmsgs);
+#endif
+		ast_free(instances[n]);
+	}
 	if (nullfd != -1) close(nullfd);
 	return 0;
 }
@@ -2622,6 +2764,9 @@ static int do_new_call(struct el_instance *instp, struct el_pvt *p, char *call,
 		el_node_key->countdown = instp->rtcptimeout;
 		el_node_key->seqnum = 1;
 		el_node_key->instp = instp;
+		el_node_key->sin.sin_family = AF_INET;
+		el_node_key->sin.sin_port = htons(instp->audio_port);
+		el_node_key->sin.sin_addr.s_addr = inet_addr(el_node_key->ip);
 		if (tsearch(el_node_key, &el_node_list, compare_ip))
 		{
 			if (option_verbose > 3) ast_verbose(VERBOSE_PREFIX_3 "new CALL=%s,ip=%s,name=%s\n",
@@ -2710,8 +2855,6 @@ static void *el_reader(void *data)
 	unsigned char bye[40];
 	struct sockaddr_in sin,sin1;
  	int i,j,x;
-        struct el_rxqast *qpast;
-        struct el_rxqel *qpel;
 	struct ast_frame fr;
         socklen_t fromlen;
 	ssize_t recvlen;
@@ -3068,36 +3211,21 @@ static void *el_reader(void *data)
 								/* break them up for Asterisk */
 								for (i = 0; i < BLOCKING_FACTOR; i++)
 								{
-									qpast = ast_malloc(sizeof(struct el_rxqast));
-									if (!qpast)
-									{
-										ast_log(LOG_ERROR,"Cannot malloc for qpast\n");
-										ast_mutex_unlock(&instp->lock);
-										mythread_exit(NULL);
-									}
-									memcpy(qpast->buf,((struct gsmVoice_t *)buf)->data +
+									if (p->rxqastq.depth >= p->rxqastq.size) instp->rxqast_overflows++;
+									instp->rxqast_frames++;
+									j = el_rxq_put(&p->rxqastq);
+									memcpy(p->rxqast[j].buf,((struct gsmVoice_t *)buf)->data +
 										(GSM_FRAME_SIZE * i),GSM_FRAME_SIZE);
-									insque((struct qelem *)qpast,(struct qelem *)
-										p->rxqast.qe_back);
 								}
 							}
 							if (!instp->useless_flag_1) continue;
 							/* need complete packet and IP address for Echolink */
-							qpel = ast_malloc(sizeof(struct el_rxqel));
-							if (!qpel)
-							{
-								ast_log(LOG_ERROR,"Cannot malloc for qpel\n");
-							}
-							else
-							{
-								memcpy(qpel->buf,((struct gsmVoice_t *)buf)->data,
-									BLOCKING_FACTOR * GSM_FRAME_SIZE);
-								ptr = ast_strndup(instp->el_node_test.ip, EL_IP_SIZE);
-								strncpy(qpel->fromip, ptr, EL_IP_SIZE);
-								ast_free(ptr);
-								insque((struct qelem *)qpel,(struct qelem *)
-									p->rxqel.qe_back);
-							}
+							if (p->rxqelq.depth >= p->rxqelq.size) instp->rxqel_overflows++;
+							instp->rxqel_frames++;
+							j = el_rxq_put(&p->rxqelq);
+							memcpy(p->rxqel[j].buf,((struct gsmVoice_t *)buf)->data,
+								BLOCKING_FACTOR * GSM_FRAME_SIZE);
+							ast_copy_string(p->rxqel[j].fromip, instp->el_node_test.ip, sizeof(p->rxqel[j].fromip));
 						}
 					}   
 				}
@@ -3423,6 +3551,7 @@ int load_module(void)
 	ast_cli_register(&cli_debug);
 	ast_cli_register(&cli_dbdump);
 	ast_cli_register(&cli_dbget);
+	ast_cli_register(&cli_stats);
 #endif
 	/* Make sure we can register our channel type */
 	if (ast_channel_register(&el_tech)) {
@@ -252,6 +252,8 @@ static char mohsuggest[MAX_MUSICCLASS];
 static int amaflags = 0;
 static int adsi = 0;
 static int delayreject = 0;
+static int compatusermatch = 1;
+static int batchio = 1;
 static int iax2_encryption = 0;
 
 static struct ast_flags globalflags = { 0 };
@@ -358,6 +360,7 @@ struct iax2_user {
 	struct iax2_context *contexts;
 	struct ast_variable *vars;
 	enum calltoken_peer_enum calltoken_required;        /*!< Is calltoken validation required or not, can be YES, NO, or AUTO */
+	int linkseq;					/*!< When this was linked into users, for compatusermatch */
 };
 
 struct iax2_peer {
@@ -383,6 +386,8 @@ struct iax2_peer {
 	struct ast_codec_pref prefs;
 	struct ast_dnsmgr_entry *dnsmgr;		/*!< DNS refresh manager */
 	struct sockaddr_in addr;
+	struct sockaddr_in addr_key;			/*!< The addr this peer is filed under in peers_by_addr */
+	struct ao2_container *addr_index;		/*!< peers_by_addr, peers_dnsmgr or NULL, see peer_index_addr() */
 	int formats;
 	int sockfd;					/*!< Socket to use for transmission */
 	struct in_addr mask;
@@ -429,13 +434,39 @@ static struct iax2_trunk_peer {
 	unsigned char *trunkdata;
 	unsigned int trunkdatalen;
 	unsigned int trunkdataalloc;
-	struct iax2_trunk_peer *next;
+	struct iax2_trunk_peer *next;		/*!< Next in tpeers */
+	struct iax2_trunk_peer *hnext;		/*!< Next in the same tpeer_buckets chain */
+	struct iax2_trunk_peer *dirtynext;	/*!< Next in tpeers_dirty, or in the list timing_read() took from it */
+	int dirty;				/*!< On one of those two lists, protected by lock */
 	int trunkerror;
 	int calls;
 } *tpeers = NULL;
 
 AST_MUTEX_DEFINE_STATIC(tpeerlock);
 
+#ifdef LOW_MEMORY
+#define TRUNK_PEER_BUCKETS 17
+#else
+#define TRUNK_PEER_BUCKETS 563
+#endif
+
+/*! \brief Trunk peers by address, protected by tpeerlock like tpeers */
+static struct iax2_trunk_peer *tpeer_buckets[TRUNK_PEER_BUCKETS];
+
+/*! \brief Trunk peers with data queued for the next trunk tick */
+static struct iax2_trunk_peer *tpeers_dirty = NULL;
+
+AST_MUTEX_DEFINE_STATIC(tpeerdirtylock);
+
+/*! \brief How the trunk ticks that had something to send went, for iax2 show netstats */
+static struct iax2_trunk_stats {
+	unsigned int ticks;			/*!< Ticks that flushed at least one trunk peer */
+	unsigned int packets;			/*!< Trunk frames sent */
+	unsigned int calls;			/*!< Call chunks in those frames */
+	unsigned long long flushus;		/*!< Total time spent flushing, in microseconds */
+	unsigned int maxflushus;		/*!< Longest flush */
+} trunkstats;					/*!< Protected by tpeerdirtylock */
+
 struct iax_firmware {
 	struct iax_firmware *next;
 	int fd;
@@ -503,6 +534,18 @@ static AST_LIST_HEAD_STATIC(registrations, iax2_registry);
 
 #define MAX_TIMESTAMP_SKEW	160		/*!< maximum difference between actual and predicted ts for sending */
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define IAX2_HAVE_MMSG			/*!< recvmmsg() and sendmmsg() are there for batchio */
+#endif
+
+#ifdef LOW_MEMORY
+#define IAX_RX_BATCH		4	/*!< Most datagrams socket_read() takes per recvmmsg() */
+#define IAX_TX_BATCH		4	/*!< Most trunk frames timing_read() sends per sendmmsg() */
+#else
+#define IAX_RX_BATCH		32
+#define IAX_TX_BATCH		32
+#endif
+
 /* If consecutive voice frame timestamps jump by more than this many milliseconds, then jitter buffer will resync */
 #define TS_GAP_FOR_JB_RESYNC	5000
 
@@ -602,6 +645,10 @@ struct chan_iax2_pvt {
 	unsigned char iseqno;
 	/*! Last incoming sequence number we have acknowledged */
 	unsigned char aseqno;
+	/*! Reliable frames not acknowledged yet, by oseqno (see txwin_add()) */
+	struct iax_frame *txwin[256];
+	/*! How many frames there are in txwin */
+	int txwincount;
 
 	AST_DECLARE_STRING_FIELDS(
 		/*! Peer name */
@@ -711,14 +758,7 @@ struct signaling_queue_entry {
 	AST_LIST_ENTRY(signaling_queue_entry) next;
 };
 
-/*! table of available call numbers */
-static struct ao2_container *callno_pool;
-
-/*! table of available trunk call numbers */
-static struct ao2_container *callno_pool_trunk;
-
-static const unsigned int CALLNO_POOL_BUCKETS = 2699;
-
+/*! Frames waiting for the network thread to send them the first time */
 static struct ast_iax2_queue {
 	AST_LIST_HEAD(, iax_frame) queue;
 	int count;
@@ -729,24 +769,31 @@ static int randomcalltokendata;
 static const time_t MAX_CALLTOKEN_DELAY = 10;
 
 /*!
- * This module will get much higher performance when doing a lot of
- * user and peer lookups if the number of buckets is increased from 1.
- * However, to maintain old behavior for Asterisk 1.4, these are set to
- * 1 by default.  When using multiple buckets, search order through these
- * containers is considered random, so you will not be able to depend on
- * the order the entires are specified in iax.conf for matching order. */
+ * Search order through these containers is random, so anything that
+ * depends on the order entries were specified in iax.conf (matching an
+ * incoming call to a user, listing peers) has to sort that out itself.
+ * See compatusermatch and sorted_objects(). */
 #ifdef LOW_MEMORY
-#define MAX_PEER_BUCKETS 1
-/* #define MAX_PEER_BUCKETS 17 */
+#define MAX_PEER_BUCKETS 17
 #else
-#define MAX_PEER_BUCKETS 1
-/* #define MAX_PEER_BUCKETS 563 */
+#define MAX_PEER_BUCKETS 563
 #endif
 static struct ao2_container *peers;
 
 #define MAX_USER_BUCKETS MAX_PEER_BUCKETS
 static struct ao2_container *users;
 
+/*! Peers we know the address of, hashed on addr_key, for finding a peer
+ *  from the address a packet came from. Peers that get their address
+ *  from dnsmgr are in peers_dnsmgr instead, since that can change it
+ *  at any time. Both only hold peers that are also in peers. */
+static struct ao2_container *peers_by_addr;
+static struct ao2_container *peers_dnsmgr;
+AST_MUTEX_DEFINE_STATIC(peers_by_addr_lock);
+
+/*! Bumped every time a user is linked into users */
+static int user_linkseq;
+
 
 /*! Table containing peercnt objects for every ip address consuming a callno */
 static struct ao2_container *peercnts;
@@ -766,7 +813,7 @@ static uint16_t global_maxcallno;
 /*! Total num of call numbers allowed to be allocated without calltoken validation */
 static uint16_t global_maxcallno_nonval;
 
-static uint16_t total_nonval_callno_used = 0;
+static volatile unsigned int total_nonval_callno_used = 0;
 
 /*! peer connection private, keeps track of all the call numbers
  *  consumed by a single ip address */
@@ -799,6 +846,22 @@ struct callno_entry {
 	unsigned char validated;
 };
 
+/*! One for each call number, handed out along with it */
+static struct callno_entry callno_entries[IAX_MAX_CALLS];
+
+/*!
+ * \brief Call numbers that are free to use, one bit each
+ *
+ * Non-trunk call numbers come from the words below TRUNK_CALL_START and
+ * trunk ones from the rest.  A bit is claimed and given back with compare
+ * and swap, so setting up a call doesn't take a lock.
+ */
+static volatile unsigned int callno_free[IAX_MAX_CALLS / 32];
+
+#if !defined(HAVE_GCC_ATOMICS)
+AST_MUTEX_DEFINE_STATIC(callno_free_lock);
+#endif
+
 static struct ast_firmware_list {
 	struct iax_firmware *wares;
 	ast_mutex_t lock;
@@ -856,6 +919,7 @@ static int ast_cli_netstats(struct mansession *s, int fd, int limit_fmt);
 
 struct iax2_pkt_buf {
 	AST_LIST_ENTRY(iax2_pkt_buf) entry;
+	struct sockaddr_in sin;		/*!< Where it came from */
 	size_t len;
 	unsigned char buf[1];
 };
@@ -898,6 +962,9 @@ struct iax2_thread {
 	 *  a call which this thread is already processing a full frame for, they
 	 *  are queued up here. */
 	AST_LIST_HEAD_NOLOCK(, iax2_pkt_buf) full_frames;
+	/*! The rest of the datagrams for the same call from the same batched
+	 *  read, in the order they came in, after the one in readbuf. */
+	AST_LIST_HEAD_NOLOCK(, iax2_pkt_buf) batch_frames;
 };
 
 /* Thread lists */
@@ -987,9 +1054,6 @@ static struct ao2_container *iax_transfercallno_pvts;
    but keeps the division between trunked and non-trunked better. */
 #define TRUNK_CALL_START	IAX_MAX_CALLS / 2
 
-static int maxtrunkcall = TRUNK_CALL_START;
-static int maxnontrunkcall = 1;
-
 static enum ast_bridge_result iax2_bridge(struct ast_channel *c0, struct ast_channel *c1, int flags, struct ast_frame **fo, struct ast_channel **rc, int timeoutms);
 static int expire_registry(const void *data);
 static int iax2_answer(struct ast_channel *c);
@@ -1367,32 +1431,165 @@ static inline struct iax2_user *user_unref(struct iax2_user *user)
 	return NULL;
 }
 
-static int iax2_getpeername(struct sockaddr_in sin, char *host, int len)
+/*!
+ * \note The only member of the peer passed here guaranteed to be set is addr_key
+ */
+static int peer_addr_hash_cb(const void *obj, const int flags)
+{
+	const struct iax2_peer *peer = obj;
+
+	return (int) ((ntohl(peer->addr_key.sin_addr.s_addr) ^ ntohs(peer->addr_key.sin_port)) & 0x7fffffff);
+}
+
+/*!
+ * \note The only member of the peer passed here guaranteed to be set is addr_key
+ */
+static int peer_addr_cmp_cb(void *obj, void *arg, int flags)
+{
+	struct iax2_peer *peer = obj, *peer2 = arg;
+
+	return (peer->addr_key.sin_addr.s_addr == peer2->addr_key.sin_addr.s_addr &&
+		peer->addr_key.sin_port == peer2->addr_key.sin_port) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+/*! \brief Matches a peer in peers_dnsmgr on its current address */
+static int peer_dnsmgr_cmp_cb(void *obj, void *arg, int flags)
+{
+	struct iax2_peer *peer = obj;
+	struct sockaddr_in *sin = arg;
+
+	return (peer->addr.sin_addr.s_addr == sin->sin_addr.s_addr &&
+		peer->addr.sin_port == sin->sin_port) ? CMP_MATCH | CMP_STOP : 0;
+}
+
+/*!
+ * \brief File a peer under its current address
+ *
+ * Call this whenever peer->addr changes while the peer is in peers (or is
+ * just about to be), and after linking it. Temporary realtime peers are
+ * never indexed.
+ */
+static void peer_index_addr(struct iax2_peer *peer)
+{
+	ast_mutex_lock(&peers_by_addr_lock);
+	if (peer->addr_index) {
+		ao2_unlink(peer->addr_index, peer);
+		peer->addr_index = NULL;
+	}
+	if (!ast_test_flag(peer, IAX_TEMPONLY)) {
+		if (peer->dnsmgr) {
+			peer->addr_index = peers_dnsmgr;
+		} else if (peer->addr.sin_addr.s_addr) {
+			memset(&peer->addr_key, 0, sizeof(peer->addr_key));
+			peer->addr_key.sin_addr = peer->addr.sin_addr;
+			peer->addr_key.sin_port = peer->addr.sin_port;
+			peer->addr_index = peers_by_addr;
+		}
+		if (peer->addr_index)
+			ao2_link(peer->addr_index, peer);
+	}
+	ast_mutex_unlock(&peers_by_addr_lock);
+}
+
+static void peer_unindex_addr(struct iax2_peer *peer)
+{
+	ast_mutex_lock(&peers_by_addr_lock);
+	if (peer->addr_index) {
+		ao2_unlink(peer->addr_index, peer);
+		peer->addr_index = NULL;
+	}
+	ast_mutex_unlock(&peers_by_addr_lock);
+}
+
+/*! \brief Find a (non realtime) peer by the address and port it is at */
+static struct iax2_peer *find_peer_by_addr(struct sockaddr_in *sin)
+{
+	struct iax2_peer *peer;
+	struct iax2_peer tmp_peer = {
+		.addr_key = {
+			.sin_addr = sin->sin_addr,
+			.sin_port = sin->sin_port,
+		},
+	};
+
+	if (!(peer = ao2_find(peers_by_addr, &tmp_peer, OBJ_POINTER)))
+		peer = ao2_callback(peers_dnsmgr, 0, peer_dnsmgr_cmp_cb, sin);
+
+	return peer;
+}
+
+/*!
+ * \brief Take a reference to every object in a container, sorted with \a cmp
+ *
+ * For listings that should not come out in hash order.
+ *
+ * \return NULL terminated array, to be unreffed and then ast_free()d, or NULL
+ */
+static void **sorted_objects(struct ao2_container *c, int (*cmp)(const void *, const void *))
 {
-	struct iax2_peer *peer = NULL;
-	int res = 0;
 	struct ao2_iterator i;
+	void **objs, **tmp, *obj;
+	int count = 0, size = ao2_container_count(c) + 1;
 
-	i = ao2_iterator_init(peers, 0);
-	while ((peer = ao2_iterator_next(&i))) {
-		if ((peer->addr.sin_addr.s_addr == sin.sin_addr.s_addr) &&
-		    (peer->addr.sin_port == sin.sin_port)) {
-			ast_copy_string(host, peer->name, len);
-			peer_unref(peer);
-			res = 1;
-			break;
+	if (!(objs = ast_calloc(size + 1, sizeof(*objs))))
+		return NULL;
+
+	i = ao2_iterator_init(c, 0);
+	while ((obj = ao2_iterator_next(&i))) {
+		if (count == size) {
+			if (!(tmp = ast_realloc(objs, (size * 2 + 1) * sizeof(*objs)))) {
+				ao2_ref(obj, -1);
+				break;
+			}
+			objs = tmp;
+			size *= 2;
 		}
-		peer_unref(peer);
+		objs[count++] = obj;
 	}
 	ao2_iterator_destroy(&i);
+	objs[count] = NULL;
 
-	if (!peer) {
+	qsort(objs, count, sizeof(*objs), cmp);
+
+	return objs;
+}
+
+static int peer_sort_cmp(const void *a, const void *b)
+{
+	const struct iax2_peer *peer = *(struct iax2_peer * const *) a, *peer2 = *(struct iax2_peer * const *) b;
+
+	return strcasecmp(peer->name, peer2->name);
+}
+
+static int user_sort_cmp(const void *a, const void *b)
+{
+	const struct iax2_user *user = *(struct iax2_user * const *) a, *user2 = *(struct iax2_user * const *) b;
+
+	return strcasecmp(user->name, user2->name);
+}
+
+/*! \brief Link a user into users, noting where compatusermatch puts it */
+static void link_user(struct iax2_user *user, int realtime)
+{
+	int seq = ast_atomic_fetchadd_int(&user_linkseq, 1) + 1;
+
+	/* Users from iax.conf have always been tried newest first, and
+	 * cached realtime users after all of them, oldest first. */
+	user->linkseq = realtime ? -seq : seq;
+	ao2_link(users, user);
+}
+
+static int iax2_getpeername(struct sockaddr_in sin, char *host, int len)
+{
+	struct iax2_peer *peer = NULL;
+	int res = 0;
+
+	if (!(peer = find_peer_by_addr(&sin)))
 		peer = realtime_peer(NULL, &sin);
-		if (peer) {
-			ast_copy_string(host, peer->name, len);
-			peer_unref(peer);
-			res = 1;
-		}
+	if (peer) {
+		ast_copy_string(host, peer->name, len);
+		peer_unref(peer);
+		res = 1;
 	}
 
 	return res;
@@ -1464,27 +1661,88 @@ static void remove_by_peercallno(struct chan_iax2_pvt *pvt)
 	ao2_unlink(iax_peercallno_pvts, pvt);
 }
 
-static void update_max_trunk(void)
+static void iax2_frame_free(struct iax_frame *fr)
 {
-	int max = TRUNK_CALL_START;
-	int x;
+	AST_SCHED_DEL(sched, fr->retrans);
+	iax_frame_free(fr);
+}
 
-	/* XXX Prolly don't need locks here XXX */
-	for (x = TRUNK_CALL_START; x < ARRAY_LEN(iaxs) - 1; x++) {
-		if (iaxs[x]) {
-			max = x + 1;
+/*
+ * Every reliable frame we send stays in its call's retransmit window until
+ * it is acknowledged, chained off the slot for its (8 bit) oseqno.  An ACK
+ * only looks at the slots it acknowledges, and retransmissions are left to
+ * the scheduler, so nothing has to walk all the outstanding frames of all
+ * the calls.  The window of iaxs[callno] is protected by iaxsl[callno], and
+ * every frame in it has f->callno == callno.
+ */
+static void txwin_add(struct chan_iax2_pvt *pvt, struct iax_frame *f)
+{
+	struct iax_frame **fp;
+
+	for (fp = &pvt->txwin[(unsigned char) f->oseqno]; *fp; fp = &(*fp)->txnext)
+		;
+	f->txnext = NULL;
+	f->inwindow = 1;
+	*fp = f;
+	pvt->txwincount++;
+}
+
+static void txwin_remove(struct chan_iax2_pvt *pvt, struct iax_frame *f)
+{
+	struct iax_frame **fp;
+
+	if (!f->inwindow)
+		return;
+	for (fp = &pvt->txwin[(unsigned char) f->oseqno]; *fp; fp = &(*fp)->txnext) {
+		if (*fp == f) {
+			*fp = f->txnext;
+			break;
 		}
 	}
+	f->txnext = NULL;
+	f->inwindow = 0;
+	pvt->txwincount--;
+}
 
-	maxtrunkcall = max;
-	if (option_debug && iaxdebug)
-		ast_log(LOG_DEBUG, "New max trunk callno is %d\n", max);
+/*! \brief Stop (re)transmitting a frame, and free it if nobody else will */
+static void txwin_drop(struct chan_iax2_pvt *pvt, struct iax_frame *f)
+{
+	txwin_remove(pvt, f);
+	f->retries = -1;
+	/* If it hasn't been sent yet the network thread frees it, and if its
+	   retransmission is already running __attempt_transmit() does */
+	if (f->sentyet && f->retrans > -1 && !ast_sched_del(sched, f->retrans)) {
+		f->retrans = -1;
+		iax_frame_free(f);
+	}
 }
 
-static void iax2_frame_free(struct iax_frame *fr)
+/*! \brief Drop everything in the window, or just what goes to the transfer peer */
+static void txwin_cancel(struct chan_iax2_pvt *pvt, int transfer_only)
 {
-	AST_SCHED_DEL(sched, fr->retrans);
-	iax_frame_free(fr);
+	struct iax_frame *f, *next;
+	int x;
+
+	for (x = 0; pvt->txwincount && x < ARRAY_LEN(pvt->txwin); x++) {
+		for (f = pvt->txwin[x]; f; f = next) {
+			next = f->txnext;
+			if (!transfer_only || f->transfer)
+				txwin_drop(pvt, f);
+		}
+	}
+}
+
+/*! \brief The first frame in the window, starting from the oldest unacknowledged seqno */
+static struct iax_frame *txwin_first(struct chan_iax2_pvt *pvt)
+{
+	unsigned char x = pvt->rseqno;
+	int i;
+
+	for (i = 0; pvt->txwincount && i < ARRAY_LEN(pvt->txwin); i++, x++) {
+		if (pvt->txwin[x])
+			return pvt->txwin[x];
+	}
+	return NULL;
 }
 
 static void iax2_destroy(int callno)
@@ -1515,6 +1773,7 @@ retry:
 		AST_SCHED_DEL_SPINLOCK(sched, pvt->pingid, &iaxsl[pvt->callno]);
 		ao2_ref(pvt, -1);
 		if (iaxs[callno]) {
+			txwin_cancel(pvt, 0);
 			iaxs[callno] = NULL;
 		} else {
 			pvt = NULL;
@@ -1548,10 +1807,6 @@ retry:
 	if (owner) {
 		ast_mutex_unlock(&owner->lock);
 	}
-
-	if (callno & 0x4000) {
-		update_max_trunk();
-	}
 }
 
 static int scheduled_destroy(const void *vid)
@@ -1616,7 +1871,6 @@ static int queue_signalling(struct chan_iax2_pvt *pvt, struct ast_frame *f)
 static void pvt_destructor(void *obj)
 {
 	struct chan_iax2_pvt *pvt = obj;
-	struct iax_frame *cur = NULL;
 	struct signaling_queue_entry *s = NULL;
 
 	iax2_destroy_helper(pvt);
@@ -1626,14 +1880,8 @@ static void pvt_destructor(void *obj)
 	/* Already gone */
 	ast_set_flag(pvt, IAX_ALREADYGONE);	
 
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-		/* Cancel any pending transmissions */
-		if (cur->callno == pvt->callno) { 
-			cur->retries = -1;
-		}
-	}
-	AST_LIST_UNLOCK(&iaxq.queue);
+	/* Cancel any pending transmissions */
+	txwin_cancel(pvt, 0);
 
 	while ((s = AST_LIST_REMOVE_HEAD(&pvt->signaling_queue, next))) {
 		free_signaling_queue_entry(s);
@@ -1751,20 +1999,6 @@ static int match(struct sockaddr_in *sin, unsigned short callno, unsigned short
 	return 0;
 }
 
-static void update_max_nontrunk(void)
-{
-	int max = 1;
-	int x;
-	/* XXX Prolly don't need locks here XXX */
-	for (x=1;x<TRUNK_CALL_START - 1; x++) {
-		if (iaxs[x])
-			max = x + 1;
-	}
-	maxnontrunkcall = max;
-	if (option_debug && iaxdebug)
-		ast_log(LOG_DEBUG, "New max nontrunk callno is %d\n", max);
-}
-
 static int make_trunk(unsigned short callno, int locked)
 {
 	int x;
@@ -1792,6 +2026,8 @@ static int make_trunk(unsigned short callno, int locked)
 	 */
 	AST_SCHED_DEL(sched, iaxs[callno]->pingid);
 	AST_SCHED_DEL(sched, iaxs[callno]->lagid);
+	/* Anything still in the window was sent as the old callno */
+	txwin_cancel(iaxs[callno], 0);
 	iaxs[x] = iaxs[callno];
 	iaxs[x]->callno = x;
 
@@ -1817,9 +2053,6 @@ static int make_trunk(unsigned short callno, int locked)
 
 	if (option_debug)
 		ast_log(LOG_DEBUG, "Made call %d into trunk call %d\n", callno, x);
-	/* We move this call from a non-trunked to a trunked call */
-	update_max_trunk();
-	update_max_nontrunk();
 	return res;
 }
 
@@ -2247,109 +2480,129 @@ static int iax2_show_callnumber_usage(int fd, int argc, char *argv[])
 	}
 	ao2_iterator_destroy(&i);
 	if (argc == 4) {
-		ast_cli(fd, "\nNon-CallToken Validation Limit: %d\nNon-CallToken Validated: %d\n", global_maxcallno_nonval, total_nonval_callno_used);
+		ast_cli(fd, "\nNon-CallToken Validation Limit: %d\nNon-CallToken Validated: %u\n", global_maxcallno_nonval, total_nonval_callno_used);
 	} else if (argc == 5 && !found) {
 		ast_cli(fd, "No callnumber table entries for %s found\n", argv[4] );
 	}
 	return RESULT_SUCCESS;
 }
 
-static struct callno_entry *get_unused_callno(int trunk, int validated)
+/*! \brief Compare and swap, for the call number bitmap and counter */
+static inline int callno_cas(volatile unsigned int *p, unsigned int old, unsigned int new)
 {
-	struct callno_entry *callno_entry = NULL;
-	if ((!ao2_container_count(callno_pool) && !trunk) || (!ao2_container_count(callno_pool_trunk) && trunk)) {
-		ast_log(LOG_WARNING, "Out of CallNumbers\n");
-		/* Minor optimization for the extreme case. */
-		return NULL;
-	}
-
-	/* the callno_pool container is locked here primarily to ensure thread
-	 * safety of the total_nonval_callno_used check and increment */
-	ao2_lock(callno_pool);
+#if defined(HAVE_GCC_ATOMICS)
+	return __sync_bool_compare_and_swap(p, old, new);
+#else
+	int res;
 
-	/* only a certain number of nonvalidated call numbers should be allocated.
-	 * If there ever is an attack, this separates the calltoken validating
-	 * users from the non calltoken validating users. */
-	if (!validated && (total_nonval_callno_used >= global_maxcallno_nonval)) {
-		ast_log(LOG_WARNING, "NON-CallToken callnumber limit is reached. Current:%d Max:%d\n", total_nonval_callno_used, global_maxcallno_nonval);
-		ao2_unlock(callno_pool);
-		return NULL;
-	}
+	ast_mutex_lock(&callno_free_lock);
+	if ((res = (*p == old)))
+		*p = new;
+	ast_mutex_unlock(&callno_free_lock);
+	return res;
+#endif
+}
 
-	/* unlink the object from the container, taking over ownership
-	 * of the reference the container had to the object */
-	callno_entry = ao2_find((trunk ? callno_pool_trunk : callno_pool), NULL, OBJ_POINTER | OBJ_UNLINK | OBJ_CONTINUE);
+/*! \brief Claim a free call number from the trunk or non-trunk range, 0 if there is none */
+static int callno_take(int trunk)
+{
+	int first = trunk ? (TRUNK_CALL_START) / 32 : 0;
+	int words = trunk ? ARRAY_LEN(callno_free) - first : (TRUNK_CALL_START) / 32;
+	int start = ast_random() % words;
+	int i, w, bit, r;
+	unsigned int bits, rot;
 
-	if (callno_entry) {
-		callno_entry->validated = validated;
-		if (!validated) {
-			total_nonval_callno_used++;
+	for (i = 0; i < words; i++) {
+		w = first + (start + i) % words;
+		while ((bits = callno_free[w])) {
+			/* Any free one in the word, so call numbers stay hard to guess */
+			r = ast_random() & 31;
+			rot = r ? (bits >> r) | (bits << (32 - r)) : bits;
+			bit = (ffs(rot) - 1 + r) & 31;
+			if (callno_cas(&callno_free[w], bits, bits & ~(1U << bit)))
+				return w * 32 + bit;
 		}
 	}
-
-	ao2_unlock(callno_pool);
-	return callno_entry;
+	return 0;
 }
 
-static int replace_callno(const void *obj)
+static void callno_give(int callno)
 {
-	struct callno_entry *callno_entry = (struct callno_entry *) obj;
-
-	/* the callno_pool container is locked here primarily to ensure thread
-	 * safety of the total_nonval_callno_used check and decrement */
-	ao2_lock(callno_pool);
-
-	if (!callno_entry->validated && (total_nonval_callno_used != 0)) {
-		total_nonval_callno_used--;
-	} else if (!callno_entry->validated && (total_nonval_callno_used == 0)) {
-		ast_log(LOG_ERROR, "Attempted to decrement total non calltoken validated callnumbers below zero... Callno is:%d \n", callno_entry->callno);
-	}
+	volatile unsigned int *p = &callno_free[callno / 32];
+	unsigned int bits;
 
-	if (callno_entry->callno < TRUNK_CALL_START) {
-		ao2_link(callno_pool, callno_entry);
-	} else {
-		ao2_link(callno_pool_trunk, callno_entry);
-	}
-	ao2_ref(callno_entry, -1); /* only container ref remains */
-
-	ao2_unlock(callno_pool);
-	return 0;
+	do {
+		bits = *p;
+	} while (!callno_cas(p, bits, bits | (1U << (callno % 32))));
 }
 
-static int callno_hash(const void *obj, const int flags)
+/*! \brief Count a non calltoken validated call number as no longer used */
+static void nonval_callno_put(int callno)
 {
-	return abs(ast_random());
+	unsigned int used;
+
+	do {
+		if (!(used = total_nonval_callno_used)) {
+			ast_log(LOG_ERROR, "Attempted to decrement total non calltoken validated callnumbers below zero... Callno is:%d \n", callno);
+			return;
+		}
+	} while (!callno_cas(&total_nonval_callno_used, used, used - 1));
 }
 
-static int create_callno_pools(void)
+static struct callno_entry *get_unused_callno(int trunk, int validated)
 {
-	uint16_t i;
+	struct callno_entry *callno_entry;
+	unsigned int used;
+	int callno;
 
-	if (!(callno_pool = ao2_container_alloc(CALLNO_POOL_BUCKETS, callno_hash, NULL))) {
-		return -1;
+	/* only a certain number of nonvalidated call numbers should be allocated.
+	 * If there ever is an attack, this separates the calltoken validating
+	 * users from the non calltoken validating users. */
+	if (!validated) {
+		do {
+			used = total_nonval_callno_used;
+			if (used >= global_maxcallno_nonval) {
+				ast_log(LOG_WARNING, "NON-CallToken callnumber limit is reached. Current:%u Max:%d\n", used, global_maxcallno_nonval);
+				return NULL;
+			}
+		} while (!callno_cas(&total_nonval_callno_used, used, used + 1));
 	}
 
-	if (!(callno_pool_trunk = ao2_container_alloc(CALLNO_POOL_BUCKETS, callno_hash, NULL))) {
-		return -1;
+	if (!(callno = callno_take(trunk))) {
+		ast_log(LOG_WARNING, "Out of CallNumbers\n");
+		if (!validated)
+			nonval_callno_put(0);
+		return NULL;
 	}
 
-	/* start at 2, 0 and 1 are reserved */
-	for (i = 2; i <= IAX_MAX_CALLS; i++) {
-		struct callno_entry *callno_entry;
+	callno_entry = &callno_entries[callno];
+	callno_entry->validated = validated;
+	return callno_entry;
+}
 
-		if (!(callno_entry = ao2_alloc(sizeof(*callno_entry), NULL))) {
-			return -1;
-		}
+static int replace_callno(const void *obj)
+{
+	struct callno_entry *callno_entry = (struct callno_entry *) obj;
 
-		callno_entry->callno = i;
+	if (!callno_entry->validated)
+		nonval_callno_put(callno_entry->callno);
 
-		if (i < TRUNK_CALL_START) {
-			ao2_link(callno_pool, callno_entry);
-		} else {
-			ao2_link(callno_pool_trunk, callno_entry);
-		}
+	/* Once given back, it can be handed out again straight away */
+	callno_give(callno_entry->callno);
+	return 0;
+}
+
+static int create_callno_pools(void)
+{
+	int i;
 
-		ao2_ref(callno_entry, -1);
+	memset((void *) callno_free, 0, sizeof(callno_free));
+	/* start at 2, 0 and 1 are reserved, and stop short of IAX_MAX_CALLS,
+	 * which doesn't fit in the 15 bits call numbers have on the wire */
+	for (i = 2; i < IAX_MAX_CALLS; i++) {
+		callno_entries[i].callno = i;
+		callno_entries[i].validated = 0;
+		callno_free[i / 32] |= 1U << (i % 32);
 	}
 
 	return 0;
@@ -2476,46 +2729,6 @@ static int __find_callno(unsigned short callno, unsigned short dcallno, struct s
 		if (dcallno) {
 			ast_mutex_unlock(&iaxsl[dcallno]);
 		}
-#ifdef IAX_OLD_FIND
-		/* If we get here, we SHOULD NOT find a call structure for this
-		   callno; if we do, it means that there is a call structure that
-		   has a peer callno but did NOT get entered into the hash table,
-		   which is bad.
-
-		   If we find a call structure using this old, slow method, output a log
-		   message so we'll know about it. After a few months of leaving this in
-		   place, if we don't hear about people seeing these messages, we can
-		   remove this code for good.
-		*/
-
-		for (x = 1; !res && x < maxnontrunkcall; x++) {
-			ast_mutex_lock(&iaxsl[x]);
-			if (iaxs[x]) {
-				/* Look for an exact match */
-				if (match(sin, callno, dcallno, iaxs[x], check_dcallno)) {
-					res = x;
-				}
-			}
-			if (!res || !return_locked)
-				ast_mutex_unlock(&iaxsl[x]);
-		}
-
-		for (x = TRUNK_CALL_START; !res && x < maxtrunkcall; x++) {
-			ast_mutex_lock(&iaxsl[x]);
-			if (iaxs[x]) {
-				/* Look for an exact match */
-				if (match(sin, callno, dcallno, iaxs[x], check_dcallno)) {
-					res = x;
-				}
-			}
-			if (!res || !return_locked)
-				ast_mutex_unlock(&iaxsl[x]);
-		}
-
-		if (res) {
-			ast_log(LOG_WARNING, "Old call search code found call number %d that was not in hash table!\n", res);
-		}
-#endif
 	}
 	if (!res && (new >= NEW_ALLOW)) {
 		struct callno_entry *callno_entry;
@@ -2545,7 +2758,6 @@ static int __find_callno(unsigned short callno, unsigned short dcallno, struct s
 		ast_mutex_lock(&iaxsl[x]);
 
 		iaxs[x] = new_iax(sin, host);
-		update_max_nontrunk();
 		if (iaxs[x]) {
 			if (option_debug && iaxdebug)
 				ast_log(LOG_DEBUG, "Creating new call structure %d\n", x);
@@ -3005,9 +3217,90 @@ static int handle_error(void)
 	return 0;
 }
 
-static int transmit_trunk(struct iax_frame *f, struct sockaddr_in *sin, int sockfd)
+/*!
+ * \brief Trunk frames of one timing tick, to be sent with one sendmmsg()
+ *
+ * A frame in here still lives in the trunkdata of its trunk peer, so the
+ * peer stays locked until trunk_batch_flush() has sent it.
+ */
+struct iax2_trunk_batch {
+	int count;
+#ifdef IAX2_HAVE_MMSG
+	int fd;
+	struct iax2_trunk_peer *tpeers[IAX_TX_BATCH];
+	struct mmsghdr msgs[IAX_TX_BATCH];
+	struct iovec iovs[IAX_TX_BATCH];
+#endif
+};
+
+/*! \brief Send what is in the batch and unlock its trunk peers */
+static void trunk_batch_flush(struct iax2_trunk_batch *batch)
+{
+#ifdef IAX2_HAVE_MMSG
+	int i, res, sent = 0;
+
+	while (sent < batch->count) {
+		if (batchio)
+			res = sendmmsg(batch->fd, batch->msgs + sent, batch->count - sent, 0);
+		else
+			res = sendmsg(batch->fd, &batch->msgs[sent].msg_hdr, 0) < 0 ? -1 : 1;
+		if (res < 0) {
+			if (errno == ENOSYS) {
+				/* Kernel too old, go back to one at a time */
+				batchio = 0;
+				continue;
+			}
+			if (option_debug)
+				ast_log(LOG_DEBUG, "Received error: %s\n", strerror(errno));
+			handle_error();
+			/* Skip the one that failed, send the rest */
+			res = 1;
+		}
+		sent += res;
+	}
+	for (i = 0; i < batch->count; i++)
+		ast_mutex_unlock(&batch->tpeers[i]->lock);
+#endif
+	batch->count = 0;
+}
+
+/*! \brief Is the frame of this (locked) trunk peer waiting in the batch */
+static int trunk_batch_holds(struct iax2_trunk_batch *batch, struct iax2_trunk_peer *tpeer)
+{
+#ifdef IAX2_HAVE_MMSG
+	return batch->count && batch->tpeers[batch->count - 1] == tpeer;
+#else
+	return 0;
+#endif
+}
+
+/*!
+ * \brief Send a trunk frame of \a tpeer, or add it to \a batch if there is one
+ *
+ * \note If the frame is batched, \a tpeer must stay locked until the batch
+ *       is flushed.
+ */
+static int transmit_trunk(struct iax_frame *f, struct sockaddr_in *sin, int sockfd, struct iax2_trunk_peer *tpeer, struct iax2_trunk_batch *batch)
 {
 	int res;
+
+#ifdef IAX2_HAVE_MMSG
+	if (batch && batchio) {
+		if (batch->count == IAX_TX_BATCH || (batch->count && batch->fd != sockfd))
+			trunk_batch_flush(batch);
+		res = batch->count++;
+		batch->fd = sockfd;
+		batch->tpeers[res] = tpeer;
+		batch->iovs[res].iov_base = f->data;
+		batch->iovs[res].iov_len = f->datalen;
+		memset(&batch->msgs[res], 0, sizeof(batch->msgs[res]));
+		batch->msgs[res].msg_hdr.msg_name = sin;
+		batch->msgs[res].msg_hdr.msg_namelen = sizeof(*sin);
+		batch->msgs[res].msg_hdr.msg_iov = &batch->iovs[res];
+		batch->msgs[res].msg_hdr.msg_iovlen = 1;
+		return 0;
+	}
+#endif
 	res = sendto(sockfd, f->data, f->datalen, 0,(struct sockaddr *)sin,
 					sizeof(*sin));
 	if (res < 0) {
@@ -3019,6 +3312,12 @@ static int transmit_trunk(struct iax_frame *f, struct sockaddr_in *sin, int sock
 	return res;
 }
 
+/*! \brief Send one frame now
+ *
+ * This is not batched like trunk frames: it runs on whichever thread wrote
+ * the frame, and holding voice frames back for a batch would add delay to
+ * every one of them.  Calls that need fewer system calls should be trunked.
+ */
 static int send_packet(struct iax_frame *f)
 {
 	int res;
@@ -3116,6 +3415,7 @@ static void __attempt_transmit(const void *data)
 	if (callno && iaxs[callno]) {
 		if ((f->retries < 0) /* Already ACK'd */ ||
 		    (f->retries >= max_retries) /* Too many attempts */) {
+				txwin_remove(iaxs[callno], f);
 				/* Record an error if we've transmitted too many times */
 				if (f->retries >= max_retries) {
 					if (f->transfer) {
@@ -3173,11 +3473,7 @@ static void __attempt_transmit(const void *data)
 		ast_mutex_unlock(&iaxsl[callno]);
 	/* Do not try again */
 	if (freeme) {
-		/* Don't attempt delivery, just remove it from the queue */
-		AST_LIST_LOCK(&iaxq.queue);
-		AST_LIST_REMOVE(&iaxq.queue, f, list);
-		iaxq.count--;
-		AST_LIST_UNLOCK(&iaxq.queue);
+		/* Don't attempt delivery, it's already out of the window */
 		f->retrans = -1; /* this is safe because this is the scheduled function */
 		/* Free the IAX frame */
 		iax2_frame_free(f);
@@ -3399,17 +3695,29 @@ static int iax2_show_stats(int fd, int argc, char *argv[])
 {
 	struct iax_frame *cur;
 	int cnt = 0, dead=0, final=0;
+	int x, y;
 
 	if (argc != 3)
 		return RESULT_SHOWUSAGE;
 
+	for (x = 0; x < ARRAY_LEN(iaxs); x++) {
+		ast_mutex_lock(&iaxsl[x]);
+		for (y = 0; iaxs[x] && iaxs[x]->txwincount && y < ARRAY_LEN(iaxs[x]->txwin); y++) {
+			for (cur = iaxs[x]->txwin[y]; cur; cur = cur->txnext) {
+				if (cur->final)
+					final++;
+				cnt++;
+			}
+		}
+		ast_mutex_unlock(&iaxsl[x]);
+	}
+	/* Reliable frames not sent yet are in their window already */
 	AST_LIST_LOCK(&iaxq.queue);
 	AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-		if (cur->retries < 0)
+		if (cur->retries < 0) {
 			dead++;
-		if (cur->final)
-			final++;
-		cnt++;
+			cnt++;
+		}
 	}
 	AST_LIST_UNLOCK(&iaxq.queue);
 
@@ -3707,8 +4015,11 @@ static int schedule_delivery(struct iax_frame *fr, int updatehistory, int fromtr
 	return 0;
 }
 
-static int iax2_transmit(struct iax_frame *fr)
+static int iax2_transmit(struct chan_iax2_pvt *pvt, struct iax_frame *fr)
 {
+	/* Reliable frames stay in the call's window until they are acked */
+	if (fr->retries > -1)
+		txwin_add(pvt, fr);
 	/* Lock the queue and place this packet at the end */
 	/* By setting this to 0, the network thread will send it for us, and
 	   queue retransmission if necessary */
@@ -3888,6 +4199,9 @@ static struct iax2_peer *realtime_peer(const char *peername, struct sockaddr_in
 		}
 	}
 
+	if (ast_test_flag(peer, IAX_RTCACHEFRIENDS))
+		peer_index_addr(peer);
+
 	return peer;
 }
 
@@ -3954,7 +4268,7 @@ static struct iax2_user *realtime_user(const char *username, struct sockaddr_in
 
 	if (ast_test_flag((&globalflags), IAX_RTCACHEFRIENDS)) {
 		ast_set_flag(user, IAX_RTCACHEFRIENDS);
-		ao2_link(users, user);
+		link_user(user, 1);
 	} else {
 		ast_set_flag(user, IAX_TEMPONLY);	
 	}
@@ -4238,13 +4552,16 @@ static void resend_with_token(int callno, struct iax_frame *f, const char *newto
 	/* make sure to update token length incase it ever has to be stripped off again */
 	pvt->calltoken_ie_len = data.ied.pos - ie_data_pos; /* new pos minus old pos tells how big token ie is */
 
-	/* ---3.--- */
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_REMOVE(&iaxq.queue, f, list);
-	AST_LIST_UNLOCK(&iaxq.queue);
-
-	/* ---4.--- */
-	iax2_frame_free(f);
+	/* ---3.--- and ---4.--- */
+	if (!f->sentyet) {
+		AST_LIST_LOCK(&iaxq.queue);
+		AST_LIST_REMOVE(&iaxq.queue, f, list);
+		iaxq.count--;
+		AST_LIST_UNLOCK(&iaxq.queue);
+		txwin_remove(pvt, f);
+		iax2_frame_free(f);
+	} else
+		txwin_drop(pvt, f);
 
 	/* ---5.--- */
 	pvt->oseqno = 0;
@@ -4973,19 +5290,11 @@ static int iax2_getpeertrunk(struct sockaddr_in sin)
 {
 	struct iax2_peer *peer;
 	int res = 0;
-	struct ao2_iterator i;
 
-	i = ao2_iterator_init(peers, 0);
-	while ((peer = ao2_iterator_next(&i))) {
-		if ((peer->addr.sin_addr.s_addr == sin.sin_addr.s_addr) &&
-		    (peer->addr.sin_port == sin.sin_port)) {
-			res = ast_test_flag(peer, IAX_TRUNK);
-			peer_unref(peer);
-			break;
-		}
+	if ((peer = find_peer_by_addr(&sin))) {
+		res = ast_test_flag(peer, IAX_TRUNK);
 		peer_unref(peer);
 	}
-	ao2_iterator_destroy(&i);
 
 	return res;
 }
@@ -5285,13 +5594,19 @@ static unsigned int calc_rxstamp(struct chan_iax2_pvt *p, unsigned int offset)
 	return ms;
 }
 
+static unsigned int tpeer_hash(struct sockaddr_in *sin)
+{
+	return (ntohl(sin->sin_addr.s_addr) ^ ntohs(sin->sin_port)) % TRUNK_PEER_BUCKETS;
+}
+
 static struct iax2_trunk_peer *find_tpeer(struct sockaddr_in *sin, int fd)
 {
 	struct iax2_trunk_peer *tpeer;
+	unsigned int bucket = tpeer_hash(sin);
 	
 	/* Finds and locks trunk peer */
 	ast_mutex_lock(&tpeerlock);
-	for (tpeer = tpeers; tpeer; tpeer = tpeer->next) {
+	for (tpeer = tpeer_buckets[bucket]; tpeer; tpeer = tpeer->hnext) {
 		/* We don't lock here because tpeer->addr *never* changes */
 		if (!inaddrcmp(&tpeer->addr, sin)) {
 			ast_mutex_lock(&tpeer->lock);
@@ -5308,6 +5623,8 @@ static struct iax2_trunk_peer *find_tpeer(struct sockaddr_in *sin, int fd)
 			tpeer->next = tpeers;
 			tpeer->sockfd = fd;
 			tpeers = tpeer;
+			tpeer->hnext = tpeer_buckets[bucket];
+			tpeer_buckets[bucket] = tpeer;
 #ifdef SO_NO_CHECK
 			setsockopt(tpeer->sockfd, SOL_SOCKET, SO_NO_CHECK, &nochecksums, sizeof(nochecksums));
 #endif
@@ -5372,6 +5689,14 @@ static int iax2_trunk_queue(struct chan_iax2_pvt *pvt, struct iax_frame *fr)
 		tpeer->trunkdatalen += f->datalen;
 
 		tpeer->calls++;
+		/* Have the next trunk tick send it */
+		if (!tpeer->dirty) {
+			tpeer->dirty = 1;
+			ast_mutex_lock(&tpeerdirtylock);
+			tpeer->dirtynext = tpeers_dirty;
+			tpeers_dirty = tpeer;
+			ast_mutex_unlock(&tpeerdirtylock);
+		}
 		ast_mutex_unlock(&tpeer->lock);
 	}
 	return 0;
@@ -5722,7 +6047,7 @@ static int iax2_send(struct chan_iax2_pvt *pvt, struct ast_frame *f, unsigned in
 		if (now) {
 			res = send_packet(fr);
 		} else
-			res = iax2_transmit(fr);
+			res = iax2_transmit(pvt, fr);
 	} else {
 		if (ast_test_flag(pvt, IAX_TRUNK)) {
 			iax2_trunk_queue(pvt, fr);
@@ -5772,10 +6097,10 @@ static int iax2_show_users(int fd, int argc, char *argv[])
 #define FORMAT "%-15.15s  %-20.20s  %-15.15s  %-15.15s  %-5.5s  %-5.10s\n"
 #define FORMAT2 "%-15.15s  %-20.20s  %-15.15d  %-15.15s  %-5.5s  %-5.10s\n"
 
-	struct iax2_user *user = NULL;
+	struct iax2_user *user = NULL, **sorted;
 	char auth[90];
 	char *pstr = "";
-	struct ao2_iterator i;
+	int x;
 
 	switch (argc) {
 	case 5:
@@ -5792,9 +6117,8 @@ static int iax2_show_users(int fd, int argc, char *argv[])
 	}
 
 	ast_cli(fd, FORMAT, "Username", "Secret", "Authen", "Def.Context", "A/C","Codec Pref");
-	i = ao2_iterator_init(users, 0);
-	for (user = ao2_iterator_next(&i); user; 
-		user_unref(user), user = ao2_iterator_next(&i)) {
+	sorted = (struct iax2_user **) sorted_objects(users, user_sort_cmp);
+	for (x = 0; sorted && (user = sorted[x]); user_unref(user), x++) {
 		if (havepattern && regexec(&regexbuf, user->name, 0, NULL, 0))
 			continue;
 		
@@ -5816,7 +6140,7 @@ static int iax2_show_users(int fd, int argc, char *argv[])
 			user->contexts ? user->contexts->context : context,
 			user->ha ? "Yes" : "No", pstr);
 	}
-	ao2_iterator_destroy(&i);
+	ast_free(sorted);
 
 	if (havepattern)
 		regfree(&regexbuf);
@@ -5834,12 +6158,12 @@ static int __iax2_show_peers(int manager, int fd, struct mansession *s, int argc
 	int online_peers = 0;
 	int offline_peers = 0;
 	int unmonitored_peers = 0;
-	struct ao2_iterator i;
+	int x;
 
 #define FORMAT2 "%-15.15s  %-15.15s %s  %-15.15s  %-8s  %s %-10s%s"
 #define FORMAT "%-15.15s  %-15.15s %s  %-15.15s  %-5d%s  %s %-10s%s"
 
-	struct iax2_peer *peer = NULL;
+	struct iax2_peer *peer = NULL, **sorted;
 	char name[256];
 	int registeredonly=0;
 	char *term = manager ? "\r\n" : "\n";
@@ -5883,9 +6207,8 @@ static int __iax2_show_peers(int manager, int fd, struct mansession *s, int argc
 	else
 		ast_cli(fd, FORMAT2, "Name/Username", "Host", "   ", "Mask", "Port", "   ", "Status", term);
 
-	i = ao2_iterator_init(peers, 0);
-	for (peer = ao2_iterator_next(&i); peer; 
-		peer_unref(peer), peer = ao2_iterator_next(&i)) {
+	sorted = (struct iax2_peer **) sorted_objects(peers, peer_sort_cmp);
+	for (x = 0; sorted && (peer = sorted[x]); peer_unref(peer), x++) {
 		char nm[20];
 		char status[20];
 		char srch[2000];
@@ -5934,7 +6257,7 @@ static int __iax2_show_peers(int manager, int fd, struct mansession *s, int argc
 				peer->encmethods ? "(E)" : "   ", status, term);
 		total_peers++;
 	}
-	ao2_iterator_destroy(&i);
+	ast_free(sorted);
 
 	if (s)
 		astman_append(s,"%d iax2 peers [%d online, %d offline, %d unmonitored]%s", total_peers, online_peers, offline_peers, unmonitored_peers, term);
@@ -6253,12 +6576,31 @@ static int ast_cli_netstats(struct mansession *s, int fd, int limit_fmt)
 static int iax2_show_netstats(int fd, int argc, char *argv[])
 {
 	int numchans = 0;
+	int numtpeers = 0;
+	struct iax2_trunk_peer *tpeer;
+	struct iax2_trunk_stats stats;
 	if (argc != 3)
 		return RESULT_SHOWUSAGE;
 	ast_cli(fd, "                                ------------- LOCAL ----------------  ------------- REMOTE ---------------\n");
 	ast_cli(fd, "Channel                    RTT  Jit  Del  Lost   %%  Drop  OOO  Kpkts  Jit  Del  Lost   %%  Drop  OOO  Kpkts FirstMsg    LastMsg\n");
 	numchans = ast_cli_netstats(NULL, fd, 1);
 	ast_cli(fd, "%d active IAX channel%s\n", numchans, (numchans != 1) ? "s" : "");
+
+	ast_mutex_lock(&tpeerlock);
+	for (tpeer = tpeers; tpeer; tpeer = tpeer->next)
+		numtpeers++;
+	ast_mutex_unlock(&tpeerlock);
+	ast_mutex_lock(&tpeerdirtylock);
+	stats = trunkstats;
+	ast_mutex_unlock(&tpeerdirtylock);
+	if (numtpeers || stats.ticks) {
+		ast_cli(fd, "%d trunk peer%s, %u trunk tick%s with frames to send\n", numtpeers, (numtpeers != 1) ? "s" : "",
+			stats.ticks, (stats.ticks != 1) ? "s" : "");
+		if (stats.ticks)
+			ast_cli(fd, "Trunk flush: %llu us average, %u us longest, %.2f calls per trunk frame\n",
+				stats.flushus / stats.ticks, stats.maxflushus,
+				stats.packets ? (double) stats.calls / stats.packets : 0.0);
+	}
 	return RESULT_SUCCESS;
 }
 
@@ -6420,7 +6762,7 @@ static int check_access(int callno, struct sockaddr_in *sin, struct iax_ies *ies
 	int res = -1;
 	int version = 2;
 	struct iax2_user *user = NULL, *best = NULL;
-	int bestscore = 0;
+	int score, bestscore = 0;
 	int gotcapability = 0;
 	struct ast_variable *v = NULL, *tmpvar = NULL;
 	struct ao2_iterator i;
@@ -6479,67 +6821,51 @@ static int check_access(int callno, struct sockaddr_in *sin, struct iax_ies *ies
 			ast_inet_ntoa(sin->sin_addr), version);
 		return res;
 	}
-	/* Search the userlist for a compatible entry, and fill in the rest */
-	i = ao2_iterator_init(users, 0);
-	while ((user = ao2_iterator_next(&i))) {
-		if ((ast_strlen_zero(iaxs[callno]->username) ||				/* No username specified */
-			!strcmp(iaxs[callno]->username, user->name))	/* Or this username specified */
-			&& ast_apply_ha(user->ha, sin) 	/* Access is permitted from this IP */
-			&& (ast_strlen_zero(iaxs[callno]->context) ||			/* No context specified */
-			     apply_context(user->contexts, iaxs[callno]->context))) {			/* Context is permitted */
-			if (!ast_strlen_zero(iaxs[callno]->username)) {
-				/* Exact match, stop right now. */
+	if (!ast_strlen_zero(iaxs[callno]->username)) {
+		/* Names are unique, so there is only the one to check */
+		if ((user = find_user(iaxs[callno]->username))) {
+			if (!ast_apply_ha(user->ha, sin) ||				/* Access is not permitted from this IP */
+			    (!ast_strlen_zero(iaxs[callno]->context) &&			/* Or the context specified */
+			     !apply_context(user->contexts, iaxs[callno]->context)))	/* is not permitted */
+				user = user_unref(user);
+		}
+	} else {
+		/* Search the userlist for the best compatible entry, and fill in the rest */
+		i = ao2_iterator_init(users, 0);
+		while ((user = ao2_iterator_next(&i))) {
+			score = 0;
+			if (ast_apply_ha(user->ha, sin) 	/* Access is permitted from this IP */
+				&& (ast_strlen_zero(iaxs[callno]->context) ||			/* No context specified */
+				     apply_context(user->contexts, iaxs[callno]->context))) {			/* Context is permitted */
+				if (ast_strlen_zero(user->secret) && ast_strlen_zero(user->dbsecret) && ast_strlen_zero(user->inkeys)) {
+					/* No required authentication. If there was host
+					   authentication and we passed, bonus!  No host
+					   access, but no secret, either, not bad */
+					score = user->ha ? 4 : 3;
+				} else {
+					/* Authentication, but host access too, eh, it's
+					   something..  Authentication and no host access is
+					   our baseline */
+					score = user->ha ? 2 : 1;
+				}
+			}
+			/* Users come out of the container in no particular order,
+			   so settle ties the way the old user list did if asked to */
+			if (score > bestscore ||
+			    (score && score == bestscore && compatusermatch && user->linkseq > best->linkseq)) {
 				if (best)
 					user_unref(best);
 				best = user;
-				break;
-			} else if (ast_strlen_zero(user->secret) && ast_strlen_zero(user->dbsecret) && ast_strlen_zero(user->inkeys)) {
-				/* No required authentication */
-				if (user->ha) {
-					/* There was host authentication and we passed, bonus! */
-					if (bestscore < 4) {
-						bestscore = 4;
-						if (best)
-							user_unref(best);
-						best = user;
-						continue;
-					}
-				} else {
-					/* No host access, but no secret, either, not bad */
-					if (bestscore < 3) {
-						bestscore = 3;
-						if (best)
-							user_unref(best);
-						best = user;
-						continue;
-					}
-				}
-			} else {
-				if (user->ha) {
-					/* Authentication, but host access too, eh, it's something.. */
-					if (bestscore < 2) {
-						bestscore = 2;
-						if (best)
-							user_unref(best);
-						best = user;
-						continue;
-					}
-				} else {
-					/* Authentication and no host access...  This is our baseline */
-					if (bestscore < 1) {
-						bestscore = 1;
-						if (best)
-							user_unref(best);
-						best = user;
-						continue;
-					}
-				}
+				bestscore = score;
+				if (bestscore == 4 && !compatusermatch)
+					break;
+				continue;
 			}
+			user_unref(user);
 		}
-		user_unref(user);
+		ao2_iterator_destroy(&i);
+		user = best;
 	}
-	ao2_iterator_destroy(&i);
-	user = best;
 	if (!user && !ast_strlen_zero(iaxs[callno]->username)) {
 		user = realtime_user(iaxs[callno]->username, sin);
 		if (user && !ast_strlen_zero(iaxs[callno]->context) &&			/* No context specified */
@@ -7214,7 +7540,6 @@ static int complete_transfer(int callno, struct iax_ies *ies)
 {
 	int peercallno = 0;
 	struct chan_iax2_pvt *pvt = iaxs[callno];
-	struct iax_frame *cur;
 	jb_frame frame;
 
 	if (ies->callno)
@@ -7230,6 +7555,10 @@ static int complete_transfer(int callno, struct iax_ies *ies)
 	 * the old address and add the new one */
 	peercnt_remove_by_addr(&pvt->addr);
 	peercnt_add(&pvt->transfer);
+	/* iax_peercallno_pvts is hashed on the address, so take it out first */
+	if (pvt->peercallno) {
+		remove_by_peercallno(pvt);
+	}
 	/* now copy over the new address */
 	memcpy(&pvt->addr, &pvt->transfer, sizeof(pvt->addr));
 	memset(&pvt->transfer, 0, sizeof(pvt->transfer));
@@ -7239,9 +7568,6 @@ static int complete_transfer(int callno, struct iax_ies *ies)
 	pvt->iseqno = 0;
 	pvt->aseqno = 0;
 
-	if (pvt->peercallno) {
-		remove_by_peercallno(pvt);
-	}
 	pvt->peercallno = peercallno;
 	/*this is where the transfering call swiches hash tables */
 	store_by_peercallno(pvt);
@@ -7262,15 +7588,10 @@ static int complete_transfer(int callno, struct iax_ies *ies)
 	pvt->lastsent = 0;
 	pvt->nextpred = 0;
 	pvt->pingtime = DEFAULT_RETRY_TIME;
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-		/* We must cancel any packets that would have been transmitted
-		   because now we're talking to someone new.  It's okay, they
-		   were transmitted to someone that didn't care anyway. */
-		if (callno == cur->callno) 
-			cur->retries = -1;
-	}
-	AST_LIST_UNLOCK(&iaxq.queue);
+	/* We must cancel any packets that would have been transmitted
+	   because now we're talking to someone new.  It's okay, they
+	   were transmitted to someone that didn't care anyway. */
+	txwin_cancel(pvt, 0);
 	return 0; 
 }
 
@@ -7446,6 +7767,7 @@ static void unlink_peer(struct iax2_peer *peer)
 		}
 	}
 
+	peer_unindex_addr(peer);
 	ao2_unlink(peers, peer);
 }
 
@@ -7467,6 +7789,7 @@ static void __expire_registry(const void *data)
 	peercnt_modify(0, 0, &peer->addr);
 	/* Reset the address */
 	memset(&peer->addr, 0, sizeof(peer->addr));
+	peer_index_addr(peer);
 	/* Reset expiry value */
 	peer->expiry = min_reg_expire;
 	if (!ast_test_flag(peer, IAX_TEMPONLY))
@@ -7517,6 +7840,7 @@ static void reg_source_db(struct iax2_peer *p)
 					p->addr.sin_family = AF_INET;
 					p->addr.sin_addr = in;
 					p->addr.sin_port = htons(atoi(c));
+					peer_index_addr(p);
 					if (p->expire > -1) {
 						if (!ast_sched_del(sched, p->expire)) {
 							p->expire = -1;
@@ -7587,6 +7911,7 @@ static int update_registry(struct sockaddr_in *sin, int callno, char *devtype, i
 
 		/* Stash the IP address from which they registered */
 		memcpy(&p->addr, sin, sizeof(p->addr));
+		peer_index_addr(p);
 
 		snprintf(data, sizeof(data), "%s:%d:%d", ast_inet_ntoa(sin->sin_addr), ntohs(sin->sin_port), p->expiry);
 		if (!ast_test_flag(p, IAX_TEMPONLY) && sin->sin_addr.s_addr) {
@@ -7882,18 +8207,18 @@ static int iax2_vnak(int callno)
 
 static void vnak_retransmit(int callno, int last)
 {
+	struct chan_iax2_pvt *pvt = iaxs[callno];
 	struct iax_frame *f;
+	unsigned char x = last;
+	int i;
 
-	AST_LIST_LOCK(&iaxq.queue);
-	AST_LIST_TRAVERSE(&iaxq.queue, f, list) {
-		/* Send a copy immediately */
-		if ((f->callno == callno) && iaxs[f->callno] &&
-			((unsigned char ) (f->oseqno - last) < 128) &&
-			(f->retries >= 0)) {
+	if (!pvt)
+		return;
+	/* Send a copy of everything from last on immediately */
+	for (i = 0; pvt->txwincount && i < 128; i++, x++) {
+		for (f = pvt->txwin[x]; f; f = f->txnext)
 			send_packet(f);
-		}
 	}
-	AST_LIST_UNLOCK(&iaxq.queue);
 }
 
 static void __iax2_poke_peer_s(const void *data)
@@ -7914,7 +8239,7 @@ static int iax2_poke_peer_s(const void *data)
 	return 0;
 }
 
-static int send_trunk(struct iax2_trunk_peer *tpeer, struct timeval *now)
+static int send_trunk(struct iax2_trunk_peer *tpeer, struct timeval *now, struct iax2_trunk_batch *batch)
 {
 	int res = 0;
 	struct iax_frame *fr;
@@ -7943,7 +8268,7 @@ static int send_trunk(struct iax2_trunk_peer *tpeer, struct timeval *now)
 		/* Any appropriate call will do */
 		fr->data = fr->afdata;
 		fr->datalen = tpeer->trunkdatalen + sizeof(struct ast_iax2_meta_hdr) + sizeof(struct ast_iax2_meta_trunk_hdr);
-		res = transmit_trunk(fr, &tpeer->addr, tpeer->sockfd);
+		res = transmit_trunk(fr, &tpeer->addr, tpeer->sockfd, tpeer, batch);
 		calls = tpeer->calls;
 #if 0
 		if (option_debug)
@@ -7970,13 +8295,17 @@ static int timing_read(int *id, int fd, short events, void *cbdata)
 {
 	char buf[1024];
 	int res;
-	struct iax2_trunk_peer *tpeer, *prev = NULL, *drop=NULL;
+	struct iax2_trunk_peer *tpeer, *dirty, *drop = NULL, **prev, **hprev;
 	int processed = 0;
 	int totalcalls = 0;
+	int packets = 0;
+	unsigned int flushus;
+	static time_t lastsweep;
 #ifdef DAHDI_TIMERACK
 	int x = 1;
 #endif
-	struct timeval now;
+	struct timeval now, start;
+	struct iax2_trunk_batch batch = { .count = 0 };
 	if (iaxtrunkdebug)
 		ast_verbose("Beginning trunk processing. Trunk queue ceiling is %d bytes per host\n", MAX_TRUNKDATA);
 	gettimeofday(&now, NULL);
@@ -7997,49 +8326,73 @@ static int timing_read(int *id, int fd, short events, void *cbdata)
 			return 1;
 		}
 	}
-	/* For each peer that supports trunking... */
-	ast_mutex_lock(&tpeerlock);
-	tpeer = tpeers;
-	while(tpeer) {
+	/* Send what the trunk peers that had frames queued have got */
+	ast_mutex_lock(&tpeerdirtylock);
+	dirty = tpeers_dirty;
+	tpeers_dirty = NULL;
+	ast_mutex_unlock(&tpeerdirtylock);
+	start = ast_tvnow();
+	while (dirty) {
+		tpeer = dirty;
 		processed++;
-		res = 0;
 		ast_mutex_lock(&tpeer->lock);
-		/* We can drop a single tpeer per pass.  That makes all this logic
-		   substantially easier */
-		if (!drop && iax2_trunk_expired(tpeer, &now)) {
-			/* Take it out of the list, but don't free it yet, because it
-			   could be in use */
-			if (prev)
-				prev->next = tpeer->next;
-			else
-				tpeers = tpeer->next;
+		/* Nobody touches dirtynext while it is still marked dirty */
+		dirty = tpeer->dirtynext;
+		tpeer->dirty = 0;
+		res = send_trunk(tpeer, &now, &batch);
+		if (iaxtrunkdebug)
+			ast_verbose(" - Trunk peer (%s:%d) has %d call chunk%s in transit, %d bytes backloged and has hit a high water mark of %d bytes\n", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port), res, (res != 1) ? "s" : "", tpeer->trunkdatalen, tpeer->trunkdataalloc);
+		if (res > 0) {
+			packets++;
+			totalcalls += res;
+		}
+		if (!trunk_batch_holds(&batch, tpeer))
+			ast_mutex_unlock(&tpeer->lock);
+	}
+	trunk_batch_flush(&batch);
+	if (processed) {
+		start = ast_tvsub(ast_tvnow(), start);
+		flushus = start.tv_sec * 1000000 + start.tv_usec;
+		ast_mutex_lock(&tpeerdirtylock);
+		trunkstats.ticks++;
+		trunkstats.packets += packets;
+		trunkstats.calls += totalcalls;
+		trunkstats.flushus += flushus;
+		if (flushus > trunkstats.maxflushus)
+			trunkstats.maxflushus = flushus;
+		ast_mutex_unlock(&tpeerdirtylock);
+	}
+
+	/* Once a second, drop the trunk peers that have been idle for a while */
+	if (now.tv_sec != lastsweep) {
+		lastsweep = now.tv_sec;
+		ast_mutex_lock(&tpeerlock);
+		for (prev = &tpeers; (tpeer = *prev); ) {
+			ast_mutex_lock(&tpeer->lock);
+			if (tpeer->dirty || !iax2_trunk_expired(tpeer, &now)) {
+				ast_mutex_unlock(&tpeer->lock);
+				prev = &tpeer->next;
+				continue;
+			}
+			*prev = tpeer->next;
+			for (hprev = &tpeer_buckets[tpeer_hash(&tpeer->addr)]; *hprev != tpeer; hprev = &(*hprev)->hnext)
+				;
+			*hprev = tpeer->hnext;
+			ast_mutex_unlock(&tpeer->lock);
+			tpeer->next = drop;
 			drop = tpeer;
-		} else {
-			res = send_trunk(tpeer, &now);
-			if (iaxtrunkdebug)
-				ast_verbose(" - Trunk peer (%s:%d) has %d call chunk%s in transit, %d bytes backloged and has hit a high water mark of %d bytes\n", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port), res, (res != 1) ? "s" : "", tpeer->trunkdatalen, tpeer->trunkdataalloc);
-		}		
-		totalcalls += res;	
-		res = 0;
-		ast_mutex_unlock(&tpeer->lock);
-		prev = tpeer;
-		tpeer = tpeer->next;
+		}
+		ast_mutex_unlock(&tpeerlock);
 	}
-	ast_mutex_unlock(&tpeerlock);
-	if (drop) {
-		ast_mutex_lock(&drop->lock);
-		/* Once we have this lock, we're sure nobody else is using it or could use it once we release it, 
-		   because by the time they could get tpeerlock, we've already grabbed it */
+	/* Nobody can find them anymore, and nobody had them locked */
+	while ((tpeer = drop)) {
+		drop = tpeer->next;
 		if (option_debug)
-			ast_log(LOG_DEBUG, "Dropping unused iax2 trunk peer '%s:%d'\n", ast_inet_ntoa(drop->addr.sin_addr), ntohs(drop->addr.sin_port));
-		if (drop->trunkdata) {
-			free(drop->trunkdata);
-			drop->trunkdata = NULL;
-		}
-		ast_mutex_unlock(&drop->lock);
-		ast_mutex_destroy(&drop->lock);
-		free(drop);
-		
+			ast_log(LOG_DEBUG, "Dropping unused iax2 trunk peer '%s:%d'\n", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port));
+		if (tpeer->trunkdata)
+			free(tpeer->trunkdata);
+		ast_mutex_destroy(&tpeer->lock);
+		free(tpeer);
 	}
 	if (iaxtrunkdebug)
 		ast_verbose("Ending trunk processing with %d peers and %d call chunks processed\n", processed, totalcalls);
@@ -8260,6 +8613,7 @@ static void handle_deferred_full_frames(struct iax2_thread *thread)
 	while ((pkt_buf = AST_LIST_REMOVE_HEAD(&thread->full_frames, entry))) {
 		ast_mutex_unlock(&thread->lock);
 
+		memcpy(&thread->iosin, &pkt_buf->sin, sizeof(thread->iosin));
 		thread->buf = pkt_buf->buf;
 		thread->buf_len = pkt_buf->len;
 		thread->buf_size = pkt_buf->len + 1;
@@ -8276,21 +8630,43 @@ static void handle_deferred_full_frames(struct iax2_thread *thread)
 }
 
 /*!
- * \brief Queue the last read full frame for processing by a certain thread
+ * \brief Handle the rest of the datagrams from the same batched read for this thread's call
+ */
+static void handle_batch_frames(struct iax2_thread *thread)
+{
+	struct iax2_pkt_buf *pkt_buf;
+
+	/* Filled in before we were signalled, nobody else touches it now */
+	while ((pkt_buf = AST_LIST_REMOVE_HEAD(&thread->batch_frames, entry))) {
+		memcpy(&thread->iosin, &pkt_buf->sin, sizeof(thread->iosin));
+		thread->buf = pkt_buf->buf;
+		thread->buf_len = pkt_buf->len;
+		thread->buf_size = pkt_buf->len + 1;
+
+		socket_process(thread);
+
+		thread->buf = NULL;
+		ast_free(pkt_buf);
+	}
+}
+
+/*!
+ * \brief Queue a full frame for processing by a certain thread
  *
  * If there are already any full frames queued, they are sorted
  * by sequence number.
  */
-static void defer_full_frame(struct iax2_thread *from_here, struct iax2_thread *to_here)
+static void defer_full_frame(struct iax2_thread *to_here, const struct sockaddr_in *sin, const unsigned char *buf, ssize_t len)
 {
 	struct iax2_pkt_buf *pkt_buf, *cur_pkt_buf;
 	struct ast_iax2_full_hdr *fh, *cur_fh;
 
-	if (!(pkt_buf = ast_calloc(1, sizeof(*pkt_buf) + from_here->buf_len)))
+	if (!(pkt_buf = ast_calloc(1, sizeof(*pkt_buf) + len)))
 		return;
 
-	pkt_buf->len = from_here->buf_len;
-	memcpy(pkt_buf->buf, from_here->buf, pkt_buf->len);
+	memcpy(&pkt_buf->sin, sin, sizeof(pkt_buf->sin));
+	pkt_buf->len = len;
+	memcpy(pkt_buf->buf, buf, pkt_buf->len);
 
 	fh = (struct ast_iax2_full_hdr *) pkt_buf->buf;
 	ast_mutex_lock(&to_here->lock);
@@ -8309,40 +8685,21 @@ static void defer_full_frame(struct iax2_thread *from_here, struct iax2_thread *
 	ast_mutex_unlock(&to_here->lock);
 }
 
-static int socket_read(int *id, int fd, short events, void *cbdata)
+/*!
+ * \brief Work out which thread processes the datagram just read into \a thread
+ *
+ * If it is a full frame, and any thread is currently processing a full frame
+ * for the same callno from this peer, then it goes to that thread instead.
+ *
+ * \retval 0 \a thread should process it
+ * \retval -1 it was dropped or handed to another thread, \a thread is still free
+ */
+static int socket_claim(struct iax2_thread *thread)
 {
-	struct iax2_thread *thread;
-	socklen_t len;
-	time_t t;
-	static time_t last_errtime = 0;
 	struct ast_iax2_full_hdr *fh;
 
-	if (!(thread = find_idle_thread())) {
-		time(&t);
-		if (t != last_errtime && option_debug)
-			ast_log(LOG_DEBUG, "Out of idle IAX2 threads for I/O, pausing!\n");
-		last_errtime = t;
-		usleep(1);
-		return 1;
-	}
-
-	len = sizeof(thread->iosin);
-	thread->iofd = fd;
-	thread->buf_len = recvfrom(fd, thread->readbuf, sizeof(thread->readbuf), 0, (struct sockaddr *) &thread->iosin, &len);
-	thread->buf_size = sizeof(thread->readbuf);
-	thread->buf = thread->readbuf;
-	if (thread->buf_len < 0) {
-		if (errno != ECONNREFUSED && errno != EAGAIN)
-			ast_log(LOG_WARNING, "Error: %s\n", strerror(errno));
-		handle_error();
-		thread->iostate = IAX_IOSTATE_IDLE;
-		signal_condition(&thread->lock, &thread->cond);
-		return 1;
-	}
 	if (test_losspct && ((100.0 * ast_random() / (RAND_MAX + 1.0)) < test_losspct)) { /* simulate random loss condition */
-		thread->iostate = IAX_IOSTATE_IDLE;
-		signal_condition(&thread->lock, &thread->cond);
-		return 1;
+		return -1;
 	}
 	
 	/* Determine if this frame is a full frame; if so, and any thread is currently
@@ -8362,11 +8719,9 @@ static int socket_read(int *id, int fd, short events, void *cbdata)
 		if (cur) {
 			/* we found another thread processing a full frame for this call,
 			   so queue it up for processing later. */
-			defer_full_frame(thread, cur);
+			defer_full_frame(cur, &thread->iosin, thread->buf, thread->buf_len);
 			AST_LIST_UNLOCK(&active_list);
-			thread->iostate = IAX_IOSTATE_IDLE;
-			signal_condition(&thread->lock, &thread->cond);
-			return 1;
+			return -1;
 		} else {
 			/* this thread is going to process this frame, so mark it */
 			thread->ffinfo.callno = callno;
@@ -8377,6 +8732,216 @@ static int socket_read(int *id, int fd, short events, void *cbdata)
 		}
 		AST_LIST_UNLOCK(&active_list);
 	}
+
+	return 0;
+}
+
+#ifdef IAX2_HAVE_MMSG
+/*! \brief Datagrams of one recvmmsg(), only ever used by socket_read() in the network thread */
+static struct {
+	struct mmsghdr msgs[IAX_RX_BATCH];
+	struct iovec iovs[IAX_RX_BATCH];
+	struct sockaddr_in addrs[IAX_RX_BATCH];
+	unsigned char bufs[IAX_RX_BATCH][4096];
+} rxbatch;
+
+/*! \brief The sending side's call number of a datagram, the one it is dispatched by */
+static unsigned short datagram_callno(const unsigned char *buf, ssize_t len)
+{
+	if (len < 4)
+		return 0;
+	/* Full and mini frames start with it, meta frames (video) have it after
+	   16 zero bits */
+	if (buf[0] || buf[1])
+		return ((buf[0] << 8) | buf[1]) & ~IAX_FLAG_FULL;
+	return ((buf[2] << 8) | buf[3]) & ~IAX_FLAG_FULL;
+}
+
+/*!
+ * \brief Give a datagram from a batched read to \a thread, which already
+ *        has the earlier ones for the same call
+ */
+static void socket_batch_append(struct iax2_thread *thread, const struct sockaddr_in *sin, const unsigned char *buf, ssize_t len)
+{
+	struct ast_iax2_full_hdr *fh = (struct ast_iax2_full_hdr *) buf;
+	struct iax2_pkt_buf *pkt_buf;
+	struct iax2_thread *cur = NULL;
+	uint16_t callno;
+
+	if (test_losspct && ((100.0 * ast_random() / (RAND_MAX + 1.0)) < test_losspct)) /* simulate random loss condition */
+		return;
+
+	if (ntohs(fh->scallno) & IAX_FLAG_FULL) {
+		callno = ntohs(fh->scallno) & ~IAX_FLAG_FULL;
+		AST_LIST_LOCK(&active_list);
+		AST_LIST_TRAVERSE(&active_list, cur, list) {
+			if ((cur->ffinfo.callno == callno) &&
+			    !inaddrcmp(&cur->ffinfo.sin, sin))
+				break;
+		}
+		if (cur && cur != thread) {
+			/* same as socket_claim() */
+			defer_full_frame(cur, sin, buf, len);
+			AST_LIST_UNLOCK(&active_list);
+			return;
+		} else if (!cur && !thread->ffinfo.callno) {
+			thread->ffinfo.callno = callno;
+			memcpy(&thread->ffinfo.sin, sin, sizeof(thread->ffinfo.sin));
+			thread->ffinfo.type = fh->type;
+			thread->ffinfo.csub = fh->csub;
+			AST_LIST_INSERT_HEAD(&active_list, thread, list);
+		}
+		AST_LIST_UNLOCK(&active_list);
+	}
+
+	if (!(pkt_buf = ast_calloc(1, sizeof(*pkt_buf) + len)))
+		return;
+	memcpy(&pkt_buf->sin, sin, sizeof(pkt_buf->sin));
+	pkt_buf->len = len;
+	memcpy(pkt_buf->buf, buf, len);
+	AST_LIST_INSERT_TAIL(&thread->batch_frames, pkt_buf, entry);
+}
+
+/*! \brief Send the threads handed datagrams by socket_read_batch() on their way */
+static void socket_batch_dispatch(struct iax2_thread **threads, int nthreads)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i]->iostate = IAX_IOSTATE_READY;
+#ifdef DEBUG_SCHED_MULTITHREAD
+		ast_copy_string(threads[i]->curfunc, "socket_process", sizeof(threads[i]->curfunc));
+#endif
+		signal_condition(&threads[i]->lock, &threads[i]->cond);
+	}
+}
+
+/*!
+ * \brief Read everything waiting on \a fd, up to IAX_RX_BATCH datagrams, with
+ *        one recvmmsg() and hand it out
+ *
+ * All the datagrams for a call go to the same thread, in order, so each
+ * call costs one wakeup per read.  If we run out of idle threads, the ones
+ * we have are sent on their way and we wait for one to come free, much as
+ * socket_read() waits with the datagram left on the socket.
+ *
+ * \retval -1 recvmmsg() is not there, nothing was read
+ */
+static int socket_read_batch(int fd, struct iax2_thread *thread)
+{
+	struct iax2_thread *threads[IAX_RX_BATCH];
+	unsigned short callnos[IAX_RX_BATCH];
+	unsigned short callno;
+	int i, j, count, nthreads = 0;
+	time_t t;
+	static time_t last_errtime = 0;
+
+	for (i = 0; i < IAX_RX_BATCH; i++) {
+		rxbatch.iovs[i].iov_base = rxbatch.bufs[i];
+		rxbatch.iovs[i].iov_len = sizeof(rxbatch.bufs[i]);
+		rxbatch.msgs[i].msg_hdr.msg_iov = &rxbatch.iovs[i];
+		rxbatch.msgs[i].msg_hdr.msg_iovlen = 1;
+		rxbatch.msgs[i].msg_hdr.msg_name = &rxbatch.addrs[i];
+		rxbatch.msgs[i].msg_hdr.msg_namelen = sizeof(rxbatch.addrs[i]);
+	}
+	if ((count = recvmmsg(fd, rxbatch.msgs, IAX_RX_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+		if (errno == ENOSYS) {
+			/* Kernel too old, go back to one at a time */
+			batchio = 0;
+			return -1;
+		}
+		if (errno != ECONNREFUSED && errno != EAGAIN)
+			ast_log(LOG_WARNING, "Error: %s\n", strerror(errno));
+		handle_error();
+		count = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		callno = datagram_callno(rxbatch.bufs[i], rxbatch.msgs[i].msg_len);
+		for (j = 0; j < nthreads; j++) {
+			if (callnos[j] == callno && !inaddrcmp(&threads[j]->iosin, &rxbatch.addrs[i]))
+				break;
+		}
+		if (j == nthreads && !thread && !(thread = find_idle_thread())) {
+			time(&t);
+			if (t != last_errtime && option_debug)
+				ast_log(LOG_DEBUG, "Out of idle IAX2 threads for I/O, waiting!\n");
+			last_errtime = t;
+			/* Nothing for this datagram to join now */
+			socket_batch_dispatch(threads, nthreads);
+			nthreads = 0;
+			while (!(thread = find_idle_thread()))
+				usleep(1);
+		}
+		if (j < nthreads) {
+			socket_batch_append(threads[j], &rxbatch.addrs[i], rxbatch.bufs[i], rxbatch.msgs[i].msg_len);
+			continue;
+		}
+		thread->iofd = fd;
+		memcpy(&thread->iosin, &rxbatch.addrs[i], sizeof(thread->iosin));
+		thread->buf_len = rxbatch.msgs[i].msg_len;
+		memcpy(thread->readbuf, rxbatch.bufs[i], thread->buf_len);
+		thread->buf_size = sizeof(thread->readbuf);
+		thread->buf = thread->readbuf;
+		if (socket_claim(thread))
+			continue;
+		callnos[nthreads] = callno;
+		threads[nthreads++] = thread;
+		thread = NULL;
+	}
+
+	/* Left over, nothing for it to do */
+	if (thread) {
+		thread->iostate = IAX_IOSTATE_IDLE;
+		signal_condition(&thread->lock, &thread->cond);
+	}
+
+	/* Mark as ready and send on their way */
+	socket_batch_dispatch(threads, nthreads);
+
+	return 0;
+}
+#endif
+
+static int socket_read(int *id, int fd, short events, void *cbdata)
+{
+	struct iax2_thread *thread;
+	socklen_t len;
+	time_t t;
+	static time_t last_errtime = 0;
+
+	if (!(thread = find_idle_thread())) {
+		time(&t);
+		if (t != last_errtime && option_debug)
+			ast_log(LOG_DEBUG, "Out of idle IAX2 threads for I/O, pausing!\n");
+		last_errtime = t;
+		usleep(1);
+		return 1;
+	}
+
+#ifdef IAX2_HAVE_MMSG
+	if (batchio && !socket_read_batch(fd, thread))
+		return 1;
+#endif
+
+	len = sizeof(thread->iosin);
+	thread->iofd = fd;
+	thread->buf_len = recvfrom(fd, thread->readbuf, sizeof(thread->readbuf), 0, (struct sockaddr *) &thread->iosin, &len);
+	thread->buf_size = sizeof(thread->readbuf);
+	thread->buf = thread->readbuf;
+	if (thread->buf_len < 0) {
+		if (errno != ECONNREFUSED && errno != EAGAIN)
+			ast_log(LOG_WARNING, "Error: %s\n", strerror(errno));
+		handle_error();
+		thread->iostate = IAX_IOSTATE_IDLE;
+		signal_condition(&thread->lock, &thread->cond);
+		return 1;
+	}
+	if (socket_claim(thread)) {
+		thread->iostate = IAX_IOSTATE_IDLE;
+		signal_condition(&thread->lock, &thread->cond);
+		return 1;
+	}
 	
 	/* Mark as ready and send on its way */
 	thread->iostate = IAX_IOSTATE_READY;
@@ -8821,9 +9386,10 @@ blow up, and will be removed as soon as possible */
 		}
 
 		/* Handle implicit ACKing unless this is an INVAL, and only if this is 
-		   from the real peer, not the transfer peer */
+		   from the real peer, not the transfer peer.  A CALLTOKEN doesn't
+		   really ack our NEW, resend_with_token() takes it out of the window. */
 		if (!inaddrcmp(&sin, &iaxs[fr->callno]->addr) && 
-		    ((f.subclass != IAX_COMMAND_INVAL) ||
+		    (((f.subclass != IAX_COMMAND_INVAL) && (f.subclass != IAX_COMMAND_CALLTOKEN)) ||
 		     (f.frametype != AST_FRAME_IAX))) {
 			unsigned char x;
 			int call_to_destroy;
@@ -8841,17 +9407,15 @@ blow up, and will be removed as soon as possible */
 					if (option_debug && iaxdebug)
 						ast_log(LOG_DEBUG, "Cancelling transmission of packet %d\n", x);
 					call_to_destroy = 0;
-					AST_LIST_LOCK(&iaxq.queue);
-					AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-						/* If it's our call, and our timestamp, mark -1 retries */
-						if ((fr->callno == cur->callno) && (x == cur->oseqno)) {
-							cur->retries = -1;
-							/* Destroy call if this is the end */
-							if (cur->final)
-								call_to_destroy = fr->callno;
-						}
+					if (!iaxs[fr->callno])
+						break;
+					/* Everything we sent with this seqno is done with */
+					while ((cur = iaxs[fr->callno]->txwin[x])) {
+						/* Destroy call if this is the end */
+						if (cur->final)
+							call_to_destroy = fr->callno;
+						txwin_drop(iaxs[fr->callno], cur);
 					}
-					AST_LIST_UNLOCK(&iaxq.queue);
 					if (call_to_destroy) {
 						if (iaxdebug && option_debug)
 							ast_log(LOG_DEBUG, "Really destroying %d, having been acked on final message\n", call_to_destroy);
@@ -9019,14 +9583,8 @@ retryowner:
 				break;
 			case IAX_COMMAND_TXACC:
 				if (iaxs[fr->callno]->transferring == TRANSFER_BEGIN) {
-					/* Ack the packet with the given timestamp */
-					AST_LIST_LOCK(&iaxq.queue);
-					AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-						/* Cancel any outstanding txcnt's */
-						if ((fr->callno == cur->callno) && (cur->transfer))
-							cur->retries = -1;
-					}
-					AST_LIST_UNLOCK(&iaxq.queue);
+					/* Cancel any outstanding txcnt's */
+					txwin_cancel(iaxs[fr->callno], 1);
 					memset(&ied1, 0, sizeof(ied1));
 					iax_ie_append_short(&ied1, IAX_IE_CALLNO, iaxs[fr->callno]->callno);
 					send_command(iaxs[fr->callno], AST_FRAME_IAX, IAX_COMMAND_TXREADY, 0, ied1.buf, ied1.pos, -1);
@@ -9862,14 +10420,8 @@ retryowner2:
 				break;	
 			case IAX_COMMAND_TXMEDIA:
 				if (iaxs[fr->callno]->transferring == TRANSFER_READY) {
-                                        AST_LIST_LOCK(&iaxq.queue);
-                                        AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-                                                /* Cancel any outstanding frames and start anew */
-                                                if ((fr->callno == cur->callno) && (cur->transfer)) {
-                                                        cur->retries = -1;
-                                                }
-                                        }
-                                        AST_LIST_UNLOCK(&iaxq.queue);
+					/* Cancel any outstanding frames and start anew */
+					txwin_cancel(iaxs[fr->callno], 1);
 					/* Start sending our media to the transfer address, but otherwise leave the call as-is */
 					iaxs[fr->callno]->transferring = TRANSFER_MEDIAPASS;
 				}
@@ -9901,17 +10453,10 @@ retryowner2:
 				break;
 			case IAX_COMMAND_CALLTOKEN:
 			{
-				struct iax_frame *cur;
-				AST_LIST_LOCK(&iaxq.queue);
-				AST_LIST_TRAVERSE(&iaxq.queue, cur, list) {
-					/* find the last sent frame in our frame queue for this callno.
-					 * There are many things to take into account before resending this frame.
-					 * All of these are taken care of in resend_with_token() */
-					if (cur->callno == fr->callno) {
-						break;
-					}
-				}
-				AST_LIST_UNLOCK(&iaxq.queue);
+				/* find the last sent frame in our frame queue for this callno.
+				 * There are many things to take into account before resending this frame.
+				 * All of these are taken care of in resend_with_token() */
+				struct iax_frame *cur = txwin_first(iaxs[fr->callno]);
 
 				/* find last sent frame */
 				if (cur && ies.calltoken && ies.calltokendata) {
@@ -10123,6 +10668,7 @@ static void *iax2_process_thread(void *data)
 			thread->actions++;
 			thread->iostate = IAX_IOSTATE_PROCESSING;
 			socket_process(thread);
+			handle_batch_frames(thread);
 			handle_deferred_full_frames(thread);
 			break;
 		case IAX_IOSTATE_SCHEDREADY:
@@ -10701,6 +11247,7 @@ static void *network_thread(void *ignore)
 	/* Our job is simple: Send queued messages, retrying if necessary.  Read frames 
 	   from the network, and queue them for delivery to the channels */
 	int res, count, wakeup;
+	unsigned short callno;
 	struct iax_frame *f;
 
 	if (timingfd > -1)
@@ -10710,40 +11257,38 @@ static void *network_thread(void *ignore)
 		pthread_testcancel();
 
 		/* Go through the queue, sending messages which have not yet been
-		   sent, and scheduling retransmissions if appropriate */
+		   sent, and scheduling retransmissions if appropriate.  Once sent,
+		   a frame is the scheduler's (and its call's window's) problem. */
 		AST_LIST_LOCK(&iaxq.queue);
 		count = 0;
 		wakeup = -1;
 		AST_LIST_TRAVERSE_SAFE_BEGIN(&iaxq.queue, f, list) {
-			if (f->sentyet)
-				continue;
-			
 			/* Try to lock the pvt, if we can't... don't fret - defer it till later */
-			if (ast_mutex_trylock(&iaxsl[f->callno])) {
+			callno = f->callno;
+			if (ast_mutex_trylock(&iaxsl[callno])) {
 				wakeup = 1;
 				continue;
 			}
 
+			AST_LIST_REMOVE_CURRENT(&iaxq.queue, list);
+			iaxq.count--;
 			f->sentyet++;
 
-			if (iaxs[f->callno]) {
+			if (iaxs[callno]) {
 				send_packet(f);
 				count++;
 			} 
 
-			ast_mutex_unlock(&iaxsl[f->callno]);
-
 			if (f->retries < 0) {
 				/* This is not supposed to be retransmitted */
-				AST_LIST_REMOVE_CURRENT(&iaxq.queue, list);
-				iaxq.count--;
-				/* Free the iax frame */
 				iax_frame_free(f);
 			} else {
 				/* We need reliable delivery.  Schedule a retransmission */
 				f->retries++;
 				f->retrans = iax2_sched_add(sched, f->retrytime, attempt_transmit, f);
 			}
+
+			ast_mutex_unlock(&iaxsl[callno]);
 		}
 		AST_LIST_TRAVERSE_SAFE_END
 		AST_LIST_UNLOCK(&iaxq.queue);
@@ -11522,6 +12067,8 @@ static void set_config_destroy(void)
 	strcpy(mohsuggest, "");
 	amaflags = 0;
 	delayreject = 0;
+	compatusermatch = 1;
+	batchio = 1;
 	ast_clear_flag((&globalflags), IAX_NOTRANSFER);	
 	ast_clear_flag((&globalflags), IAX_TRANSFERMEDIA);	
 	ast_clear_flag((&globalflags), IAX_USEJITTERBUF);	
@@ -11696,6 +12243,10 @@ static int set_config(const char *config_file, int reload)
 			ast_set2_flag((&globalflags), ast_true(v->value), IAX_FORCEJITTERBUF);	
 		else if (!strcasecmp(v->name, "delayreject"))
 			delayreject = ast_true(v->value);
+		else if (!strcasecmp(v->name, "compatusermatch"))
+			compatusermatch = ast_true(v->value);
+		else if (!strcasecmp(v->name, "batchio"))
+			batchio = ast_true(v->value);
 		else if (!strcasecmp(v->name, "allowfwdownload"))
 			ast_set2_flag((&globalflags), ast_true(v->value), IAX_ALLOWFWDOWNLOAD);
 		else if (!strcasecmp(v->name, "rtcachefriends"))
@@ -11849,14 +12400,15 @@ static int set_config(const char *config_file, int reload)
 					/* Start with general parameters, then specific parameters, user and peer */
 					user = build_user(cat, gen, ast_variable_browse(ucfg, cat), 0);
 					if (user) {
-						__ao2_link(users, user, (MAX_PEER_BUCKETS == 1) ? 1 : 0);
+						link_user(user, 0);
 						user = user_unref(user);
 					}
 					peer = build_peer(cat, gen, ast_variable_browse(ucfg, cat), 0);
 					if (peer) {
 						if (ast_test_flag(peer, IAX_DYNAMIC))
 							reg_source_db(peer);
-						__ao2_link(peers, peer, (MAX_PEER_BUCKETS == 1) ? 1 : 0);
+						ao2_link(peers, peer);
+						peer_index_addr(peer);
 						peer = peer_unref(peer);
 					}
 				}
@@ -11895,7 +12447,7 @@ static int set_config(const char *config_file, int reload)
 				if (!strcasecmp(utype, "user") || !strcasecmp(utype, "friend")) {
 					user = build_user(cat, ast_variable_browse(cfg, cat), NULL, 0);
 					if (user) {
-						__ao2_link(users, user, (MAX_PEER_BUCKETS == 1) ? 1 : 0);
+						link_user(user, 0);
 						user = user_unref(user);
 					}
 				}
@@ -11904,7 +12456,8 @@ static int set_config(const char *config_file, int reload)
 					if (peer) {
 						if (ast_test_flag(peer, IAX_DYNAMIC))
 							reg_source_db(peer);
-						__ao2_link(peers, peer, (MAX_PEER_BUCKETS == 1) ? 1 : 0);
+						ao2_link(peers, peer);
+						peer_index_addr(peer);
 						peer = peer_unref(peer);
 					}
 				} else if (strcasecmp(utype, "user")) {
@@ -12499,7 +13052,8 @@ static char show_channels_usage[] =
 
 static char show_netstats_usage[] = 
 "Usage: iax2 show netstats\n"
-"       Lists network status for all currently active IAX channels.\n";
+"       Lists network status for all currently active IAX channels,\n"
+"       and how trunk frames have been sent since the module was loaded.\n";
 
 static char show_threads_usage[] = 
 "Usage: iax2 show threads\n"
@@ -12767,6 +13321,8 @@ static int __unload_module(void)
 		ast_mutex_destroy(&iaxsl[x]);
 	}
 
+	ao2_ref(peers_by_addr, -1);
+	ao2_ref(peers_dnsmgr, -1);
 	ao2_ref(peers, -1);
 	ao2_ref(users, -1);
 	ao2_ref(iax_peercallno_pvts, -1);
@@ -12774,8 +13330,6 @@ static int __unload_module(void)
 	ao2_ref(peercnts, -1);
 	ao2_ref(callno_limits, -1);
 	ao2_ref(calltoken_ignores, -1);
-	ao2_ref(callno_pool, -1);
-	ao2_ref(callno_pool_trunk, -1);
 
 	return 0;
 }
@@ -12799,8 +13353,15 @@ static int peer_set_sock_cb(void *obj, void *arg, int flags)
 static int pvt_hash_cb(const void *obj, const int flags)
 {
 	const struct chan_iax2_pvt *pvt = obj;
+	unsigned int hash;
+
+	/* Many remote ends hand out the same low call numbers, so mix in
+	 * where the call is from.  pvt->addr must not change while the pvt
+	 * is in iax_peercallno_pvts. */
+	hash = ntohl(pvt->addr.sin_addr.s_addr) * 31 + ntohs(pvt->addr.sin_port);
+	hash = hash * 31 + pvt->peercallno;
 
-	return pvt->peercallno;
+	return hash & INT_MAX;
 }
 
 static int pvt_cmp_cb(void *obj, void *arg, int flags)
@@ -12835,11 +13396,15 @@ static int transfercallno_pvt_cmp_cb(void *obj, void *arg, int flags)
 
 static int load_objects(void)
 {
-	peers = users = iax_peercallno_pvts = iax_transfercallno_pvts = NULL;
-	peercnts = callno_limits = calltoken_ignores = callno_pool = callno_pool_trunk = NULL;
+	peers = peers_by_addr = peers_dnsmgr = users = iax_peercallno_pvts = iax_transfercallno_pvts = NULL;
+	peercnts = callno_limits = calltoken_ignores = NULL;
 
 	if (!(peers = ao2_container_alloc(MAX_PEER_BUCKETS, peer_hash_cb, peer_cmp_cb))) {
 		goto container_fail;
+	} else if (!(peers_by_addr = ao2_container_alloc(MAX_PEER_BUCKETS, peer_addr_hash_cb, peer_addr_cmp_cb))) {
+		goto container_fail;
+	} else if (!(peers_dnsmgr = ao2_container_alloc(1, NULL, NULL))) {
+		goto container_fail;
 	} else if (!(users = ao2_container_alloc(MAX_USER_BUCKETS, user_hash_cb, user_cmp_cb))) {
 		goto container_fail;
 	} else if (!(iax_peercallno_pvts = ao2_container_alloc(IAX_MAX_CALLS, pvt_hash_cb, pvt_cmp_cb))) {
@@ -12862,6 +13427,12 @@ container_fail:
 	if (peers) {
 		ao2_ref(peers, -1);
 	}
+	if (peers_by_addr) {
+		ao2_ref(peers_by_addr, -1);
+	}
+	if (peers_dnsmgr) {
+		ao2_ref(peers_dnsmgr, -1);
+	}
 	if (users) {
 		ao2_ref(users, -1);
 	}
@@ -12880,12 +13451,6 @@ container_fail:
 	if (calltoken_ignores) {
 		ao2_ref(calltoken_ignores, -1);
 	}
-	if (callno_pool) {
-		ao2_ref(callno_pool, -1);
-	}
-	if (callno_pool_trunk) {
-		ao2_ref(callno_pool_trunk, -1);
-	}
 	return AST_MODULE_LOAD_FAILURE;
 }
 
@@ -268,6 +268,8 @@ struct ast_flags zeroflag = { 0 };
 #define	XPMR_VOTER
 #include "xpmr/xpmr.h"
 
+#include "voter_mix.h"
+
 #ifdef	OLD_ASTERISK
 #define	AST_MODULE_LOAD_DECLINE -1
 #endif
@@ -335,6 +337,32 @@ AST_MUTEX_DEFINE_STATIC(voter_lock);
 int16_t listen_port = 667;				/* port to listen to UDP packets on */
 int udp_socket = -1;
 
+#define	MAX_VOTER_READERS 16
+#define	VOTER_RX_BATCH 32
+#define	VOTER_RX_BUFSIZE 4096
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define	VOTER_HAVE_RECVMMSG
+#endif
+
+/* one receive batch per reader thread */
+struct voter_rxbatch {
+	int sock;
+	int n;		/* packets in batch */
+	int next;	/* next packet to be processed */
+#ifdef	VOTER_HAVE_RECVMMSG
+	struct mmsghdr msgs[VOTER_RX_BATCH];
+	struct iovec iovs[VOTER_RX_BATCH];
+#endif
+	struct sockaddr_in addrs[VOTER_RX_BATCH];
+	ssize_t lens[VOTER_RX_BATCH];
+	char bufs[VOTER_RX_BATCH][VOTER_RX_BUFSIZE];
+} ;
+
+int voter_readers = 1;		/* number of reader threads/sockets */
+static int reader_sockets[MAX_VOTER_READERS];	/* reader_sockets[0] is udp_socket */
+static int master_port = 0;	/* must be accessed with voter_lock locked */
+
 int voter_timing_fd = -1;
 int voter_timing_count = 0;
 int last_master_count = 0;
@@ -348,7 +376,7 @@ char context[100];
 
 double dnsec;
 
-static pthread_t voter_reader_thread = 0;
+static pthread_t voter_reader_threads[MAX_VOTER_READERS];
 static pthread_t voter_timer_thread = 0;
 
 int maxpvtorder = 0;
@@ -434,6 +462,8 @@ struct voter_client {
 	char dynamic;
 	char txlockout;
 	struct voter_client *next;
+	struct voter_client *digest_next;	/* chain in client_digest_hash */
+	struct voter_client *addr_next;		/* chain in client_addr_hash */
 	uint8_t lastrssi;
 	int txseqno;
 	int txseqno_rxkeyed;
@@ -509,7 +539,6 @@ struct voter_pvt {
 	struct ast_trans_pvt *nuin;
 	struct ast_trans_pvt *nuout;
 	struct ast_trans_pvt *toast;
-	struct ast_trans_pvt *toast1;
 	struct ast_trans_pvt *fromast;
 	t_pmr_chan	*pmrChan;
 	char	txctcssfreq[32];
@@ -548,6 +577,8 @@ struct voter_pvt {
 #endif
 	ast_mutex_t  txqlock;
 	ast_mutex_t  pagerqlock;
+	struct voter_client **clients;		/* this instance's clients, NULL terminated */
+	struct voter_client **oldclients;	/* previous vector, kept until the next rebuild */
 };
 
 #ifdef	OLD_ASTERISK
@@ -583,6 +614,14 @@ struct voter_client *clients = NULL;
 
 struct voter_client *dyn_clients = NULL;
 
+/* all clients indexed by digest, and (those that have one) by address */
+#define	VOTER_CLIENT_HASH_SIZE 256
+
+static struct voter_client *client_digest_hash[VOTER_CLIENT_HASH_SIZE];
+static struct voter_client *client_addr_hash[VOTER_CLIENT_HASH_SIZE];
+
+static struct voter_client *noclients[1] = { NULL };
+
 FILE *fp;
 
 VTIME master_time = {0,0};
@@ -899,6 +938,173 @@ int	i;
 	return(i);
 }
 
+static unsigned int voter_digest_hash(uint32_t digest)
+{
+	return((digest ^ (digest >> 8) ^ (digest >> 16) ^ (digest >> 24)) & (VOTER_CLIENT_HASH_SIZE - 1));
+}
+
+static unsigned int voter_addr_hash(struct sockaddr_in *sin)
+{
+uint32_t h;
+
+	h = sin->sin_addr.s_addr ^ ((uint32_t)sin->sin_port << 16) ^ sin->sin_port;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return(h & (VOTER_CLIENT_HASH_SIZE - 1));
+}
+
+/* must be called with voter_lock locked */
+static void digest_hash_add(struct voter_client *client)
+{
+unsigned int h = voter_digest_hash(client->digest);
+
+	client->digest_next = client_digest_hash[h];
+	client_digest_hash[h] = client;
+}
+
+/* must be called with voter_lock locked */
+static void digest_hash_del(struct voter_client *client)
+{
+struct voter_client **cpp;
+
+	for(cpp = &client_digest_hash[voter_digest_hash(client->digest)]; *cpp; cpp = &(*cpp)->digest_next)
+	{
+		if (*cpp != client) continue;
+		*cpp = client->digest_next;
+		break;
+	}
+	client->digest_next = NULL;
+}
+
+/* must be called with voter_lock locked */
+static void addr_hash_del(struct voter_client *client)
+{
+struct voter_client **cpp;
+
+	if ((!client->sin.sin_addr.s_addr) && (!client->sin.sin_port)) return;
+	for(cpp = &client_addr_hash[voter_addr_hash(&client->sin)]; *cpp; cpp = &(*cpp)->addr_next)
+	{
+		if (*cpp != client) continue;
+		*cpp = client->addr_next;
+		break;
+	}
+	client->addr_next = NULL;
+}
+
+/* set (or with NULL, clear) a client's address, must be called with voter_lock locked */
+static void voter_client_setaddr(struct voter_client *client, struct sockaddr_in *sin)
+{
+unsigned int h;
+
+	if (sin && (client->sin.sin_addr.s_addr == sin->sin_addr.s_addr) &&
+		(client->sin.sin_port == sin->sin_port))
+	{
+		client->sin = *sin;
+		return;
+	}
+	addr_hash_del(client);
+	if (!sin)
+	{
+		memset(&client->sin,0,sizeof(client->sin));
+		return;
+	}
+	client->sin = *sin;
+	if ((!client->sin.sin_addr.s_addr) && (!client->sin.sin_port)) return;
+	h = voter_addr_hash(&client->sin);
+	client->addr_next = client_addr_hash[h];
+	client_addr_hash[h] = client;
+}
+
+/* find a non-dynamic client by digest, must be called with voter_lock locked */
+static struct voter_client *find_client_digest(uint32_t digest)
+{
+struct voter_client *client;
+
+	for(client = client_digest_hash[voter_digest_hash(digest)]; client; client = client->digest_next)
+	{
+		if (client->dynamic) continue;
+		if (client->digest == digest) break;
+	}
+	return(client);
+}
+
+/* 
+ * if two authenticated clients claim the same address and port, kick both.
+ * With skippriconn, leave clients of a missing instance or one connected
+ * to a primary alone. Must be called with voter_lock locked
+*/
+static void check_dup_addrs(int skippriconn)
+{
+struct voter_client *client,*client1;
+struct voter_pvt *p;
+
+	for(client = clients; client; client = client->next)
+	{
+		if (!client->respdigest) continue;
+		if ((!client->sin.sin_addr.s_addr) && (!client->sin.sin_port)) continue;
+		if (skippriconn)
+		{
+			for(p = pvts; p; p = p->next)
+			{
+				if (p->nodenum == client->nodenum) break;
+			}
+			if ((!p) || p->priconn) continue;
+		}
+		for(client1 = client_addr_hash[voter_addr_hash(&client->sin)]; client1; client1 = client1->addr_next)
+		{
+			if (client1 == client) continue;
+			if (!client1->respdigest) continue;
+			if ((client1->sin.sin_addr.s_addr == client->sin.sin_addr.s_addr) &&
+				(client1->sin.sin_port == client->sin.sin_port))
+			{
+				client->respdigest = 0;
+				client->heardfrom = 0;
+				client1->respdigest = 0;
+				client1->heardfrom = 0;
+			}
+		}
+	}
+}
+
+/* 
+ * (re)build an instance's client vector, must be called with voter_lock locked.
+ * voter_xmit() walks the vector without the lock, so the previous one is
+ * only freed on the rebuild after this one
+*/
+static int voter_pvt_clients(struct voter_pvt *p)
+{
+struct voter_client *client,**v;
+int	n;
+
+	n = 0;
+	for(client = clients; client; client = client->next)
+	{
+		if (client->nodenum == p->nodenum) n++;
+	}
+	v = (struct voter_client **)ast_malloc((n + 1) * sizeof(struct voter_client *));
+	if (!v)
+	{
+		ast_log(LOG_ERROR,"Cant malloc()\n");
+		/* the old vector may point at clients that were just freed,
+		   so leave the instance with none rather than keep it */
+		if (p->oldclients && (p->oldclients != noclients)) ast_free(p->oldclients);
+		p->oldclients = p->clients;
+		p->clients = noclients;
+		return -1;
+	}
+	n = 0;
+	for(client = clients; client; client = client->next)
+	{
+		if (client->nodenum == p->nodenum) v[n++] = client;
+	}
+	v[n] = NULL;
+	if (p->oldclients && (p->oldclients != noclients)) ast_free(p->oldclients);
+	p->oldclients = p->clients;
+	p->clients = v;
+	return 0;
+}
+
 
 /* return offsetted time */
 static long long puckoffset(struct voter_client *client)
@@ -926,12 +1132,11 @@ long long btime;
 /* must be called with voter_lock locked */
  static void incr_drainindex(struct voter_pvt *p)
 {
-struct voter_client *client;
+struct voter_client *client,**cpp;
 
 	if (p == NULL) return;
-	for(client = clients; client; client = client->next)
+	for(cpp = p->clients; (client = *cpp); cpp++)
 	{
-		if (client->nodenum != p->nodenum) continue;
 		if (!client->drain40ms) 
 		{
 			client->drainindex_40ms = client->drainindex;
@@ -971,7 +1176,6 @@ static int voter_hangup(struct ast_channel *ast)
 	if (p->adpcmin) ast_translator_free_path(p->adpcmin);
 	if (p->adpcmout) ast_translator_free_path(p->adpcmout);
 	if (p->toast) ast_translator_free_path(p->toast);
-	if (p->toast) ast_translator_free_path(p->toast1);
 	if (p->fromast) ast_translator_free_path(p->fromast);
 	if (p->nuin) ast_translator_free_path(p->nuin);
 	if (p->nuout) ast_translator_free_path(p->nuout);
@@ -983,6 +1187,8 @@ static int voter_hangup(struct ast_channel *ast)
 	if (q->next) q->next = p->next;
 	if (pvts == p) pvts = p->next;
 	ast_mutex_unlock(&voter_lock);
+	if (p->oldclients && (p->oldclients != noclients)) ast_free(p->oldclients);
+	if (p->clients != noclients) ast_free(p->clients);
 	ast_free(p);
 	ast->tech_pvt = NULL;
 	ast_setstate(ast, AST_STATE_DOWN);
@@ -1303,9 +1509,9 @@ int len;
 static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclient, int maxrssi)
 {
 
-	int i,j,k,x,maxprio,haslastaudio;
+	int i,k,x,maxprio,haslastaudio;
 	struct ast_frame fr,*f1,*f2;
-	struct voter_client *client;
+	struct voter_client *client,**cpp;
 	short  silbuf[FRAME_SIZE];
 
 
@@ -1328,9 +1534,8 @@ static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclien
 		return(0);
 	}
 	maxprio = 0;
-	for(client = clients; client; client = client->next)
+	for(cpp = p->clients; (client = *cpp); cpp++)
 	{
-		if (client->nodenum != p->nodenum) continue;
 		if (!client->mix) continue;
 		if (client->prio_override == -1) continue;
 		if (client->prio_override > -2)
@@ -1340,10 +1545,9 @@ static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclien
 		if (i > maxprio) maxprio = i;
 	}
 	/* f1 now contains the voted-upon audio in slinear */
-	for(client = clients; client; client = client->next)
+	for(cpp = p->clients; (client = *cpp); cpp++)
 	{
-		short *sp1,*sp2;
-		if (client->nodenum != p->nodenum) continue;
+		short *sp1;
 		if (!client->mix) continue;
 		if (client->prio_override == -1) continue;
 		if (maxprio)
@@ -1354,89 +1558,24 @@ static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclien
 				i = client->prio;
 			if (i < maxprio) continue;
 		}
-		i = (int)client->buflen - ((int)client->drainindex + FRAME_SIZE);
-		if (i >= 0)
-		{
-			memcpy(p->buf + AST_FRIENDLY_OFFSET,client->audio + client->drainindex,FRAME_SIZE);
-		}
-		else
-		{
-			memcpy(p->buf + AST_FRIENDLY_OFFSET,client->audio + client->drainindex,FRAME_SIZE + i);
-			memcpy(p->buf + AST_FRIENDLY_OFFSET + (client->buflen - i),client->audio,-i);
-		}
-		if (i >= 0)
-		{
-			memset(client->audio + client->drainindex,0xff,FRAME_SIZE);
-		}
-		else
-		{
-			memset(client->audio + client->drainindex,0xff,FRAME_SIZE + i);
-			memset(client->audio,0xff,-i);
-		}
-		k = 0;
-		if (i >= 0)
-		{
-			for(j = client->drainindex; j < client->drainindex + FRAME_SIZE; j++)
-			{
-				k += client->rssi[j];
-				client->rssi[j] = 0;
-			}
-		}
-		else
-		{
-			for(j = client->drainindex; j < client->drainindex + (FRAME_SIZE + i); j++)
-			{
-				k += client->rssi[j];
-				client->rssi[j] = 0;
-			}
-			for(j = 0; j < -i; j++)
-			{
-				k += client->rssi[j];
-				client->rssi[j] = 0;
-			}
-		}			
+		/* take the frame out of the client's buffers and sum its rssi, all in one go */
+		k = voter_drain(client->audio,client->rssi,client->buflen,client->drainindex,
+			(uint8_t *)p->buf + AST_FRIENDLY_OFFSET,FRAME_SIZE);
 		client->lastrssi = k / FRAME_SIZE; 
 		if (client->lastrssi > maxrssi)
 		{
 			maxrssi = client->lastrssi;
 			maxclient = client;
 		}
-		memset(&fr,0,sizeof(struct ast_frame));
-	        fr.frametype = AST_FRAME_VOICE;
-	        fr.subclass = AST_FORMAT_ULAW;
-	        fr.datalen = FRAME_SIZE;
-	        fr.samples = FRAME_SIZE;
-	        AST_FRAME_DATA(fr) =  p->buf + AST_FRIENDLY_OFFSET;
-	        fr.src = type;
-	        fr.offset = AST_FRIENDLY_OFFSET;
-	        fr.mallocd = 0;
-	        fr.delivery.tv_sec = 0;
-	        fr.delivery.tv_usec = 0;
-		f2 = ast_translate(p->toast1,&fr,0);
-		if (!f2)
-		{
-			ast_log(LOG_ERROR,"Can not translate frame to send to Asterisk\n");
-			return(0);
-		}
 		sp1 = AST_FRAME_DATAP(f1);
-		sp2 = AST_FRAME_DATAP(f2);
 		if (!haslastaudio)
 		{
 			memcpy(p->lastaudio,sp1,FRAME_SIZE * 2);
 			haslastaudio = 1;
 		}
-		memcpy(client->lastaudio,sp2,FRAME_SIZE * 2);
-		for(i = 0; i < FRAME_SIZE; i++)
-		{
-			if (maxprio && client->lastrssi)
-				j = sp2[i];
-			else
-				j = sp1[i] + sp2[i];
-			if (j > 32767) j = 32767;
-			if (j < -32767) j = -32767;
-			sp1[i] = j;
-		}
-		ast_frfree(f2);
+		/* convert to slinear straight from the table and mix in (no translator frame) */
+		voter_ulaw_mix(sp1,client->lastaudio,(uint8_t *)p->buf + AST_FRIENDLY_OFFSET,__ast_mulaw,
+			(maxprio && client->lastrssi),FRAME_SIZE);
 	}
 	if (p->priconn) maxclient = NULL;
 	if (!maxclient) /* if nothing there */
@@ -1574,7 +1713,7 @@ char buf[4096];
 struct sockaddr_in sin;
 socklen_t fromlen;
 ssize_t recvlen;
-struct voter_client *client;
+struct voter_client *client,**cpp;
 struct timeval tv,lasttx,lastrx;
 VOTER_PACKET_HEADER *vph;
 uint32_t resp_digest,digest,mydigest;
@@ -1643,9 +1782,8 @@ struct {
 			digest = 0;
 			p->primary_challenge[0] = 0;
 			if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 "Primary client for %d  Lost connection!!!\n",p->nodenum);
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (!IS_CLIENT_PROXY(client)) continue;
 				client->respdigest = 0;
 				client->heardfrom = 0;
@@ -1748,7 +1886,7 @@ i16 dummybuf1[FRAME_SIZE * 12],xmtbuf1[FRAME_SIZE * 12];
 i16 xmtbuf[FRAME_SIZE],dummybuf2[FRAME_SIZE],xmtbuf2[FRAME_SIZE];
 i32	l;
 struct ast_frame fr,*f1,*f2,*f3,wf1;
-struct voter_client *client,*client1;
+struct voter_client *client,*client1,**cpp;
 struct timeval tv;
 
 #pragma pack(push)
@@ -1881,9 +2019,8 @@ struct timeval tv;
 		mx = 0;
 		if (p->mixminus)
 		{
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (!client->heardfrom) continue;
 				if (!client->respdigest) continue;
 				if (!client->mix) continue;
@@ -1910,9 +2047,8 @@ struct timeval tv;
 #endif
 			audiopacket.vp.curtime.vtime_sec = htonl(master_time.vtime_sec);
 			audiopacket.vp.curtime.vtime_nsec = htonl(master_time.vtime_nsec);
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (p->priconn && (!client->dynamic) && (!client->mix)) continue;
 				if ((!client->respdigest) && (!IS_CLIENT_PROXY(client))) continue;
 				if (!client->heardfrom) continue;
@@ -2014,9 +2150,8 @@ struct timeval tv;
 				memcpy(audiopacket.audio,AST_FRAME_DATAP(f2),f2->datalen);
 				audiopacket.vp.curtime.vtime_sec = htonl(master_time.vtime_sec);
 				audiopacket.vp.payload_type = htons(3);
-				for(client = clients; client; client = client->next)
+				for(cpp = p->clients; (client = *cpp); cpp++)
 				{
-					if (client->nodenum != p->nodenum) continue;
 					if (p->priconn && (!client->dynamic) && (!client->mix)) continue;
 					if ((!client->respdigest) && (!IS_CLIENT_PROXY(client))) continue;
 					if (!client->heardfrom) continue;
@@ -2094,9 +2229,8 @@ struct timeval tv;
 				memcpy(audiopacket.audio,nubuf,sizeof(nubuf));
 				audiopacket.vp.curtime.vtime_sec = htonl(master_time.vtime_sec);
 				audiopacket.vp.payload_type = htons(4);
-				for(client = clients; client; client = client->next)
+				for(cpp = p->clients; (client = *cpp); cpp++)
 				{
-					if (client->nodenum != p->nodenum) continue;
 					if (p->priconn && (!client->dynamic) && (!client->mix)) continue;
 					if ((!client->respdigest) && (!IS_CLIENT_PROXY(client))) continue;
 					if (!client->heardfrom) continue;
@@ -2137,9 +2271,8 @@ struct timeval tv;
 		}
 		if (f1) ast_frfree(f1);
 		gettimeofday(&tv,NULL);
-		for(client = clients; client; client = client->next)
+		for(cpp = p->clients; (client = *cpp); cpp++)
 		{
-			if (client->nodenum != p->nodenum) continue;
 			if (!client->respdigest) continue;
 			if (!client->heardfrom) continue;
 			if (IS_CLIENT_PROXY(client)) continue;
@@ -2171,9 +2304,8 @@ struct timeval tv;
 				sendto(udp_socket, &pingpacket, sizeof(pingpacket),0,(struct sockaddr *)&client->sin,sizeof(client->sin));
 			}
 		}
-		for(client = clients; client; client = client->next)
+		for(cpp = p->clients; (client = *cpp); cpp++)
 		{
-			if (client->nodenum != p->nodenum) continue;
 			if ((!client->respdigest) && (!IS_CLIENT_PROXY(client))) continue;
 			if (p->priconn && (!client->dynamic) && (!client->mix) && (!IS_CLIENT_PROXY(client))) continue;
 			if (!client->heardfrom) continue;
@@ -2236,6 +2368,7 @@ static struct ast_channel *voter_request(const char *type, int format, void *dat
 	}
 	memset(p, 0, sizeof(struct voter_pvt));
 	p->nodenum = strtoul((char *)data,NULL,0);
+	p->clients = noclients;
 	ast_mutex_init(&p->txqlock);
 	ast_mutex_init(&p->pagerqlock);
 	ast_mutex_init(&p->xmit_lock);
@@ -2279,14 +2412,6 @@ static struct ast_channel *voter_request(const char *type, int format, void *dat
 		ast_free(p);
 		return NULL;
 	}
-	p->toast1 = ast_translator_build_path(AST_FORMAT_SLINEAR,AST_FORMAT_ULAW);
-	if (!p->toast1)
-	{
-		ast_log(LOG_ERROR,"Cannot get translator from ulaw to slinear!!\n");
-		ast_dsp_free(p->dsp);
-		ast_free(p);
-		return NULL;
-	}
 	p->fromast = ast_translator_build_path(AST_FORMAT_ULAW,AST_FORMAT_SLINEAR);
 	if (!p->fromast)
 	{
@@ -2335,6 +2460,7 @@ static struct ast_channel *voter_request(const char *type, int format, void *dat
 	ast_mutex_lock(&voter_lock);
 	if (pvts != NULL) p->next = pvts;
 	pvts = p;
+	voter_pvt_clients(p);
 	ast_mutex_unlock(&voter_lock);
 	tmp->tech = &voter_tech;
 	tmp->rawwriteformat = AST_FORMAT_SLINEAR;
@@ -2588,7 +2714,7 @@ static int voter_do_prio(int fd, int argc, char *argv[])
 {
 	int newlevel,foundit;
 	struct voter_pvt *p;
-	struct voter_client *client;
+	struct voter_client *client,**cpp;
 
         if (argc < 3)
                 return RESULT_SHOWUSAGE;
@@ -2606,9 +2732,8 @@ static int voter_do_prio(int fd, int argc, char *argv[])
 	if (argc == 3)
 	{
 		ast_cli(fd,"Voter instance %d priority values:\n\n",p->nodenum);
-		for(client = clients; client; client = client->next)
+		for(cpp = p->clients; (client = *cpp); cpp++)
 		{
-			if (client->nodenum != p->nodenum) continue;
 			if (client->prio_override > -2)
 				ast_cli(fd,"client %s: eff_prio: %d, prio: %d, override_prio: %d\n",
 					client->name,client->prio_override, client->prio,client->prio_override);
@@ -2621,9 +2746,8 @@ static int voter_do_prio(int fd, int argc, char *argv[])
 	if (argc == 4)
 	{
 		foundit = 0;
-		for(client = clients; client; client = client->next)
+		for(cpp = p->clients; (client = *cpp); cpp++)
 		{
-			if (client->nodenum != p->nodenum) continue;
 			if (strcasecmp(argv[3],"all") && strcasecmp(argv[3],client->name)) continue;
 			foundit = 1;
 			if (client->prio_override > -2)
@@ -2643,9 +2767,8 @@ static int voter_do_prio(int fd, int argc, char *argv[])
                 return RESULT_SHOWUSAGE;
 	}
 	foundit = 0;
-	for(client = clients; client; client = client->next)
+	for(cpp = p->clients; (client = *cpp); cpp++)
 	{
-		if (client->nodenum != p->nodenum) continue;
 		if (strcasecmp(argv[3],"all") && strcasecmp(argv[3],client->name)) continue;
 		if ((!strcasecmp(argv[4],"off")) || (!strncasecmp(argv[4],"dis",3))) newlevel = -2;
 		else 
@@ -2790,7 +2913,7 @@ static void voter_display(int fd, struct voter_pvt *p, int doips)
 {
 	int j,rssi,thresh,ncols = 56,wasverbose,vt100compat;
 	char str[256],*term,c,hasdyn;
-	struct voter_client *client;
+	struct voter_client *client,**cpp;
 
 
 	term = getenv("TERM");
@@ -2831,9 +2954,8 @@ static void voter_display(int fd, struct voter_pvt *p, int doips)
 		if (hasmaster && (!master_time.vtime_sec))
 			ast_cli(fd,"*** WARNING -- LOSS OF MASTER TIMING SOURCE ***\n\n");
 		hasdyn = 0;
-		for(client = clients; client; client = client->next)
+		for(cpp = p->clients; (client = *cpp); cpp++)
 		{
-			if (client->nodenum != p->nodenum) continue;
 			if (client->dynamic) hasdyn = 1;
 			if (p->priconn && (!client->dynamic) && (!client->mix)) continue;
 			if ((!client->respdigest) && (!IS_CLIENT_PROXY(client))) continue;
@@ -2856,9 +2978,8 @@ static void voter_display(int fd, struct voter_pvt *p, int doips)
 		if (hasdyn)
 		{
 			ast_cli(fd,"ACTIVE DYNAMIC CLIENTS:\n\n");
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (!client->dynamic) continue;
 				if (ast_tvzero(client->lastdyntime)) continue;
 				ast_cli(fd,"%10.10s -- %s:%d\n",client->name,ast_inet_ntoa(client->sin.sin_addr),ntohs(client->sin.sin_port));
@@ -2868,9 +2989,8 @@ static void voter_display(int fd, struct voter_pvt *p, int doips)
 		if (doips)
 		{
 			ast_cli(fd,"ACTIVE NON-DYNAMIC CLIENTS:\n\n");
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (client->dynamic) continue;
 				if (p->priconn && (!client->dynamic) && (!client->mix)) continue;
 				if ((!client->respdigest) && (!IS_CLIENT_PROXY(client))) continue;
@@ -2907,7 +3027,7 @@ static int voter_do_txlockout(int fd, int argc, char *argv[])
 int i,n,newval;
 char str[300],*strs[100];
 struct voter_pvt *p;
-struct voter_client *client;
+struct voter_client *client,**cpp;
 
         if (argc < 3)
                 return RESULT_SHOWUSAGE;
@@ -2924,18 +3044,16 @@ struct voter_client *client;
 	{
 		if (!strcasecmp(argv[3],"all"))
 		{
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (client->dynamic) continue;
 				client->txlockout = 1;
 			}
 		}
 		else if (!strcasecmp(argv[3],"none"))
 		{
-			for(client = clients; client; client = client->next)
+			for(cpp = p->clients; (client = *cpp); cpp++)
 			{
-				if (client->nodenum != p->nodenum) continue;
 				if (client->dynamic) continue;
 				client->txlockout = 0;
 			}
@@ -2957,9 +3075,8 @@ struct voter_client *client;
 				{
 					strs[i]++;
 				}
-				for(client = clients; client; client = client->next)
+				for(cpp = p->clients; (client = *cpp); cpp++)
 				{
-					if (client->nodenum != p->nodenum) continue;
 					if (strcasecmp(strs[i],client->name)) continue;
 					if (client->dynamic)
 					{
@@ -2975,9 +3092,8 @@ struct voter_client *client;
 		}
 	}
 	ast_cli(fd,"\nFull list of Tx Locked-out clients for voter instance %s:\n",argv[2]);
-	for(n = 0,client = clients; client; client = client->next)
+	for(n = 0,cpp = p->clients; (client = *cpp); cpp++)
 	{
-		if (client->nodenum != p->nodenum) continue;
 		if (client->dynamic) continue;
 		if (client->txlockout)
 		{
@@ -2987,9 +3103,8 @@ struct voter_client *client;
 	}
 	if (!n) ast_cli(fd,"No clients are currently locked-out\n");
 	ast_cli(fd,"\nFull list of normally transmitting clients for voter instance %s:\n",argv[2]);
-	for(n = 0,client = clients; client; client = client->next)
+	for(n = 0,cpp = p->clients; (client = *cpp); cpp++)
 	{
-		if (client->nodenum != p->nodenum) continue;
 		if (client->dynamic) continue;
 		if (!client->txlockout)
 		{
@@ -3224,7 +3339,7 @@ static int manager_voter_status(struct mansession *ses, const struct message *m)
 {
 int success = 0,i,j,n;
 struct voter_pvt *p;
-struct voter_client *client;
+struct voter_client *client,**cpp;
 const char *node = astman_get_header(m, "Node");
 char *str,*strs[100];
 
@@ -3254,9 +3369,8 @@ char *str,*strs[100];
 		astman_append(ses,"Node: %d\r\n",p->nodenum);
 		if (p->lastwon) 
 			astman_append(ses,"Voted: %s\r\n",p->lastwon->name);
-		for(client = clients; client; client = client->next)
+		for(cpp = p->clients; (client = *cpp); cpp++)
 		{
-			if (client->nodenum != p->nodenum) continue;
 			if (!client->heardfrom) continue;
 			if (IS_CLIENT_PROXY(client))
 			{
@@ -3294,6 +3408,19 @@ char *str,*strs[100];
 
 #include "xpmr/xpmr.c"
 
+/* close every reader socket, udp_socket (reader_sockets[0]) among them */
+static void voter_close_sockets(void)
+{
+int	i;
+
+	for(i = 0; i < voter_readers; i++)
+	{
+		if (reader_sockets[i] != -1) close(reader_sockets[i]);
+		reader_sockets[i] = -1;
+	}
+	udp_socket = -1;
+}
+
 #ifndef	OLD_ASTERISK
 static
 #endif
@@ -3321,6 +3448,7 @@ int unload_module(void)
 #endif
 	/* First, take us out of the channel loop */
 	ast_channel_unregister(&voter_tech);
+	voter_close_sockets();
 	if (nullfd != -1) close(nullfd);
 	return 0;
 }
@@ -3364,7 +3492,7 @@ struct timeval tv;
 			if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
 				"DYN client %s past lease time\n",client->name);
 			memset(&client->lastdyntime,0,sizeof(client->lastheardtime));
-			memset(&client->sin,0,sizeof(client->sin));
+			voter_client_setaddr(client,NULL);
 		}
 	}
 	return;
@@ -3379,7 +3507,7 @@ static void *voter_timer(void *data)
 	int	i;
 	time_t	t;
 	struct voter_pvt *p;
-	struct voter_client *client,*client1;
+	struct voter_client *client;
 	struct timeval tv;
 
 	while(run_forever && (!ast_shutting_down()))
@@ -3413,44 +3541,87 @@ static void *voter_timer(void *data)
 					client->lastheardtime.tv_sec = client->lastheardtime.tv_usec = 0;
 				}
 			}
-			if (check_client_sanity)
-			{
-				for(client = clients; client; client = client->next)
-				{
-					if (!client->respdigest) continue;
-					for(client1 = client->next; client1; client1 = client1->next)
-					{
-						if ((client1->sin.sin_addr.s_addr == client->sin.sin_addr.s_addr) &&
-							(client1->sin.sin_port == client->sin.sin_port))
-						{
-							if (!client1->respdigest) continue;
-							client->respdigest = 0;
-							client->heardfrom = 0;
-							client1->respdigest = 0;
-							client1->heardfrom = 0;
-						}
-					}
-				}
-			}
+			if (check_client_sanity) check_dup_addrs(0);
 		}
 		ast_mutex_unlock(&voter_lock);
 	}
 	return(NULL);
 }	
 
+/* fill the batch with as many packets as are waiting on the socket.
+   must be called with voter_lock NOT locked */
+static void voter_rx_fill(struct voter_rxbatch *rx)
+{
+#ifdef	VOTER_HAVE_RECVMMSG
+int	i,n;
+
+	for(i = 0; i < VOTER_RX_BATCH; i++)
+	{
+		rx->msgs[i].msg_hdr.msg_name = &rx->addrs[i];
+		rx->msgs[i].msg_hdr.msg_namelen = sizeof(rx->addrs[i]);
+	}
+	n = recvmmsg(rx->sock,rx->msgs,VOTER_RX_BATCH,MSG_DONTWAIT,NULL);
+	if (n < 0) n = 0;
+	for(i = 0; i < n; i++) rx->lens[i] = rx->msgs[i].msg_len;
+	rx->n = n;
+#else
+socklen_t fromlen;
+
+	fromlen = sizeof(struct sockaddr_in);
+	rx->lens[0] = recvfrom(rx->sock,rx->bufs[0],VOTER_RX_BUFSIZE - 1,0,
+		(struct sockaddr *)&rx->addrs[0],&fromlen);
+	rx->n = (rx->lens[0] < 0) ? 0 : 1;
+#endif
+	rx->next = 0;
+}
+
+/* hand out the next packet in the batch, returns -1 if batch is empty */
+static ssize_t voter_rx_next(struct voter_rxbatch *rx, char *buf, struct sockaddr_in *sin)
+{
+ssize_t	len;
+
+	if (rx->next >= rx->n) return -1;
+	len = rx->lens[rx->next];
+	memcpy(buf,rx->bufs[rx->next],len);
+	*sin = rx->addrs[rx->next++];
+	return(len);
+}
+
+static struct voter_rxbatch *voter_rx_alloc(int sock)
+{
+struct voter_rxbatch *rx;
+#ifdef	VOTER_HAVE_RECVMMSG
+int	i;
+#endif
+
+	rx = ast_calloc(1,sizeof(struct voter_rxbatch));
+	if (!rx) return NULL;
+	rx->sock = sock;
+#ifdef	VOTER_HAVE_RECVMMSG
+	for(i = 0; i < VOTER_RX_BATCH; i++)
+	{
+		rx->iovs[i].iov_base = rx->bufs[i];
+		rx->iovs[i].iov_len = VOTER_RX_BUFSIZE - 1;
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iovs[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+	return(rx);
+}
+
 static void *voter_reader(void *data)
 {
- 	char buf[4096],timestr[100],hasmastered,*cp,*cp1;
+ 	char buf[VOTER_RX_BUFSIZE],timestr[100],hasmastered,*cp,*cp1;
 	char gps1[300],gps2[300],isproxy;
 	struct sockaddr_in sin,sin_stream,psin;
 	struct voter_pvt *p;
-	int i,j,k,ms,maxrssi,master_port;
+	int i,j,k,ms,maxrssi;
 	struct ast_frame *f1,fr;
-        socklen_t fromlen;
+	struct voter_rxbatch *rx;
 	ssize_t recvlen;
 	struct timeval tv,timetv;
 	FILE *gpsfp;
-	struct voter_client *client,*client1,*maxclient,*lastmaster;
+	struct voter_client *client,*client1,*maxclient,*lastmaster,**cpp;
 	VOTER_PACKET_HEADER *vph;
 	VOTER_PROXY_HEADER proxy;
 	VOTER_GPS *vgp;
@@ -3485,19 +3656,30 @@ static void *voter_reader(void *data)
 	} pingpacket;
 #pragma pack(pop)
 
+	rx = voter_rx_alloc(*((int *)data));
+	if (!rx)
+	{
+		ast_log(LOG_ERROR,"Cant malloc()\n");
+		pthread_exit(NULL);
+	}
 	if (option_verbose > 2) ast_verbose(VERBOSE_PREFIX_3 "voter: reader thread started.\n");
 	ast_mutex_lock(&voter_lock);
-	master_port = 0;
 	while(run_forever && (!ast_shutting_down()))
 	{
-		ast_mutex_unlock(&voter_lock);
-		ms = 50;
-		i = ast_waitfor_n_fd(&udp_socket, 1, &ms,NULL);
-		ast_mutex_lock(&voter_lock);
+		/* only give up the lock (and wait) once the current batch is used up */
+		if (rx->next >= rx->n)
+		{
+			ast_mutex_unlock(&voter_lock);
+			ms = 50;
+			i = ast_waitfor_n_fd(&rx->sock, 1, &ms,NULL);
+			if (i == rx->sock) voter_rx_fill(rx);
+			ast_mutex_lock(&voter_lock);
+		} else i = rx->sock;
 		if (i == -1)
 		{
 			ast_mutex_unlock(&voter_lock);
 			ast_log(LOG_ERROR,"Error in select()\n");
+			ast_free(rx);
 			pthread_exit(NULL);
 		}
 		gettimeofday(&tv,NULL);
@@ -3523,11 +3705,10 @@ static void *voter_reader(void *data)
 			}
 		}
 		if (i < 0) continue;
-		if (i == udp_socket) /* if we get a packet */
+		if (i == rx->sock) /* if we get a packet */
 		{
-			fromlen = sizeof(struct sockaddr_in);
-			recvlen = recvfrom(udp_socket,buf,sizeof(buf) - 1,0,
-				(struct sockaddr *)&sin,&fromlen);
+			recvlen = voter_rx_next(rx,buf,&sin);
+			if (recvlen < 0) continue;
 			if (recvlen >= sizeof(VOTER_PACKET_HEADER)) /* if set got something worthwile */
 			{
 				vph = (VOTER_PACKET_HEADER *)buf;
@@ -3539,15 +3720,11 @@ static void *voter_reader(void *data)
 				{
 					gettimeofday(&tv,NULL);
 					/* first see if client is not a dynamic one */
-					for(client = clients; client; client = client->next)
-					{
-						if (client->dynamic) continue;
-						if (client->digest == htonl(vph->digest)) break;
-					}
+					client = find_client_digest(htonl(vph->digest));
 					/* if not found as non-dynamic, try it as existing dynamic */					
 					if (!client)
 					{
-						for(client = clients; client; client = client->next)
+						for(client = client_digest_hash[voter_digest_hash(htonl(vph->digest))]; client; client = client->digest_next)
 						{
 							if (!client->dynamic) continue;
 							if (ast_tvzero(client->lastdyntime)) continue;
@@ -3556,7 +3733,7 @@ static void *voter_reader(void *data)
 								if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
 									"DYN client %s past lease time\n",client->name);
 								memset(&client->lastdyntime,0,sizeof(client->lastheardtime));
-								memset(&client->sin,0,sizeof(client->sin));
+								voter_client_setaddr(client,NULL);
 								continue;
 							}
 							if (client->digest != htonl(vph->digest)) continue;
@@ -3570,14 +3747,14 @@ static void *voter_reader(void *data)
 					/* if still now found, try as new dynamic */
 					if (!client)
 					{
-						for(client = clients; client; client = client->next)
+						for(client = client_digest_hash[voter_digest_hash(htonl(vph->digest))]; client; client = client->digest_next)
 						{
 							if (!client->dynamic) continue;
 							if (!ast_tvzero(client->lastdyntime)) continue;
 							if (client->digest != htonl(vph->digest)) continue;
 							/* okay, we found an empty dynamic slot with proper digest */
 							gettimeofday(&client->lastdyntime,NULL);
-							client->sin = sin;
+							voter_client_setaddr(client,&sin);
 							if (option_verbose >= 3) ast_verbose(VERBOSE_PREFIX_3 
 								"Bound new Dynamic client %s to %s:%d\n",client->name,ast_inet_ntoa(sin.sin_addr),ntohs(sin.sin_port));
 							break;
@@ -3649,7 +3826,7 @@ static void *voter_reader(void *data)
 						gettimeofday(&client->lastdyntime,NULL);
 						if ((!client) || (client && (ntohs(vph->payload_type) != VOTER_PAYLOAD_PROXY)))
 							client->respdigest = crc32_bufs((char*)vph->challenge,password);
-						client->sin = sin;
+						voter_client_setaddr(client,&sin);
 						memset(&client->proxy_sin,0,sizeof(client->proxy_sin));
 						if ((!client->curmaster) && hasmaster)
 						{
@@ -3961,31 +4138,7 @@ static void *voter_reader(void *data)
 									}
 									if (!client->heardfrom) client->lastheardtime.tv_sec = client->lastheardtime.tv_usec = 0;
 								}
-								if (check_client_sanity)
-								{
-									for(client = clients; client; client = client->next)
-									{
-										for(p = pvts; p; p = p->next)
-										{
-											if (p->nodenum == client->nodenum) break;
-										}
-										if ((!p) || p->priconn) continue;
-										if (!client->respdigest) continue;
-										for(client1 = client->next; client1; client1 = client1->next)
-										{
-											if (client1 == client) continue;
-											if ((client1->sin.sin_addr.s_addr == client->sin.sin_addr.s_addr) &&
-												(client1->sin.sin_port == client->sin.sin_port))
-											{
-												if (!client1->respdigest) continue;
-												client->respdigest = 0;
-												client->heardfrom = 0;
-												client1->respdigest = 0;
-												client1->heardfrom = 0;
-											}
-										}
-									}
-								}
+								if (check_client_sanity) check_dup_addrs(1);
 								hasmastered = 0;
 								voter_xmit_master();
 								for(p = pvts; p; p = p->next)
@@ -3995,34 +4148,14 @@ static void *voter_reader(void *data)
 									startagain = 0;
 									maxrssi = 0;
 									maxclient = NULL;
-									for(client = clients; client; client = (startagain) ? clients : client->next)
+									for(cpp = p->clients; (client = *cpp); cpp = (startagain) ? p->clients : cpp + 1)
 									{
 										int maxprio,thisprio;
 
 										startagain = 0;
-										if (client->nodenum != p->nodenum) continue;
 										if (client->mix) continue;
 										if (client->prio_override == -1) continue;
-										k = 0;
-										i = (int)client->buflen - ((int)client->drainindex + FRAME_SIZE);
-										if (i >= 0)
-										{
-											for(j = client->drainindex; j < client->drainindex + FRAME_SIZE; j++)
-											{
-												k += client->rssi[j];
-											}
-										}
-										else
-										{
-											for(j = client->drainindex; j < client->drainindex + (FRAME_SIZE + i); j++)
-											{
-												k += client->rssi[j];
-											}
-											for(j = 0; j < -i; j++)
-											{
-												k += client->rssi[j];
-											}
-										}			
+										k = voter_rssi_sum(client->rssi,client->buflen,client->drainindex,FRAME_SIZE);
 										client->lastrssi = k / FRAME_SIZE; 
 										maxprio = thisprio = 0;
 										if (maxclient)
@@ -4044,30 +4177,11 @@ static void *voter_reader(void *data)
 											if (thisprio > maxprio) startagain = 1;
 										}
 									}
-									for(client = clients; client; client =  client->next)
+									for(cpp = p->clients; (client = *cpp); cpp++)
 									{
-										if (client->nodenum != p->nodenum) continue;
 										if (client->mix) continue;
 										if (client->prio_override == -1) continue;
-										i = (int)client->buflen - ((int)client->drainindex + FRAME_SIZE);
-										if (i >= 0)
-										{
-											for(j = client->drainindex; j < client->drainindex + FRAME_SIZE; j++)
-											{
-												client->rssi[j] = 0;
-											}
-										}
-										else
-										{
-											for(j = client->drainindex; j < client->drainindex + (FRAME_SIZE + i); j++)
-											{
-												client->rssi[j] = 0;
-											}
-											for(j = 0; j < -i; j++)
-											{
-												client->rssi[j] = 0;
-											}
-										}			
+										voter_rssi_clear(client->rssi,client->buflen,client->drainindex,FRAME_SIZE);
 									}
 									if (!maxclient) maxrssi = 0;
 									memset(p->buf + AST_FRIENDLY_OFFSET,0xff,FRAME_SIZE);
@@ -4137,9 +4251,8 @@ static void *voter_reader(void *data)
 										if (p->voter_test > 0) /* perform cyclic selection */
 										{
 											/* see how many are eligible */
-											for(i = 0,client = clients; client; client = client->next)
+											for(i = 0,cpp = p->clients; (client = *cpp); cpp++)
 											{
-												if (client->nodenum != p->nodenum) continue;
 												if (client->mix) continue;
 												if (client->lastrssi == maxrssi) i++;
 											}
@@ -4157,9 +4270,8 @@ static void *voter_reader(void *data)
 													if (p->testindex >= i) p->testindex = 0;
 												}
 											}
-											for(i = 0,client = clients; client; client = client->next)
+											for(i = 0,cpp = p->clients; (client = *cpp); cpp++)
 											{
-												if (client->nodenum != p->nodenum) continue;
 												if (client->mix) continue;
 												if (client->lastrssi != maxrssi) continue;
 												if (i++ == p->testindex)
@@ -4207,9 +4319,8 @@ static void *voter_reader(void *data)
 											memcpy(p->buf + AST_FRIENDLY_OFFSET,maxclient->audio + maxclient->drainindex,FRAME_SIZE + i);
 											memcpy(p->buf + AST_FRIENDLY_OFFSET + (maxclient->buflen - i),maxclient->audio,-i);
 										}
-										for(client = clients; client; client = client->next)
+										for(cpp = p->clients; (client = *cpp); cpp++)
 										{
-											if (client->nodenum != p->nodenum) continue;
 											if (client->mix) continue;
 											if (p->recfp)
 											{
@@ -4284,9 +4395,8 @@ static void *voter_reader(void *data)
 										stream.curtime = master_time;
 										memcpy(stream.audio,p->buf + AST_FRIENDLY_OFFSET,FRAME_SIZE);
 										sprintf(stream.str,"%s",maxclient->name);
-										for(client = clients; client; client = client->next)
+										for(cpp = p->clients; (client = *cpp); cpp++)
 										{
-											if (client->nodenum != p->nodenum) continue;
 											sprintf(stream.str + strlen(stream.str),",%s=%d",client->name,client->lastrssi);
 										}
 										for(i = 0; i < p->nstreams; i++)
@@ -4584,6 +4694,7 @@ process_gps:
 		}
 	}
 	ast_mutex_unlock(&voter_lock);
+	ast_free(rx);
 	if (option_verbose > 2)
 		ast_verbose(VERBOSE_PREFIX_3 "voter: read thread exited.\n");
 	return NULL;
@@ -4601,12 +4712,13 @@ static int reload(void)
 	int i,n,instance_buflen,buflen,oldtoctype,oldlevel;
 	char *val,*ctg,*cp,*cp1,*cp2,*strs[40],newclient,data[100],oldctcss[100];
 	struct voter_pvt *p;
-	struct voter_client *client,*client1;
+	struct voter_client *client,*client1,*dupclient,*dupclient1,**cpp;
 	struct ast_config *cfg = NULL;
 	struct ast_variable *v;
 
 	
 	ast_mutex_lock(&voter_lock);
+	dupclient = dupclient1 = NULL;
 	for(client = clients; client; client = client->next)
 	{
 		client->reload = 0;
@@ -4789,7 +4901,7 @@ static int reload(void)
 			if (!cp)
 			{
 				ast_log(LOG_ERROR,"Cant Malloc()\n");
-                                close(udp_socket);
+                                voter_close_sockets();
                                 ast_config_destroy(cfg);
 				ast_mutex_unlock(&voter_lock);
 				return -1;
@@ -4797,20 +4909,12 @@ static int reload(void)
 			n = finddelim(cp,strs,40);
 			if (n < 1) continue;
 			/* see if we "know" this client already */
-			for(client = clients; client; client = client->next)
+			client = find_client_digest(crc32_bufs(challenge,strs[0]));
+			/* if has moved to another instance, free this one, and treat as new */
+			if (client && (client->nodenum != strtoul(ctg,NULL,0)))
 			{
-				if (client->dynamic) continue;
-				/* if this is the one whose digest matches one currently being looked at */
-				if (client->digest == crc32_bufs(challenge,strs[0]))
-				{
-					/* if has moved to another instance, free this one, and treat as new */
-					if (client->nodenum != strtoul(ctg,NULL,0))
-					{
-						client->reload = 0;
-						client = NULL;
-					}
-					break;
-				}
+				client->reload = 0;
+				client = NULL;
 			}
 			newclient = 0;
 			/* if a new one, alloc its space */
@@ -4821,7 +4925,7 @@ static int reload(void)
 				{
 					ast_log(LOG_ERROR,"Cant malloc()\n");
 					ast_free(cp);
-			                close(udp_socket);
+			                voter_close_sockets();
 					ast_config_destroy(cfg);
 					ast_mutex_unlock(&voter_lock);
 					return -1;
@@ -4891,7 +4995,7 @@ static int reload(void)
 				if (!client->audio)
 				{
 					ast_log(LOG_ERROR,"Cant realloc()\n");
-			                close(udp_socket);
+			                voter_close_sockets();
 					ast_config_destroy(cfg);
 					ast_mutex_unlock(&voter_lock);
 					return -1;
@@ -4904,7 +5008,7 @@ static int reload(void)
 				if (!client->audio)
 				{
 					ast_log(LOG_ERROR,"Cant malloc()\n");
-			                close(udp_socket);
+			                voter_close_sockets();
 					ast_config_destroy(cfg);
 					ast_mutex_unlock(&voter_lock);
 					return -1;
@@ -4917,7 +5021,7 @@ static int reload(void)
 				if (!client->rssi)
 				{
 					ast_log(LOG_ERROR,"Cant realloc()\n");
-			                close(udp_socket);
+			                voter_close_sockets();
 					ast_config_destroy(cfg);
 					ast_mutex_unlock(&voter_lock);
 					return -1;
@@ -4930,7 +5034,7 @@ static int reload(void)
 				if (!client->rssi)
 				{
 					ast_log(LOG_ERROR,"Cant malloc()\n");
-			                close(udp_socket);
+			                voter_close_sockets();
 					ast_config_destroy(cfg);
 					ast_mutex_unlock(&voter_lock);
 					return -1;
@@ -4946,6 +5050,20 @@ static int reload(void)
 					for(client1 = clients; client1->next; client1 = client1->next) ;
 					client1->next = client;
 				}
+				/* catch two clients with the same password as they go in */
+				if ((!client->dynamic) && (!dupclient))
+				{
+					for(client1 = client_digest_hash[voter_digest_hash(client->digest)]; client1; client1 = client1->digest_next)
+					{
+						if (!client1->reload) continue;
+						if (client1->dynamic) continue;
+						if (client->digest != client1->digest) continue;
+						dupclient = client1;
+						dupclient1 = client;
+						break;
+					}
+				}
+				digest_hash_add(client);
 			}
 		}
 	}
@@ -4959,39 +5077,85 @@ static int reload(void)
 			ast_mutex_unlock(&voter_lock);
 			return -1;
 		}
-		if (client->dynamic) continue;
-		for(client1 = clients; client1; client1 = client1->next)
-		{
-			if (!client1->reload) continue;
-			if (client == client1) continue;
-			if (client->digest == client1->digest)
-			{
-				ast_log(LOG_ERROR,"Can Not Load chan_voter -- VOTER clients %s and %s have same authentication digest!!!\n",client->name,client1->name);
-				ast_mutex_unlock(&voter_lock);
-				return -1;
-			}
-		}
+	}
+	if (dupclient)
+	{
+		ast_log(LOG_ERROR,"Can Not Load chan_voter -- VOTER clients %s and %s have same authentication digest!!!\n",dupclient->name,dupclient1->name);
+		ast_mutex_unlock(&voter_lock);
+		return -1;
 	}
 	/* remove all the clients that are no longer in the config */
-	for(client = clients; client; client = client->next)
+	for(cpp = &clients; (client = *cpp);)
 	{
-		if (client->reload) continue;
+		if (client->reload)
+		{
+			cpp = &client->next;
+			continue;
+		}
+		*cpp = client->next;
+		digest_hash_del(client);
+		addr_hash_del(client);
+		for(p = pvts; p; p = p->next)
+		{
+			if (p->lastwon == client) p->lastwon = NULL;
+			if (p->winner == client) p->winner = NULL;
+		}
 		if (client->audio) ast_free(client->audio);
 		if (client->rssi) ast_free(client->rssi);
 		if (client->gpsid) ast_free(client->gpsid);
-		for(client1 = clients; client1; client1 = client1->next)
-		{
-			if (client1->next == client) break;
-		}
-		if (client1) client1->next = client->next;
-		else clients = NULL;
 		ast_free(client);
-		client = clients;
 	}
+	for(p = pvts; p; p = p->next) voter_pvt_clients(p);
 	ast_mutex_unlock(&voter_lock);
 	return(0);
 }
 
+/* create a (non-blocking) voter UDP socket bound to sin, sharing the
+   port with the other readers if reuse is set */
+static int voter_open_socket(struct sockaddr_in *sin, int utos, int reuse)
+{
+int	s,i;
+
+	if ((s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+	{
+		ast_log(LOG_ERROR,"Unable to create new socket for voter audio connection\n");
+		return -1;
+	}
+#ifdef	SO_REUSEPORT
+	if (reuse)
+	{
+		i = 1;
+		if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &i, sizeof(i)))
+		{
+			ast_log(LOG_WARNING,"Can't setsockopt:SO_REUSEPORT:%s\n",strerror(errno));
+			close(s);
+			return -1;
+		}
+	}
+#endif
+	if (bind(s, (struct sockaddr *)sin, sizeof(*sin)) == -1) 
+	{
+		ast_log(LOG_ERROR, "Unable to bind port for voter audio connection\n");
+		close(s);
+		return -1;
+	}
+
+	i = fcntl(s,F_GETFL,0);              // Get socket flags
+	fcntl(s,F_SETFL,i | O_NONBLOCK);   // Add non-blocking flag
+
+	if (utos)
+	{
+		i = 0xc0;
+		if (setsockopt(s, IPPROTO_IP, IP_TOS,  &i, sizeof(i)))
+		{
+			ast_log(LOG_ERROR,"Can't setsockopt:IP_TOS:%s\n",strerror(errno));
+			close(s);
+			return -1;
+		}
+	}
+	return(s);
+}
+
 #ifndef	OLD_ASTERISK
 static
 #endif
@@ -5020,12 +5184,6 @@ int load_module(void)
 		return 1;
         }
 
-	if ((udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
-	{
-		ast_log(LOG_ERROR,"Unable to create new socket for voter audio connection\n");
-		ast_config_destroy(cfg);
-                return AST_MODULE_LOAD_DECLINE;
-	}
 	memset((char *) &sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
         val = (char *) ast_variable_retrieve(cfg,"general","port"); 
@@ -5040,33 +5198,44 @@ int load_module(void)
         else
 		sin.sin_addr.s_addr = inet_addr(val);
 	sin.sin_port = htons(listen_port);               
-	if (bind(udp_socket, &sin, sizeof(sin)) == -1) 
+
+        val = (char *) ast_variable_retrieve(cfg,"general","readers"); 
+	if (val) voter_readers = strtoul(val,NULL,0); else voter_readers = 1;
+	if (voter_readers < 1) voter_readers = 1;
+	if (voter_readers > MAX_VOTER_READERS) voter_readers = MAX_VOTER_READERS;
+#ifndef	SO_REUSEPORT
+	if (voter_readers > 1)
 	{
-		ast_log(LOG_ERROR, "Unable to bind port for voter audio connection\n");
-                close(udp_socket);
-                return AST_MODULE_LOAD_DECLINE;
+		ast_log(LOG_WARNING,"voter: SO_REUSEPORT not supported, using 1 reader thread\n");
+		voter_readers = 1;
 	}
+#endif
 
-	i = fcntl(udp_socket,F_GETFL,0);              // Get socket flags
-	fcntl(udp_socket,F_SETFL,i | O_NONBLOCK);   // Add non-blocking flag
-
-
-	if (utos)
+	udp_socket = voter_open_socket(&sin,utos,(voter_readers > 1));
+	if (udp_socket == -1)
 	{
-		i = 0xc0;
-		if (setsockopt(udp_socket, IPPROTO_IP, IP_TOS,  &i, sizeof(i)))
+		ast_config_destroy(cfg);
+                return AST_MODULE_LOAD_DECLINE;
+	}
+	reader_sockets[0] = udp_socket;
+	/* additional readers share the port, the kernel spreads clients among them */
+	for(i = 1; i < voter_readers; i++)
+	{
+		reader_sockets[i] = voter_open_socket(&sin,utos,1);
+		if (reader_sockets[i] == -1)
 		{
-			ast_log(LOG_ERROR,"Can't setsockopt:IP_TOS:%s\n",strerror(errno));
-			close(udp_socket);
-			return AST_MODULE_LOAD_DECLINE;
+			ast_log(LOG_WARNING,"voter: only able to start %d reader thread(s)\n",i);
+			voter_readers = i;
+			break;
 		}
 	}
+	master_port = 0;
 
 	voter_timing_fd = open(DAHDI_PSEUDO_DEV_NAME,O_RDWR);
 	if (voter_timing_fd == -1)
 	{
 		ast_log(LOG_ERROR,"Cant open DAHDI timing channel\n");
-                close(udp_socket);
+                voter_close_sockets();
 		ast_config_destroy(cfg);
                 return AST_MODULE_LOAD_DECLINE;
 	}
@@ -5075,14 +5244,18 @@ int load_module(void)
 	{
 		ast_log(LOG_WARNING, "Unable to set blocksize '%d': %s\n", bs,  strerror(errno));
 		close(voter_timing_fd);
-                close(udp_socket);
+                voter_close_sockets();
 		ast_config_destroy(cfg);
                 return AST_MODULE_LOAD_DECLINE;
 	}
 	ast_config_destroy(cfg);
 
 
-	if (reload()) return AST_MODULE_LOAD_DECLINE;
+	if (reload())
+	{
+		voter_close_sockets();
+		return AST_MODULE_LOAD_DECLINE;
+	}
 
 #ifdef	NEW_ASTERISK
 	ast_cli_register_multiple(voter_cli,sizeof(voter_cli) / 
@@ -5105,13 +5278,14 @@ int load_module(void)
 #endif
         pthread_attr_init(&attr);
         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-        ast_pthread_create(&voter_reader_thread,&attr,voter_reader,NULL);
+	for(i = 0; i < voter_readers; i++)
+	        ast_pthread_create(&voter_reader_threads[i],&attr,voter_reader,&reader_sockets[i]);
         ast_pthread_create(&voter_timer_thread,&attr,voter_timer,NULL);
 
 	/* Make sure we can register our channel type */
 	if (ast_channel_register(&voter_tech)) {
 		ast_log(LOG_ERROR, "Unable to register channel class %s\n", type);
-                close(udp_socket);
+                voter_close_sockets();
                 return AST_MODULE_LOAD_DECLINE;
 	}
 	nullfd = open("/dev/null",O_RDWR);
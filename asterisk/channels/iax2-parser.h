@@ -115,6 +115,8 @@ struct iax_frame {
 	unsigned int direction:2;
 	/* Can this frame be cached? */
 	unsigned int cacheable:1;
+	/* In our call's retransmit window? */
+	unsigned int inwindow:1;
 	/* Outgoing Packet sequence number */
 	int oseqno;
 	/* Next expected incoming packet sequence number */
@@ -131,6 +133,8 @@ struct iax_frame {
 	unsigned char semirand[32];
 	/*! Easy linking */
 	AST_LIST_ENTRY(iax_frame) list;
+	/*! Next frame with the same oseqno in our call's retransmit window */
+	struct iax_frame *txnext;
 	/* Actual, isolated frame header */
 	struct ast_frame af;
 	/*! Amount of space _allocated_ for data */
@@ -0,0 +1,228 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Voting/mixing kernels for chan_voter
+ *
+ * Each voter client has a circular ulaw audio buffer and a parallel
+ * circular RSSI buffer. Every 20ms frame, FRAME_SIZE samples starting at
+ * the drain index are taken out of both (audio refilled with ulaw silence,
+ * RSSI zeroed) and the RSSI summed. These do that in one pass per
+ * (at most two, because of wrap) contiguous segment, using SSE2/AVX2 or
+ * NEON when the compiler targets them and plain C otherwise.
+ *
+ * Self contained, so that utils/voter-mixbench can use them too.
+ */
+
+#ifndef _VOTER_MIX_H
+#define _VOTER_MIX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define	VOTER_MIX_NEON
+#endif
+
+#if defined(__AVX2__)
+#define	VOTER_MIX_KERNEL "avx2"
+#elif defined(__SSE2__)
+#define	VOTER_MIX_KERNEL "sse2"
+#elif defined(VOTER_MIX_NEON)
+#define	VOTER_MIX_KERNEL "neon"
+#else
+#define	VOTER_MIX_KERNEL "scalar"
+#endif
+
+/* sum n rssi bytes */
+static inline unsigned int voter_rssi_sum_seg(const uint8_t *rssi, int n)
+{
+unsigned int sum = 0;
+int	i = 0;
+
+#if defined(__SSE2__)
+	{
+		__m128i acc = _mm_setzero_si128(),z = _mm_setzero_si128();
+
+		for(; i + 16 <= n; i += 16)
+			acc = _mm_add_epi64(acc,_mm_sad_epu8(_mm_loadu_si128((__m128i *)(rssi + i)),z));
+		sum += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc,8));
+	}
+#elif defined(VOTER_MIX_NEON)
+	{
+		uint32x4_t acc = vdupq_n_u32(0);
+
+		for(; i + 16 <= n; i += 16)
+			acc = vpadalq_u16(acc,vpaddlq_u8(vld1q_u8(rssi + i)));
+		sum += vgetq_lane_u32(acc,0) + vgetq_lane_u32(acc,1) +
+			vgetq_lane_u32(acc,2) + vgetq_lane_u32(acc,3);
+	}
+#endif
+	for(; i < n; i++) sum += rssi[i];
+	return(sum);
+}
+
+/* copy n audio bytes to out, refill them with ulaw silence (0xff),
+   and sum and zero the n matching rssi bytes */
+static inline unsigned int voter_drain_seg(uint8_t *audio, uint8_t *rssi, uint8_t *out, int n)
+{
+unsigned int sum = 0;
+int	i = 0;
+
+#if defined(__AVX2__)
+	{
+		__m256i acc = _mm256_setzero_si256(),z = _mm256_setzero_si256(),ff = _mm256_set1_epi8(-1),v;
+
+		for(; i + 32 <= n; i += 32)
+		{
+			v = _mm256_loadu_si256((__m256i *)(audio + i));
+			_mm256_storeu_si256((__m256i *)(out + i),v);
+			_mm256_storeu_si256((__m256i *)(audio + i),ff);
+			v = _mm256_loadu_si256((__m256i *)(rssi + i));
+			acc = _mm256_add_epi64(acc,_mm256_sad_epu8(v,z));
+			_mm256_storeu_si256((__m256i *)(rssi + i),z);
+		}
+		{
+			__m128i acc1 = _mm_add_epi64(_mm256_castsi256_si128(acc),_mm256_extracti128_si256(acc,1));
+
+			sum += _mm_cvtsi128_si32(acc1) + _mm_cvtsi128_si32(_mm_srli_si128(acc1,8));
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	{
+		__m128i acc = _mm_setzero_si128(),z = _mm_setzero_si128(),ff = _mm_set1_epi8(-1),v;
+
+		for(; i + 16 <= n; i += 16)
+		{
+			v = _mm_loadu_si128((__m128i *)(audio + i));
+			_mm_storeu_si128((__m128i *)(out + i),v);
+			_mm_storeu_si128((__m128i *)(audio + i),ff);
+			v = _mm_loadu_si128((__m128i *)(rssi + i));
+			acc = _mm_add_epi64(acc,_mm_sad_epu8(v,z));
+			_mm_storeu_si128((__m128i *)(rssi + i),z);
+		}
+		sum += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc,8));
+	}
+#elif defined(VOTER_MIX_NEON)
+	{
+		uint32x4_t acc = vdupq_n_u32(0);
+		uint8x16_t v;
+
+		for(; i + 16 <= n; i += 16)
+		{
+			v = vld1q_u8(audio + i);
+			vst1q_u8(out + i,v);
+			vst1q_u8(audio + i,vdupq_n_u8(0xff));
+			v = vld1q_u8(rssi + i);
+			acc = vpadalq_u16(acc,vpaddlq_u8(v));
+			vst1q_u8(rssi + i,vdupq_n_u8(0));
+		}
+		sum += vgetq_lane_u32(acc,0) + vgetq_lane_u32(acc,1) +
+			vgetq_lane_u32(acc,2) + vgetq_lane_u32(acc,3);
+	}
+#endif
+	if (i >= n) return(sum);
+	memcpy(out + i,audio + i,n - i);
+	memset(audio + i,0xff,n - i);
+	sum += voter_rssi_sum_seg(rssi + i,n - i);
+	memset(rssi + i,0,n - i);
+	return(sum);
+}
+
+/* drain n samples starting at idx out of the circular buffers (of length len)
+   into out, returns the rssi sum */
+static inline unsigned int voter_drain(uint8_t *audio, uint8_t *rssi, int len, int idx, uint8_t *out, int n)
+{
+int	i;
+
+	i = len - (idx + n);
+	if (i >= 0) return(voter_drain_seg(audio + idx,rssi + idx,out,n));
+	return(voter_drain_seg(audio + idx,rssi + idx,out,n + i) +
+		voter_drain_seg(audio,rssi,out + n + i,-i));
+}
+
+/* sum n rssi samples starting at idx in the circular buffer of length len */
+static inline unsigned int voter_rssi_sum(const uint8_t *rssi, int len, int idx, int n)
+{
+int	i;
+
+	i = len - (idx + n);
+	if (i >= 0) return(voter_rssi_sum_seg(rssi + idx,n));
+	return(voter_rssi_sum_seg(rssi + idx,n + i) + voter_rssi_sum_seg(rssi,-i));
+}
+
+/* zero n rssi samples starting at idx in the circular buffer of length len */
+static inline void voter_rssi_clear(uint8_t *rssi, int len, int idx, int n)
+{
+int	i;
+
+	i = len - (idx + n);
+	if (i >= 0)
+	{
+		memset(rssi + idx,0,n);
+		return;
+	}
+	memset(rssi + idx,0,n + i);
+	memset(rssi,0,-i);
+}
+
+/* decode n ulaw samples into dec using tab (the ulaw to slinear table),
+   then either replace mix with them or add them into mix (clipped to +/-32767) */
+static inline void voter_ulaw_mix(short *mix, short *dec, const uint8_t *ulaw, const short *tab, int replace, int n)
+{
+int	i,j;
+
+	for(i = 0; i < n; i++) dec[i] = tab[ulaw[i]];
+	if (replace)
+	{
+		memcpy(mix,dec,n * sizeof(short));
+		return;
+	}
+	i = 0;
+#if defined(__SSE2__)
+	{
+		__m128i lim = _mm_set1_epi16(-32767),v;
+
+		for(; i + 8 <= n; i += 8)
+		{
+			v = _mm_adds_epi16(_mm_loadu_si128((__m128i *)(mix + i)),_mm_loadu_si128((__m128i *)(dec + i)));
+			_mm_storeu_si128((__m128i *)(mix + i),_mm_max_epi16(v,lim));
+		}
+	}
+#elif defined(VOTER_MIX_NEON)
+	{
+		int16x8_t lim = vdupq_n_s16(-32767);
+
+		for(; i + 8 <= n; i += 8)
+			vst1q_s16(mix + i,vmaxq_s16(vqaddq_s16(vld1q_s16(mix + i),vld1q_s16(dec + i)),lim));
+	}
+#endif
+	for(; i < n; i++)
+	{
+		j = mix[i] + dec[i];
+		if (j > 32767) j = 32767;
+		if (j < -32767) j = -32767;
+		mix[i] = j;
+	}
+}
+
+#endif /* _VOTER_MIX_H */
@@ -852,6 +852,41 @@ struct ast_channel *ast_waitfor_n(struct ast_channel **chan, int n, int *ms);
 	This version works on fd's only.  Be careful with it. */
 int ast_waitfor_n_fd(int *fds, int n, int *ms, int *exception);
 
+/*! \brief A persistent set of channels to wait on
+ * Unlike ast_waitfor_n(), the set is only touched when channels are
+ * added or removed, and a wait only looks at the channels that are
+ * ready (epoll on Linux, a kept pollfd array elsewhere).  A set belongs
+ * to one thread.  Channels in a set are not marked blocking and their
+ * whentohangup is not checked, so use a bounded timeout.  A pending
+ * masquerade is done when the channel next comes up ready. */
+struct ast_waitset;
+
+/*! \brief Create an empty wait set
+	\return the set, or NULL on error */
+struct ast_waitset *ast_waitset_alloc(void);
+
+/*! \brief Free a wait set, the channels in it are left alone */
+void ast_waitset_free(struct ast_waitset *ws);
+
+/*! \brief Add a channel (all of its fds) to a wait set
+	If the channel is already in the set its fds are refreshed.
+	\return 0 on success, -1 on error */
+int ast_waitset_add(struct ast_waitset *ws, struct ast_channel *chan);
+
+/*! \brief Remove a channel from a wait set, do this before hanging it up */
+void ast_waitset_remove(struct ast_waitset *ws, struct ast_channel *chan);
+
+/*! \brief Remove every channel from a wait set */
+void ast_waitset_clear(struct ast_waitset *ws);
+
+/*! \brief Waits for input on the channels in a wait set
+	Channels found ready by one poll are handed out one per call,
+	before polling again.
+	\return the channel with activity, or NULL if none had any.
+	\param ws the set to wait on
+	\param ms time "ms" is modified in-place, if applicable */
+struct ast_channel *ast_waitset_wait(struct ast_waitset *ws, int *ms);
+
 
 /*! \brief Reads a frame
  * \param chan channel to read a frame from
@@ -202,6 +202,8 @@ extern struct ast_frame ast_null_frame;
 #define AST_MALLOCD_DATA	(1 << 1)
 /*! Need the source be free'd? (haha!) */
 #define AST_MALLOCD_SRC		(1 << 2)
+/*! Is the data a reference counted payload shared with other frames? (see ast_frshare()) */
+#define AST_MALLOCD_SHARED	(1 << 3)
 
 /* MODEM subclasses */
 /*! T.38 Fax-over-IP */
@@ -419,6 +421,27 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr);
  */
 struct ast_frame *ast_frdup(const struct ast_frame *fr);
 
+/*! \brief Copies a frame, sharing its data
+ * \param fr frame to copy
+ * Like ast_frdup(), but the copy's data is a reference counted payload.
+ * If \a fr already has one, the copy just gets another reference to it
+ * (a new header, no data copy); otherwise it gets its own.  So handing
+ * the same audio to N queues costs one data copy plus N headers, if the
+ * first copy is the one that gets shared.  The data is copy-on-write:
+ * call ast_frame_make_writable() before changing it.  ast_frfree()
+ * drops the reference.
+ * \return Returns a frame on success, NULL on error
+ */
+struct ast_frame *ast_frshare(const struct ast_frame *fr);
+
+/*! \brief Makes sure a frame's data is not shared with any other frame
+ * \param fr frame to act upon
+ * If the data is a payload shared with other frames (see ast_frshare()),
+ * give this frame a private copy of it.
+ * \return Returns 0 on success, -1 on error (the frame is unchanged)
+ */
+int ast_frame_make_writable(struct ast_frame *fr);
+
 void ast_swapcopy_samples(void *dst, const void *src, int samples);
 
 /* Helpers for byteswapping native samples to/from 
@@ -0,0 +1,183 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ * \brief A bank of Goertzel filters run over the same signal
+ *
+ * The DTMF and MF detectors run 6 to 18 Goertzel filters over every
+ * sample.  Each filter is independent of the others, so this keeps
+ * them side by side and updates four at a time with SSE2 or NEON when
+ * the compiler targets them, and one at a time in plain C otherwise.
+ *
+ * Every filter does exactly the same single precision operations, in
+ * the same order, as the one-at-a-time code in dsp.c always did
+ * (v3 = fac * v2 - v1 + sample, with no fused multiply-add), so the
+ * results are bit for bit the same whichever kernel is used.
+ *
+ * Self contained, so that utils/goertzel-bench can use it too.
+ */
+
+#ifndef _ASTERISK_GOERTZEL_H
+#define _ASTERISK_GOERTZEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GOERTZEL_KERNEL "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GOERTZEL_NEON
+#define GOERTZEL_KERNEL "neon"
+#else
+#define GOERTZEL_KERNEL "scalar"
+#endif
+
+/*! \brief Filters run side by side in one pass over the samples */
+#define GOERTZEL_BANK_LANES	12
+
+/*! \brief Most filters a bank can hold (a multiple of GOERTZEL_BANK_LANES) */
+#define GOERTZEL_BANK_MAX	24
+
+/*! \brief Samples converted to float at a time */
+#define GOERTZEL_BANK_CHUNK	64
+
+struct goertzel_bank {
+	float v2[GOERTZEL_BANK_MAX];
+	float v3[GOERTZEL_BANK_MAX];
+	float fac[GOERTZEL_BANK_MAX];
+	int bins;	/*!< filters in use, the rest up to a multiple of GOERTZEL_BANK_LANES just idle */
+};
+
+/*! \brief Set up filter \a bin of the bank to look for \a freq Hz (at 8kHz) */
+static inline void goertzel_bank_set(struct goertzel_bank *b, int bin, float freq)
+{
+	b->v2[bin] = b->v3[bin] = 0.0;
+	b->fac[bin] = 2.0 * cos(2.0 * M_PI * (freq / 8000.0));
+	if (bin >= b->bins)
+		b->bins = bin + 1;
+}
+
+static inline void goertzel_bank_init(struct goertzel_bank *b)
+{
+	memset(b, 0, sizeof(*b));
+}
+
+static inline void goertzel_bank_reset(struct goertzel_bank *b)
+{
+	memset(b->v2, 0, sizeof(b->v2));
+	memset(b->v3, 0, sizeof(b->v3));
+}
+
+/*! \brief Energy at the frequency of filter \a bin for the samples so far */
+static inline float goertzel_bank_result(const struct goertzel_bank *b, int bin)
+{
+	return b->v3[bin] * b->v3[bin] + b->v2[bin] * b->v2[bin] - b->v2[bin] * b->v3[bin] * b->fac[bin];
+}
+
+/*!
+ * \brief Run \a count samples through filters \a first to \a first + 11
+ *
+ * Each filter's next value depends on its last two, so a filter can't go
+ * any faster than one multiply, subtract and add per sample. Running three
+ * vectors of four through the same loop keeps that many chains in flight.
+ */
+static inline void goertzel_bank_run(struct goertzel_bank *b, int first, const float *famp, int count)
+{
+	int i;
+#if defined(__SSE2__)
+	float *p2 = b->v2 + first, *p3 = b->v3 + first, *pf = b->fac + first;
+	__m128 a2 = _mm_loadu_ps(p2), b2 = _mm_loadu_ps(p2 + 4), c2 = _mm_loadu_ps(p2 + 8);
+	__m128 a3 = _mm_loadu_ps(p3), b3 = _mm_loadu_ps(p3 + 4), c3 = _mm_loadu_ps(p3 + 8);
+	__m128 af = _mm_loadu_ps(pf), bf = _mm_loadu_ps(pf + 4), cf = _mm_loadu_ps(pf + 8);
+	__m128 a1, b1, c1, x;
+
+	for (i = 0; i < count; i++) {
+		x = _mm_set1_ps(famp[i]);
+		a1 = a2;
+		b1 = b2;
+		c1 = c2;
+		a2 = a3;
+		b2 = b3;
+		c2 = c3;
+		a3 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(af, a2), a1), x);
+		b3 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(bf, b2), b1), x);
+		c3 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(cf, c2), c1), x);
+	}
+	_mm_storeu_ps(p2, a2);
+	_mm_storeu_ps(p2 + 4, b2);
+	_mm_storeu_ps(p2 + 8, c2);
+	_mm_storeu_ps(p3, a3);
+	_mm_storeu_ps(p3 + 4, b3);
+	_mm_storeu_ps(p3 + 8, c3);
+#elif defined(GOERTZEL_NEON)
+	float *p2 = b->v2 + first, *p3 = b->v3 + first, *pf = b->fac + first;
+	float32x4_t a2 = vld1q_f32(p2), b2 = vld1q_f32(p2 + 4), c2 = vld1q_f32(p2 + 8);
+	float32x4_t a3 = vld1q_f32(p3), b3 = vld1q_f32(p3 + 4), c3 = vld1q_f32(p3 + 8);
+	float32x4_t af = vld1q_f32(pf), bf = vld1q_f32(pf + 4), cf = vld1q_f32(pf + 8);
+	float32x4_t a1, b1, c1, x;
+
+	for (i = 0; i < count; i++) {
+		x = vdupq_n_f32(famp[i]);
+		a1 = a2;
+		b1 = b2;
+		c1 = c2;
+		a2 = a3;
+		b2 = b3;
+		c2 = c3;
+		/* not vmlaq/vfmaq, which may round differently */
+		a3 = vaddq_f32(vsubq_f32(vmulq_f32(af, a2), a1), x);
+		b3 = vaddq_f32(vsubq_f32(vmulq_f32(bf, b2), b1), x);
+		c3 = vaddq_f32(vsubq_f32(vmulq_f32(cf, c2), c1), x);
+	}
+	vst1q_f32(p2, a2);
+	vst1q_f32(p2 + 4, b2);
+	vst1q_f32(p2 + 8, c2);
+	vst1q_f32(p3, a3);
+	vst1q_f32(p3 + 4, b3);
+	vst1q_f32(p3 + 8, c3);
+#else
+	float v1[GOERTZEL_BANK_LANES], *v2 = b->v2 + first, *v3 = b->v3 + first, *fac = b->fac + first;
+	int j;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < GOERTZEL_BANK_LANES; j++) {
+			v1[j] = v2[j];
+			v2[j] = v3[j];
+			v3[j] = fac[j] * v2[j] - v1[j] + famp[i];
+		}
+	}
+#endif
+}
+
+/*! \brief Run \a count samples through every filter in the bank */
+static inline void goertzel_bank_update(struct goertzel_bank *b, const int16_t *amp, int count)
+{
+	float famp[GOERTZEL_BANK_CHUNK];
+	int i, n, first;
+
+	while (count > 0) {
+		n = count < GOERTZEL_BANK_CHUNK ? count : GOERTZEL_BANK_CHUNK;
+		for (i = 0; i < n; i++)
+			famp[i] = amp[i];
+		for (first = 0; first < b->bins; first += GOERTZEL_BANK_LANES)
+			goertzel_bank_run(b, first, famp, n);
+		amp += n;
+		count -= n;
+	}
+}
+
+#endif /* _ASTERISK_GOERTZEL_H */
@@ -149,6 +149,8 @@ struct ast_trans_pvt {
 	struct ast_trans_pvt *next;	/*!< next in translator chain */
 	struct timeval nextin;
 	struct timeval nextout;
+	/*! \brief G.711 step done by ast_translate() itself, see ast_translator_build_path() */
+	int fused;
 };
 
 /*! \brief generic frameout function */
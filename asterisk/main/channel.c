@@ -37,6 +37,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <unistd.h>
 #include <math.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #if defined(HAVE_ZAPTEL) || defined (HAVE_DAHDI)
 #include <sys/ioctl.h>
 #include "asterisk/dahdi_compat.h"
@@ -1803,6 +1807,254 @@ struct ast_channel *ast_waitfor_n(struct ast_channel **c, int n, int *ms)
 	return ast_waitfor_nandfds(c, n, NULL, 0, NULL, NULL, ms);
 }
 
+struct ast_waitset_fd {
+	struct ast_channel *chan;
+	int fdno;
+	int fd;
+};
+
+struct ast_waitset {
+	int epfd;			/*!< epoll instance, -1 if we use poll() */
+	struct ast_waitset_fd *fds;	/*!< one entry per channel fd */
+	struct pollfd *pfds;		/*!< same order as fds, poll() only */
+	int nfds;
+	int maxfds;
+	int *ready;			/*!< fds entries found ready, not yet handed out */
+	short *revents;
+	int nready;
+	int nextready;
+#ifdef __linux__
+	struct epoll_event *events;
+#endif
+};
+
+struct ast_waitset *ast_waitset_alloc(void)
+{
+	struct ast_waitset *ws;
+
+	if (!(ws = ast_calloc(1, sizeof(*ws))))
+		return NULL;
+	ws->epfd = -1;
+#ifdef __linux__
+	if ((ws->epfd = epoll_create(AST_MAX_FDS * 8)) < 0)
+		ast_log(LOG_DEBUG, "epoll_create failed (%s), falling back to poll\n", strerror(errno));
+#endif
+	return ws;
+}
+
+void ast_waitset_free(struct ast_waitset *ws)
+{
+	if (!ws)
+		return;
+	if (ws->epfd > -1)
+		close(ws->epfd);
+	free(ws->fds);
+	free(ws->pfds);
+	free(ws->ready);
+	free(ws->revents);
+#ifdef __linux__
+	free(ws->events);
+#endif
+	free(ws);
+}
+
+static int waitset_grow(struct ast_waitset *ws)
+{
+	int max = ws->maxfds ? ws->maxfds * 2 : AST_MAX_FDS * 8;
+	void *tmp;
+
+	if (!(tmp = ast_realloc(ws->fds, max * sizeof(*ws->fds))))
+		return -1;
+	ws->fds = tmp;
+	if (!(tmp = ast_realloc(ws->pfds, max * sizeof(*ws->pfds))))
+		return -1;
+	ws->pfds = tmp;
+	if (!(tmp = ast_realloc(ws->ready, max * sizeof(*ws->ready))))
+		return -1;
+	ws->ready = tmp;
+	if (!(tmp = ast_realloc(ws->revents, max * sizeof(*ws->revents))))
+		return -1;
+	ws->revents = tmp;
+#ifdef __linux__
+	if (!(tmp = ast_realloc(ws->events, max * sizeof(*ws->events))))
+		return -1;
+	ws->events = tmp;
+#endif
+	ws->maxfds = max;
+	return 0;
+}
+
+#ifdef __linux__
+static int waitset_ctl(struct ast_waitset *ws, int op, int x)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.u32 = x;
+	return epoll_ctl(ws->epfd, op, ws->fds[x].fd, &ev);
+}
+#endif
+
+void ast_waitset_remove(struct ast_waitset *ws, struct ast_channel *chan)
+{
+	int x, y, shared;
+
+	for (x = 0; x < ws->nfds; ) {
+		if (ws->fds[x].chan != chan) {
+			x++;
+			continue;
+		}
+#ifdef __linux__
+		if (ws->epfd > -1) {
+			/* the fd may have been closed and handed to another member */
+			for (y = 0, shared = 0; y < ws->nfds; y++) {
+				if ((y != x) && (ws->fds[y].fd == ws->fds[x].fd))
+					shared = 1;
+			}
+			if (!shared)
+				epoll_ctl(ws->epfd, EPOLL_CTL_DEL, ws->fds[x].fd, NULL);
+		}
+#endif
+		ws->nfds--;
+		if (x != ws->nfds) {
+			ws->fds[x] = ws->fds[ws->nfds];
+			ws->pfds[x] = ws->pfds[ws->nfds];
+#ifdef __linux__
+			if (ws->epfd > -1)
+				waitset_ctl(ws, EPOLL_CTL_MOD, x);
+#endif
+		}
+	}
+	/* indexes may have moved, anything still ready will show up again */
+	ws->nready = ws->nextready = 0;
+}
+
+int ast_waitset_add(struct ast_waitset *ws, struct ast_channel *chan)
+{
+	int y, x;
+
+	ast_waitset_remove(ws, chan);
+	for (y = 0; y < AST_MAX_FDS; y++) {
+		if (chan->fds[y] < 0)
+			continue;
+		if ((ws->nfds >= ws->maxfds) && waitset_grow(ws))
+			return -1;
+		x = ws->nfds;
+		ws->fds[x].chan = chan;
+		ws->fds[x].fdno = y;
+		ws->fds[x].fd = chan->fds[y];
+		ast_add_fd(&ws->pfds[x], chan->fds[y]);
+#ifdef __linux__
+		if ((ws->epfd > -1) && waitset_ctl(ws, EPOLL_CTL_ADD, x) &&
+		    ((errno != EEXIST) || waitset_ctl(ws, EPOLL_CTL_MOD, x))) {
+			ast_log(LOG_WARNING, "Unable to watch fd %d of '%s': %s\n",
+				chan->fds[y], chan->name, strerror(errno));
+			continue;
+		}
+#endif
+		ws->nfds++;
+	}
+	return 0;
+}
+
+void ast_waitset_clear(struct ast_waitset *ws)
+{
+#ifdef __linux__
+	if (ws->epfd > -1) {
+		/* cheaper than one EPOLL_CTL_DEL per fd, and forgets closed fds */
+		close(ws->epfd);
+		if ((ws->epfd = epoll_create(AST_MAX_FDS * 8)) < 0)
+			ast_log(LOG_WARNING, "epoll_create failed (%s), falling back to poll\n", strerror(errno));
+	}
+#endif
+	ws->nfds = 0;
+	ws->nready = ws->nextready = 0;
+}
+
+struct ast_channel *ast_waitset_wait(struct ast_waitset *ws, int *ms)
+{
+	struct timeval start = { 0 , 0 };
+	struct ast_channel *winner;
+	int res, x, y;
+	short revents;
+
+	if (ws->nextready >= ws->nready) {
+		ws->nready = ws->nextready = 0;
+		if (*ms > 0)
+			start = ast_tvnow();
+#ifdef __linux__
+		if ((ws->epfd > -1) && ws->nfds) {
+			res = epoll_wait(ws->epfd, ws->events, ws->maxfds, *ms);
+			for (x = 0; x < res; x++) {
+				ws->ready[x] = ws->events[x].data.u32;
+				ws->revents[x] = (ws->events[x].events & EPOLLPRI) ? POLLPRI : POLLIN;
+			}
+		} else
+#endif
+		{
+			res = poll(ws->pfds, ws->nfds, *ms);
+			for (x = 0, y = 0; (res > 0) && (x < ws->nfds) && (y < res); x++) {
+				if (!ws->pfds[x].revents)
+					continue;
+				ws->ready[y] = x;
+				ws->revents[y++] = ws->pfds[x].revents;
+			}
+		}
+		if (res < 0) {	/* Simulate a timeout if we were interrupted */
+			if (errno != EINTR)
+				*ms = -1;
+			return NULL;
+		}
+		if (res == 0) {
+			*ms = 0;
+			return NULL;
+		}
+		/* a channel with more than one fd up is only handed out once */
+		for (x = 0, ws->nready = 0; x < res; x++) {
+			for (y = 0; y < ws->nready; y++) {
+				if (ws->fds[ws->ready[y]].chan == ws->fds[ws->ready[x]].chan)
+					break;
+			}
+			if (y < ws->nready) {
+				ws->ready[y] = ws->ready[x];
+				ws->revents[y] = ws->revents[x];
+				continue;
+			}
+			ws->ready[ws->nready] = ws->ready[x];
+			ws->revents[ws->nready++] = ws->revents[x];
+		}
+		if (*ms > 0) {
+			*ms -= ast_tvdiff_ms(ast_tvnow(), start);
+			if (*ms < 0)
+				*ms = 0;
+		}
+	}
+	x = ws->ready[ws->nextready];
+	revents = ws->revents[ws->nextready++];
+	winner = ws->fds[x].chan;
+	if (revents & POLLPRI)
+		ast_set_flag(winner, AST_FLAG_EXCEPTION);
+	else
+		ast_clear_flag(winner, AST_FLAG_EXCEPTION);
+	winner->fdno = ws->fds[x].fdno;
+	ast_channel_lock(winner);
+	if (winner->masq) {
+		if (ast_do_masquerade(winner)) {
+			ast_log(LOG_WARNING, "Masquerade failed\n");
+			*ms = -1;
+			ast_channel_unlock(winner);
+			return NULL;
+		}
+		ast_channel_unlock(winner);
+		/* we now have the clone's fds */
+		ast_waitset_add(ws, winner);
+		return winner;
+	}
+	ast_channel_unlock(winner);
+	return winner;
+}
+
 int ast_waitfor(struct ast_channel *c, int ms)
 {
 	int oldms = ms;	/* -1 if no timeout */
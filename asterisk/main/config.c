@@ -34,6 +34,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/stat.h>
@@ -165,6 +166,21 @@ struct ast_category_template_instance {
 	AST_LIST_ENTRY(ast_category_template_instance) next;
 };
 
+/*! \brief Case-insensitive name index over the categories of a config or the
+ * variables of a category.  It is built on the first lookup and thrown away
+ * whenever the list changes; the lists themselves stay the authority, so
+ * browse order is untouched.  Each name maps to its first entry in the list,
+ * which is what a walk with strcasecmp() would find. */
+struct config_index {
+	unsigned int mask;
+	int dups;			/*!< some name is in the list twice */
+	void *slots[0];			/*!< open addressed, mask + 1 of them */
+};
+
+#define CONFIG_INDEX_MIN 16		/*!< shorter lists are just walked */
+
+AST_MUTEX_DEFINE_STATIC(config_index_lock);
+
 struct ast_category {
 	char name[80];
 	int ignored;			/*!< do not let user of the config see this category */
@@ -175,6 +191,9 @@ struct ast_category {
 	struct ast_variable *root;
 	struct ast_variable *last;
 	struct ast_category *next;
+	struct ast_config *config;		/*!< config this was appended to, whose index a rename invalidates */
+	struct config_index *index;		/*!< variable index, if indexed and long enough */
+	int indexed;
 };
 
 struct ast_config {
@@ -184,8 +203,134 @@ struct ast_config {
 	struct ast_category *last_browse;		/*!< used to cache the last category supplied via category_browse */
 	int include_level;
 	int max_include_level;
+	struct config_index *index;			/*!< category index, if indexed and long enough */
+	int indexed;
 };
 
+static unsigned int config_index_hash(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	for (; *name; name++)
+		hash = (hash ^ (unsigned char) tolower(*name)) * 16777619U;
+	return hash;
+}
+
+static const char *category_index_name(const void *entry)
+{
+	return ((const struct ast_category *) entry)->name;
+}
+
+static const char *variable_index_name(const void *entry)
+{
+	return ((const struct ast_variable *) entry)->name;
+}
+
+static struct config_index *config_index_alloc(int entries)
+{
+	struct config_index *index;
+	unsigned int size;
+
+	for (size = 32; size < entries * 2; size <<= 1);
+	if ((index = ast_calloc(1, sizeof(*index) + size * sizeof(index->slots[0]))))
+		index->mask = size - 1;
+	return index;
+}
+
+/*! \brief Add an entry, unless an earlier one has the same name */
+static void config_index_add(struct config_index *index, void *entry, const char *(*getname)(const void *))
+{
+	const char *name = getname(entry);
+	unsigned int x;
+
+	for (x = config_index_hash(name) & index->mask; index->slots[x]; x = (x + 1) & index->mask) {
+		if (!strcasecmp(getname(index->slots[x]), name)) {
+			index->dups = 1;
+			return;
+		}
+	}
+	index->slots[x] = entry;
+}
+
+static void *config_index_find(const struct config_index *index, const char *name, const char *(*getname)(const void *))
+{
+	unsigned int x;
+
+	for (x = config_index_hash(name) & index->mask; index->slots[x]; x = (x + 1) & index->mask) {
+		if (!strcasecmp(getname(index->slots[x]), name))
+			return index->slots[x];
+	}
+	return NULL;
+}
+
+/*! \brief Publish a freshly built index; called with config_index_lock held.
+ * A reader that sees indexed set but not yet the new pointer just walks the list. */
+static void config_index_publish(struct config_index **indexp, int *indexed, struct config_index *index)
+{
+#if defined(HAVE_GCC_ATOMICS)
+	__sync_synchronize();
+#endif
+	*indexp = index;
+#if defined(HAVE_GCC_ATOMICS)
+	__sync_synchronize();
+#endif
+	*indexed = 1;
+}
+
+static void config_index_drop(struct config_index **indexp, int *indexed)
+{
+	*indexed = 0;
+	if (*indexp) {
+		free(*indexp);
+		*indexp = NULL;
+	}
+}
+
+/*! \brief Lookups may come from several threads at once (app_rpt shares its
+ * config between them), so building is serialized; lists are never changed
+ * while being looked up in, so nothing else needs the lock. */
+static void category_index_build(const struct ast_config *config)
+{
+	struct ast_config *cfg = (struct ast_config *) config;
+	struct config_index *index = NULL;
+	struct ast_category *cat;
+	int n = 0;
+
+	ast_mutex_lock(&config_index_lock);
+	if (!cfg->indexed) {
+		for (cat = cfg->root; cat; cat = cat->next)
+			n++;
+		if ((n >= CONFIG_INDEX_MIN) && (index = config_index_alloc(n))) {
+			for (cat = cfg->root; cat; cat = cat->next) {
+				if (!cat->ignored)
+					config_index_add(index, cat, category_index_name);
+			}
+		}
+		config_index_publish(&cfg->index, &cfg->indexed, index);
+	}
+	ast_mutex_unlock(&config_index_lock);
+}
+
+static void variable_index_build(const struct ast_category *category)
+{
+	struct ast_category *cat = (struct ast_category *) category;
+	struct config_index *index = NULL;
+	struct ast_variable *v;
+	int n = 0;
+
+	ast_mutex_lock(&config_index_lock);
+	if (!cat->indexed) {
+		for (v = cat->root; v; v = v->next)
+			n++;
+		if ((n >= CONFIG_INDEX_MIN) && (index = config_index_alloc(n))) {
+			for (v = cat->root; v; v = v->next)
+				config_index_add(index, v, variable_index_name);
+		}
+		config_index_publish(&cat->index, &cat->indexed, index);
+	}
+	ast_mutex_unlock(&config_index_lock);
+}
+
 struct ast_variable *ast_variable_new(const char *name, const char *value) 
 {
 	struct ast_variable *variable;
@@ -205,6 +350,8 @@ void ast_variable_append(struct ast_category *category, struct ast_variable *var
 {
 	if (!variable)
 		return;
+	if (category->indexed)
+		config_index_drop(&category->index, &category->indexed);
 	if (category->last)
 		category->last->next = variable;
 	else
@@ -252,7 +399,21 @@ const char *ast_variable_retrieve(const struct ast_config *config, const char *c
 	struct ast_variable *v;
 
 	if (category) {
-		for (v = ast_variable_browse(config, category); v; v = v->next) {
+		struct ast_category *cat;
+
+		if (config->last_browse && (config->last_browse->name == category))
+			cat = config->last_browse;
+		else
+			cat = ast_category_get(config, category);
+		if (!cat)
+			return NULL;
+		if (!cat->indexed)
+			variable_index_build(cat);
+		if (cat->index) {
+			v = config_index_find(cat->index, variable, variable_index_name);
+			return v ? v->value : NULL;
+		}
+		for (v = cat->root; v; v = v->next) {
 			if (!strcasecmp(variable, v->name))
 				return v->value;
 		}
@@ -286,6 +447,8 @@ static void move_variables(struct ast_category *old, struct ast_category *new)
 {
 	struct ast_variable *var = old->root;
 	old->root = NULL;
+	if (old->indexed)
+		config_index_drop(&old->index, &old->indexed);
 #if 1
 	/* we can just move the entire list in a single op */
 	ast_variable_append(new, var);
@@ -312,6 +475,15 @@ static struct ast_category *category_get(const struct ast_config *config, const
 {
 	struct ast_category *cat;
 
+	/* the index only has visible categories, and with duplicate names
+	   the exact match below may pick a later one than strcasecmp would */
+	if (!ignored) {
+		if (!config->indexed)
+			category_index_build(config);
+		if (config->index && !config->index->dups)
+			return config_index_find(config->index, category_name, category_index_name);
+	}
+
 	/* try exact match first, then case-insensitive match */
 	for (cat = config->root; cat; cat = cat->next) {
 		if (cat->name == category_name && (ignored || !cat->ignored))
@@ -338,6 +510,9 @@ int ast_category_exist(const struct ast_config *config, const char *category_nam
 
 void ast_category_append(struct ast_config *config, struct ast_category *category)
 {
+	if (config->indexed)
+		config_index_drop(&config->index, &config->indexed);
+	category->config = config;
 	if (config->last)
 		config->last->next = category;
 	else
@@ -374,6 +549,7 @@ static void ast_destroy_template_list(struct ast_category *cat)
 
 void ast_category_destroy(struct ast_category *cat)
 {
+	config_index_drop(&cat->index, &cat->indexed);
 	ast_variables_destroy(cat->root);
 	ast_destroy_comments(cat);
 	ast_destroy_template_list(cat);
@@ -434,6 +610,8 @@ struct ast_variable *ast_category_detach_variables(struct ast_category *cat)
 	v = cat->root;
 	cat->root = NULL;
 	cat->last = NULL;
+	if (cat->indexed)
+		config_index_drop(&cat->index, &cat->indexed);
 
 	return v;
 }
@@ -441,6 +619,8 @@ struct ast_variable *ast_category_detach_variables(struct ast_category *cat)
 void ast_category_rename(struct ast_category *cat, const char *name)
 {
 	ast_copy_string(cat->name, name, sizeof(cat->name));
+	if (cat->config && cat->config->indexed)
+		config_index_drop(&cat->config->index, &cat->config->indexed);
 }
 
 static void inherit_category(struct ast_category *new, const struct ast_category *base)
@@ -467,6 +647,8 @@ int ast_variable_delete(struct ast_category *category, char *variable, char *mat
 {
 	struct ast_variable *cur, *prev=NULL, *curn;
 	int res = -1;
+	if (category->indexed)
+		config_index_drop(&category->index, &category->indexed);
 	cur = category->root;
 	while (cur) {
 		if (cur->name == variable) {
@@ -521,6 +703,8 @@ int ast_variable_update(struct ast_category *category, const char *variable,
 		return -1;
 	
 	newer->object = object;
+	if (category->indexed)
+		config_index_drop(&category->index, &category->indexed);
 
 	for (cur = category->root; cur; prev = cur, cur = cur->next) {
 		if (strcasecmp(cur->name, variable) ||
@@ -553,6 +737,8 @@ int ast_variable_update(struct ast_category *category, const char *variable,
 int ast_category_delete(struct ast_config *cfg, char *category)
 {
 	struct ast_category *prev=NULL, *cat;
+	if (cfg->indexed)
+		config_index_drop(&cfg->index, &cfg->indexed);
 	cat = cfg->root;
 	while(cat) {
 		if (cat->name == category) {
@@ -607,6 +793,7 @@ void ast_config_destroy(struct ast_config *cfg)
 		cat = cat->next;
 		ast_category_destroy(catn);
 	}
+	config_index_drop(&cfg->index, &cfg->indexed);
 	free(cfg);
 }
 
@@ -58,6 +58,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/dsp.h"
 #include "asterisk/ulaw.h"
 #include "asterisk/alaw.h"
+#include "asterisk/goertzel.h"
 #include "asterisk/utils.h"
 
 /*! Number of goertzels for progress detect */
@@ -199,19 +200,18 @@ typedef struct {
 #endif	
 } goertzel_state_t;
 
+/*! \brief Filters in the DTMF detector's goertzel bank */
+#define DTMF_ROW(i)	(i)
+#define DTMF_COL(i)	(4 + (i))
+#define DTMF_FAX	8
+#define DTMF_ROW2ND(i)	(9 + (i))
+#define DTMF_COL2ND(i)	(13 + (i))
+#define DTMF_FAX2ND	17
+
 typedef struct
 {
-	goertzel_state_t row_out[4];
-	goertzel_state_t col_out[4];
-#ifdef FAX_DETECT
-	goertzel_state_t fax_tone;
-#endif
+	struct goertzel_bank bank;	/*!< rows, columns, fax tone and (OLD_DSP_ROUTINES) their 2nd harmonics */
 #ifdef OLD_DSP_ROUTINES
-	goertzel_state_t row_out2nd[4];
-	goertzel_state_t col_out2nd[4];
-#ifdef FAX_DETECT
-	goertzel_state_t fax_tone2nd;    
-#endif
 	int hit1;
 	int hit2;
 	int hit3;
@@ -234,16 +234,19 @@ typedef struct
 #endif
 } dtmf_detect_state_t;
 
+/*! \brief Filters in the MF detector's goertzel bank */
+#define MF_TONE(i)	(i)
+#define MF_TONE2ND(i)	(6 + (i))
+
 typedef struct
 {
-	goertzel_state_t tone_out[6];
+	struct goertzel_bank bank;	/*!< the 6 tones and (OLD_DSP_ROUTINES) their 2nd harmonics */
 	int mhit;
 #ifdef OLD_DSP_ROUTINES
 	int hit1;
 	int hit2;
 	int hit3;
 	int hit4;
-	goertzel_state_t tone_out2nd[6];
 	float energy;
 #else
 	int hits[5];
@@ -374,22 +377,23 @@ static void ast_dtmf_detect_init (dtmf_detect_state_t *s)
 #else
 	s->lasthit = 0;
 #endif
+	goertzel_bank_init(&s->bank);
 	for (i = 0;  i < 4;  i++) {
-		goertzel_init (&s->row_out[i], dtmf_row[i], 102);
-		goertzel_init (&s->col_out[i], dtmf_col[i], 102);
+		goertzel_bank_set(&s->bank, DTMF_ROW(i), dtmf_row[i]);
+		goertzel_bank_set(&s->bank, DTMF_COL(i), dtmf_col[i]);
 #ifdef OLD_DSP_ROUTINES
-		goertzel_init (&s->row_out2nd[i], dtmf_row[i] * 2.0, 102);
-		goertzel_init (&s->col_out2nd[i], dtmf_col[i] * 2.0, 102);
+		goertzel_bank_set(&s->bank, DTMF_ROW2ND(i), dtmf_row[i] * 2.0);
+		goertzel_bank_set(&s->bank, DTMF_COL2ND(i), dtmf_col[i] * 2.0);
 #endif	
 		s->energy = 0.0;
 	}
 #ifdef FAX_DETECT
 	/* Same for the fax dector */
-	goertzel_init (&s->fax_tone, fax_freq, 102);
+	goertzel_bank_set(&s->bank, DTMF_FAX, fax_freq);
 
 #ifdef OLD_DSP_ROUTINES
 	/* Same for the fax dector 2nd harmonic */
-	goertzel_init (&s->fax_tone2nd, fax_freq * 2.0, 102);
+	goertzel_bank_set(&s->bank, DTMF_FAX2ND, fax_freq * 2.0);
 #endif	
 #endif /* FAX_DETECT */
 	s->current_sample = 0;
@@ -409,10 +413,11 @@ static void ast_mf_detect_init (mf_detect_state_t *s)
 #else	
 	s->hits[0] = s->hits[1] = s->hits[2] = s->hits[3] = s->hits[4] = 0;
 #endif
+	goertzel_bank_init(&s->bank);
 	for (i = 0;  i < 6;  i++) {
-		goertzel_init (&s->tone_out[i], mf_tones[i], 160);
+		goertzel_bank_set(&s->bank, MF_TONE(i), mf_tones[i]);
 #ifdef OLD_DSP_ROUTINES
-		goertzel_init (&s->tone_out2nd[i], mf_tones[i] * 2.0, 160);
+		goertzel_bank_set(&s->bank, MF_TONE2ND(i), mf_tones[i] * 2.0);
 		s->energy = 0.0;
 #endif
 	}
@@ -437,7 +442,6 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 #endif	
 #endif /* FAX_DETECT */
 	float famp;
-	float v1;
 	int i;
 	int j;
 	int sample;
@@ -453,87 +457,12 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 			limit = sample + (102 - s->current_sample);
 		else
 			limit = samples;
-#if defined(USE_3DNOW)
-		_dtmf_goertzel_update (s->row_out, amp + sample, limit - sample);
-		_dtmf_goertzel_update (s->col_out, amp + sample, limit - sample);
-#ifdef OLD_DSP_ROUTINES
-		_dtmf_goertzel_update (s->row_out2nd, amp + sample, limit2 - sample);
-		_dtmf_goertzel_update (s->col_out2nd, amp + sample, limit2 - sample);
-#endif		
-		/* XXX Need to fax detect for 3dnow too XXX */
-		#warning "Fax Support Broken"
-#else
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
 		for (j=sample;j<limit;j++) {
 			famp = amp[j];
 			s->energy += famp*famp;
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			v1 = s->row_out[0].v2;
-			s->row_out[0].v2 = s->row_out[0].v3;
-			s->row_out[0].v3 = s->row_out[0].fac*s->row_out[0].v2 - v1 + famp;
-			v1 = s->col_out[0].v2;
-			s->col_out[0].v2 = s->col_out[0].v3;
-			s->col_out[0].v3 = s->col_out[0].fac*s->col_out[0].v2 - v1 + famp;
-			v1 = s->row_out[1].v2;
-			s->row_out[1].v2 = s->row_out[1].v3;
-			s->row_out[1].v3 = s->row_out[1].fac*s->row_out[1].v2 - v1 + famp;
-			v1 = s->col_out[1].v2;
-			s->col_out[1].v2 = s->col_out[1].v3;
-			s->col_out[1].v3 = s->col_out[1].fac*s->col_out[1].v2 - v1 + famp;
-			v1 = s->row_out[2].v2;
-			s->row_out[2].v2 = s->row_out[2].v3;
-			s->row_out[2].v3 = s->row_out[2].fac*s->row_out[2].v2 - v1 + famp;
-			v1 = s->col_out[2].v2;
-			s->col_out[2].v2 = s->col_out[2].v3;
-			s->col_out[2].v3 = s->col_out[2].fac*s->col_out[2].v2 - v1 + famp;
-			v1 = s->row_out[3].v2;
-			s->row_out[3].v2 = s->row_out[3].v3;
-			s->row_out[3].v3 = s->row_out[3].fac*s->row_out[3].v2 - v1 + famp;
-			v1 = s->col_out[3].v2;
-			s->col_out[3].v2 = s->col_out[3].v3;
-			s->col_out[3].v3 = s->col_out[3].fac*s->col_out[3].v2 - v1 + famp;
-#ifdef FAX_DETECT
-			/* Update fax tone */
-			v1 = s->fax_tone.v2;
-			s->fax_tone.v2 = s->fax_tone.v3;
-			s->fax_tone.v3 = s->fax_tone.fac*s->fax_tone.v2 - v1 + famp;
-#endif /* FAX_DETECT */
-#ifdef OLD_DSP_ROUTINES
-			v1 = s->col_out2nd[0].v2;
-			s->col_out2nd[0].v2 = s->col_out2nd[0].v3;
-			s->col_out2nd[0].v3 = s->col_out2nd[0].fac*s->col_out2nd[0].v2 - v1 + famp;
-			v1 = s->row_out2nd[0].v2;
-			s->row_out2nd[0].v2 = s->row_out2nd[0].v3;
-			s->row_out2nd[0].v3 = s->row_out2nd[0].fac*s->row_out2nd[0].v2 - v1 + famp;
-			v1 = s->col_out2nd[1].v2;
-			s->col_out2nd[1].v2 = s->col_out2nd[1].v3;
-			s->col_out2nd[1].v3 = s->col_out2nd[1].fac*s->col_out2nd[1].v2 - v1 + famp;
-			v1 = s->row_out2nd[1].v2;
-			s->row_out2nd[1].v2 = s->row_out2nd[1].v3;
-			s->row_out2nd[1].v3 = s->row_out2nd[1].fac*s->row_out2nd[1].v2 - v1 + famp;
-			v1 = s->col_out2nd[2].v2;
-			s->col_out2nd[2].v2 = s->col_out2nd[2].v3;
-			s->col_out2nd[2].v3 = s->col_out2nd[2].fac*s->col_out2nd[2].v2 - v1 + famp;
-			v1 = s->row_out2nd[2].v2;
-			s->row_out2nd[2].v2 = s->row_out2nd[2].v3;
-			s->row_out2nd[2].v3 = s->row_out2nd[2].fac*s->row_out2nd[2].v2 - v1 + famp;
-			v1 = s->col_out2nd[3].v2;
-			s->col_out2nd[3].v2 = s->col_out2nd[3].v3;
-			s->col_out2nd[3].v3 = s->col_out2nd[3].fac*s->col_out2nd[3].v2 - v1 + famp;
-			v1 = s->row_out2nd[3].v2;
-			s->row_out2nd[3].v2 = s->row_out2nd[3].v3;
-			s->row_out2nd[3].v3 = s->row_out2nd[3].fac*s->row_out2nd[3].v2 - v1 + famp;
-#ifdef FAX_DETECT
-			/* Update fax tone */            
-			v1 = s->fax_tone.v2;
-			s->fax_tone2nd.v2 = s->fax_tone2nd.v3;
-			s->fax_tone2nd.v3 = s->fax_tone2nd.fac*s->fax_tone2nd.v2 - v1 + famp;
-#endif /* FAX_DETECT */
-#endif
 		}
-#endif
+		/* All the rows, columns and the fax tone in one pass, see goertzel.h */
+		goertzel_bank_update(&s->bank, amp + sample, limit - sample);
 		s->current_sample += (limit - sample);
 		if (s->current_sample < 102) {
 			if (hit && !((digitmode & DSP_DIGITMODE_NOQUELCH))) {
@@ -547,18 +476,18 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 		}
 #ifdef FAX_DETECT
 		/* Detect the fax energy, too */
-		fax_energy = goertzel_result(&s->fax_tone);
+		fax_energy = goertzel_bank_result(&s->bank, DTMF_FAX);
 #endif
 		/* We are at the end of a DTMF detection block */
 		/* Find the peak row and the peak column */
-		row_energy[0] = goertzel_result (&s->row_out[0]);
-		col_energy[0] = goertzel_result (&s->col_out[0]);
+		row_energy[0] = goertzel_bank_result(&s->bank, DTMF_ROW(0));
+		col_energy[0] = goertzel_bank_result(&s->bank, DTMF_COL(0));
 
 		for (best_row = best_col = 0, i = 1;  i < 4;  i++) {
-			row_energy[i] = goertzel_result (&s->row_out[i]);
+			row_energy[i] = goertzel_bank_result(&s->bank, DTMF_ROW(i));
 			if (row_energy[i] > row_energy[best_row])
 				best_row = i;
-			col_energy[i] = goertzel_result (&s->col_out[i]);
+			col_energy[i] = goertzel_bank_result(&s->bank, DTMF_COL(i));
 			if (col_energy[i] > col_energy[best_col])
 				best_col = i;
 		}
@@ -581,8 +510,8 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 			/* ... and second harmonic test */
 			if (i >= 4 && 
 			    (row_energy[best_row] + col_energy[best_col]) > 42.0*s->energy &&
-                	    goertzel_result(&s->col_out2nd[best_col])*DTMF_2ND_HARMONIC_COL < col_energy[best_col]
-			    && goertzel_result(&s->row_out2nd[best_row])*DTMF_2ND_HARMONIC_ROW < row_energy[best_row]) {
+                	    goertzel_bank_result(&s->bank, DTMF_COL2ND(best_col))*DTMF_2ND_HARMONIC_COL < col_energy[best_col]
+			    && goertzel_bank_result(&s->bank, DTMF_ROW2ND(best_row))*DTMF_2ND_HARMONIC_ROW < row_energy[best_row]) {
 #else
 			/* ... and fraction of total energy test */
 			if (i >= 4 &&
@@ -675,20 +604,7 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 		s->lasthit = hit;
 #endif		
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 4;  i++) {
-			goertzel_reset(&s->row_out[i]);
-			goertzel_reset(&s->col_out[i]);
-#ifdef OLD_DSP_ROUTINES
-			goertzel_reset(&s->row_out2nd[i]);
-			goertzel_reset(&s->col_out2nd[i]);
-#endif			
-		}
-#ifdef FAX_DETECT
-		goertzel_reset (&s->fax_tone);
-#ifdef OLD_DSP_ROUTINES
-		goertzel_reset (&s->fax_tone2nd);
-#endif			
-#endif
+		goertzel_bank_reset(&s->bank);
 		s->energy = 0.0;
 		s->current_sample = 0;
 	}
@@ -724,10 +640,11 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 	int best;
 	int second_best;
 #endif
+#ifdef OLD_DSP_ROUTINES
 	float famp;
-	float v1;
-	int i;
 	int j;
+#endif
+	int i;
 	int sample;
 	int hit;
 	int limit;
@@ -739,65 +656,13 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 			limit = sample + (MF_GSIZE - s->current_sample);
 		else
 			limit = samples;
-#if defined(USE_3DNOW)
-		_dtmf_goertzel_update (s->row_out, amp + sample, limit - sample);
-		_dtmf_goertzel_update (s->col_out, amp + sample, limit - sample);
 #ifdef OLD_DSP_ROUTINES
-		_dtmf_goertzel_update (s->row_out2nd, amp + sample, limit2 - sample);
-		_dtmf_goertzel_update (s->col_out2nd, amp + sample, limit2 - sample);
-#endif
-		/* XXX Need to fax detect for 3dnow too XXX */
-		#warning "Fax Support Broken"
-#else
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
 		for (j = sample;  j < limit;  j++) {
 			famp = amp[j];
-#ifdef OLD_DSP_ROUTINES
 			s->energy += famp*famp;
-#endif
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			v1 = s->tone_out[0].v2;
-			s->tone_out[0].v2 = s->tone_out[0].v3;
-			s->tone_out[0].v3 = s->tone_out[0].fac*s->tone_out[0].v2 - v1 + famp;
-			v1 = s->tone_out[1].v2;
-			s->tone_out[1].v2 = s->tone_out[1].v3;
-			s->tone_out[1].v3 = s->tone_out[1].fac*s->tone_out[1].v2 - v1 + famp;
-			v1 = s->tone_out[2].v2;
-			s->tone_out[2].v2 = s->tone_out[2].v3;
-			s->tone_out[2].v3 = s->tone_out[2].fac*s->tone_out[2].v2 - v1 + famp;
-			v1 = s->tone_out[3].v2;
-			s->tone_out[3].v2 = s->tone_out[3].v3;
-			s->tone_out[3].v3 = s->tone_out[3].fac*s->tone_out[3].v2 - v1 + famp;
-			v1 = s->tone_out[4].v2;
-			s->tone_out[4].v2 = s->tone_out[4].v3;
-			s->tone_out[4].v3 = s->tone_out[4].fac*s->tone_out[4].v2 - v1 + famp;
-			v1 = s->tone_out[5].v2;
-			s->tone_out[5].v2 = s->tone_out[5].v3;
-			s->tone_out[5].v3 = s->tone_out[5].fac*s->tone_out[5].v2 - v1 + famp;
-#ifdef OLD_DSP_ROUTINES
-			v1 = s->tone_out2nd[0].v2;
-			s->tone_out2nd[0].v2 = s->tone_out2nd[0].v3;
-			s->tone_out2nd[0].v3 = s->tone_out2nd[0].fac*s->tone_out2nd[0].v2 - v1 + famp;
-			v1 = s->tone_out2nd[1].v2;
-			s->tone_out2nd[1].v2 = s->tone_out2nd[1].v3;
-			s->tone_out2nd[1].v3 = s->tone_out2nd[1].fac*s->tone_out2nd[1].v2 - v1 + famp;
-			v1 = s->tone_out2nd[2].v2;
-			s->tone_out2nd[2].v2 = s->tone_out2nd[2].v3;
-			s->tone_out2nd[2].v3 = s->tone_out2nd[2].fac*s->tone_out2nd[2].v2 - v1 + famp;
-			v1 = s->tone_out2nd[3].v2;
-			s->tone_out2nd[3].v2 = s->tone_out2nd[3].v3;
-			s->tone_out2nd[3].v3 = s->tone_out2nd[3].fac*s->tone_out2nd[3].v2 - v1 + famp;
-			v1 = s->tone_out2nd[4].v2;
-			s->tone_out2nd[4].v2 = s->tone_out2nd[4].v3;
-			s->tone_out2nd[4].v3 = s->tone_out2nd[4].fac*s->tone_out2nd[2].v2 - v1 + famp;
-			v1 = s->tone_out2nd[3].v2;
-			s->tone_out2nd[5].v2 = s->tone_out2nd[6].v3;
-			s->tone_out2nd[5].v3 = s->tone_out2nd[6].fac*s->tone_out2nd[3].v2 - v1 + famp;
-#endif
 		}
 #endif
+		goertzel_bank_update(&s->bank, amp + sample, limit - sample);
 		s->current_sample += (limit - sample);
 		if (s->current_sample < MF_GSIZE) {
 			if (hit && !((digitmode & DSP_DIGITMODE_NOQUELCH))) {
@@ -813,7 +678,7 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 		/* We're at the end of an MF detection block.  Go ahead and calculate
 		   all the energies. */
 		for (i=0;i<6;i++) {
-			tone_energy[i] = goertzel_result(&s->tone_out[i]);
+			tone_energy[i] = goertzel_bank_result(&s->bank, MF_TONE(i));
 		}
 		/* Find highest */
 		best1 = 0;
@@ -864,9 +729,9 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 		
 		if (sofarsogood) {
 			/* Check for 2nd harmonic */
-			if (goertzel_result(&s->tone_out2nd[best1]) * MF_2ND_HARMONIC > tone_energy[best1]) 
+			if (goertzel_bank_result(&s->bank, MF_TONE2ND(best1)) * MF_2ND_HARMONIC > tone_energy[best1]) 
 				sofarsogood = 0;
-			else if (goertzel_result(&s->tone_out2nd[best2]) * MF_2ND_HARMONIC > tone_energy[best2])
+			else if (goertzel_bank_result(&s->bank, MF_TONE2ND(best2)) * MF_2ND_HARMONIC > tone_energy[best2])
 				sofarsogood = 0;
 		}
 		if (sofarsogood) {
@@ -894,10 +759,7 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 		s->hit2 = s->hit3;
 		s->hit3 = hit;
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 6;  i++) {
-			goertzel_reset(&s->tone_out[i]);
-			goertzel_reset(&s->tone_out2nd[i]);
-		}
+		goertzel_bank_reset(&s->bank);
 		s->energy = 0.0;
 		s->current_sample = 0;
 	}
@@ -909,8 +771,8 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 		   well. The sinc function mess, due to rectangular windowing
 		   ensure that! Find the two highest energies and ensure they
 		   are considerably stronger than any of the others. */
-		energy[0] = goertzel_result(&s->tone_out[0]);
-		energy[1] = goertzel_result(&s->tone_out[1]);
+		energy[0] = goertzel_bank_result(&s->bank, MF_TONE(0));
+		energy[1] = goertzel_bank_result(&s->bank, MF_TONE(1));
 		if (energy[0] > energy[1]) {
 			best = 0;
 			second_best = 1;
@@ -920,7 +782,7 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 		}
 		/*endif*/
 		for (i=2;i<6;i++) {
-			energy[i] = goertzel_result(&s->tone_out[i]);
+			energy[i] = goertzel_bank_result(&s->bank, MF_TONE(i));
 			if (energy[i] >= energy[best]) {
 				second_best = best;
 				best = i;
@@ -981,8 +843,7 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 		s->hits[3] = s->hits[4];
 		s->hits[4] = hit;
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 6;  i++)
-			goertzel_reset(&s->tone_out[i]);
+		goertzel_bank_reset(&s->bank);
 		s->current_sample = 0;
 	}
 #endif	
@@ -1712,19 +1573,12 @@ void ast_dsp_set_busy_pattern(struct ast_dsp *dsp, int tonelength, int quietleng
 
 void ast_dsp_digitreset(struct ast_dsp *dsp)
 {
-	int i;
-	
 	dsp->thinkdigit = 0;
 	if (dsp->digitmode & DSP_DIGITMODE_MF) {
 		memset(dsp->td.mf.digits, 0, sizeof(dsp->td.mf.digits));
 		dsp->td.mf.current_digits = 0;
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 6;  i++) {
-			goertzel_reset(&dsp->td.mf.tone_out[i]);
-#ifdef OLD_DSP_ROUTINES
-			goertzel_reset(&dsp->td.mf.tone_out2nd[i]);
-#endif			
-		}
+		goertzel_bank_reset(&dsp->td.mf.bank);
 #ifdef OLD_DSP_ROUTINES
 		dsp->td.mf.energy = 0.0;
 		dsp->td.mf.hit1 = dsp->td.mf.hit2 = dsp->td.mf.hit3 = dsp->td.mf.hit4 = dsp->td.mf.mhit = 0;
@@ -1736,21 +1590,8 @@ void ast_dsp_digitreset(struct ast_dsp *dsp)
 		memset(dsp->td.dtmf.digits, 0, sizeof(dsp->td.dtmf.digits));
 		dsp->td.dtmf.current_digits = 0;
 		/* Reinitialise the detector for the next block */
-		for (i = 0;  i < 4;  i++) {
-			goertzel_reset(&dsp->td.dtmf.row_out[i]);
-			goertzel_reset(&dsp->td.dtmf.col_out[i]);
-#ifdef OLD_DSP_ROUTINES
-			goertzel_reset(&dsp->td.dtmf.row_out2nd[i]);
-			goertzel_reset(&dsp->td.dtmf.col_out2nd[i]);
-#endif			
-		}
-#ifdef FAX_DETECT
-		goertzel_reset (&dsp->td.dtmf.fax_tone);
-#endif
+		goertzel_bank_reset(&dsp->td.dtmf.bank);
 #ifdef OLD_DSP_ROUTINES
-#ifdef FAX_DETECT
-		goertzel_reset (&dsp->td.dtmf.fax_tone2nd);
-#endif
 		dsp->td.dtmf.hit1 = dsp->td.dtmf.hit2 = dsp->td.dtmf.hit3 = dsp->td.dtmf.hit4 = dsp->td.dtmf.mhit = 0;
 #else
 		dsp->td.dtmf.lasthit = dsp->td.dtmf.mhit = 0;
@@ -54,28 +54,84 @@ static AST_LIST_HEAD_STATIC(headerlist, ast_frame);
 #if !defined(LOW_MEMORY)
 static void frame_cache_cleanup(void *data);
 
-/*! \brief A per-thread cache of frame headers */
+/*! \brief A per-thread cache of frame blocks */
 AST_THREADSTORAGE_CUSTOM(frame_cache, frame_cache_init, frame_cache_cleanup);
 
-/*! 
- * \brief Maximum ast_frame cache size
+/*!
+ * \brief Frame block size classes
+ *
+ * Frames come in a few sizes: a bare header (ast_frame_header_new()), and a
+ * header with headroom, data and a source name in one block (ast_frdup()),
+ * where the data is nearly always 20ms of 8kHz ulaw (160 bytes), 8kHz
+ * slinear (320) or 16kHz slinear (640).  Blocks of these sizes are kept for
+ * reuse; anything else is simply malloc'd and freed.
+ */
+#define FRAME_SLAB_SRC_LEN	32
+#define FRAME_SLAB_LEN(datalen)	(sizeof(struct ast_frame) + AST_FRIENDLY_OFFSET + (datalen) + FRAME_SLAB_SRC_LEN)
+#define FRAME_SLAB_CLASSES	4
+
+static const size_t frame_slab_len[FRAME_SLAB_CLASSES] = {
+	sizeof(struct ast_frame),
+	FRAME_SLAB_LEN(160),
+	FRAME_SLAB_LEN(320),
+	FRAME_SLAB_LEN(640),
+};
+
+/*!
+ * \brief Number of blocks in a magazine
  *
- * In most cases where the frame header cache will be useful, the size
- * of the cache will stay very small.  However, it is not always the case that
- * the same thread that allocates the frame will be the one freeing them, so
- * sometimes a thread will never have any frames in its cache, or the cache
- * will never be pulled from.  For the latter case, we limit the maximum size. 
- */ 
-#define FRAME_CACHE_MAX_SIZE	10
-
-/*! \brief This is just so ast_frames, a list head struct for holding a list of
- *  ast_frame structures, is defined. */
-AST_LIST_HEAD_NOLOCK(ast_frames, ast_frame);
+ * Each thread keeps two magazines of free blocks per size class, and only
+ * goes to the shared depot when both are empty (allocating) or full
+ * (freeing), to swap a whole magazine.  That is also how blocks get back
+ * to the thread that allocated them when another thread frees them: the
+ * freeing thread's full magazine goes to the depot, and the allocating
+ * thread takes it from there when it runs dry.
+ */
+#define FRAME_MAGAZINE_SIZE	32
+
+/*! \brief Maximum number of full magazines in the depot, per size class */
+#define FRAME_DEPOT_MAX		64
+
+struct frame_magazine {
+	AST_LIST_ENTRY(frame_magazine) list;
+	int rounds;
+	void *round[FRAME_MAGAZINE_SIZE];
+};
+
+AST_LIST_HEAD_NOLOCK(frame_magazines, frame_magazine);
+
+struct frame_depot {
+	ast_mutex_t lock;
+	struct frame_magazines full;
+	struct frame_magazines empty;
+	int nfull;
+	int nempty;
+};
+
+static struct frame_depot frame_depots[FRAME_SLAB_CLASSES];
+
+/*! \brief Per size class counters, see "core show framecache" */
+struct frame_slab_stats {
+	unsigned long hits;		/*!< allocations served from a magazine */
+	unsigned long misses;		/*!< allocations that had to malloc */
+	unsigned long frees;		/*!< blocks put back in a magazine */
+	unsigned long drops;		/*!< blocks freed because the depot was full */
+	unsigned long depot_gets;	/*!< full magazines taken from the depot */
+	unsigned long depot_puts;	/*!< full magazines given to the depot */
+};
 
 struct ast_frame_cache {
-	struct ast_frames list;
-	size_t size;
+	AST_LIST_ENTRY(ast_frame_cache) list;
+	int registered;
+	struct frame_magazine *loaded[FRAME_SLAB_CLASSES];
+	struct frame_magazine *previous[FRAME_SLAB_CLASSES];
+	int cached[FRAME_SLAB_CLASSES];			/*!< blocks in our magazines */
+	struct frame_slab_stats stats[FRAME_SLAB_CLASSES];
 };
+
+/*! \brief All thread caches, plus the counters of threads that are gone */
+static AST_LIST_HEAD_STATIC(frame_caches, ast_frame_cache);
+static struct frame_slab_stats frame_slab_retired[FRAME_SLAB_CLASSES];
 #endif
 
 #define SMOOTHER_SIZE 8000
@@ -270,6 +326,153 @@ void ast_smoother_free(struct ast_smoother *s)
 	free(s);
 }
 
+#if !defined(LOW_MEMORY)
+static int frame_slab_class(size_t len)
+{
+	int i;
+
+	for (i = 0; i < FRAME_SLAB_CLASSES; i++) {
+		if (frame_slab_len[i] >= len)
+			return i;
+	}
+	return -1;
+}
+
+static struct ast_frame_cache *frame_cache_get(void)
+{
+	struct ast_frame_cache *frames;
+
+	if (!(frames = ast_threadstorage_get(&frame_cache, sizeof(*frames))))
+		return NULL;
+	if (!frames->registered) {
+		AST_LIST_LOCK(&frame_caches);
+		AST_LIST_INSERT_TAIL(&frame_caches, frames, list);
+		AST_LIST_UNLOCK(&frame_caches);
+		frames->registered = 1;
+	}
+	return frames;
+}
+
+/*! \brief Make sure this thread has both its magazines for class \a class */
+static int frame_magazines_get(struct ast_frame_cache *frames, int class)
+{
+	if (!frames->loaded[class] && !(frames->loaded[class] = ast_calloc(1, sizeof(struct frame_magazine))))
+		return -1;
+	if (!frames->previous[class] && !(frames->previous[class] = ast_calloc(1, sizeof(struct frame_magazine))))
+		return -1;
+	return 0;
+}
+
+/*! \brief Give a full magazine to the depot, and get an empty one back
+ * \note If the depot is full already, the blocks in it are freed instead
+ */
+static struct frame_magazine *frame_depot_exchange_full(struct ast_frame_cache *frames, int class, struct frame_magazine *mag)
+{
+	struct frame_depot *depot = &frame_depots[class];
+	struct frame_magazine *empty = NULL;
+
+	ast_mutex_lock(&depot->lock);
+	if (depot->nfull < FRAME_DEPOT_MAX) {
+		AST_LIST_INSERT_HEAD(&depot->full, mag, list);
+		depot->nfull++;
+		if ((empty = AST_LIST_REMOVE_HEAD(&depot->empty, list)))
+			depot->nempty--;
+		mag = NULL;
+		frames->stats[class].depot_puts++;
+	}
+	frames->cached[class] -= FRAME_MAGAZINE_SIZE;
+	ast_mutex_unlock(&depot->lock);
+
+	if (mag) {
+		/* Nobody is taking blocks out of the depot, don't hoard them */
+		frames->stats[class].drops += mag->rounds;
+		while (mag->rounds)
+			free(mag->round[--mag->rounds]);
+		return mag;
+	}
+	return empty ? empty : ast_calloc(1, sizeof(struct frame_magazine));
+}
+
+/*! \brief Give an empty magazine to the depot, and get a full one back, if it has one */
+static struct frame_magazine *frame_depot_exchange_empty(struct ast_frame_cache *frames, int class, struct frame_magazine *mag)
+{
+	struct frame_depot *depot = &frame_depots[class];
+	struct frame_magazine *full;
+
+	ast_mutex_lock(&depot->lock);
+	if ((full = AST_LIST_REMOVE_HEAD(&depot->full, list))) {
+		depot->nfull--;
+		AST_LIST_INSERT_HEAD(&depot->empty, mag, list);
+		depot->nempty++;
+		frames->stats[class].depot_gets++;
+		frames->cached[class] += full->rounds;
+	}
+	ast_mutex_unlock(&depot->lock);
+
+	return full;
+}
+
+/*! \brief Take a block of class \a class from this thread's magazines
+ * \return the block, or NULL if there was none to be had (not even from the depot)
+ */
+static void *frame_slab_alloc(struct ast_frame_cache *frames, int class)
+{
+	struct frame_magazine *mag, *full;
+
+	if (frame_magazines_get(frames, class)) {
+		frames->stats[class].misses++;
+		return NULL;
+	}
+	if ((mag = frames->loaded[class])->rounds)
+		goto hit;
+	if ((mag = frames->previous[class])->rounds) {
+		frames->previous[class] = frames->loaded[class];
+		frames->loaded[class] = mag;
+		goto hit;
+	}
+	/* Both are empty, try and swap one for a full one */
+	if ((full = frame_depot_exchange_empty(frames, class, mag))) {
+		frames->previous[class] = frames->loaded[class];
+		frames->loaded[class] = mag = full;
+		goto hit;
+	}
+	frames->stats[class].misses++;
+	return NULL;
+
+hit:
+	frames->stats[class].hits++;
+	frames->cached[class]--;
+	return mag->round[--mag->rounds];
+}
+
+/*! \brief Put a block of class \a class into this thread's magazines
+ * \return 0 if it was taken, -1 if the caller should free() it
+ */
+static int frame_slab_free(struct ast_frame_cache *frames, int class, void *block)
+{
+	struct frame_magazine *mag;
+
+	if (frame_magazines_get(frames, class))
+		return -1;
+
+	if ((mag = frames->loaded[class])->rounds == FRAME_MAGAZINE_SIZE) {
+		if ((mag = frames->previous[class])->rounds == FRAME_MAGAZINE_SIZE) {
+			/* Both are full, hand one to the depot */
+			if (!(mag = frame_depot_exchange_full(frames, class, mag))) {
+				frames->previous[class] = NULL;
+				return -1;
+			}
+		}
+		frames->previous[class] = frames->loaded[class];
+		frames->loaded[class] = mag;
+	}
+	mag->round[mag->rounds++] = block;
+	frames->stats[class].frees++;
+	frames->cached[class]++;
+	return 0;
+}
+#endif
+
 static struct ast_frame *ast_frame_header_new(void)
 {
 	struct ast_frame *f;
@@ -277,15 +480,11 @@ static struct ast_frame *ast_frame_header_new(void)
 #if !defined(LOW_MEMORY)
 	struct ast_frame_cache *frames;
 
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
-		if ((f = AST_LIST_REMOVE_HEAD(&frames->list, frame_list))) {
-			size_t mallocd_len = f->mallocd_hdr_len;
-			memset(f, 0, sizeof(*f));
-			f->mallocd_hdr_len = mallocd_len;
-			f->mallocd = AST_MALLOCD_HDR;
-			frames->size--;
-			return f;
-		}
+	if ((frames = frame_cache_get()) && (f = frame_slab_alloc(frames, 0))) {
+		memset(f, 0, sizeof(*f));
+		f->mallocd_hdr_len = frame_slab_len[0];
+		f->mallocd = AST_MALLOCD_HDR;
+		return f;
 	}
 	if (!(f = ast_calloc_cache(1, sizeof(*f))))
 		return NULL;
@@ -309,15 +508,89 @@ static struct ast_frame *ast_frame_header_new(void)
 static void frame_cache_cleanup(void *data)
 {
 	struct ast_frame_cache *frames = data;
-	struct ast_frame *f;
+	struct frame_magazine *mags[2];
+	int class, i;
+
+	if (frames->registered) {
+		AST_LIST_LOCK(&frame_caches);
+		AST_LIST_REMOVE(&frame_caches, frames, list);
+		for (class = 0; class < FRAME_SLAB_CLASSES; class++) {
+			frame_slab_retired[class].hits += frames->stats[class].hits;
+			frame_slab_retired[class].misses += frames->stats[class].misses;
+			frame_slab_retired[class].frees += frames->stats[class].frees;
+			frame_slab_retired[class].drops += frames->stats[class].drops;
+			frame_slab_retired[class].depot_gets += frames->stats[class].depot_gets;
+			frame_slab_retired[class].depot_puts += frames->stats[class].depot_puts;
+		}
+		AST_LIST_UNLOCK(&frame_caches);
+	}
 
-	while ((f = AST_LIST_REMOVE_HEAD(&frames->list, frame_list)))
-		free(f);
+	for (class = 0; class < FRAME_SLAB_CLASSES; class++) {
+		mags[0] = frames->loaded[class];
+		mags[1] = frames->previous[class];
+		for (i = 0; i < 2; i++) {
+			if (!mags[i])
+				continue;
+			/* Full magazines are still good to the other threads */
+			if (mags[i]->rounds == FRAME_MAGAZINE_SIZE) {
+				ast_mutex_lock(&frame_depots[class].lock);
+				if (frame_depots[class].nfull < FRAME_DEPOT_MAX) {
+					AST_LIST_INSERT_HEAD(&frame_depots[class].full, mags[i], list);
+					frame_depots[class].nfull++;
+					mags[i] = NULL;
+				}
+				ast_mutex_unlock(&frame_depots[class].lock);
+				if (!mags[i])
+					continue;
+			}
+			while (mags[i]->rounds)
+				free(mags[i]->round[--mags[i]->rounds]);
+			free(mags[i]);
+		}
+	}
 	
 	free(frames);
 }
 #endif
 
+/*! \brief The header of a reference counted frame payload, see ast_frshare()
+ *
+ * The data follows it directly.  Frames pointing at a shared payload have
+ * no headroom (offset 0), so that channel drivers which build their packet
+ * headers in front of the data (RTP, for one) make their own copy instead of
+ * scribbling over memory another frame is looking at.
+ */
+struct frame_payload {
+	int refs;
+	int len;
+};
+
+static struct frame_payload *frame_payload_get(const void *data)
+{
+	return (struct frame_payload *) data - 1;
+}
+
+/*! \brief Make a new payload holding a copy of len bytes of data, with one reference */
+static void *frame_payload_new(const void *data, int len)
+{
+	struct frame_payload *p;
+
+	if (!(p = ast_malloc(sizeof(*p) + len)))
+		return NULL;
+	p->refs = 1;
+	p->len = len;
+	memcpy(p + 1, data, len);
+	return p + 1;
+}
+
+static void frame_payload_unref(void *data)
+{
+	struct frame_payload *p = frame_payload_get(data);
+
+	if (ast_atomic_dec_and_test(&p->refs))
+		free(p);
+}
+
 void ast_frame_free(struct ast_frame *fr, int cache)
 {
 	if (ast_test_flag(fr, AST_FRFLAG_FROM_TRANSLATOR))
@@ -328,18 +601,23 @@ void ast_frame_free(struct ast_frame *fr, int cache)
 	if (!fr->mallocd)
 		return;
 
+	if (fr->mallocd & AST_MALLOCD_SHARED) {
+		/* Drop our reference; what is left is just a header */
+		frame_payload_unref(fr->data);
+		fr->data = NULL;
+		fr->mallocd &= ~AST_MALLOCD_SHARED;
+	}
+
 #if !defined(LOW_MEMORY)
 	if (cache && fr->mallocd == AST_MALLOCD_HDR) {
-		/* Cool, only the header is malloc'd, let's just cache those for now 
-		 * to keep things simple... */
+		/* Cool, only the header (block) is malloc'd, keep it if it is one
+		 * of the sizes we hand out */
 		struct ast_frame_cache *frames;
+		int class = frame_slab_class(fr->mallocd_hdr_len);
 
-		if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames))) 
-		    && frames->size < FRAME_CACHE_MAX_SIZE) {
-			AST_LIST_INSERT_HEAD(&frames->list, fr, frame_list);
-			frames->size++;
+		if (class > -1 && frame_slab_len[class] == fr->mallocd_hdr_len
+		    && (frames = frame_cache_get()) && !frame_slab_free(frames, class, fr))
 			return;
-		}
 	}
 #endif
 	
@@ -406,6 +684,14 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 	} else
 		out->src = fr->src;
 	
+	if (fr->mallocd & AST_MALLOCD_SHARED) {
+		/* A shared payload is as good as malloc'd; the new header needs its own reference */
+		if (out != fr)
+			ast_atomic_fetchadd_int(&frame_payload_get(fr->data)->refs, 1);
+		out->mallocd = AST_MALLOCD_HDR | AST_MALLOCD_SRC | AST_MALLOCD_SHARED;
+		return out;
+	}
+
 	if (!(fr->mallocd & AST_MALLOCD_DATA))  {
 		if (!(newdata = ast_malloc(fr->datalen + AST_FRIENDLY_OFFSET))) {
 			if (out->src != fr->src)
@@ -434,6 +720,7 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 
 #if !defined(LOW_MEMORY)
 	struct ast_frame_cache *frames;
+	int class;
 #endif
 
 	/* Start with standard stuff */
@@ -449,19 +736,16 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 		len += srclen + 1;
 	
 #if !defined(LOW_MEMORY)
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
-		AST_LIST_TRAVERSE_SAFE_BEGIN(&frames->list, out, frame_list) {
-			if (out->mallocd_hdr_len >= len) {
-				size_t mallocd_len = out->mallocd_hdr_len;
-				AST_LIST_REMOVE_CURRENT(&frames->list, frame_list);
-				memset(out, 0, sizeof(*out));
-				out->mallocd_hdr_len = mallocd_len;
-				buf = out;
-				frames->size--;
-				break;
-			}
-		}
-		AST_LIST_TRAVERSE_SAFE_END
+	if ((class = frame_slab_class(len)) > -1) {
+		/* Always hand out whole blocks of the class, so they can be reused */
+		if ((frames = frame_cache_get()) && (out = frame_slab_alloc(frames, class))) {
+			memset(out, 0, sizeof(*out));
+			buf = out;
+		} else if ((buf = ast_calloc_cache(1, frame_slab_len[class])))
+			out = buf;
+		else
+			return NULL;
+		out->mallocd_hdr_len = frame_slab_len[class];
 	}
 #endif
 
@@ -497,6 +781,60 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	return out;
 }
 
+struct ast_frame *ast_frshare(const struct ast_frame *f)
+{
+	struct ast_frame *out;
+	void *data;
+
+	if (f->mallocd & AST_MALLOCD_SHARED) {
+		data = f->data;
+		ast_atomic_fetchadd_int(&frame_payload_get(data)->refs, 1);
+	} else if (f->datalen && f->data) {
+		if (!(data = frame_payload_new(f->data, f->datalen)))
+			return NULL;
+	} else {
+		/* Nothing to share */
+		return ast_frdup(f);
+	}
+
+	if (!(out = ast_frame_header_new())) {
+		frame_payload_unref(data);
+		return NULL;
+	}
+	out->frametype = f->frametype;
+	out->subclass = f->subclass;
+	out->datalen = f->datalen;
+	out->samples = f->samples;
+	out->delivery = f->delivery;
+	out->offset = 0;
+	out->data = data;
+	out->mallocd = AST_MALLOCD_HDR | AST_MALLOCD_SHARED;
+	ast_copy_flags(out, f, AST_FRFLAG_HAS_TIMING_INFO);
+	out->ts = f->ts;
+	out->len = f->len;
+	out->seqno = f->seqno;
+	return out;
+}
+
+int ast_frame_make_writable(struct ast_frame *fr)
+{
+	struct frame_payload *p;
+	void *data;
+
+	if (!(fr->mallocd & AST_MALLOCD_SHARED))
+		return 0;
+	p = frame_payload_get(fr->data);
+	/* Nobody else can take a reference through us while we look, so if we
+	   hold the only one it stays that way */
+	if (p->refs == 1)
+		return 0;
+	if (!(data = frame_payload_new(fr->data, fr->datalen)))
+		return -1;
+	frame_payload_unref(fr->data);
+	fr->data = data;
+	return 0;
+}
+
 void ast_swapcopy_samples(void *dst, const void *src, int samples)
 {
 	int i;
@@ -954,6 +1292,65 @@ static char frame_stats_usage[] =
 "       Displays debugging statistics from framer\n";
 #endif
 
+#if !defined(LOW_MEMORY)
+static int show_frame_cache(int fd, int argc, char *argv[])
+{
+	struct ast_frame_cache *frames;
+	struct frame_slab_stats total;
+	int class, cached, threads = 0;
+	size_t resident = 0;
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+
+	ast_cli(fd, "%-6s %6s %12s %10s %12s %8s %16s %8s\n",
+		"Class", "Block", "Hits", "Misses", "Frees", "Dropped", "Depot get/put", "Cached");
+	AST_LIST_LOCK(&frame_caches);
+	for (class = 0; class < FRAME_SLAB_CLASSES; class++) {
+		char data[16], depot[32];
+
+		total = frame_slab_retired[class];
+		cached = 0;
+		threads = 0;
+		AST_LIST_TRAVERSE(&frame_caches, frames, list) {
+			total.hits += frames->stats[class].hits;
+			total.misses += frames->stats[class].misses;
+			total.frees += frames->stats[class].frees;
+			total.drops += frames->stats[class].drops;
+			total.depot_gets += frames->stats[class].depot_gets;
+			total.depot_puts += frames->stats[class].depot_puts;
+			cached += frames->cached[class];
+			threads++;
+		}
+		ast_mutex_lock(&frame_depots[class].lock);
+		cached += frame_depots[class].nfull * FRAME_MAGAZINE_SIZE;
+		ast_mutex_unlock(&frame_depots[class].lock);
+		resident += cached * frame_slab_len[class];
+
+		if (class)
+			snprintf(data, sizeof(data), "%d", (int) (frame_slab_len[class] - frame_slab_len[0] - AST_FRIENDLY_OFFSET - FRAME_SLAB_SRC_LEN));
+		else
+			ast_copy_string(data, "hdr", sizeof(data));
+		snprintf(depot, sizeof(depot), "%lu/%lu", total.depot_gets, total.depot_puts);
+		ast_cli(fd, "%-6s %6d %12lu %10lu %12lu %8lu %16s %8d\n", data, (int) frame_slab_len[class],
+			total.hits, total.misses, total.frees, total.drops, depot, cached);
+	}
+	AST_LIST_UNLOCK(&frame_caches);
+	ast_cli(fd, "%d thread caches, %d blocks per magazine, %lu bytes resident\n",
+		threads, FRAME_MAGAZINE_SIZE, (unsigned long) resident);
+
+	return RESULT_SUCCESS;
+}
+
+static char frame_cache_usage[] =
+"Usage: core show framecache\n"
+"       Shows how well the frame block cache is doing.  Class is the size\n"
+"       of the data the blocks have room for (hdr for bare frame headers).\n"
+"       Blocks freed by another thread than the one that allocated them get\n"
+"       back to it through the depot, a full magazine at a time; Dropped are\n"
+"       blocks freed for good because the depot was full.\n";
+#endif
+
 /* Builtin Asterisk CLI-commands for debugging */
 static struct ast_cli_entry cli_show_codecs = {
 	{ "show", "codecs", NULL },
@@ -1008,6 +1405,12 @@ static struct ast_cli_entry my_clis[] = {
 	show_codec_n, "Shows a specific codec",
 	frame_show_codec_n_usage, NULL, &cli_show_codec },
 
+#if !defined(LOW_MEMORY)
+	{ { "core", "show", "framecache", NULL },
+	show_frame_cache, "Shows frame cache statistics",
+	frame_cache_usage },
+#endif
+
 #ifdef TRACE_FRAMES
 	{ { "core", "show", "frame", "stats", NULL },
 	show_frame_stats, "Shows frame statistics",
@@ -1017,6 +1420,12 @@ static struct ast_cli_entry my_clis[] = {
 
 int init_framer(void)
 {
+#if !defined(LOW_MEMORY)
+	int class;
+
+	for (class = 0; class < FRAME_SLAB_CLASSES; class++)
+		ast_mutex_init(&frame_depots[class].lock);
+#endif
 	ast_cli_register_multiple(my_clis, sizeof(my_clis) / sizeof(struct ast_cli_entry));
 	return 0;	
 }
@@ -1557,7 +1966,7 @@ int ast_codec_get_len(int format, int samples)
 int ast_frame_adjust_volume(struct ast_frame *f, int adjustment)
 {
 	int count;
-	short *fdata = f->data;
+	short *fdata;
 	short adjust_value = abs(adjustment);
 
 	if ((f->frametype != AST_FRAME_VOICE) || (f->subclass != AST_FORMAT_SLINEAR))
@@ -1566,6 +1975,10 @@ int ast_frame_adjust_volume(struct ast_frame *f, int adjustment)
 	if (!adjustment)
 		return 0;
 
+	if (ast_frame_make_writable(f))
+		return -1;
+	fdata = f->data;
+
 	for (count = 0; count < f->samples; count++) {
 		if (adjustment > 0) {
 			ast_slinear_saturated_multiply(&fdata[count], &adjust_value);
@@ -1591,6 +2004,9 @@ int ast_frame_slinear_sum(struct ast_frame *f1, struct ast_frame *f2)
 	if (f1->samples != f2->samples)
 		return -1;
 
+	if (ast_frame_make_writable(f1))
+		return -1;
+
 	for (count = 0, data1 = f1->data, data2 = f2->data;
 	     count < f1->samples;
 	     count++, data1++, data2++)
@@ -134,6 +134,62 @@ static int colors[] = {
 	COLOR_BRGREEN
 };
 
+#define NUMLOGLEVELS (sizeof(levels) / sizeof(levels[0]))
+
+/*!
+ * \brief Messages for the file channels and the event log are not written by
+ * the thread calling ast_log(), which is often a voice thread, but put in this
+ * ring and written out in batches by logger_thread() every flushinterval
+ * milliseconds, or sooner when the ring starts filling up.  Producers claim
+ * slots without taking a lock; logger_thread() is the only consumer.
+ */
+#define LOG_RING_SIZE		1024			/*!< slots, must be a power of 2 */
+#define LOG_RING_WAKE		(LOG_RING_SIZE / 4)	/*!< wake the writer early at this depth */
+#define LOG_RING_DEBUG_MAX	(LOG_RING_SIZE * 3 / 4)	/*!< drop DEBUG messages above this depth */
+#define LOG_MSG_INLINE		256			/*!< longer messages are malloc'd */
+
+struct logmsg {
+	volatile unsigned int seq;	/*!< position + 1 when full, position + LOG_RING_SIZE when free again */
+	int level;
+	struct timeval queued;
+	char *str;			/*!< buf, or malloc'd if it did not fit */
+	char buf[LOG_MSG_INLINE];
+};
+
+static struct logmsg logring[LOG_RING_SIZE];
+static volatile unsigned int logring_tail;	/*!< next position a producer claims */
+static volatile unsigned int logring_head;	/*!< next position the writer takes */
+
+#if defined(HAVE_GCC_ATOMICS)
+#define logring_barrier() __sync_synchronize()
+#else
+AST_MUTEX_DEFINE_STATIC(logring_lock);
+#define logring_barrier() do { ast_mutex_lock(&logring_lock); ast_mutex_unlock(&logring_lock); } while (0)
+#endif
+
+static int flushinterval = 100;			/*!< ms, 0 writes synchronously */
+static int file_logmask;			/*!< levels that go to a file channel or the event log */
+static pthread_t logthread = AST_PTHREADT_NULL;
+static int logthread_stop;
+static ast_cond_t logcond;
+AST_MUTEX_DEFINE_STATIC(logcond_lock);
+
+/*! \brief Held while writing to, flushing or reopening the file channels and
+ * the event log, and while changing the list of channels.  When logchannels
+ * is needed as well, this is taken first. */
+AST_MUTEX_DEFINE_STATIC(logwriter_lock);
+
+static struct {
+	volatile int queued;
+	volatile int dropped[NUMLOGLEVELS];
+	unsigned int written;
+	unsigned int batches;
+	unsigned int maxdepth;
+	long long latency_last;			/*!< us from the oldest message of a batch being queued to it being flushed */
+	long long latency_max;
+	long long latency_total;
+} logstats;
+
 AST_THREADSTORAGE(verbose_buf, verbose_buf_init);
 #define VERBOSE_BUF_INIT_SIZE   128
 
@@ -295,6 +351,8 @@ static void init_logger_chain(void)
 	AST_LIST_UNLOCK(&logchannels);
 	
 	global_logmask = 0;
+	file_logmask = 0;
+	flushinterval = 100;
 	errno = 0;
 	/* close syslog */
 	closelog();
@@ -336,6 +394,14 @@ static void init_logger_chain(void)
 		logfiles.queue_log = ast_true(s);
 	if ((s = ast_variable_retrieve(cfg, "general", "event_log")))
 		logfiles.event_log = ast_true(s);
+	if ((s = ast_variable_retrieve(cfg, "general", "flushinterval"))) {
+		if (sscanf(s, "%d", &flushinterval) != 1 || flushinterval < 0) {
+			fprintf(stderr, "Logger Warning: invalid flushinterval '%s' in logger.conf, using 100\n", s);
+			flushinterval = 100;
+		}
+	}
+	if (logfiles.event_log)
+		file_logmask |= (1 << __LOG_EVENT);
 
 	AST_LIST_LOCK(&logchannels);
 	var = ast_variable_browse(cfg, "logfiles");
@@ -344,6 +410,8 @@ static void init_logger_chain(void)
 			continue;
 		AST_LIST_INSERT_HEAD(&logchannels, chan, list);
 		global_logmask |= chan->logmask;
+		if (chan->type == LOGTYPE_FILE)
+			file_logmask |= chan->logmask;
 	}
 	AST_LIST_UNLOCK(&logchannels);
 
@@ -365,6 +433,166 @@ void ast_queue_log(const char *queuename, const char *callid, const char *agent,
 	AST_LIST_UNLOCK(&logchannels);
 }
 
+/*! \brief Write a formatted line to the event log, or to the file channels that
+ * take its level.  Called with logwriter_lock held. */
+static void logger_write(int level, const char *str, int flush)
+{
+	struct logchannel *chan;
+
+	if (logfiles.event_log && level == __LOG_EVENT) {
+		if (eventlog) {
+			fputs(str, eventlog);
+			if (flush)
+				fflush(eventlog);
+		}
+		return;
+	}
+
+	AST_LIST_TRAVERSE(&logchannels, chan, list) {
+		if (chan->disabled || (chan->type != LOGTYPE_FILE) || !chan->fileptr || !(chan->logmask & (1 << level)))
+			continue;
+		if (fputs(str, chan->fileptr) == EOF) {
+			fprintf(stderr,"**** Asterisk Logging Error: ***********\n");
+			if (errno == ENOMEM || errno == ENOSPC) {
+				fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
+			} else
+				fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
+			manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
+			chan->disabled = 1;
+		} else if (flush)
+			fflush(chan->fileptr);
+	}
+}
+
+/*! \brief Hand a formatted line to the writer thread.  This never blocks: above
+ * LOG_RING_DEBUG_MAX queued messages DEBUG is dropped, and when the ring is
+ * full everything is, with the drops counted per level. */
+static void logger_queue(int level, const char *str)
+{
+	struct logmsg *msg;
+	unsigned int pos;
+	size_t len;
+
+	if ((level == __LOG_DEBUG) && (logring_tail - logring_head >= LOG_RING_DEBUG_MAX)) {
+		ast_atomic_fetchadd_int(&logstats.dropped[level], 1);
+		return;
+	}
+
+#if defined(HAVE_GCC_ATOMICS)
+	for (;;) {
+		unsigned int seq;
+
+		pos = logring_tail;
+		seq = logring[pos & (LOG_RING_SIZE - 1)].seq;
+		if (seq == pos) {
+			if (__sync_bool_compare_and_swap(&logring_tail, pos, pos + 1))
+				break;
+		} else if ((int) (seq - pos) < 0) {
+			/* still holds the message from one lap ago */
+			ast_atomic_fetchadd_int(&logstats.dropped[level], 1);
+			return;
+		}
+	}
+#else
+	ast_mutex_lock(&logring_lock);
+	pos = logring_tail;
+	if (logring[pos & (LOG_RING_SIZE - 1)].seq != pos) {
+		ast_mutex_unlock(&logring_lock);
+		ast_atomic_fetchadd_int(&logstats.dropped[level], 1);
+		return;
+	}
+	logring_tail = pos + 1;
+	ast_mutex_unlock(&logring_lock);
+#endif
+
+	msg = &logring[pos & (LOG_RING_SIZE - 1)];
+	msg->level = level;
+	msg->queued = ast_tvnow();
+	len = strlen(str) + 1;
+	if ((len <= sizeof(msg->buf)) || !(msg->str = malloc(len))) {
+		ast_copy_string(msg->buf, str, sizeof(msg->buf));
+		msg->str = msg->buf;
+	} else
+		memcpy(msg->str, str, len);
+	logring_barrier();
+	msg->seq = pos + 1;
+	ast_atomic_fetchadd_int(&logstats.queued, 1);
+
+	if (pos + 1 - logring_head >= LOG_RING_WAKE)
+		ast_cond_signal(&logcond);
+}
+
+/*! \brief Write out everything that is queued, flushing each file once */
+static void logger_drain(void)
+{
+	struct logmsg *msg;
+	struct logchannel *chan;
+	struct timeval oldest = { 0, }, tv;
+	unsigned int depth, n = 0;
+	long long latency;
+
+	ast_mutex_lock(&logwriter_lock);
+	depth = logring_tail - logring_head;
+	for (;;) {
+		msg = &logring[logring_head & (LOG_RING_SIZE - 1)];
+		if (msg->seq != logring_head + 1)
+			break;
+		logring_barrier();
+		if (!n++)
+			oldest = msg->queued;
+		logger_write(msg->level, msg->str, 0);
+		if (msg->str != msg->buf)
+			free(msg->str);
+		logring_barrier();
+		msg->seq = logring_head + LOG_RING_SIZE;
+		logring_head++;
+	}
+	if (n) {
+		if (eventlog)
+			fflush(eventlog);
+		AST_LIST_TRAVERSE(&logchannels, chan, list) {
+			if ((chan->type == LOGTYPE_FILE) && chan->fileptr)
+				fflush(chan->fileptr);
+		}
+		tv = ast_tvsub(ast_tvnow(), oldest);
+		latency = (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+		logstats.written += n;
+		logstats.batches++;
+		logstats.latency_last = latency;
+		logstats.latency_total += latency;
+		if (latency > logstats.latency_max)
+			logstats.latency_max = latency;
+		if (depth > logstats.maxdepth)
+			logstats.maxdepth = depth;
+	}
+	ast_mutex_unlock(&logwriter_lock);
+}
+
+static void *logger_thread(void *data)
+{
+	struct timeval tv;
+	struct timespec ts;
+	int stop;
+
+	for (;;) {
+		ast_mutex_lock(&logcond_lock);
+		if (!logthread_stop && (logring_tail - logring_head < LOG_RING_WAKE)) {
+			/* when writing synchronously, only leftovers from before a reload can turn up */
+			tv = ast_tvadd(ast_tvnow(), ast_samp2tv(flushinterval ? flushinterval : 1000, 1000));
+			ts.tv_sec = tv.tv_sec;
+			ts.tv_nsec = tv.tv_usec * 1000;
+			ast_cond_timedwait(&logcond, &logcond_lock, &ts);
+		}
+		stop = logthread_stop;
+		ast_mutex_unlock(&logcond_lock);
+		logger_drain();
+		if (stop)
+			break;
+	}
+
+	return NULL;
+}
+
 int reload_logger(int rotate)
 {
 	char old[PATH_MAX] = "";
@@ -374,6 +602,7 @@ int reload_logger(int rotate)
 	FILE *myf;
 	int x, res = 0;
 
+	ast_mutex_lock(&logwriter_lock);
 	AST_LIST_LOCK(&logchannels);
 
 	if (eventlog) 
@@ -479,6 +708,7 @@ int reload_logger(int rotate)
 	}
 
 	AST_LIST_UNLOCK(&logchannels);
+	ast_mutex_unlock(&logwriter_lock);
 
 	return res;
 }
@@ -546,6 +776,38 @@ static int handle_logger_show_channels(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+/*! \brief CLI command to show how the log writer is keeping up */
+static int handle_logger_show_stats(int fd, int argc, char *argv[])
+{
+	unsigned int x, dropped = 0;
+
+	ast_mutex_lock(&logwriter_lock);
+	if (logthread == AST_PTHREADT_NULL)
+		ast_cli(fd, "Writer:          not running, writing synchronously\n");
+	else if (!flushinterval)
+		ast_cli(fd, "Writer:          flushinterval is 0, writing synchronously\n");
+	else
+		ast_cli(fd, "Writer:          asynchronous, flushing every %d ms\n", flushinterval);
+	ast_cli(fd, "Queue depth:     %u of %d (max %u)\n", logring_tail - logring_head, LOG_RING_SIZE, logstats.maxdepth);
+	ast_cli(fd, "Queued:          %u\n", (unsigned int) logstats.queued);
+	ast_cli(fd, "Written:         %u in %u batches\n", logstats.written, logstats.batches);
+	for (x = 0; x < NUMLOGLEVELS; x++)
+		dropped += logstats.dropped[x];
+	ast_cli(fd, "Dropped:         %u", dropped);
+	for (x = 0; x < NUMLOGLEVELS; x++) {
+		if (logstats.dropped[x])
+			ast_cli(fd, " %s %u", levels[x], (unsigned int) logstats.dropped[x]);
+	}
+	ast_cli(fd, "\n");
+	ast_cli(fd, "Writer latency:  last %.1f ms, avg %.1f ms, max %.1f ms\n",
+		logstats.latency_last / 1000.0,
+		logstats.batches ? logstats.latency_total / 1000.0 / logstats.batches : 0.0,
+		logstats.latency_max / 1000.0);
+	ast_mutex_unlock(&logwriter_lock);
+
+	return RESULT_SUCCESS;
+}
+
 struct verb {
 	void (*verboser)(const char *string);
 	AST_LIST_ENTRY(verb) list;
@@ -565,11 +827,21 @@ static char logger_show_channels_help[] =
 "Usage: logger show channels\n"
 "       List configured logger channels.\n";
 
+static char logger_show_stats_help[] =
+"Usage: logger show stats\n"
+"       Shows the depth of the log writer queue, how many messages were\n"
+"       dropped because it was full, and how long messages waited in it\n"
+"       before being written to the log files.\n";
+
 static struct ast_cli_entry cli_logger[] = {
 	{ { "logger", "show", "channels", NULL }, 
 	handle_logger_show_channels, "List configured log channels",
 	logger_show_channels_help },
 
+	{ { "logger", "show", "stats", NULL },
+	handle_logger_show_stats, "Show log writer statistics",
+	logger_show_stats_help },
+
 	{ { "logger", "reload", NULL }, 
 	handle_logger_reload, "Reopens the log files",
 	logger_reload_help },
@@ -589,7 +861,7 @@ static int handle_SIGXFSZ(int sig)
 int init_logger(void)
 {
 	char tmp[4096];
-	int res = 0;
+	int x, res = 0;
 
 	/* auto rotate if sig SIGXFSZ comes a-knockin */
 	(void) signal(SIGXFSZ,(void *) handle_SIGXFSZ);
@@ -600,7 +872,9 @@ int init_logger(void)
 	mkdir((char *)ast_config_AST_LOG_DIR, 0755);
   
 	/* create log channels */
+	ast_mutex_lock(&logwriter_lock);
 	init_logger_chain();
+	ast_mutex_unlock(&logwriter_lock);
 
 	/* create the eventlog */
 	if (logfiles.event_log) {
@@ -622,6 +896,16 @@ int init_logger(void)
 		qlog = fopen(tmp, "a");
 		ast_queue_log("NONE", "NONE", "NONE", "QUEUESTART", "%s", "");
 	}
+
+	/* start the log writer, until it runs everything is written synchronously */
+	for (x = 0; x < LOG_RING_SIZE; x++)
+		logring[x].seq = x;
+	ast_cond_init(&logcond, NULL);
+	if (ast_pthread_create(&logthread, NULL, logger_thread, NULL)) {
+		logthread = AST_PTHREADT_NULL;
+		ast_log(LOG_WARNING, "Unable to start the log writer thread, logging synchronously\n");
+	}
+
 	return res;
 }
 
@@ -629,6 +913,17 @@ void close_logger(void)
 {
 	struct logchannel *f;
 
+	/* let the writer empty the queue first */
+	if (logthread != AST_PTHREADT_NULL) {
+		ast_mutex_lock(&logcond_lock);
+		logthread_stop = 1;
+		ast_cond_signal(&logcond);
+		ast_mutex_unlock(&logcond_lock);
+		pthread_join(logthread, NULL);
+		logthread = AST_PTHREADT_NULL;
+	}
+
+	ast_mutex_lock(&logwriter_lock);
 	AST_LIST_LOCK(&logchannels);
 
 	if (eventlog) {
@@ -651,6 +946,7 @@ void close_logger(void)
 	closelog(); /* syslog */
 
 	AST_LIST_UNLOCK(&logchannels);
+	ast_mutex_unlock(&logwriter_lock);
 
 	return;
 }
@@ -739,77 +1035,41 @@ void ast_log(int level, const char *file, int line, const char *function, const
 
 	AST_LIST_LOCK(&logchannels);
 
-	if (logfiles.event_log && level == __LOG_EVENT) {
-		va_start(ap, fmt);
-
-		fprintf(eventlog, "%s asterisk[%ld]: ", date, (long)getpid());
-		vfprintf(eventlog, fmt, ap);
-		fflush(eventlog);
-
-		va_end(ap);
-		AST_LIST_UNLOCK(&logchannels);
-		return;
-	}
-
-	AST_LIST_TRAVERSE(&logchannels, chan, list) {
-		if (chan->disabled)
-			break;
-		/* Check syslog channels */
-		if (chan->type == LOGTYPE_SYSLOG && (chan->logmask & (1 << level))) {
-			va_start(ap, fmt);
-			ast_log_vsyslog(level, file, line, function, fmt, ap);
-			va_end(ap);
-		/* Console channels */
-		} else if ((chan->logmask & (1 << level)) && (chan->type == LOGTYPE_CONSOLE)) {
-			char linestr[128];
-			char tmp1[80], tmp2[80], tmp3[80], tmp4[80];
-
-			if (level != __LOG_VERBOSE) {
-				int res;
-				sprintf(linestr, "%d", line);
-				ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf,
-					"[%s] %s[%ld]: %s:%s %s: ",
-					date,
-					term_color(tmp1, levels[level], colors[level], 0, sizeof(tmp1)),
-					(long)GETTID(),
-					term_color(tmp2, file, COLOR_BRWHITE, 0, sizeof(tmp2)),
-					term_color(tmp3, linestr, COLOR_BRWHITE, 0, sizeof(tmp3)),
-					term_color(tmp4, function, COLOR_BRWHITE, 0, sizeof(tmp4)));
-				/*filter to the console!*/
-				term_filter_escapes(buf->str);
-				ast_console_puts_mutable(buf->str);
-				
+	/* events only go to the event log */
+	if (!logfiles.event_log || level != __LOG_EVENT) {
+		AST_LIST_TRAVERSE(&logchannels, chan, list) {
+			if (chan->disabled)
+				break;
+			/* Check syslog channels */
+			if (chan->type == LOGTYPE_SYSLOG && (chan->logmask & (1 << level))) {
 				va_start(ap, fmt);
-				res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
+				ast_log_vsyslog(level, file, line, function, fmt, ap);
 				va_end(ap);
-				if (res != AST_DYNSTR_BUILD_FAILED)
+			/* Console channels */
+			} else if ((chan->logmask & (1 << level)) && (chan->type == LOGTYPE_CONSOLE)) {
+				char linestr[128];
+				char tmp1[80], tmp2[80], tmp3[80], tmp4[80];
+
+				if (level != __LOG_VERBOSE) {
+					int res;
+					sprintf(linestr, "%d", line);
+					ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf,
+						"[%s] %s[%ld]: %s:%s %s: ",
+						date,
+						term_color(tmp1, levels[level], colors[level], 0, sizeof(tmp1)),
+						(long)GETTID(),
+						term_color(tmp2, file, COLOR_BRWHITE, 0, sizeof(tmp2)),
+						term_color(tmp3, linestr, COLOR_BRWHITE, 0, sizeof(tmp3)),
+						term_color(tmp4, function, COLOR_BRWHITE, 0, sizeof(tmp4)));
+					/*filter to the console!*/
+					term_filter_escapes(buf->str);
 					ast_console_puts_mutable(buf->str);
-			}
-		/* File channels */
-		} else if ((chan->logmask & (1 << level)) && (chan->fileptr)) {
-			int res;
-			ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf, 
-				"[%s] %s[%ld] %s: ",
-				date, levels[level], (long)GETTID(), file);
-			res = fprintf(chan->fileptr, "%s", buf->str);
-			if (res <= 0 && !ast_strlen_zero(buf->str)) {	/* Error, no characters printed */
-				fprintf(stderr,"**** Asterisk Logging Error: ***********\n");
-				if (errno == ENOMEM || errno == ENOSPC) {
-					fprintf(stderr, "Asterisk logging error: Out of disk space, can't log to log file %s\n", chan->filename);
-				} else
-					fprintf(stderr, "Logger Warning: Unable to write to log file '%s': %s (disabled)\n", chan->filename, strerror(errno));
-				manager_event(EVENT_FLAG_SYSTEM, "LogChannel", "Channel: %s\r\nEnabled: No\r\nReason: %d - %s\r\n", chan->filename, errno, strerror(errno));
-				chan->disabled = 1;	
-			} else {
-				int res;
-				/* No error message, continue printing */
-				va_start(ap, fmt);
-				res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
-				va_end(ap);
-				if (res != AST_DYNSTR_BUILD_FAILED) {
-					term_strip(buf->str, buf->str, buf->len);
-					fputs(buf->str, chan->fileptr);
-					fflush(chan->fileptr);
+					
+					va_start(ap, fmt);
+					res = ast_dynamic_str_thread_set_va(&buf, BUFSIZ, &log_buf, fmt, ap);
+					va_end(ap);
+					if (res != AST_DYNSTR_BUILD_FAILED)
+						ast_console_puts_mutable(buf->str);
 				}
 			}
 		}
@@ -817,6 +1077,30 @@ void ast_log(int level, const char *file, int line, const char *function, const
 
 	AST_LIST_UNLOCK(&logchannels);
 
+	/* File channels and the event log, through the log writer unless it is not running */
+	if (file_logmask & (1 << level)) {
+		int res;
+
+		if (logfiles.event_log && level == __LOG_EVENT)
+			ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf, "%s asterisk[%ld]: ", date, (long)getpid());
+		else
+			ast_dynamic_str_thread_set(&buf, BUFSIZ, &log_buf, "[%s] %s[%ld] %s: ", date, levels[level], (long)GETTID(), file);
+		va_start(ap, fmt);
+		res = ast_dynamic_str_thread_append_va(&buf, BUFSIZ, &log_buf, fmt, ap);
+		va_end(ap);
+		if (res != AST_DYNSTR_BUILD_FAILED) {
+			if (level != __LOG_EVENT)
+				term_strip(buf->str, buf->str, buf->len);
+			if (flushinterval && (logthread != AST_PTHREADT_NULL))
+				logger_queue(level, buf->str);
+			else {
+				ast_mutex_lock(&logwriter_lock);
+				logger_write(level, buf->str, 1);
+				ast_mutex_unlock(&logwriter_lock);
+			}
+		}
+	}
+
 	if (filesize_reload_needed) {
 		reload_logger(1);
 		ast_log(LOG_EVENT,"Rotated Logs Per SIGXFSZ (Exceeded file size limit)\n");
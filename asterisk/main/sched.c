@@ -50,9 +50,15 @@ ASTERISK_FILE_VERSION(__FILE__,"$Revision$")
 #include "asterisk/linkedlists.h"
 #include "asterisk/options.h"
 
+/*! Initial number of slots in the heap and buckets in the id hash */
+#define SCHED_INITIAL_SIZE 64
+
 struct sched {
-	AST_LIST_ENTRY(sched) list;
+	AST_LIST_ENTRY(sched) list;   /*!< Cache of unused entries */
+	struct sched *hnext;          /*!< Next entry in the same id hash bucket */
 	int id;                       /*!< ID number of event */
+	unsigned int slot;            /*!< Where the event is in the heap */
+	unsigned int seq;             /*!< Order scheduled, to keep events due at the same time FIFO */
 	struct timeval when;          /*!< Absolute time event should take place */
 	int resched;                  /*!< When to reschedule */
 	int variable;                 /*!< Use return value from callback to reschedule */
@@ -64,7 +70,11 @@ struct sched_context {
 	ast_mutex_t lock;
 	unsigned int eventcnt;                  /*!< Number of events processed */
 	unsigned int schedcnt;                  /*!< Number of outstanding schedule events */
-	AST_LIST_HEAD_NOLOCK(, sched) schedq;   /*!< Schedule entry and main queue */
+	unsigned int schedseq;                  /*!< Sequence for the next scheduled event */
+	struct sched **heap;                    /*!< Schedule queue, a binary min-heap on when */
+	unsigned int heapsize;                  /*!< Number of slots in heap */
+	struct sched **hash;                    /*!< Schedule entries hashed by id */
+	unsigned int hashsize;                  /*!< Number of buckets in hash, a power of 2 */
 
 #ifdef SCHED_MAX_CACHE
 	AST_LIST_HEAD_NOLOCK(, sched) schedc;   /*!< Cache of unused schedule structures and how many */
@@ -88,6 +98,7 @@ struct sched_context *sched_context_create(void)
 void sched_context_destroy(struct sched_context *con)
 {
 	struct sched *s;
+	unsigned int i;
 
 	ast_mutex_lock(&con->lock);
 
@@ -98,8 +109,12 @@ void sched_context_destroy(struct sched_context *con)
 #endif
 
 	/* And the queue */
-	while ((s = AST_LIST_REMOVE_HEAD(&con->schedq, list)))
-		free(s);
+	for (i = 0; i < con->schedcnt; i++)
+		free(con->heap[i]);
+	if (con->heap)
+		free(con->heap);
+	if (con->hash)
+		free(con->hash);
 	
 	/* And the context */
 	ast_mutex_unlock(&con->lock);
@@ -152,10 +167,10 @@ int ast_sched_wait(struct sched_context *con)
 	DEBUG(ast_log(LOG_DEBUG, "ast_sched_wait()\n"));
 
 	ast_mutex_lock(&con->lock);
-	if (AST_LIST_EMPTY(&con->schedq)) {
+	if (!con->schedcnt) {
 		ms = -1;
 	} else {
-		ms = ast_tvdiff_ms(AST_LIST_FIRST(&con->schedq)->when, ast_tvnow());
+		ms = ast_tvdiff_ms(con->heap[0]->when, ast_tvnow());
 		if (ms < 0)
 			ms = 0;
 	}
@@ -164,28 +179,151 @@ int ast_sched_wait(struct sched_context *con)
 	return ms;
 }
 
+/*! \brief Does a have to run before b? Events due at the same time run in the order scheduled. */
+static inline int sched_before(const struct sched *a, const struct sched *b)
+{
+	int res = ast_tvcmp(a->when, b->when);
+
+	if (res)
+		return res < 0;
+	return (int) (a->seq - b->seq) < 0;
+}
+
+static inline void heap_set(struct sched_context *con, unsigned int slot, struct sched *s)
+{
+	con->heap[slot] = s;
+	s->slot = slot;
+}
+
+/*! \brief Move the entry at slot up towards the root until its parent is due before it */
+static void heap_up(struct sched_context *con, unsigned int slot)
+{
+	struct sched *s = con->heap[slot];
+	unsigned int parent;
+
+	while (slot) {
+		parent = (slot - 1) / 2;
+		if (!sched_before(s, con->heap[parent]))
+			break;
+		heap_set(con, slot, con->heap[parent]);
+		slot = parent;
+	}
+	heap_set(con, slot, s);
+}
+
+/*! \brief Move the entry at slot down until both its children are due after it */
+static void heap_down(struct sched_context *con, unsigned int slot)
+{
+	struct sched *s = con->heap[slot];
+	unsigned int child;
+
+	while ((child = slot * 2 + 1) < con->schedcnt) {
+		if (child + 1 < con->schedcnt && sched_before(con->heap[child + 1], con->heap[child]))
+			child++;
+		if (!sched_before(con->heap[child], s))
+			break;
+		heap_set(con, slot, con->heap[child]);
+		slot = child;
+	}
+	heap_set(con, slot, s);
+}
+
+static inline unsigned int hash_bucket(const struct sched_context *con, int id)
+{
+	/* ids are handed out sequentially, so the low bits spread them evenly */
+	return (unsigned int) id & (con->hashsize - 1);
+}
+
+/*! \brief Grow the id hash to newsize buckets and rehash everything that is queued */
+static int hash_resize(struct sched_context *con, unsigned int newsize)
+{
+	struct sched **newhash;
+	unsigned int i, bucket;
+
+	if (!(newhash = ast_calloc(newsize, sizeof(*newhash))))
+		return -1;
+	if (con->hash)
+		free(con->hash);
+	con->hash = newhash;
+	con->hashsize = newsize;
+	for (i = 0; i < con->schedcnt; i++) {
+		bucket = hash_bucket(con, con->heap[i]->id);
+		con->heap[i]->hnext = con->hash[bucket];
+		con->hash[bucket] = con->heap[i];
+	}
+	return 0;
+}
+
+static struct sched *hash_find(const struct sched_context *con, int id)
+{
+	struct sched *s;
+
+	if (!con->hashsize)
+		return NULL;
+	for (s = con->hash[hash_bucket(con, id)]; s; s = s->hnext) {
+		if (s->id == id)
+			break;
+	}
+	return s;
+}
 
 /*! \brief
- * Take a sched structure and put it in the
- * queue, such that the soonest event is
- * first in the list. 
+ * Take a sched structure out of the queue
  */
-static void schedule(struct sched_context *con, struct sched *s)
+static void unschedule(struct sched_context *con, struct sched *s)
 {
-	 
-	struct sched *cur = NULL;
-	
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&con->schedq, cur, list) {
-		if (ast_tvcmp(s->when, cur->when) == -1) {
-			AST_LIST_INSERT_BEFORE_CURRENT(&con->schedq, s, list);
+	struct sched **sp;
+	unsigned int slot = s->slot;
+
+	for (sp = &con->hash[hash_bucket(con, s->id)]; *sp; sp = &(*sp)->hnext) {
+		if (*sp == s) {
+			*sp = s->hnext;
 			break;
 		}
 	}
-	AST_LIST_TRAVERSE_SAFE_END
-	if (!cur)
-		AST_LIST_INSERT_TAIL(&con->schedq, s, list);
-	
-	con->schedcnt++;
+
+	if (slot != --con->schedcnt) {
+		/* fill the hole with the last entry, and put that where it belongs */
+		heap_set(con, slot, con->heap[con->schedcnt]);
+		if (slot && sched_before(con->heap[slot], con->heap[(slot - 1) / 2]))
+			heap_up(con, slot);
+		else
+			heap_down(con, slot);
+	}
+}
+
+/*! \brief
+ * Take a sched structure and put it in the
+ * queue, such that the soonest event is
+ * at the top of the heap.
+ */
+static int schedule(struct sched_context *con, struct sched *s)
+{
+	struct sched **newheap;
+	unsigned int newsize, bucket;
+
+	if (con->schedcnt == con->heapsize) {
+		newsize = con->heapsize ? con->heapsize * 2 : SCHED_INITIAL_SIZE;
+		if (!(newheap = ast_realloc(con->heap, newsize * sizeof(*newheap))))
+			return -1;
+		con->heap = newheap;
+		con->heapsize = newsize;
+	}
+	/* keep the hash about as large as the queue (if it can't grow, longer chains still work) */
+	if (con->schedcnt >= con->hashsize) {
+		if (hash_resize(con, con->hashsize ? con->hashsize * 2 : SCHED_INITIAL_SIZE) && !con->hashsize)
+			return -1;
+	}
+
+	s->seq = con->schedseq++;
+	bucket = hash_bucket(con, s->id);
+	s->hnext = con->hash[bucket];
+	con->hash[bucket] = s;
+
+	heap_set(con, con->schedcnt++, s);
+	heap_up(con, s->slot);
+
+	return 0;
 }
 
 /*! \brief
@@ -225,10 +363,9 @@ int ast_sched_add_variable(struct sched_context *con, int when, ast_sched_cb cal
 		tmp->resched = when;
 		tmp->variable = variable;
 		tmp->when = ast_tv(0, 0);
-		if (sched_settime(&tmp->when, when)) {
+		if (sched_settime(&tmp->when, when) || schedule(con, tmp)) {
 			sched_release(con, tmp);
 		} else {
-			schedule(con, tmp);
 			res = tmp->id;
 		}
 	}
@@ -264,15 +401,10 @@ int _ast_sched_del(struct sched_context *con, int id, const char *file, int line
 	DEBUG(ast_log(LOG_DEBUG, "ast_sched_del()\n"));
 	
 	ast_mutex_lock(&con->lock);
-	AST_LIST_TRAVERSE_SAFE_BEGIN(&con->schedq, s, list) {
-		if (s->id == id) {
-			AST_LIST_REMOVE_CURRENT(&con->schedq, list);
-			con->schedcnt--;
-			sched_release(con, s);
-			break;
-		}
+	if ((s = hash_find(con, id))) {
+		unschedule(con, s);
+		sched_release(con, s);
 	}
-	AST_LIST_TRAVERSE_SAFE_END
 
 #ifdef DUMP_SCHEDULER
 	/* Dump contents of the context while we have the lock so nothing gets screwed up by accident. */
@@ -295,10 +427,11 @@ int _ast_sched_del(struct sched_context *con, int id, const char *file, int line
 	return 0;
 }
 
-/*! \brief Dump the contents of the scheduler to LOG_DEBUG */
+/*! \brief Dump the contents of the scheduler to LOG_DEBUG (in heap order, soonest first) */
 void ast_sched_dump(const struct sched_context *con)
 {
 	struct sched *q;
+	unsigned int i;
 	struct timeval tv = ast_tvnow();
 #ifdef SCHED_MAX_CACHE
 	ast_log(LOG_DEBUG, "Asterisk Schedule Dump (%d in Q, %d Total, %d Cache)\n", con->schedcnt, con->eventcnt - 1, con->schedccnt);
@@ -309,8 +442,11 @@ void ast_sched_dump(const struct sched_context *con)
 	ast_log(LOG_DEBUG, "=============================================================\n");
 	ast_log(LOG_DEBUG, "|ID    Callback          Data              Time  (sec:ms)   |\n");
 	ast_log(LOG_DEBUG, "+-----+-----------------+-----------------+-----------------+\n");
-	AST_LIST_TRAVERSE(&con->schedq, q, list) {
-		struct timeval delta = ast_tvsub(q->when, tv);
+	for (i = 0; i < con->schedcnt; i++) {
+		struct timeval delta;
+
+		q = con->heap[i];
+		delta = ast_tvsub(q->when, tv);
 
 		ast_log(LOG_DEBUG, "|%.4d | %-15p | %-15p | %.6ld : %.6ld |\n", 
 			q->id,
@@ -337,18 +473,18 @@ int ast_sched_runq(struct sched_context *con)
 		
 	ast_mutex_lock(&con->lock);
 
-	for (numevents = 0; !AST_LIST_EMPTY(&con->schedq); numevents++) {
+	for (numevents = 0; con->schedcnt; numevents++) {
 		/* schedule all events which are going to expire within 1ms.
 		 * We only care about millisecond accuracy anyway, so this will
 		 * help us get more than one event at one time if they are very
 		 * close together.
 		 */
 		tv = ast_tvadd(ast_tvnow(), ast_tv(0, 1000));
-		if (ast_tvcmp(AST_LIST_FIRST(&con->schedq)->when, tv) != -1)
+		if (ast_tvcmp(con->heap[0]->when, tv) != -1)
 			break;
 		
-		current = AST_LIST_REMOVE_HEAD(&con->schedq, list);
-		con->schedcnt--;
+		current = con->heap[0];
+		unschedule(con, current);
 
 		/*
 		 * At this point, the schedule queue is still intact.  We
@@ -368,10 +504,10 @@ int ast_sched_runq(struct sched_context *con)
 			 * If they return non-zero, we should schedule them to be
 			 * run again.
 			 */
-			if (sched_settime(&current->when, current->variable? res : current->resched)) {
+			if (sched_settime(&current->when, current->variable? res : current->resched) ||
+			    schedule(con, current)) {
 				sched_release(con, current);
-			} else
-				schedule(con, current);
+			}
 		} else {
 			/* No longer needed, so release it */
 		 	sched_release(con, current);
@@ -390,11 +526,7 @@ long ast_sched_when(struct sched_context *con,int id)
 	DEBUG(ast_log(LOG_DEBUG, "ast_sched_when()\n"));
 
 	ast_mutex_lock(&con->lock);
-	AST_LIST_TRAVERSE(&con->schedq, s, list) {
-		if (s->id == id)
-			break;
-	}
-	if (s) {
+	if ((s = hash_find(con, id))) {
 		struct timeval now = ast_tvnow();
 		secs = s->when.tv_sec - now.tv_sec;
 	}
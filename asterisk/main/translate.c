@@ -45,9 +45,32 @@ ASTERISK_FILE_VERSION(__FILE__,"$Revision$")
 #include "asterisk/sched.h"
 #include "asterisk/cli.h"
 #include "asterisk/term.h"
+#include "asterisk/ulaw.h"
+#include "asterisk/alaw.h"
 
 #define MAX_RECALC 200 /* max sample recalc */
 
+/*! \brief Frames run through each path by "core show translation benchmark" */
+#define BENCHMARK_FRAMES 500
+
+/*!
+ * \brief G.711 steps that ast_translate() does inline
+ *
+ * Converting between G.711 and signed linear is a table lookup per sample,
+ * which is cheap next to the framein()/frameout() round trip through the
+ * translator around it.  So when such a step has no generic PLC to feed,
+ * ast_translate() converts straight from the previous step's output buffer
+ * into this step's output buffer, which also fuses e.g. ulaw -> gsm and
+ * ulaw -> adpcm (through slin) into a single pass over the data.
+ */
+enum trans_fused {
+	TRANS_FUSED_NONE = 0,
+	TRANS_FUSED_ULAW_SLIN,
+	TRANS_FUSED_ALAW_SLIN,
+	TRANS_FUSED_SLIN_ULAW,
+	TRANS_FUSED_SLIN_ALAW,
+};
+
 /*! \brief the list of translators */
 static AST_LIST_HEAD_STATIC(translators, ast_translator);
 
@@ -255,6 +278,91 @@ static struct ast_frame *default_frameout(struct ast_trans_pvt *pvt)
 	return ast_trans_frameout(pvt, 0, 0);
 }
 
+/*! \brief what kind of fused step, if any, \a pvt can be */
+static enum trans_fused fused_type(struct ast_trans_pvt *pvt)
+{
+	int src = pvt->t->srcfmt, dst = pvt->t->dstfmt;
+
+	/* PLC needs to see every frame go through framein() */
+	if (pvt->plc)
+		return TRANS_FUSED_NONE;
+	if (dst == powerof(AST_FORMAT_SLINEAR)) {
+		if (src == powerof(AST_FORMAT_ULAW))
+			return TRANS_FUSED_ULAW_SLIN;
+		if (src == powerof(AST_FORMAT_ALAW))
+			return TRANS_FUSED_ALAW_SLIN;
+	} else if (src == powerof(AST_FORMAT_SLINEAR)) {
+		if (dst == powerof(AST_FORMAT_ULAW))
+			return TRANS_FUSED_SLIN_ULAW;
+		if (dst == powerof(AST_FORMAT_ALAW))
+			return TRANS_FUSED_SLIN_ALAW;
+	}
+	return TRANS_FUSED_NONE;
+}
+
+/*! \brief do a fused step: convert \a f straight into the outbuf of \a pvt
+ * \return the output frame, or NULL if \a f is not something we can do
+ * this way, in which case the caller goes through framein()/frameout().
+ */
+static struct ast_frame *fused_frame(struct ast_trans_pvt *pvt, struct ast_frame *f)
+{
+	struct ast_frame *out;
+	int i, samples = f->samples;
+
+	/* Anything left over from the regular path has to go out first */
+	if (pvt->samples || samples <= 0 || samples > pvt->t->buffer_samples)
+		return NULL;
+
+	switch (pvt->fused) {
+	case TRANS_FUSED_ULAW_SLIN:
+	case TRANS_FUSED_ALAW_SLIN:
+	{
+		unsigned char *src = f->data;
+		int16_t *dst = (int16_t *) pvt->outbuf;
+
+		if (f->datalen != samples)
+			return NULL;
+		if (pvt->fused == TRANS_FUSED_ULAW_SLIN) {
+			for (i = 0; i < samples; i++)
+				dst[i] = AST_MULAW(src[i]);
+		} else {
+			for (i = 0; i < samples; i++)
+				dst[i] = AST_ALAW(src[i]);
+		}
+		out = ast_trans_frameout(pvt, samples * 2, samples);
+		break;
+	}
+	case TRANS_FUSED_SLIN_ULAW:
+	case TRANS_FUSED_SLIN_ALAW:
+	{
+		int16_t *src = f->data;
+		unsigned char *dst = (unsigned char *) pvt->outbuf;
+
+		if (f->datalen != samples * 2)
+			return NULL;
+		if (pvt->fused == TRANS_FUSED_SLIN_ULAW) {
+			for (i = 0; i < samples; i++)
+				dst[i] = AST_LIN2MU(src[i]);
+		} else {
+			for (i = 0; i < samples; i++)
+				dst[i] = AST_LIN2A(src[i]);
+		}
+		out = ast_trans_frameout(pvt, samples, samples);
+		break;
+	}
+	default:
+		return NULL;
+	}
+
+	/* Same timing info as framein() would have passed on */
+	ast_copy_flags(out, f, AST_FRFLAG_HAS_TIMING_INFO);
+	out->ts = f->ts;
+	out->len = f->len;
+	out->seqno = f->seqno;
+
+	return out;
+}
+
 /* end of callback wrappers and helpers */
 
 void ast_translator_free_path(struct ast_trans_pvt *p)
@@ -303,6 +411,7 @@ struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 			tail->next = cur;
 		tail = cur;
 		cur->nextin = cur->nextout = ast_tv(0, 0);
+		cur->fused = fused_type(cur);
 		/* Keep going if this isn't the final destination */
 		source = cur->t->dstfmt;
 	}
@@ -351,10 +460,15 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 	}
 	delivery = f->delivery;
 	for ( ; out && p ; p = p->next) {
-		framein(p, out);
+		struct ast_frame *next = NULL;
+
+		if (!p->fused || !(next = fused_frame(p, out))) {
+			framein(p, out);
+			next = p->t->frameout(p);
+		}
 		if (out != f)
 			ast_frfree(out);
-		out = p->t->frameout(p);
+		out = next;
 	}
 	if (consume)
 		ast_frfree(f);
@@ -590,6 +704,87 @@ static int show_translation_deprecated(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+/*! \brief time \a frames translations of \a sample over \a path
+ * \return the average time per frame in nanoseconds, or -1 if the path gave nothing back
+ */
+static long benchmark_path(struct ast_trans_pvt *path, struct ast_frame *sample, int frames)
+{
+	struct ast_frame *out;
+	struct timeval start, elapsed;
+	int i, outframes = 0;
+
+	/* Warm up the caches (and fill up any codec buffering) first */
+	for (i = 0; i < 10; i++) {
+		if ((out = ast_translate(path, sample, 0)))
+			ast_frfree(out);
+	}
+
+	start = ast_tvnow();
+	for (i = 0; i < frames; i++) {
+		if ((out = ast_translate(path, sample, 0))) {
+			outframes++;
+			ast_frfree(out);
+		}
+	}
+	elapsed = ast_tvsub(ast_tvnow(), start);
+
+	if (!outframes)
+		return -1;
+	return (elapsed.tv_sec * 1000000L + elapsed.tv_usec) * 1000L / frames;
+}
+
+/*! \brief CLI "core show translation benchmark" command handler
+ * \note This expects the list of translators to be locked
+ */
+static int show_translation_benchmark(int fd, int argc, char *argv[])
+{
+	struct ast_trans_pvt *path, *p;
+	struct ast_frame *sample;
+	int x, y, frames = BENCHMARK_FRAMES, steps, fused;
+	long ns, unfused;
+	char name[40], unfused_str[24];
+
+	if (argc == 5 && (frames = atoi(argv[4])) <= 0)
+		return RESULT_SHOWUSAGE;
+
+	ast_cli(fd, "         Measured translation times, in nanoseconds per frame (%d frames per path)\n", frames);
+	ast_cli(fd, "         'unfused' is the same path with the inline G.711 steps turned off\n\n");
+	ast_cli(fd, " %-24s %5s %7s %10s %10s\n", "Path", "Steps", "Samples", "ns/frame", "unfused");
+	for (x = 0; x < SHOW_TRANS; x++) {
+		for (y = 0; y < SHOW_TRANS; y++) {
+			if (x == y || !tr_matrix[x][y].step || !tr_matrix[x][y].step->sample)
+				continue;
+			if (!(path = ast_translator_build_path(1 << y, 1 << x)))
+				continue;
+			snprintf(name, sizeof(name), "%s -> %s", ast_getformatname(1 << x), ast_getformatname(1 << y));
+			if (!(sample = path->t->sample())) {
+				ast_translator_free_path(path);
+				continue;
+			}
+			for (steps = 0, fused = 0, p = path; p; p = p->next, steps++)
+				fused |= p->fused;
+			ns = benchmark_path(path, sample, frames);
+			unfused = -1;
+			if (fused) {
+				for (p = path; p; p = p->next)
+					p->fused = TRANS_FUSED_NONE;
+				unfused = benchmark_path(path, sample, frames);
+			}
+			ast_translator_free_path(path);
+
+			if (unfused > -1)
+				snprintf(unfused_str, sizeof(unfused_str), "%ld", unfused);
+			else
+				ast_copy_string(unfused_str, "-", sizeof(unfused_str));
+			if (ns > -1)
+				ast_cli(fd, " %-24s %5d %7d %10ld %10s\n", name, steps, sample->samples, ns, unfused_str);
+			else
+				ast_cli(fd, " %-24s %5d %7d %10s %10s\n", name, steps, sample->samples, "(none)", unfused_str);
+		}
+	}
+	return RESULT_SUCCESS;
+}
+
 static int show_translation(int fd, int argc, char *argv[])
 {
 	int x, y, z;
@@ -600,6 +795,12 @@ static int show_translation(int fd, int argc, char *argv[])
 
 	AST_LIST_LOCK(&translators);	
 	
+	if (argv[3] && !strcasecmp(argv[3], "benchmark")) {
+		z = show_translation_benchmark(fd, argc, argv);
+		AST_LIST_UNLOCK(&translators);
+		return z;
+	}
+
 	if (argv[3] && !strcasecmp(argv[3], "recalc")) {
 		z = argv[4] ? atoi(argv[4]) : 1;
 
@@ -661,10 +862,14 @@ static int show_translation(int fd, int argc, char *argv[])
 
 static char show_trans_usage[] =
 "Usage: core show translation [recalc] [<recalc seconds>]\n"
+"       core show translation benchmark [<frames>]\n"
 "       Displays known codec translators and the cost associated\n"
 "with each conversion.  If the argument 'recalc' is supplied along\n"
 "with optional number of seconds to test a new test will be performed\n"
-"as the chart is being displayed.\n";
+"as the chart is being displayed.  With 'benchmark', every available\n"
+"translation path is timed end to end instead, through ast_translate()\n"
+"with the translators' sample frames, and the result shown in\n"
+"nanoseconds per frame.\n";
 
 static struct ast_cli_entry cli_show_translation_deprecated = {
 	{ "show", "translation", NULL },
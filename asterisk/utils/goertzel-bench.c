@@ -0,0 +1,334 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief Microbenchmark for the DTMF/MF goertzel bank
+ *
+ * Runs synthesized DTMF and MF digits (with twist and some noise)
+ * through the filter bank from include/asterisk/goertzel.h and through
+ * the unrolled one-filter-at-a-time loop main/dsp.c used before it, and
+ * checks that every filter ends every detection block (102 samples for
+ * DTMF, 120 for MF) in exactly the same state. Then it times both over
+ * 160 sample (20ms) frames.
+ *
+ * This is built on request only: make -C utils ASTTOPDIR=.. goertzel-bench
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "asterisk/goertzel.h"
+
+#define FRAME_SIZE 160
+#define SIGNAL_LEN (FRAME_SIZE * 500)	/* 10 seconds */
+#define ROUNDS 20
+
+#define DTMF_BLOCK 102
+#define MF_BLOCK 120
+
+/* same as main/dsp.c */
+static const float dtmf_row[] = { 697.0, 770.0, 852.0, 941.0 };
+static const float dtmf_col[] = { 1209.0, 1336.0, 1477.0, 1633.0 };
+static const float fax_freq = 1100.0;
+static const float mf_tones[] = { 700.0, 900.0, 1100.0, 1300.0, 1500.0, 1700.0 };
+
+/* goertzel_state_t and friends, as main/dsp.c has them */
+struct ref_state {
+	float v2;
+	float v3;
+	float fac;
+};
+
+static void ref_init(struct ref_state *s, float freq)
+{
+	s->v2 = s->v3 = 0.0;
+	s->fac = 2.0 * cos(2.0 * M_PI * (freq / 8000.0));
+}
+
+struct ref_dtmf {
+	struct ref_state row_out[4];
+	struct ref_state col_out[4];
+	struct ref_state fax_tone;
+	float energy;
+};
+
+struct ref_mf {
+	struct ref_state tone_out[6];
+};
+
+/* the unrolled loop from dtmf_detect() */
+static void ref_dtmf_update(struct ref_dtmf *s, const int16_t *amp, int count)
+{
+	float famp, v1;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		famp = amp[j];
+		s->energy += famp*famp;
+		v1 = s->row_out[0].v2;
+		s->row_out[0].v2 = s->row_out[0].v3;
+		s->row_out[0].v3 = s->row_out[0].fac*s->row_out[0].v2 - v1 + famp;
+		v1 = s->col_out[0].v2;
+		s->col_out[0].v2 = s->col_out[0].v3;
+		s->col_out[0].v3 = s->col_out[0].fac*s->col_out[0].v2 - v1 + famp;
+		v1 = s->row_out[1].v2;
+		s->row_out[1].v2 = s->row_out[1].v3;
+		s->row_out[1].v3 = s->row_out[1].fac*s->row_out[1].v2 - v1 + famp;
+		v1 = s->col_out[1].v2;
+		s->col_out[1].v2 = s->col_out[1].v3;
+		s->col_out[1].v3 = s->col_out[1].fac*s->col_out[1].v2 - v1 + famp;
+		v1 = s->row_out[2].v2;
+		s->row_out[2].v2 = s->row_out[2].v3;
+		s->row_out[2].v3 = s->row_out[2].fac*s->row_out[2].v2 - v1 + famp;
+		v1 = s->col_out[2].v2;
+		s->col_out[2].v2 = s->col_out[2].v3;
+		s->col_out[2].v3 = s->col_out[2].fac*s->col_out[2].v2 - v1 + famp;
+		v1 = s->row_out[3].v2;
+		s->row_out[3].v2 = s->row_out[3].v3;
+		s->row_out[3].v3 = s->row_out[3].fac*s->row_out[3].v2 - v1 + famp;
+		v1 = s->col_out[3].v2;
+		s->col_out[3].v2 = s->col_out[3].v3;
+		s->col_out[3].v3 = s->col_out[3].fac*s->col_out[3].v2 - v1 + famp;
+		v1 = s->fax_tone.v2;
+		s->fax_tone.v2 = s->fax_tone.v3;
+		s->fax_tone.v3 = s->fax_tone.fac*s->fax_tone.v2 - v1 + famp;
+	}
+}
+
+/* the unrolled loop from mf_detect() */
+static void ref_mf_update(struct ref_mf *s, const int16_t *amp, int count)
+{
+	float famp, v1;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		famp = amp[j];
+		v1 = s->tone_out[0].v2;
+		s->tone_out[0].v2 = s->tone_out[0].v3;
+		s->tone_out[0].v3 = s->tone_out[0].fac*s->tone_out[0].v2 - v1 + famp;
+		v1 = s->tone_out[1].v2;
+		s->tone_out[1].v2 = s->tone_out[1].v3;
+		s->tone_out[1].v3 = s->tone_out[1].fac*s->tone_out[1].v2 - v1 + famp;
+		v1 = s->tone_out[2].v2;
+		s->tone_out[2].v2 = s->tone_out[2].v3;
+		s->tone_out[2].v3 = s->tone_out[2].fac*s->tone_out[2].v2 - v1 + famp;
+		v1 = s->tone_out[3].v2;
+		s->tone_out[3].v2 = s->tone_out[3].v3;
+		s->tone_out[3].v3 = s->tone_out[3].fac*s->tone_out[3].v2 - v1 + famp;
+		v1 = s->tone_out[4].v2;
+		s->tone_out[4].v2 = s->tone_out[4].v3;
+		s->tone_out[4].v3 = s->tone_out[4].fac*s->tone_out[4].v2 - v1 + famp;
+		v1 = s->tone_out[5].v2;
+		s->tone_out[5].v2 = s->tone_out[5].v3;
+		s->tone_out[5].v3 = s->tone_out[5].fac*s->tone_out[5].v2 - v1 + famp;
+	}
+}
+
+/* 50ms digits with 50ms gaps, the two tones at different levels, over noise */
+static void synth(int16_t *out, int len, const float *lo, int nlo, const float *hi, int nhi)
+{
+	double f1 = 0.0, f2 = 0.0, s;
+	int i, digit = -1;
+
+	for (i = 0; i < len; i++) {
+		if (i % 800 == 0) {
+			digit = (i / 800) & 1 ? -1 : random();
+			f1 = lo[(digit >> 4) % nlo];
+			f2 = hi[(digit >> 8) % nhi];
+		}
+		s = (random() % 401) - 200;
+		if (digit >= 0) {
+			s += 6000.0 * sin(2.0 * M_PI * f1 * i / 8000.0);
+			s += (3000.0 + (digit % 5000)) * sin(2.0 * M_PI * f2 * i / 8000.0);
+		}
+		out[i] = s;
+	}
+}
+
+static int same(float a, float b)
+{
+	return !memcmp(&a, &b, sizeof(a));
+}
+
+static int check_dtmf(const int16_t *sig)
+{
+	struct ref_dtmf r;
+	struct goertzel_bank b;
+	float energy = 0.0, famp;
+	int i, j, n;
+
+	memset(&r, 0, sizeof(r));
+	goertzel_bank_init(&b);
+	for (i = 0; i < 4; i++) {
+		ref_init(&r.row_out[i], dtmf_row[i]);
+		ref_init(&r.col_out[i], dtmf_col[i]);
+		goertzel_bank_set(&b, i, dtmf_row[i]);
+		goertzel_bank_set(&b, 4 + i, dtmf_col[i]);
+	}
+	ref_init(&r.fax_tone, fax_freq);
+	goertzel_bank_set(&b, 8, fax_freq);
+
+	for (n = 0; n + DTMF_BLOCK <= SIGNAL_LEN; n += DTMF_BLOCK) {
+		ref_dtmf_update(&r, sig + n, DTMF_BLOCK);
+		for (j = n; j < n + DTMF_BLOCK; j++) {
+			famp = sig[j];
+			energy += famp*famp;
+		}
+		goertzel_bank_update(&b, sig + n, DTMF_BLOCK);
+		if (!same(energy, r.energy))
+			return -1;
+		for (i = 0; i < 4; i++) {
+			if (!same(b.v2[i], r.row_out[i].v2) || !same(b.v3[i], r.row_out[i].v3) ||
+			    !same(b.v2[4 + i], r.col_out[i].v2) || !same(b.v3[4 + i], r.col_out[i].v3))
+				return -1;
+		}
+		if (!same(b.v2[8], r.fax_tone.v2) || !same(b.v3[8], r.fax_tone.v3))
+			return -1;
+		for (i = 0; i < 4; i++) {
+			r.row_out[i].v2 = r.row_out[i].v3 = 0.0;
+			r.col_out[i].v2 = r.col_out[i].v3 = 0.0;
+		}
+		r.fax_tone.v2 = r.fax_tone.v3 = 0.0;
+		r.energy = energy = 0.0;
+		goertzel_bank_reset(&b);
+	}
+	return 0;
+}
+
+static int check_mf(const int16_t *sig)
+{
+	struct ref_mf r;
+	struct goertzel_bank b;
+	int i, n;
+
+	goertzel_bank_init(&b);
+	for (i = 0; i < 6; i++) {
+		ref_init(&r.tone_out[i], mf_tones[i]);
+		goertzel_bank_set(&b, i, mf_tones[i]);
+	}
+
+	for (n = 0; n + MF_BLOCK <= SIGNAL_LEN; n += MF_BLOCK) {
+		/* in two uneven pieces, like frames that straddle a block */
+		ref_mf_update(&r, sig + n, 37);
+		ref_mf_update(&r, sig + n + 37, MF_BLOCK - 37);
+		goertzel_bank_update(&b, sig + n, 37);
+		goertzel_bank_update(&b, sig + n + 37, MF_BLOCK - 37);
+		for (i = 0; i < 6; i++) {
+			if (!same(b.v2[i], r.tone_out[i].v2) || !same(b.v3[i], r.tone_out[i].v3))
+				return -1;
+		}
+		for (i = 0; i < 6; i++)
+			r.tone_out[i].v2 = r.tone_out[i].v3 = 0.0;
+		goertzel_bank_reset(&b);
+	}
+	return 0;
+}
+
+static long long now_ns(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((long long)tv.tv_sec * 1000000LL + tv.tv_usec) * 1000LL;
+}
+
+static float sink;
+
+static void bench(const char *name, const int16_t *sig, int bins, const float *freqs)
+{
+	struct ref_dtmf rd;
+	struct ref_mf rm;
+	struct goertzel_bank b;
+	long long start;
+	double tref, tbank;
+	float energy = 0.0, famp;
+	int i, n, r;
+
+	memset(&rd, 0, sizeof(rd));
+	memset(&rm, 0, sizeof(rm));
+	goertzel_bank_init(&b);
+	for (i = 0; i < bins; i++) {
+		goertzel_bank_set(&b, i, freqs[i]);
+		if (bins == 9)
+			ref_init(i < 8 ? (i < 4 ? &rd.row_out[i] : &rd.col_out[i - 4]) : &rd.fax_tone, freqs[i]);
+		else
+			ref_init(&rm.tone_out[i], freqs[i]);
+	}
+
+	start = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		for (n = 0; n < SIGNAL_LEN; n += FRAME_SIZE) {
+			if (bins == 9)
+				ref_dtmf_update(&rd, sig + n, FRAME_SIZE);
+			else
+				ref_mf_update(&rm, sig + n, FRAME_SIZE);
+		}
+	}
+	tref = (double)(now_ns() - start) / (ROUNDS * (SIGNAL_LEN / FRAME_SIZE));
+
+	/* dtmf_detect() sums the energy in its own loop now */
+	start = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		for (n = 0; n < SIGNAL_LEN; n += FRAME_SIZE) {
+			if (bins == 9) {
+				for (i = n; i < n + FRAME_SIZE; i++) {
+					famp = sig[i];
+					energy += famp*famp;
+				}
+			}
+			goertzel_bank_update(&b, sig + n, FRAME_SIZE);
+		}
+	}
+	tbank = (double)(now_ns() - start) / (ROUNDS * (SIGNAL_LEN / FRAME_SIZE));
+
+	sink += rd.row_out[0].v3 + rm.tone_out[0].v3 + b.v3[0] + energy;
+	printf("%8s %6d %14.0f %14.0f %7.2fx\n", name, bins, tref, tbank, tbank > 0 ? tref / tbank : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	static int16_t dtmf[SIGNAL_LEN], mf[SIGNAL_LEN];
+	float dtmf_freqs[9];
+	int i;
+
+	srandom(1);
+	synth(dtmf, SIGNAL_LEN, dtmf_row, 4, dtmf_col, 4);
+	synth(mf, SIGNAL_LEN, mf_tones, 3, mf_tones + 3, 3);
+
+	/* make sure both do the same thing */
+	if (check_dtmf(dtmf) || check_dtmf(mf) || check_mf(mf) || check_mf(dtmf)) {
+		fprintf(stderr, "goertzel bank (%s) does not match reference!!\n", GOERTZEL_KERNEL);
+		return 1;
+	}
+
+	for (i = 0; i < 4; i++) {
+		dtmf_freqs[i] = dtmf_row[i];
+		dtmf_freqs[4 + i] = dtmf_col[i];
+	}
+	dtmf_freqs[8] = fax_freq;
+
+	printf("kernel: %s, %d x %d frames of %d samples each\n", GOERTZEL_KERNEL, ROUNDS, SIGNAL_LEN / FRAME_SIZE, FRAME_SIZE);
+	printf("%8s %6s %14s %14s %8s\n", "detector", "bins", "ref ns/frame", "bank ns/frame", "speedup");
+	bench("dtmf", dtmf, 9, dtmf_freqs);
+	bench("mf", mf, 6, mf_tones);
+	if (argc > 1)
+		printf("%f\n", sink);
+	return 0;
+}
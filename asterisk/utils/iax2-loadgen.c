@@ -0,0 +1,488 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief IAX2 load generator for chan_iax2
+ *
+ * Places a number of IAX2 calls (all from one UDP socket, like a busy hub
+ * would) to a running Asterisk, answering call token challenges, and then
+ * sends a 20ms ULAW voice frame on every call every interval: one full
+ * voice frame, then mini frames.  Pointed at an extension that answers
+ * and echoes, e.g.
+ *
+ *	[loadtest]
+ *	exten => 100,1,Answer
+ *	exten => 100,n,Echo
+ *
+ * every frame comes back, so chan_iax2 both reads and writes one packet
+ * for every one sent.  The packet rates are printed every second.  Given
+ * the pid of the Asterisk under test (-P), the CPU time it used is read
+ * from /proc and the packets it handled per second of CPU (per core) is
+ * printed at the end, so batchio=yes and no can be compared.
+ *
+ * The user the calls come in as must not need authentication.
+ *
+ * This is built on request only: make -C utils ASTTOPDIR=.. iax2-loadgen
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../channels/iax2.h"
+
+#define	FRAME_SIZE 160
+#define	FRAME_VOICE 2		/* AST_FRAME_VOICE */
+#define	FRAME_IAX 6		/* AST_FRAME_IAX */
+#define	FORMAT_ULAW 4		/* AST_FORMAT_ULAW */
+#define	NEW_BURST 20		/* NEWs sent per pass while placing calls */
+
+enum lgstate {
+	LG_NEW,		/* NEW sent, waiting for CALLTOKEN or ACCEPT */
+	LG_UP,		/* ACCEPTed, sending voice */
+	LG_GONE,	/* hung up, rejected or given up on */
+};
+
+struct lgcall {
+	enum lgstate state;
+	unsigned short dcallno;		/* theirs */
+	unsigned char oseqno;
+	unsigned char iseqno;
+	int fullsent;			/* sent the full voice frame the mini frames hang off */
+	unsigned int lastfullts;
+	struct timeval start;
+	struct timeval newsent;		/* when the last NEW went */
+	struct timeval next;		/* when the next voice frame is due */
+};
+
+static int sock;
+static struct sockaddr_in sin;
+static char *username = "guest", *exten = "100", *context = NULL;
+static unsigned long long sent, rcvd, senderr;
+
+static long long tvdiff_us(struct timeval a, struct timeval b)
+{
+	return ((long long)(a.tv_sec - b.tv_sec) * 1000000LL) + (a.tv_usec - b.tv_usec);
+}
+
+static struct timeval tvadd_us(struct timeval a, long long us)
+{
+	us += a.tv_usec;
+	a.tv_sec += us / 1000000;
+	a.tv_usec = us % 1000000;
+	return a;
+}
+
+static unsigned int call_ts(struct lgcall *c, struct timeval now)
+{
+	return tvdiff_us(now, c->start) / 1000 + 1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: iax2-loadgen [-s server] [-p port] [-n calls] [-u username]\n"
+		"                    [-e exten] [-c context] [-i interval_ms] [-t seconds] [-P pid]\n"
+		"  -s  server address (default 127.0.0.1)\n"
+		"  -p  server port (default 4569)\n"
+		"  -n  number of calls (default 10, at most 32767)\n"
+		"  -u  username to call in as (default \"guest\")\n"
+		"  -e  extension to call (default 100)\n"
+		"  -c  context to call (default: the user's)\n"
+		"  -i  interval between voice frames, ms (default 20, 0 = flat out)\n"
+		"  -t  run time in seconds once the calls are up (default 10)\n"
+		"  -P  pid of the Asterisk under test, to report its CPU use\n");
+	exit(1);
+}
+
+static void ie_append(unsigned char *ies, int *pos, int ie, const void *data, int len)
+{
+	ies[(*pos)++] = ie;
+	ies[(*pos)++] = len;
+	memcpy(ies + *pos, data, len);
+	*pos += len;
+}
+
+static void ie_append_int(unsigned char *ies, int *pos, int ie, unsigned int value)
+{
+	value = htonl(value);
+	ie_append(ies, pos, ie, &value, sizeof(value));
+}
+
+/* Send a full frame.  Everything but an ACK takes a sequence number. */
+static void send_full(int callno, struct lgcall *c, int type, int csub, unsigned int ts, const void *data, int len)
+{
+	unsigned char buf[1500];
+	struct ast_iax2_full_hdr *fh = (struct ast_iax2_full_hdr *)buf;
+
+	fh->scallno = htons(callno | IAX_FLAG_FULL);
+	fh->dcallno = htons(c->dcallno);
+	fh->ts = htonl(ts);
+	fh->oseqno = c->oseqno;
+	fh->iseqno = c->iseqno;
+	fh->type = type;
+	fh->csub = csub;
+	memcpy(fh->iedata, data, len);
+	if ((type != FRAME_IAX) || (csub != IAX_COMMAND_ACK))
+		c->oseqno++;
+	if (sendto(sock, buf, sizeof(*fh) + len, 0, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		senderr++;
+	else
+		sent++;
+}
+
+static void send_new(int callno, struct lgcall *c, const unsigned char *token, int tokenlen, struct timeval now)
+{
+	unsigned char ies[512];
+	unsigned short version = htons(IAX_PROTO_VERSION);
+	int pos = 0;
+
+	ie_append(ies, &pos, IAX_IE_VERSION, &version, sizeof(version));
+	ie_append(ies, &pos, IAX_IE_CALLED_NUMBER, exten, strlen(exten));
+	if (context)
+		ie_append(ies, &pos, IAX_IE_CALLED_CONTEXT, context, strlen(context));
+	ie_append(ies, &pos, IAX_IE_USERNAME, username, strlen(username));
+	ie_append_int(ies, &pos, IAX_IE_FORMAT, FORMAT_ULAW);
+	ie_append_int(ies, &pos, IAX_IE_CAPABILITY, FORMAT_ULAW);
+	/* empty the first time round, which asks for a token */
+	ie_append(ies, &pos, IAX_IE_CALLTOKEN, token, tokenlen);
+	c->oseqno = c->iseqno = 0;
+	c->dcallno = 0;
+	c->newsent = now;
+	send_full(callno, c, FRAME_IAX, IAX_COMMAND_NEW, call_ts(c, now), ies, pos);
+}
+
+static void send_voice(int callno, struct lgcall *c, struct timeval now)
+{
+	unsigned char buf[sizeof(struct ast_iax2_mini_hdr) + FRAME_SIZE];
+	struct ast_iax2_mini_hdr *mh = (struct ast_iax2_mini_hdr *)buf;
+	unsigned char audio[FRAME_SIZE];
+	unsigned int ts = call_ts(c, now);
+
+	/* mini frames only carry the low 16 bits of the timestamp */
+	if (!c->fullsent || ((ts & 0xffff0000) != (c->lastfullts & 0xffff0000))) {
+		memset(audio, 0xff, sizeof(audio));
+		send_full(callno, c, FRAME_VOICE, FORMAT_ULAW, ts, audio, sizeof(audio));
+		c->fullsent = 1;
+		c->lastfullts = ts;
+		return;
+	}
+	mh->callno = htons(callno);
+	mh->ts = htons(ts & 0xffff);
+	memset(mh->data, 0xff, FRAME_SIZE);
+	if (sendto(sock, buf, sizeof(buf), 0, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		senderr++;
+	else
+		sent++;
+}
+
+/* Find an IE in a full frame, returns its length or -1 */
+static int ie_find(const unsigned char *ies, int len, int ie, const unsigned char **data)
+{
+	int pos = 0;
+
+	while (pos + 2 <= len) {
+		if (pos + 2 + ies[pos + 1] > len)
+			break;
+		if (ies[pos] == ie) {
+			*data = ies + pos + 2;
+			return ies[pos + 1];
+		}
+		pos += 2 + ies[pos + 1];
+	}
+	return -1;
+}
+
+static void handle_frame(struct lgcall *calls, int ncalls, const unsigned char *buf, ssize_t len, int *up, struct timeval now)
+{
+	const struct ast_iax2_full_hdr *fh = (const struct ast_iax2_full_hdr *)buf;
+	const unsigned char *token;
+	struct lgcall *c;
+	int callno, tokenlen;
+
+	if (len < (ssize_t)sizeof(struct ast_iax2_mini_hdr))
+		return;
+	rcvd++;
+	if (!(ntohs(fh->scallno) & IAX_FLAG_FULL) || (len < (ssize_t)sizeof(*fh)))
+		return;		/* mini (or meta) frame, just counted */
+
+	callno = ntohs(fh->dcallno) & ~IAX_FLAG_RETRANS;
+	if ((callno < 1) || (callno > ncalls))
+		return;
+	c = &calls[callno - 1];
+	if (c->state == LG_GONE)
+		return;
+
+	if (fh->type == FRAME_IAX) {
+		switch (fh->csub) {
+		case IAX_COMMAND_ACK:
+			return;
+		case IAX_COMMAND_CALLTOKEN:
+			if (c->state != LG_NEW)
+				return;
+			if ((tokenlen = ie_find(fh->iedata, len - sizeof(*fh), IAX_IE_CALLTOKEN, &token)) > 0)
+				send_new(callno, c, token, tokenlen, now);
+			return;
+		case IAX_COMMAND_INVAL:
+			if (c->state == LG_UP)
+				(*up)--;
+			c->state = LG_GONE;
+			return;
+		}
+	}
+
+	if (fh->oseqno == c->iseqno)
+		c->iseqno++;
+	if (!c->dcallno)
+		c->dcallno = ntohs(fh->scallno) & ~IAX_FLAG_FULL;
+	send_full(callno, c, FRAME_IAX, IAX_COMMAND_ACK, ntohl(fh->ts), NULL, 0);
+
+	if (fh->type != FRAME_IAX)
+		return;
+	switch (fh->csub) {
+	case IAX_COMMAND_ACCEPT:
+		if (c->state == LG_NEW) {
+			c->state = LG_UP;
+			(*up)++;
+		}
+		break;
+	case IAX_COMMAND_PING:
+		send_full(callno, c, FRAME_IAX, IAX_COMMAND_PONG, ntohl(fh->ts), NULL, 0);
+		break;
+	case IAX_COMMAND_LAGRQ:
+		send_full(callno, c, FRAME_IAX, IAX_COMMAND_LAGRP, ntohl(fh->ts), NULL, 0);
+		break;
+	case IAX_COMMAND_HANGUP:
+	case IAX_COMMAND_REJECT:
+		if (c->state == LG_UP)
+			(*up)--;
+		c->state = LG_GONE;
+		break;
+	}
+}
+
+/* utime + stime of a process, in seconds, or -1 */
+static double proc_cpu(int pid)
+{
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if (!(f = fopen(path, "r")))
+		return -1;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	/* the command name may have spaces in it, skip past it */
+	if (!p || !(p = strrchr(buf, ')')))
+		return -1;
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+		return -1;
+	return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+int main(int argc, char *argv[])
+{
+	struct lgcall *calls;
+	struct sockaddr_in lsin;
+	struct pollfd pfd;
+	struct timeval start, now, last, setup;
+	unsigned char buf[4096];
+	char *server = "127.0.0.1";
+	int port = 4569, ncalls = 10, interval = 20, secs = 10, pid = 0;
+	unsigned long long lastsent = 0, lastrcvd = 0, sent0 = 0, rcvd0 = 0, runsent, runrcvd;
+	double cpu0 = 0, cpu1 = 0, lastcpu = 0, cpu;
+	int i, c, up = 0, running = 0;
+	long long us;
+	ssize_t len;
+
+	while ((c = getopt(argc, argv, "s:p:n:u:e:c:i:t:P:h")) != -1) {
+		switch (c) {
+		case 's':
+			server = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			ncalls = atoi(optarg);
+			break;
+		case 'u':
+			username = optarg;
+			break;
+		case 'e':
+			exten = optarg;
+			break;
+		case 'c':
+			context = optarg;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'P':
+			pid = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if ((ncalls < 1) || (ncalls > 32767) || (interval < 0) || (secs < 1))
+		usage();
+	if (pid && (proc_cpu(pid) < 0)) {
+		fprintf(stderr, "Unable to read the CPU time of pid %d\n", pid);
+		return 1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (!inet_aton(server, &sin.sin_addr)) {
+		fprintf(stderr, "Invalid server address %s\n", server);
+		return 1;
+	}
+	if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+		fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+		return 1;
+	}
+	memset(&lsin, 0, sizeof(lsin));
+	lsin.sin_family = AF_INET;
+	if (bind(sock, (struct sockaddr *)&lsin, sizeof(lsin)) == -1) {
+		fprintf(stderr, "Unable to bind socket: %s\n", strerror(errno));
+		return 1;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+	i = 4 * 1024 * 1024;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &i, sizeof(i));
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	if (!(calls = calloc(ncalls, sizeof(*calls)))) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	/* call number i + 1 is calls[i] */
+	gettimeofday(&setup, NULL);
+	for (i = 0; i < ncalls; i++)
+		calls[i].start = setup;
+
+	last = start = setup;
+	for (;;) {
+		gettimeofday(&now, NULL);
+		if (running && (tvdiff_us(now, start) >= (long long)secs * 1000000LL))
+			break;
+		poll(&pfd, 1, (running && !interval) ? 0 : 1);
+		while ((len = recv(sock, buf, sizeof(buf), 0)) >= 0)
+			handle_frame(calls, ncalls, buf, len, &up, now);
+
+		if (!running) {
+			/*
+			 * Place the calls a few at a time, so that the NEWs don't
+			 * overrun the server's socket buffer, and try again on any
+			 * that have heard nothing back in a second.
+			 */
+			for (i = 0, c = 0; i < ncalls && c < NEW_BURST; i++) {
+				if (calls[i].state != LG_NEW)
+					continue;
+				if (!calls[i].newsent.tv_sec || (!calls[i].dcallno && tvdiff_us(now, calls[i].newsent) >= 1000000)) {
+					send_new(i + 1, &calls[i], NULL, 0, now);
+					c++;
+				}
+			}
+			/* wait for every call to be answered, or 10 seconds */
+			if ((up == ncalls) || (tvdiff_us(now, setup) >= 10000000LL)) {
+				if (!up) {
+					fprintf(stderr, "No calls were accepted, giving up\n");
+					return 1;
+				}
+				printf("%d of %d calls up, sending voice\n", up, ncalls);
+				running = 1;
+				start = last = now;
+				/* spread the calls' frames out over the interval */
+				for (i = 0; i < ncalls; i++)
+					calls[i].next = tvadd_us(now, (long long)interval * 1000 * i / ncalls);
+				lastsent = sent0 = sent;
+				lastrcvd = rcvd0 = rcvd;
+				if (pid)
+					lastcpu = cpu0 = proc_cpu(pid);
+			}
+			continue;
+		}
+
+		for (i = 0; i < ncalls; i++) {
+			if ((calls[i].state != LG_UP) || (tvdiff_us(now, calls[i].next) < 0))
+				continue;
+			send_voice(i + 1, &calls[i], now);
+			calls[i].next = tvadd_us(calls[i].next, interval * 1000);
+			/* do not try to catch up if we fell behind */
+			if (tvdiff_us(now, calls[i].next) > 0)
+				calls[i].next = now;
+		}
+		us = tvdiff_us(now, last);
+		if (us >= 1000000) {
+			printf("calls %d/%d  tx %llu pps  rx %llu pps", up, ncalls,
+				(sent - lastsent) * 1000000ULL / us, (rcvd - lastrcvd) * 1000000ULL / us);
+			if (pid) {
+				cpu = proc_cpu(pid);
+				printf("  asterisk cpu %.0f%%", (cpu - lastcpu) * 100000000.0 / us);
+				lastcpu = cpu;
+			}
+			printf("\n");
+			lastsent = sent;
+			lastrcvd = rcvd;
+			last = now;
+		}
+	}
+	if (pid)
+		cpu1 = proc_cpu(pid);
+	us = tvdiff_us(now, start);
+	runsent = sent - sent0;
+	runrcvd = rcvd - rcvd0;
+
+	/* hang up, and stay around a little to ack what comes back */
+	for (i = 0; i < ncalls; i++) {
+		if (calls[i].state == LG_UP)
+			send_full(i + 1, &calls[i], FRAME_IAX, IAX_COMMAND_HANGUP, call_ts(&calls[i], now), NULL, 0);
+	}
+	gettimeofday(&last, NULL);
+	do {
+		poll(&pfd, 1, 10);
+		gettimeofday(&now, NULL);
+		while ((len = recv(sock, buf, sizeof(buf), 0)) >= 0)
+			handle_frame(calls, ncalls, buf, len, &up, now);
+	} while (tvdiff_us(now, last) < 500000);
+
+	printf("total: %llu packets sent and %llu received in %lld ms (%llu pps out, %llu pps in), %llu send errors\n",
+		runsent, runrcvd, us / 1000, us ? runsent * 1000000ULL / us : 0, us ? runrcvd * 1000000ULL / us : 0, senderr);
+	if (pid && (cpu1 > cpu0))
+		printf("asterisk: %.2f s of CPU, %.0f packets handled per CPU second\n",
+			cpu1 - cpu0, (runsent + runrcvd) / (cpu1 - cpu0));
+	close(sock);
+	free(calls);
+	return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief Benchmark for the scheduler (main/sched.c)
+ *
+ * Links against a copy of main/sched.c and measures, for 1k, 10k and
+ * 100k outstanding entries:
+ *  - add:   ast_sched_add() of entries spread over the next minute
+ *  - del:   ast_sched_del() of all of them, in random order
+ *  - churn: add one / delete the oldest with the queue kept full,
+ *           which is what IAX2 retransmits and acks look like
+ *  - run:   ast_sched_runq() of entries that are all due
+ * Before that, it checks that due entries run in time order and that
+ * deleted ones don't run.
+ *
+ * This is built on request only: make -C utils ASTTOPDIR=.. sched-bench
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "asterisk.h"
+#include "asterisk/sched.h"
+#include "asterisk/time.h"
+
+int option_debug = 0;
+
+/* Our own versions of the bits of the core that sched.c uses */
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...) __attribute__ ((format (printf,5,6)));
+
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list vars;
+
+	va_start(vars, fmt);
+	fprintf(stderr, "LOG: %s:%d %s: ", file, line, function);
+	vfprintf(stderr, fmt, vars);
+	va_end(vars);
+}
+
+void ast_register_file_version(const char *file, const char *version);
+void ast_unregister_file_version(const char *file);
+
+void ast_register_file_version(const char *file, const char *version)
+{
+}
+
+void ast_unregister_file_version(const char *file)
+{
+}
+
+/* same as main/utils.c, for well formed timevals */
+struct timeval ast_tvadd(struct timeval a, struct timeval b)
+{
+	a.tv_sec += b.tv_sec;
+	a.tv_usec += b.tv_usec;
+	if (a.tv_usec >= 1000000) {
+		a.tv_sec++;
+		a.tv_usec -= 1000000;
+	}
+	return a;
+}
+
+struct timeval ast_tvsub(struct timeval a, struct timeval b)
+{
+	a.tv_sec -= b.tv_sec;
+	a.tv_usec -= b.tv_usec;
+	if (a.tv_usec < 0) {
+		a.tv_sec--;
+		a.tv_usec += 1000000;
+	}
+	return a;
+}
+
+static int ran;
+static int order[16];
+
+static int cb_count(const void *data)
+{
+	ran++;
+	return 0;
+}
+
+static int cb_order(const void *data)
+{
+	if (ran < (int)(sizeof(order) / sizeof(order[0])))
+		order[ran] = (long) data;
+	ran++;
+	return 0;
+}
+
+static double now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int check_order(void)
+{
+	struct sched_context *con;
+	static const int when[] = { 30, 10, 20, 10, 0, 20, 0, 10 };
+	static const int expect[] = { 4, 6, 1, 3, 2, 5, 0, 7 };
+	int i, ids[8];
+
+	if (!(con = sched_context_create()))
+		return -1;
+	for (i = 0; i < 8; i++)
+		ids[i] = ast_sched_add(con, when[i], cb_order, (void *)(long) i);
+	/* and take one out again */
+	ast_sched_del(con, ids[7]);
+	if (ast_sched_when(con, ids[0]) < 0 || ast_sched_when(con, ids[7]) != -1) {
+		sched_context_destroy(con);
+		return -1;
+	}
+	ran = 0;
+	while (ran < 7) {
+		usleep(1000);
+		ast_sched_runq(con);
+	}
+	sched_context_destroy(con);
+	for (i = 0; i < 7; i++) {
+		if (order[i] != expect[i])
+			return -1;
+	}
+	return 0;
+}
+
+static void bench(int n)
+{
+	struct sched_context *con;
+	int *ids, i, j, tmp;
+	double t, tadd, tdel, tchurn, trun;
+
+	if (!(con = sched_context_create()) || !(ids = calloc(n, sizeof(*ids)))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	t = now_sec();
+	for (i = 0; i < n; i++)
+		ids[i] = ast_sched_add(con, 1000 + random() % 60000, cb_count, NULL);
+	tadd = now_sec() - t;
+
+	/* steady state: the queue stays at n, oldest id goes, a new one comes */
+	t = now_sec();
+	for (i = 0; i < n; i++) {
+		ast_sched_del(con, ids[i]);
+		ids[i] = ast_sched_add(con, 1000 + random() % 60000, cb_count, NULL);
+	}
+	tchurn = now_sec() - t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = ids[i];
+		ids[i] = ids[j];
+		ids[j] = tmp;
+	}
+	t = now_sec();
+	for (i = 0; i < n; i++)
+		ast_sched_del(con, ids[i]);
+	tdel = now_sec() - t;
+
+	for (i = 0; i < n; i++)
+		ast_sched_add(con, 0, cb_count, NULL);
+	ran = 0;
+	t = now_sec();
+	while (ran < n)
+		ast_sched_runq(con);
+	trun = now_sec() - t;
+
+	printf("%8d %12.0f %12.0f %12.0f %12.0f\n", n,
+		n / tadd, n / tdel, n / tchurn, n / trun);
+
+	free(ids);
+	sched_context_destroy(con);
+}
+
+int main(int argc, char *argv[])
+{
+	if (check_order()) {
+		fprintf(stderr, "Scheduler ran events out of order!!\n");
+		return 1;
+	}
+	srandom(1);
+	printf("%8s %12s %12s %12s %12s\n", "entries", "add/s", "del/s", "churn/s", "run/s");
+	bench(1000);
+	bench(10000);
+	bench(100000);
+	return 0;
+}
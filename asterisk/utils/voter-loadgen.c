@@ -0,0 +1,330 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief UDP load generator for chan_voter
+ *
+ * Simulates a number of voter (mix) clients, each on its own UDP source
+ * port, against a running chan_voter.  Every client goes through the normal
+ * challenge/digest authentication and then sends a 20ms ULAW audio packet
+ * (RSSI byte + 160 samples) every interval.  The packet rate sent and the
+ * number of packets received back from the server are printed every second,
+ * so the throughput ceiling of the voter reader can be compared between
+ * builds/configurations.
+ *
+ * Client N (starting at 1) uses the password <prefix>N.  The matching
+ * voter.conf client entries can be printed with -g, e.g.:
+ *
+ *	voter-loadgen -n 200 -g >> /etc/asterisk/voter.conf
+ *
+ * This is built on request only: make -C utils ASTTOPDIR=.. voter-loadgen
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define	FRAME_SIZE 160
+#define	VOTER_CHALLENGE_LEN 10
+
+#define	VOTER_PAYLOAD_NONE 0
+#define	VOTER_PAYLOAD_ULAW 1
+
+#pragma pack(push)
+#pragma pack(1)
+typedef struct {
+	uint32_t vtime_sec;
+	uint32_t vtime_nsec;
+} VTIME;
+
+typedef struct {
+	VTIME curtime;
+	uint8_t challenge[VOTER_CHALLENGE_LEN];
+	uint32_t digest;
+	uint16_t payload_type;
+} VOTER_PACKET_HEADER;
+
+struct authpacket {
+	VOTER_PACKET_HEADER vp;
+	char flags;
+};
+
+struct audiopacket {
+	VOTER_PACKET_HEADER vp;
+	unsigned char rssi;
+	unsigned char audio[FRAME_SIZE];
+};
+#pragma pack(pop)
+
+struct lgclient {
+	int s;
+	char challenge[VOTER_CHALLENGE_LEN];
+	char pswd[32];
+	uint32_t digest;	/* our digest, based on servers challenge */
+	int authed;
+	uint32_t seqno;
+};
+
+static uint32_t crc_32_tab[256];
+
+static void crc32_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+		crc_32_tab[i] = c;
+	}
+}
+
+/* same as crc32_bufs() in chan_voter */
+static uint32_t crc32_bufs(const char *buf, const char *buf1)
+{
+	uint32_t oldcrc32 = 0xFFFFFFFF;
+
+	while (buf && *buf)
+		oldcrc32 = crc_32_tab[(oldcrc32 ^ *buf++) & 0xff] ^ (oldcrc32 >> 8);
+	while (buf1 && *buf1)
+		oldcrc32 = crc_32_tab[(oldcrc32 ^ *buf1++) & 0xff] ^ (oldcrc32 >> 8);
+	return ~oldcrc32;
+}
+
+static long long tvdiff_us(struct timeval a, struct timeval b)
+{
+	return ((long long)(a.tv_sec - b.tv_sec) * 1000000LL) + (a.tv_usec - b.tv_usec);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: voter-loadgen [-s server] [-p port] [-n clients] [-P prefix]\n"
+		"                     [-i interval_ms] [-b burst] [-t seconds] [-g]\n"
+		"  -s  server address (default 127.0.0.1)\n"
+		"  -p  server port (default 667)\n"
+		"  -n  number of simulated clients (default 10)\n"
+		"  -P  client password prefix (default \"lg\")\n"
+		"  -i  interval between audio packets, ms (default 20, 0 = flat out)\n"
+		"  -b  audio packets per client per interval (default 1)\n"
+		"  -t  run time in seconds (default 10)\n"
+		"  -g  print voter.conf client lines and exit\n");
+	exit(1);
+}
+
+static void send_auth(struct lgclient *c, struct sockaddr_in *sin)
+{
+	struct authpacket ap;
+
+	memset(&ap, 0, sizeof(ap));
+	strcpy((char *)ap.vp.challenge, c->challenge);
+	ap.vp.digest = htonl(c->digest);
+	ap.vp.payload_type = htons(VOTER_PAYLOAD_NONE);
+	ap.flags = 32;	/* mix client, no master timing source needed */
+	sendto(c->s, &ap, sizeof(ap), 0, (struct sockaddr *)sin, sizeof(*sin));
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in sin, lsin;
+	struct lgclient *clients;
+	struct audiopacket pkt;
+	struct timeval start, now, last, next;
+	struct pollfd *pfds;
+	char *server = "127.0.0.1", *prefix = "lg", buf[2048];
+	int port = 667, nclients = 10, interval = 20, burst = 1, secs = 10, genconf = 0;
+	unsigned long long sent = 0, rcvd = 0, lastsent = 0, lastrcvd = 0, senderr = 0;
+	int i, j, n, c, authed;
+	long long us;
+	ssize_t len;
+	VOTER_PACKET_HEADER *vph;
+
+	while ((c = getopt(argc, argv, "s:p:n:P:i:b:t:gh")) != -1) {
+		switch (c) {
+		case 's':
+			server = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			nclients = atoi(optarg);
+			break;
+		case 'P':
+			prefix = optarg;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'b':
+			burst = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'g':
+			genconf = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if ((nclients < 1) || (burst < 1) || (interval < 0) || (secs < 1))
+		usage();
+
+	if (genconf) {
+		for (i = 1; i <= nclients; i++)
+			printf("%s%d = %s%d\n", prefix, i, prefix, i);
+		return 0;
+	}
+
+	crc32_init();
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (!inet_aton(server, &sin.sin_addr)) {
+		fprintf(stderr, "Invalid server address %s\n", server);
+		return 1;
+	}
+
+	clients = calloc(nclients, sizeof(*clients));
+	pfds = calloc(nclients, sizeof(*pfds));
+	if (!clients || !pfds) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	srandom(getpid());
+	for (i = 0; i < nclients; i++) {
+		/* every client gets its own source port, like separate hosts would */
+		if ((clients[i].s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+			fprintf(stderr, "Unable to create socket for client %d: %s\n", i + 1, strerror(errno));
+			return 1;
+		}
+		memset(&lsin, 0, sizeof(lsin));
+		lsin.sin_family = AF_INET;
+		if (bind(clients[i].s, (struct sockaddr *)&lsin, sizeof(lsin)) == -1) {
+			fprintf(stderr, "Unable to bind socket for client %d: %s\n", i + 1, strerror(errno));
+			return 1;
+		}
+		fcntl(clients[i].s, F_SETFL, fcntl(clients[i].s, F_GETFL, 0) | O_NONBLOCK);
+		snprintf(clients[i].challenge, sizeof(clients[i].challenge), "%ld", random() % 100000000L);
+		snprintf(clients[i].pswd, sizeof(clients[i].pswd), "%s%d", prefix, i + 1);
+		pfds[i].fd = clients[i].s;
+		pfds[i].events = POLLIN;
+		send_auth(&clients[i], &sin);
+	}
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.vp.payload_type = htons(VOTER_PAYLOAD_ULAW);
+	pkt.rssi = 200;
+	memset(pkt.audio, 0xff, sizeof(pkt.audio));
+
+	gettimeofday(&start, NULL);
+	last = next = start;
+	authed = 0;
+	for (;;) {
+		gettimeofday(&now, NULL);
+		if (tvdiff_us(now, start) >= (long long)secs * 1000000LL)
+			break;
+		/* pick up replies: auth responses and mixed audio */
+		n = poll(pfds, nclients, authed ? 0 : 20);
+		for (i = 0; (n > 0) && (i < nclients); i++) {
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			while ((len = recv(clients[i].s, buf, sizeof(buf), 0)) >= (ssize_t)sizeof(VOTER_PACKET_HEADER)) {
+				rcvd++;
+				vph = (VOTER_PACKET_HEADER *)buf;
+				if (clients[i].authed || !vph->digest)
+					continue;
+				/* first answer carries the server challenge, answer with our digest */
+				if (!clients[i].digest) {
+					clients[i].digest = crc32_bufs((char *)vph->challenge, clients[i].pswd);
+					send_auth(&clients[i], &sin);
+				} else if ((len > (ssize_t)sizeof(VOTER_PACKET_HEADER)) && (buf[sizeof(VOTER_PACKET_HEADER)] & 32)) {
+					/* server knows us and accepted us as a mix client */
+					clients[i].authed = 1;
+					authed++;
+				}
+			}
+		}
+		if (!authed) {
+			/* keep knocking until somebody answers */
+			if (tvdiff_us(now, last) >= 1000000) {
+				for (i = 0; i < nclients; i++)
+					if (!clients[i].digest)
+						send_auth(&clients[i], &sin);
+				printf("waiting for authentication...\n");
+				last = now;
+			}
+			continue;
+		}
+		if (tvdiff_us(now, next) >= 0) {
+			for (i = 0; i < nclients; i++) {
+				if (!clients[i].authed)
+					continue;
+				pkt.vp.digest = htonl(clients[i].digest);
+				strcpy((char *)pkt.vp.challenge, clients[i].challenge);
+				for (j = 0; j < burst; j++) {
+					pkt.vp.curtime.vtime_sec = htonl(now.tv_sec);
+					pkt.vp.curtime.vtime_nsec = htonl(++clients[i].seqno);
+					if (sendto(clients[i].s, &pkt, sizeof(pkt), 0, (struct sockaddr *)&sin, sizeof(sin)) == sizeof(pkt))
+						sent++;
+					else
+						senderr++;
+				}
+			}
+			next.tv_usec += interval * 1000;
+			while (next.tv_usec >= 1000000) {
+				next.tv_usec -= 1000000;
+				next.tv_sec++;
+			}
+			/* do not try to catch up if we fell behind */
+			if (tvdiff_us(now, next) > 0)
+				next = now;
+		} else if (interval) {
+			us = -tvdiff_us(now, next);
+			if (us > 1000)
+				usleep(1000);
+		}
+		us = tvdiff_us(now, last);
+		if (us >= 1000000) {
+			printf("clients %d/%d  tx %llu pps  rx %llu pps  (tx total %llu, errors %llu)\n",
+				authed, nclients, (sent - lastsent) * 1000000ULL / us,
+				(rcvd - lastrcvd) * 1000000ULL / us, sent, senderr);
+			lastsent = sent;
+			lastrcvd = rcvd;
+			last = now;
+		}
+	}
+	us = tvdiff_us(now, start);
+	printf("total: %llu packets sent in %lld ms (%llu pps), %llu received, %llu send errors, %d of %d clients authenticated\n",
+		sent, us / 1000, us ? sent * 1000000ULL / us : 0, rcvd, senderr, authed, nclients);
+	for (i = 0; i < nclients; i++)
+		close(clients[i].s);
+	free(clients);
+	free(pfds);
+	return 0;
+}
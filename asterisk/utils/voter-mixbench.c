@@ -0,0 +1,209 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*!
+ * \file
+ *
+ * \brief Microbenchmark for the chan_voter voting/mixing kernels
+ *
+ * Times one voting round (drain every client's 20ms frame out of its
+ * circular audio/RSSI buffers, sum the RSSI, convert to slinear and mix)
+ * for 8, 32 and 64 clients, using the kernels from channels/voter_mix.h
+ * and the per-sample loops chan_voter used before them. The two are
+ * checked against each other first.
+ *
+ * This is built on request only: make -C utils ASTTOPDIR=.. voter-mixbench
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "../channels/voter_mix.h"
+
+#define	FRAME_SIZE 160
+#define	BUFLEN (480 * 8)	/* 480ms, the chan_voter default */
+#define	ROUNDS 20000
+
+struct bclient {
+	uint8_t audio[BUFLEN];
+	uint8_t rssi[BUFLEN];
+	int drainindex;
+	short lastaudio[FRAME_SIZE];
+	int lastrssi;
+};
+
+static short mulaw[256];
+
+/* same as ast_ulaw_init() */
+static void ulaw_init(void)
+{
+	int i, y, mu, e, f;
+	static const int etab[] = { 0, 132, 396, 924, 1980, 4092, 8316, 16764 };
+
+	for (i = 0; i < 256; i++) {
+		mu = 255 - i;
+		e = (mu & 0x70) / 16;
+		f = mu & 0x0f;
+		y = f * (1 << (e + 3));
+		y += etab[e];
+		if (mu & 0x80)
+			y = -y;
+		mulaw[i] = y;
+	}
+}
+
+static void fill(struct bclient *c, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < BUFLEN; j++) {
+			c[i].audio[j] = random();
+			c[i].rssi[j] = random();
+		}
+		/* about a quarter of the clients wrap */
+		c[i].drainindex = (i & 3) ? (FRAME_SIZE * (i % (BUFLEN / FRAME_SIZE))) : (BUFLEN - 40 - (i % 16));
+	}
+}
+
+/* what voter_mix_and_send() did per client before the kernels */
+static void round_ref(struct bclient *c, int n, short *mix)
+{
+	uint8_t buf[FRAME_SIZE];
+	int i, j, k, x, y;
+
+	for (x = 0; x < n; x++) {
+		i = BUFLEN - (c[x].drainindex + FRAME_SIZE);
+		if (i >= 0) {
+			memcpy(buf, c[x].audio + c[x].drainindex, FRAME_SIZE);
+			memset(c[x].audio + c[x].drainindex, 0xff, FRAME_SIZE);
+		} else {
+			memcpy(buf, c[x].audio + c[x].drainindex, FRAME_SIZE + i);
+			memcpy(buf + FRAME_SIZE + i, c[x].audio, -i);
+			memset(c[x].audio + c[x].drainindex, 0xff, FRAME_SIZE + i);
+			memset(c[x].audio, 0xff, -i);
+		}
+		k = 0;
+		if (i >= 0) {
+			for (j = c[x].drainindex; j < c[x].drainindex + FRAME_SIZE; j++) {
+				k += c[x].rssi[j];
+				c[x].rssi[j] = 0;
+			}
+		} else {
+			for (j = c[x].drainindex; j < c[x].drainindex + (FRAME_SIZE + i); j++) {
+				k += c[x].rssi[j];
+				c[x].rssi[j] = 0;
+			}
+			for (j = 0; j < -i; j++) {
+				k += c[x].rssi[j];
+				c[x].rssi[j] = 0;
+			}
+		}
+		c[x].lastrssi = k / FRAME_SIZE;
+		for (j = 0; j < FRAME_SIZE; j++) {
+			c[x].lastaudio[j] = mulaw[buf[j]];
+			y = mix[j] + c[x].lastaudio[j];
+			if (y > 32767)
+				y = 32767;
+			if (y < -32767)
+				y = -32767;
+			mix[j] = y;
+		}
+	}
+}
+
+static void round_simd(struct bclient *c, int n, short *mix)
+{
+	uint8_t buf[FRAME_SIZE];
+	int x;
+
+	for (x = 0; x < n; x++) {
+		c[x].lastrssi = voter_drain(c[x].audio, c[x].rssi, BUFLEN, c[x].drainindex, buf, FRAME_SIZE) / FRAME_SIZE;
+		voter_ulaw_mix(mix, c[x].lastaudio, buf, mulaw, 0, FRAME_SIZE);
+	}
+}
+
+static long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static double bench(void (*fn)(struct bclient *, int, short *), struct bclient *c, int n)
+{
+	short mix[FRAME_SIZE];
+	long long start;
+	int r;
+
+	start = now_us();
+	for (r = 0; r < ROUNDS; r++) {
+		memset(mix, 0, sizeof(mix));
+		fn(c, n, mix);
+	}
+	return (double)(now_us() - start) * 1000.0 / ROUNDS;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int sizes[] = { 8, 32, 64 };
+	struct bclient *a, *b;
+	short mixa[FRAME_SIZE], mixb[FRAME_SIZE];
+	double tref, tsimd;
+	int i, x, n;
+
+	ulaw_init();
+	a = calloc(64, sizeof(*a));
+	b = calloc(64, sizeof(*b));
+	if (!a || !b) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	/* make sure both do the same thing */
+	srandom(1);
+	fill(a, 64);
+	memcpy(b, a, 64 * sizeof(*a));
+	memset(mixa, 0, sizeof(mixa));
+	memset(mixb, 0, sizeof(mixb));
+	round_ref(a, 64, mixa);
+	round_simd(b, 64, mixb);
+	if (memcmp(mixa, mixb, sizeof(mixa)) || memcmp(a, b, 64 * sizeof(*a))) {
+		fprintf(stderr, "voter_mix kernel (%s) does not match reference!!\n", VOTER_MIX_KERNEL);
+		return 1;
+	}
+
+	printf("kernel: %s, %d rounds each\n", VOTER_MIX_KERNEL, ROUNDS);
+	printf("%8s %14s %14s %8s\n", "clients", "ref ns/round", "simd ns/round", "speedup");
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		n = sizes[i];
+		fill(a, n);
+		tref = bench(round_ref, a, n);
+		fill(a, n);
+		tsimd = bench(round_simd, a, n);
+		printf("%8d %14.0f %14.0f %7.2fx\n", n, tref, tsimd, tsimd > 0 ? tref / tsimd : 0.0);
+	}
+	/* keep the compiler from throwing the work away */
+	for (x = 0, n = 0; x < 64; x++)
+		n += a[x].lastrssi;
+	if (argc > 1)
+		printf("%d\n", n);
+	free(a);
+	free(b);
+	return 0;
+}